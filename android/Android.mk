@@ -353,6 +353,7 @@ LOCAL_SRC_FILES := \
 	bluez/monitor/keys.c \
 	bluez/monitor/ellisys.c \
 	bluez/monitor/analyze.c \
+	bluez/monitor/seek.c \
 	bluez/monitor/intel.c \
 	bluez/monitor/broadcom.c \
 	bluez/src/shared/util.c \
@@ -412,6 +413,8 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
 	bluez/android/hal-audio.c \
+	bluez/android/hal-audio-pcm.c \
+	bluez/android/hal-audio-qos.c \
 	bluez/android/hal-audio-sbc.c \
 	bluez/android/hal-audio-aptx.c \
 
@@ -478,6 +481,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
 	bluez/tools/l2test.c \
+	bluez/tools/latency.c \
 	bluez/lib/bluetooth.c \
 	bluez/lib/hci.c \
 
@@ -834,6 +838,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
 	bluez/tools/rctest.c \
+	bluez/tools/latency.c \
 	bluez/lib/bluetooth.c \
 	bluez/lib/hci.c \
 	bluez/lib/sdp.c \
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <endian.h>
+
+#if defined(__SSE2__) && __BYTE_ORDER == __LITTLE_ENDIAN
+#include <emmintrin.h>
+#define PCM_USE_SSE2
+#endif
+
+#include "hal-utils.h"
+#include "hal-audio-pcm.h"
+
+#ifdef PCM_USE_SSE2
+/*
+ * Each 32-bit lane holds one little endian L/R pair. Both samples are
+ * sign extended, summed and halved rounding towards zero, which gives
+ * the same result as the scalar (l + r) / 2.
+ */
+static size_t downmix_sse2(const int16_t *input, int16_t *output,
+								size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		__m128i a, b, l, r;
+
+		a = _mm_loadu_si128((const __m128i *) &input[i * 2]);
+		b = _mm_loadu_si128((const __m128i *) &input[i * 2 + 8]);
+
+		l = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+		r = _mm_srai_epi32(a, 16);
+		a = _mm_add_epi32(l, r);
+		a = _mm_add_epi32(a, _mm_srli_epi32(a, 31));
+		a = _mm_srai_epi32(a, 1);
+
+		l = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		r = _mm_srai_epi32(b, 16);
+		b = _mm_add_epi32(l, r);
+		b = _mm_add_epi32(b, _mm_srli_epi32(b, 31));
+		b = _mm_srai_epi32(b, 1);
+
+		/* Averages always fit, so the saturation never kicks in */
+		_mm_storeu_si128((__m128i *) &output[i],
+						_mm_packs_epi32(a, b));
+	}
+
+	return i;
+}
+#endif
+
+void pcm_downmix_to_mono(const int16_t *input, int16_t *output,
+								size_t frames)
+{
+	size_t i = 0;
+
+#ifdef PCM_USE_SSE2
+	i = downmix_sse2(input, output, frames);
+#endif
+
+	for (; i < frames; i++) {
+		int16_t l = get_le16(&input[i * 2]);
+		int16_t r = get_le16(&input[i * 2 + 1]);
+
+		put_le16((l + r) / 2, &output[i]);
+	}
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+
+#include "hal-audio-qos.h"
+
+/* Congestion once more than this many packets are waiting on the socket */
+#define QUEUE_HIGH_PACKETS	4
+/* Link keeps up when no more than this many packets are waiting */
+#define QUEUE_LOW_PACKETS	1
+
+/* Time given to the link to drain the queue after lowering the bitrate */
+#define DECREASE_HOLD_US	300000
+
+/*
+ * Time without congestion before the bitrate is raised again. Each probe
+ * that leads to congestion shortly after doubles it, so that a link that
+ * just about carries the current bitrate is not pushed over the edge all
+ * the time.
+ */
+#define PROBE_MIN_US		2000000
+#define PROBE_MAX_US		32000000
+#define PROBE_FAILED_US		4000000
+
+void qos_init(struct qos_ctrl *qos)
+{
+	memset(qos, 0, sizeof(*qos));
+
+	qos->probe_us = PROBE_MIN_US;
+}
+
+static bool is_congested(const struct qos_sample *sample)
+{
+	if (sample->overrun)
+		return true;
+
+	if (sample->outq > sample->packet_len * QUEUE_HIGH_PACKETS)
+		return true;
+
+	/* Writing takes longer than playing the packet back */
+	return sample->write_us > sample->packet_us;
+}
+
+static bool is_idle(const struct qos_sample *sample)
+{
+	if (sample->outq > sample->packet_len * QUEUE_LOW_PACKETS)
+		return false;
+
+	return sample->write_us <= sample->packet_us / 2;
+}
+
+uint8_t qos_update(struct qos_ctrl *qos, const struct qos_sample *sample)
+{
+	qos->clock_us += sample->packet_us;
+
+	/* The last increase held up, probe more often again */
+	if (qos->last_increase && qos->clock_us - qos->last_increase >=
+							PROBE_FAILED_US) {
+		qos->probe_us /= 2;
+		if (qos->probe_us < PROBE_MIN_US)
+			qos->probe_us = PROBE_MIN_US;
+
+		qos->last_increase = 0;
+	}
+
+	if (is_congested(sample)) {
+		qos->good_us = 0;
+
+		/*
+		 * Give the previous decrease a chance to take effect, unless
+		 * the stream already lags behind.
+		 */
+		if (qos->clock_us < qos->hold_until && !sample->overrun)
+			return QOS_POLICY_NONE;
+
+		return QOS_POLICY_DECREASE;
+	}
+
+	if (!is_idle(sample)) {
+		qos->good_us = 0;
+		return QOS_POLICY_NONE;
+	}
+
+	qos->good_us += sample->packet_us;
+
+	if (qos->good_us < qos->probe_us)
+		return QOS_POLICY_NONE;
+
+	qos->good_us = 0;
+
+	return QOS_POLICY_INCREASE;
+}
+
+void qos_applied(struct qos_ctrl *qos, uint8_t op, bool changed)
+{
+	if (!changed)
+		return;
+
+	switch (op) {
+	case QOS_POLICY_DECREASE:
+		qos->hold_until = qos->clock_us + DECREASE_HOLD_US;
+
+		/* The last increase did not work out, probe less often */
+		if (qos->last_increase && qos->clock_us - qos->last_increase <
+							PROBE_FAILED_US) {
+			qos->probe_us *= 2;
+			if (qos->probe_us > PROBE_MAX_US)
+				qos->probe_us = PROBE_MAX_US;
+		}
+
+		qos->last_increase = 0;
+		break;
+	case QOS_POLICY_INCREASE:
+		qos->last_increase = qos->clock_us;
+		break;
+	case QOS_POLICY_DEFAULT:
+		qos_init(qos);
+		break;
+	}
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016 Intel Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define QOS_POLICY_DEFAULT	0x00
+#define QOS_POLICY_DECREASE	0x01
+#define QOS_POLICY_INCREASE	0x02
+#define QOS_POLICY_NONE		0xff
+
+/* State of a single media packet once it has been handed to the socket */
+struct qos_sample {
+	size_t outq;		/* Bytes still queued on the socket */
+	size_t packet_len;	/* Size of the media packet */
+	uint64_t packet_us;	/* Audio duration of the media packet */
+	uint64_t write_us;	/* Time spent waiting for and writing it */
+	bool overrun;		/* Stream lags more than allowed */
+};
+
+struct qos_ctrl {
+	uint64_t clock_us;
+	uint64_t hold_until;
+	uint64_t good_us;
+	uint64_t probe_us;
+	uint64_t last_increase;
+};
+
+void qos_init(struct qos_ctrl *qos);
+uint8_t qos_update(struct qos_ctrl *qos, const struct qos_sample *sample);
+void qos_applied(struct qos_ctrl *qos, uint8_t op, bool changed);
@@ -23,6 +23,8 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -35,6 +37,7 @@
 #include "hal-log.h"
 #include "hal-msg.h"
 #include "hal-audio.h"
+#include "hal-audio-pcm.h"
 #include "hal-utils.h"
 #include "hal.h"
 
@@ -123,6 +126,8 @@ struct audio_endpoint {
 	struct timespec start;
 
 	bool resync;
+
+	struct qos_ctrl qos;
 };
 
 static struct audio_endpoint audio_endpoints[MAX_AUDIO_ENDPOINTS];
@@ -574,6 +579,7 @@ static bool resume_endpoint(struct audio_endpoint *ep)
 	ep->resync = false;
 
 	ep->codec->update_qos(ep->codec_data, QOS_POLICY_DEFAULT);
+	qos_init(&ep->qos);
 
 	return true;
 }
@@ -581,19 +587,9 @@ static bool resume_endpoint(struct audio_endpoint *ep)
 static void downmix_to_mono(struct a2dp_stream_out *out, const uint8_t *buffer,
 								size_t bytes)
 {
-	const int16_t *input = (const void *) buffer;
-	int16_t *output = (void *) out->downmix_buf;
-	size_t i, frames;
-
 	/* PCM 16bit stereo */
-	frames = bytes / (2 * sizeof(int16_t));
-
-	for (i = 0; i < frames; i++) {
-		int16_t l = get_le16(&input[i * 2]);
-		int16_t r = get_le16(&input[i * 2 + 1]);
-
-		put_le16((l + r) / 2, &output[i]);
-	}
+	pcm_downmix_to_mono((const void *) buffer, (void *) out->downmix_buf,
+					bytes / (2 * sizeof(int16_t)));
 }
 
 static bool wait_for_endpoint(struct audio_endpoint *ep, bool *writable)
@@ -655,6 +651,21 @@ static bool write_to_endpoint(struct audio_endpoint *ep, size_t bytes)
 	return true;
 }
 
+static void update_qos(struct audio_endpoint *ep,
+					const struct qos_sample *sample)
+{
+	uint8_t op;
+	bool changed;
+
+	op = qos_update(&ep->qos, sample);
+	if (op == QOS_POLICY_NONE)
+		return;
+
+	changed = ep->codec->update_qos(ep->codec_data, op);
+
+	qos_applied(&ep->qos, op, changed);
+}
+
 static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 								size_t bytes)
 {
@@ -672,6 +683,9 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		struct timespec current;
 		uint64_t audio_sent, audio_passed;
 		bool do_write = false;
+		struct qos_sample sample;
+		struct timespec write_start;
+		int outq;
 
 		/*
 		 * prepare media packet in advance so we don't waste time after
@@ -686,6 +700,11 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 						bytes - consumed, mp,
 						free_space, &written);
 
+		memset(&sample, 0, sizeof(sample));
+		sample.packet_len = written;
+		sample.packet_us = ep->codec->get_mediapacket_duration(
+							ep->codec_data);
+
 		/*
 		 * not much we can do here, let's just ignore remaining
 		 * data and continue
@@ -732,8 +751,8 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 			if (diff > MAX_DELAY) {
 				warn("lag is %jums, resyncing", diff / 1000);
 
-				ep->codec->update_qos(ep->codec_data,
-							QOS_POLICY_DECREASE);
+				sample.overrun = true;
+				update_qos(ep, &sample);
 				ep->resync = true;
 			}
 		}
@@ -744,6 +763,8 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		 * in resync mode we'll just drop mediapackets
 		 */
 		if (written > 0 && !ep->resync) {
+			clock_gettime(CLOCK_MONOTONIC, &write_start);
+
 			/* wait some time for socket to be ready for write,
 			 * but we'll just skip writing data if timeout occurs
 			 */
@@ -757,6 +778,20 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 				if (!write_to_endpoint(ep, written))
 					return false;
 			}
+
+			/*
+			 * feed the bitrate controller with how congested the
+			 * link is, i.e. how much data is still queued and how
+			 * long it took to get this packet out
+			 */
+			clock_gettime(CLOCK_MONOTONIC, &current);
+			sample.write_us = timespec_diff_us(&current,
+								&write_start);
+
+			if (ioctl(ep->fd, SIOCOUTQ, &outq) == 0 && outq > 0)
+				sample.outq = outq;
+
+			update_qos(ep, &sample);
 		}
 
 		/*
@@ -18,6 +18,8 @@
 #include <time.h>
 #include <hardware/audio.h>
 
+#include "hal-audio-qos.h"
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 
 struct rtp_header {
@@ -93,9 +95,6 @@ struct audio_codec {
 	bool (*update_qos) (void *codec_data, uint8_t op);
 };
 
-#define QOS_POLICY_DEFAULT	0x00
-#define QOS_POLICY_DECREASE	0x01
-
 typedef const struct audio_codec * (*audio_codec_get_t) (void);
 
 const struct audio_codec *codec_sbc(void);
@@ -172,9 +172,6 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 		return;
 	}
 
-	mgmt_register(data->mgmt, MGMT_EV_INDEX_ADDED, MGMT_INDEX_NONE,
-					index_added_callback, NULL, NULL);
-
 	mgmt_register(data->mgmt, MGMT_EV_INDEX_REMOVED, MGMT_INDEX_NONE,
 					index_removed_callback, NULL, NULL);
 
@@ -185,6 +182,9 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 		return;
 	}
 
+	hciemu_register_index_added(data->hciemu, data->mgmt,
+					index_added_callback, NULL);
+
 	tester_print("New hciemu instance created");
 }
 
@@ -868,6 +868,12 @@ int main(int argc, char *argv[])
 
 	tester_init(&argc, &argv);
 
+	/* The daemon and its IPC sockets can only be set up once at a time */
+	if (tester_use_parallel()) {
+		fprintf(stderr, "Parallel test execution is not supported\n");
+		return EXIT_FAILURE;
+	}
+
 	/* check general IPC errors */
 	test_generic("Too small data",
 				ipc_send_tc, setup, teardown,
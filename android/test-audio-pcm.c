@@ -0,0 +1,158 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include <glib.h>
+
+#include "android/hal-audio-pcm.h"
+
+#define MAX_FRAMES	1024
+
+struct downmix_data {
+	size_t frames;
+	size_t offset;
+};
+
+static const int16_t edge_samples[] = {
+	INT16_MIN, INT16_MIN + 1, -2, -1, 0, 1, 2, INT16_MAX - 1, INT16_MAX,
+};
+
+/* The scalar downmix as it was done before vectorizing it */
+static void reference_downmix(const int16_t *input, int16_t *output,
+								size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i < frames; i++) {
+		int16_t l = le16toh(input[i * 2]);
+		int16_t r = le16toh(input[i * 2 + 1]);
+
+		output[i] = htole16((l + r) / 2);
+	}
+}
+
+static void fill_input(int16_t *input, size_t samples, guint32 seed)
+{
+	GRand *rand = g_rand_new_with_seed(seed);
+	size_t i;
+
+	for (i = 0; i < samples; i++) {
+		/* Mix in edge values to cover rounding and overflow */
+		if (g_rand_int_range(rand, 0, 4) == 0)
+			input[i] = edge_samples[g_rand_int_range(rand, 0,
+						G_N_ELEMENTS(edge_samples))];
+		else
+			input[i] = g_rand_int_range(rand, INT16_MIN,
+							INT16_MAX + 1);
+
+		input[i] = htole16(input[i]);
+	}
+
+	g_rand_free(rand);
+}
+
+static void test_downmix(gconstpointer data)
+{
+	const struct downmix_data *test = data;
+	int16_t *input, *output, *expected;
+	int16_t *in, *out;
+
+	/* One spare sample so that unaligned buffers can be tested */
+	input = g_new0(int16_t, MAX_FRAMES * 2 + 1);
+	output = g_new0(int16_t, MAX_FRAMES + 1);
+	expected = g_new0(int16_t, MAX_FRAMES);
+
+	in = input + test->offset;
+	out = output + test->offset;
+
+	fill_input(in, test->frames * 2, test->frames);
+
+	reference_downmix(in, expected, test->frames);
+	pcm_downmix_to_mono(in, out, test->frames);
+
+	g_assert(memcmp(out, expected, test->frames * sizeof(int16_t)) == 0);
+
+	g_free(expected);
+	g_free(output);
+	g_free(input);
+}
+
+static void test_downmix_rounding(gconstpointer data)
+{
+	int16_t input[2 * 256], output[256], expected[256];
+	int l, r, i;
+
+	/*
+	 * Pair every left sample with right samples that bring the sum
+	 * close to zero, where truncation and flooring differ most.
+	 */
+	for (l = INT16_MIN; l <= INT16_MAX; l++) {
+		for (i = 0; i < 256; i++) {
+			r = CLAMP(-l + i - 128, INT16_MIN, INT16_MAX);
+
+			input[i * 2] = htole16(l);
+			input[i * 2 + 1] = htole16(r);
+		}
+
+		reference_downmix(input, expected, 256);
+		pcm_downmix_to_mono(input, output, 256);
+
+		g_assert(memcmp(output, expected, sizeof(output)) == 0);
+	}
+}
+
+static const struct downmix_data downmix_empty = { 0, 0 };
+static const struct downmix_data downmix_short = { 7, 0 };
+static const struct downmix_data downmix_block = { 8, 0 };
+static const struct downmix_data downmix_tail = { 13, 0 };
+static const struct downmix_data downmix_long = { MAX_FRAMES, 0 };
+static const struct downmix_data downmix_unaligned = { MAX_FRAMES - 1, 1 };
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_data_func("/android_audio_pcm/downmix/empty",
+					&downmix_empty, test_downmix);
+	g_test_add_data_func("/android_audio_pcm/downmix/short",
+					&downmix_short, test_downmix);
+	g_test_add_data_func("/android_audio_pcm/downmix/block",
+					&downmix_block, test_downmix);
+	g_test_add_data_func("/android_audio_pcm/downmix/tail",
+					&downmix_tail, test_downmix);
+	g_test_add_data_func("/android_audio_pcm/downmix/long",
+					&downmix_long, test_downmix);
+	g_test_add_data_func("/android_audio_pcm/downmix/unaligned",
+					&downmix_unaligned, test_downmix);
+	g_test_add_data_func("/android_audio_pcm/downmix/rounding", NULL,
+						test_downmix_rounding);
+
+	return g_test_run();
+}
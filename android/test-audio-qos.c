@@ -0,0 +1,231 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include <glib.h>
+
+#include "android/hal-audio-qos.h"
+
+/*
+ * Simulated SBC stream, joint stereo with 16 blocks and 8 subbands at
+ * 44.1 kHz, written to an endpoint socket that is drained by a link of
+ * limited capacity.
+ */
+#define PAYLOAD_LEN	672
+#define FRAME_US	2902
+#define SNDBUF		(16 * PAYLOAD_LEN)
+#define MAX_DELAY_US	100000
+
+#define MIN_BITPOOL	33
+#define MAX_BITPOOL	53
+#define BITPOOL_STEP	5
+
+struct link_sim {
+	struct qos_ctrl qos;
+	double capacity;	/* Bytes per us the link can carry */
+	double queue;		/* Bytes queued on the socket */
+	uint64_t lag;
+	uint64_t now;
+	uint8_t bitpool;
+	unsigned int changes;
+	unsigned int dropped;
+};
+
+/* Same steps as the SBC codec takes */
+static bool sim_update_bitpool(struct link_sim *sim, uint8_t op)
+{
+	uint8_t bitpool = sim->bitpool;
+
+	switch (op) {
+	case QOS_POLICY_DECREASE:
+		bitpool = MAX(bitpool - BITPOOL_STEP, MIN_BITPOOL);
+		break;
+	case QOS_POLICY_INCREASE:
+		bitpool = MIN(bitpool + BITPOOL_STEP, MAX_BITPOOL);
+		break;
+	}
+
+	if (bitpool == sim->bitpool)
+		return false;
+
+	sim->bitpool = bitpool;
+	sim->changes++;
+
+	return true;
+}
+
+static void sim_feed(struct link_sim *sim, const struct qos_sample *sample)
+{
+	uint8_t op;
+
+	op = qos_update(&sim->qos, sample);
+	if (op == QOS_POLICY_NONE)
+		return;
+
+	qos_applied(&sim->qos, op, sim_update_bitpool(sim, op));
+}
+
+static void sim_packet(struct link_sim *sim)
+{
+	struct qos_sample sample;
+	unsigned int frame_len, frames;
+	double wait = 0;
+
+	frame_len = 12 + 2 * sim->bitpool;
+	frames = PAYLOAD_LEN / frame_len;
+
+	memset(&sample, 0, sizeof(sample));
+	sample.packet_len = frames * frame_len;
+	sample.packet_us = frames * FRAME_US;
+
+	sim->now += sample.packet_us;
+
+	/* The link drains the socket while the packet is being played */
+	sim->queue = MAX(sim->queue - sim->capacity * sample.packet_us, 0);
+
+	/* Stream lags too much, packets are dropped until back in sync */
+	if (sim->lag > MAX_DELAY_US) {
+		sample.overrun = true;
+		sim_feed(sim, &sample);
+		sim->lag = 0;
+		sim->dropped++;
+		return;
+	}
+
+	/* Writing blocks until there is room in the send buffer */
+	if (sim->queue + sample.packet_len > SNDBUF) {
+		wait = (sim->queue + sample.packet_len - SNDBUF) /
+							sim->capacity;
+		sim->queue = SNDBUF - sample.packet_len;
+	}
+
+	sim->queue += sample.packet_len;
+	sim->lag += wait;
+
+	sample.write_us = wait;
+	sample.outq = sim->queue;
+
+	sim_feed(sim, &sample);
+}
+
+static void sim_init(struct link_sim *sim, unsigned int kbps)
+{
+	memset(sim, 0, sizeof(*sim));
+
+	qos_init(&sim->qos);
+
+	sim->bitpool = MAX_BITPOOL;
+	sim->capacity = kbps / 8000.0;
+}
+
+static void sim_run(struct link_sim *sim, unsigned int seconds)
+{
+	uint64_t end = sim->now + seconds * 1000000ull;
+
+	while (sim->now < end)
+		sim_packet(sim);
+}
+
+static void sim_set_capacity(struct link_sim *sim, unsigned int kbps)
+{
+	sim->capacity = kbps / 8000.0;
+}
+
+static void test_unlimited(gconstpointer data)
+{
+	struct link_sim sim;
+
+	sim_init(&sim, 1000);
+	sim_run(&sim, 60);
+
+	g_assert_cmpint(sim.bitpool, ==, MAX_BITPOOL);
+	g_assert_cmpint(sim.changes, ==, 0);
+	g_assert_cmpint(sim.dropped, ==, 0);
+}
+
+static void test_congested(gconstpointer data)
+{
+	struct link_sim sim;
+
+	/* Enough for bitpool 43, but not for 48 or above */
+	sim_init(&sim, 290);
+	sim_run(&sim, 30);
+
+	g_assert_cmpint(sim.bitpool, >=, 38);
+	g_assert_cmpint(sim.bitpool, <=, 43);
+
+	sim.changes = 0;
+	sim.dropped = 0;
+
+	/* Once settled the stream must not drop out nor oscillate */
+	sim_run(&sim, 60);
+
+	g_assert_cmpint(sim.dropped, ==, 0);
+	g_assert_cmpint(sim.changes, <=, 6);
+	g_assert_cmpint(sim.bitpool, >=, 38);
+	g_assert_cmpint(sim.bitpool, <=, 48);
+}
+
+static void test_recover(gconstpointer data)
+{
+	struct link_sim sim;
+
+	sim_init(&sim, 1000);
+	sim_run(&sim, 5);
+
+	/* Link degrades for a while, e.g. due to interference */
+	sim_set_capacity(&sim, 220);
+	sim_run(&sim, 20);
+
+	g_assert_cmpint(sim.bitpool, ==, MIN_BITPOOL);
+
+	sim.dropped = 0;
+
+	/* Quality must come back once the link recovers */
+	sim_set_capacity(&sim, 1000);
+	sim_run(&sim, 60);
+
+	g_assert_cmpint(sim.bitpool, ==, MAX_BITPOOL);
+	g_assert_cmpint(sim.dropped, ==, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_data_func("/android_audio_qos/unlimited", NULL,
+							test_unlimited);
+	g_test_add_data_func("/android_audio_qos/congested", NULL,
+							test_congested);
+	g_test_add_data_func("/android_audio_qos/recover", NULL,
+							test_recover);
+
+	return g_test_run();
+}
@@ -437,9 +437,6 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 		return;
 	}
 
-	mgmt_register(data->mgmt, MGMT_EV_INDEX_ADDED, MGMT_INDEX_NONE,
-					index_added_callback, NULL, NULL);
-
 	mgmt_register(data->mgmt, MGMT_EV_INDEX_REMOVED, MGMT_INDEX_NONE,
 					index_removed_callback, NULL, NULL);
 
@@ -450,6 +447,9 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 		return;
 	}
 
+	hciemu_register_index_added(data->hciemu, data->mgmt,
+					index_added_callback, NULL);
+
 	tester_print("New hciemu instance created");
 }
 
@@ -3358,6 +3358,12 @@ int main(int argc, char *argv[])
 
 	tester_init(&argc, &argv);
 
+	/* The daemon and its IPC sockets can only be set up once at a time */
+	if (tester_use_parallel()) {
+		fprintf(stderr, "Parallel test execution is not supported\n");
+		return EXIT_FAILURE;
+	}
+
 	queue_foreach(get_bluetooth_tests(), add_bluetooth_tests, NULL);
 	queue_foreach(get_socket_tests(), add_socket_tests, NULL);
 	queue_foreach(get_hidhost_tests(), add_hidhost_tests, NULL);
@@ -0,0 +1,434 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "src/shared/util.h"
+#include "src/shared/timeout.h"
+
+#include "btdev.h"
+#include "advpop.h"
+
+#define ADVPOP_TICK		10
+#define ADV_DELAY_MAX		10
+#define MAX_ADV_DATA		31
+#define MAX_EVENT_LEN		254
+
+#define DEFAULT_INTERVAL	100
+#define DEFAULT_RSSI_MIN	-90
+#define DEFAULT_RSSI_MAX	-40
+
+struct template {
+	uint8_t data[MAX_ADV_DATA];
+	uint8_t len;
+};
+
+struct advertiser {
+	uint64_t due;
+	uint64_t rotate;
+	uint32_t id;
+	uint16_t interval;
+	uint8_t addr_type;
+	uint8_t addr[6];
+	bool rpa;
+	int8_t rssi;
+	const struct template *template;
+};
+
+struct advpop {
+	struct btdev *btdev;
+	struct advpop_config config;
+	struct template *templates;
+	struct advertiser *advs;
+	unsigned int *heap;
+	struct timespec start;
+	unsigned int timeout_id;
+	bool scanning;
+	uint32_t rand;
+	uint64_t reports;
+	uint8_t num_reports;
+	uint8_t event_len;
+	uint8_t event[MAX_EVENT_LEN];
+};
+
+/* Flags followed by the local name, which is appended per advertiser */
+static const uint8_t default_template[] = { 0x02, 0x01, 0x06 };
+
+static uint32_t advpop_rand(struct advpop *pop)
+{
+	uint32_t x = pop->rand;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	pop->rand = x;
+
+	return x;
+}
+
+static uint64_t get_time(struct advpop *pop)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - pop->start.tv_sec) * 1000 +
+				(now.tv_nsec - pop->start.tv_nsec) / 1000000;
+}
+
+static bool heap_less(struct advpop *pop, unsigned int a, unsigned int b)
+{
+	return pop->advs[pop->heap[a]].due < pop->advs[pop->heap[b]].due;
+}
+
+static void heap_swap(struct advpop *pop, unsigned int a, unsigned int b)
+{
+	unsigned int tmp = pop->heap[a];
+
+	pop->heap[a] = pop->heap[b];
+	pop->heap[b] = tmp;
+}
+
+static void heap_sift_down(struct advpop *pop, unsigned int pos)
+{
+	unsigned int count = pop->config.count;
+
+	while (1) {
+		unsigned int child = pos * 2 + 1;
+
+		if (child >= count)
+			break;
+
+		if (child + 1 < count && heap_less(pop, child + 1, child))
+			child++;
+
+		if (!heap_less(pop, child, pos))
+			break;
+
+		heap_swap(pop, pos, child);
+		pos = child;
+	}
+}
+
+static void heap_init(struct advpop *pop)
+{
+	unsigned int i;
+
+	for (i = pop->config.count / 2; i > 0; i--)
+		heap_sift_down(pop, i - 1);
+}
+
+static void set_rpa(struct advpop *pop, struct advertiser *adv, uint64_t now)
+{
+	uint32_t r1 = advpop_rand(pop);
+	uint32_t r2 = advpop_rand(pop);
+
+	put_le32(r1, adv->addr);
+	put_le16(r2, adv->addr + 4);
+	adv->addr[5] = (adv->addr[5] & 0x3f) | 0x40;
+
+	if (pop->config.rpa_timeout)
+		adv->rotate = now + pop->config.rpa_timeout * 1000;
+	else
+		adv->rotate = UINT64_MAX;
+}
+
+static void setup_advertiser(struct advpop *pop, unsigned int id,
+						const uint8_t *types,
+						unsigned int num_types)
+{
+	const struct advpop_config *config = &pop->config;
+	struct advertiser *adv = &pop->advs[id];
+	unsigned int range;
+
+	adv->id = id;
+	adv->template = &pop->templates[id % config->num_templates];
+
+	range = config->max_interval - config->min_interval + 1;
+	adv->interval = config->min_interval + advpop_rand(pop) % range;
+
+	range = config->rssi_max - config->rssi_min + 1;
+	adv->rssi = config->rssi_min + (int) (advpop_rand(pop) % range);
+
+	switch (types[id % num_types]) {
+	case ADVPOP_ADDR_PUBLIC:
+		adv->addr_type = 0x00;
+		put_le32(0xad5a0000 | (id & 0xffff), adv->addr);
+		put_le16(id >> 16, adv->addr + 4);
+		break;
+	case ADVPOP_ADDR_STATIC:
+		adv->addr_type = 0x01;
+		put_le32(0xad5a0000 | (id & 0xffff), adv->addr);
+		put_le16(id >> 16, adv->addr + 4);
+		adv->addr[5] |= 0xc0;
+		break;
+	case ADVPOP_ADDR_RPA:
+		adv->addr_type = 0x01;
+		adv->rpa = true;
+		set_rpa(pop, adv, 0);
+
+		/* Spread rotations so they do not all happen at once */
+		if (config->rpa_timeout)
+			adv->rotate = advpop_rand(pop) %
+						(config->rpa_timeout * 1000);
+		break;
+	}
+}
+
+/* Advertisers start at a random point of their interval on every scan */
+static void reschedule(struct advpop *pop, uint64_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < pop->config.count; i++) {
+		struct advertiser *adv = &pop->advs[i];
+
+		adv->due = now + advpop_rand(pop) % adv->interval;
+	}
+
+	heap_init(pop);
+}
+
+static void flush_reports(struct advpop *pop)
+{
+	if (!pop->num_reports)
+		return;
+
+	pop->event[0] = pop->num_reports;
+
+	btdev_send_le_adv_reports(pop->btdev, pop->event, pop->event_len);
+
+	pop->num_reports = 0;
+	pop->event_len = 1;
+}
+
+static void add_report(struct advpop *pop, struct advertiser *adv)
+{
+	const struct template *template = adv->template;
+	uint8_t data[MAX_ADV_DATA];
+	uint8_t *ptr;
+	uint8_t len = template->len;
+	char name[MAX_ADV_DATA];
+	int name_len;
+	int8_t rssi;
+
+	memcpy(data, template->data, len);
+
+	name_len = snprintf(name, sizeof(name), "adv-%u", adv->id);
+	if (len + 2 + name_len <= MAX_ADV_DATA) {
+		data[len++] = name_len + 1;
+		data[len++] = 0x09;
+		memcpy(data + len, name, name_len);
+		len += name_len;
+	}
+
+	/* Reports are packed back to back as the kernel parses them */
+	if (pop->event_len + 10 + len > MAX_EVENT_LEN ||
+			pop->num_reports == pop->config.reports_per_event)
+		flush_reports(pop);
+
+	/* Small fading around the distance based level of the device */
+	rssi = adv->rssi + (int) (advpop_rand(pop) % 5) - 2;
+
+	ptr = pop->event + pop->event_len;
+	*ptr++ = 0x03;		/* ADV_NONCONN_IND */
+	*ptr++ = adv->addr_type;
+	memcpy(ptr, adv->addr, 6);
+	ptr += 6;
+	*ptr++ = len;
+	memcpy(ptr, data, len);
+	ptr += len;
+	*ptr++ = rssi;
+
+	pop->event_len = ptr - pop->event;
+	pop->num_reports++;
+	pop->reports++;
+}
+
+static bool advpop_tick(void *user_data)
+{
+	struct advpop *pop = user_data;
+	uint64_t now = get_time(pop);
+
+	if (!btdev_get_le_scan_enable(pop->btdev)) {
+		pop->scanning = false;
+		return true;
+	}
+
+	if (!pop->scanning) {
+		pop->scanning = true;
+		reschedule(pop, now);
+	}
+
+	while (pop->advs[pop->heap[0]].due <= now) {
+		struct advertiser *adv = &pop->advs[pop->heap[0]];
+
+		if (adv->rpa && now >= adv->rotate)
+			set_rpa(pop, adv, now);
+
+		add_report(pop, adv);
+
+		adv->due += adv->interval + advpop_rand(pop) %
+							(ADV_DELAY_MAX + 1);
+
+		/* Do not try to catch up when the loop fell behind */
+		if (adv->due <= now)
+			adv->due = now + adv->interval;
+
+		heap_sift_down(pop, 0);
+	}
+
+	flush_reports(pop);
+
+	return true;
+}
+
+static bool setup_templates(struct advpop *pop,
+					const struct advpop_config *config)
+{
+	unsigned int i;
+
+	if (!config->num_templates) {
+		pop->templates = new0(struct template, 1);
+		memcpy(pop->templates[0].data, default_template,
+						sizeof(default_template));
+		pop->templates[0].len = sizeof(default_template);
+		pop->config.num_templates = 1;
+		return true;
+	}
+
+	pop->templates = new0(struct template, config->num_templates);
+
+	for (i = 0; i < config->num_templates; i++) {
+		const struct advpop_template *template = &config->templates[i];
+
+		if (template->len > MAX_ADV_DATA)
+			return false;
+
+		memcpy(pop->templates[i].data, template->data, template->len);
+		pop->templates[i].len = template->len;
+	}
+
+	return true;
+}
+
+struct advpop *advpop_new(struct btdev *btdev,
+					const struct advpop_config *config)
+{
+	struct advpop *pop;
+	uint8_t types[3];
+	unsigned int num_types = 0;
+	unsigned int i;
+
+	if (!btdev || !config || !config->count)
+		return NULL;
+
+	if (config->addr_types & ~(ADVPOP_ADDR_PUBLIC | ADVPOP_ADDR_STATIC |
+							ADVPOP_ADDR_RPA))
+		return NULL;
+
+	pop = new0(struct advpop, 1);
+	pop->btdev = btdev;
+	pop->config = *config;
+	pop->config.templates = NULL;
+	pop->rand = config->seed ? config->seed : 0x2545f491;
+	pop->event_len = 1;
+
+	if (!pop->config.min_interval)
+		pop->config.min_interval = DEFAULT_INTERVAL;
+
+	if (pop->config.max_interval < pop->config.min_interval)
+		pop->config.max_interval = pop->config.min_interval;
+
+	if (!pop->config.rssi_min && !pop->config.rssi_max) {
+		pop->config.rssi_min = DEFAULT_RSSI_MIN;
+		pop->config.rssi_max = DEFAULT_RSSI_MAX;
+	}
+
+	if (!pop->config.reports_per_event)
+		pop->config.reports_per_event = 1;
+
+	if (!pop->config.addr_types)
+		pop->config.addr_types = ADVPOP_ADDR_PUBLIC;
+
+	if (pop->config.rssi_min > pop->config.rssi_max)
+		goto failed;
+
+	if (!setup_templates(pop, config))
+		goto failed;
+
+	for (i = 0; i < 3; i++) {
+		if (pop->config.addr_types & (1 << i))
+			types[num_types++] = 1 << i;
+	}
+
+	pop->advs = new0(struct advertiser, config->count);
+	pop->heap = new0(unsigned int, config->count);
+
+	for (i = 0; i < config->count; i++) {
+		setup_advertiser(pop, i, types, num_types);
+		pop->heap[i] = i;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &pop->start);
+
+	pop->timeout_id = timeout_add(ADVPOP_TICK, advpop_tick, pop, NULL);
+	if (!pop->timeout_id)
+		goto failed;
+
+	return pop;
+
+failed:
+	advpop_free(pop);
+	return NULL;
+}
+
+void advpop_free(struct advpop *pop)
+{
+	if (!pop)
+		return;
+
+	timeout_remove(pop->timeout_id);
+
+	free(pop->heap);
+	free(pop->advs);
+	free(pop->templates);
+	free(pop);
+}
+
+uint64_t advpop_get_reports(struct advpop *pop)
+{
+	if (!pop)
+		return 0;
+
+	return pop->reports;
+}
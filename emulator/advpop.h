@@ -0,0 +1,57 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ADVPOP_ADDR_PUBLIC	0x01
+#define ADVPOP_ADDR_STATIC	0x02
+#define ADVPOP_ADDR_RPA		0x04
+
+struct advpop_template {
+	const uint8_t *data;
+	uint8_t len;
+};
+
+struct advpop_config {
+	unsigned int count;		/* Number of advertisers */
+	uint8_t addr_types;		/* Mask of ADVPOP_ADDR_* */
+	unsigned int rpa_timeout;	/* RPA rotation in seconds */
+	uint16_t min_interval;		/* Advertising interval in ms */
+	uint16_t max_interval;
+	int8_t rssi_min;
+	int8_t rssi_max;
+	uint8_t reports_per_event;
+	const struct advpop_template *templates;
+	unsigned int num_templates;
+	uint32_t seed;
+};
+
+struct btdev;
+struct advpop;
+
+struct advpop *advpop_new(struct btdev *btdev,
+					const struct advpop_config *config);
+void advpop_free(struct advpop *pop);
+
+uint64_t advpop_get_reports(struct advpop *pop);
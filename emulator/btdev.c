@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <alloca.h>
+#include <sched.h>
 #include <sys/uio.h>
 #include <stdint.h>
 
@@ -38,6 +39,7 @@
 #include "lib/hci.h"
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
 #include "src/shared/timeout.h"
 #include "src/shared/crypto.h"
 #include "src/shared/ecc.h"
@@ -56,10 +58,42 @@ struct hook {
 
 #define MAX_HOOK_ENTRIES 16
 
+/* HCI link types, with LE links getting a private value */
+#define CONN_TYPE_SCO		0x00
+#define CONN_TYPE_ACL		0x01
+#define CONN_TYPE_ESCO		0x02
+#define CONN_TYPE_LE		0x80
+
+#define ACL_HANDLE_BASE		42
+#define SCO_HANDLE_BASE		257
+#define MAX_HANDLE		0x0eff
+
+#define DEFAULT_LINK_INTERVAL	10
+
+/*
+ * One end of a link between two emulated controllers. Each side uses its
+ * own handle and the two entries point at each other through link.
+ */
+struct btdev_conn {
+	uint16_t handle;
+	uint8_t type;
+	struct btdev *dev;
+	struct btdev_conn *link;
+
+	/* ACL packets waiting for airtime when a link model is used */
+	struct queue *tx_queue;
+	uint32_t credit;
+};
+
+struct acl_pkt {
+	uint16_t len;
+	uint8_t data[0];
+};
+
 struct btdev {
 	enum btdev_type type;
 
-	struct btdev *conn;
+	struct queue *conns;
 
 	bool auth_init;
 	uint8_t link_key[16];
@@ -76,9 +110,19 @@ struct btdev {
 	btdev_send_func send_handler;
 	void *send_data;
 
+	const void *owner;
+	btdev_send_func post_handler;
+	void *post_data;
+
 	unsigned int inquiry_id;
 	unsigned int inquiry_timeout_id;
 
+	bool link_model_enabled;
+	struct btdev_link_model link_model;
+	unsigned int link_id;
+	uint16_t acl_pending;
+	uint16_t le_pending;
+
 	struct hook *hook_list[MAX_HOOK_ENTRIES];
 
 	struct bt_crypto *crypto;
@@ -92,6 +136,7 @@ struct btdev {
 	uint8_t  feat_page_2[8];
 	uint16_t acl_mtu;
 	uint16_t acl_max_pkt;
+	uint16_t le_max_pkt;
 	uint8_t  country_code;
 	uint8_t  bdaddr[6];
 	uint8_t  random_addr[6];
@@ -157,13 +202,69 @@ struct inquiry_data {
 
 #define DEFAULT_INQUIRY_INTERVAL 100 /* 100 miliseconds */
 
-#define MAX_BTDEV_ENTRIES 16
+#define MAX_BTDEV_ENTRIES 0xfe00
 
 static const uint8_t LINK_KEY_NONE[16] = { 0 };
 static const uint8_t LINK_KEY_DUMMY[16] = {	0, 1, 2, 3, 4, 5, 6, 7,
 						8, 9, 0, 1, 2, 3, 4, 5 };
 
-static struct btdev *btdev_list[MAX_BTDEV_ENTRIES] = { };
+/* Grows on demand, free slots are NULL and get reused */
+static struct btdev **btdev_list = NULL;
+static int btdev_list_len = 0;
+
+/*
+ * Controllers driven by different threads still share one radio. Anything
+ * that may touch several controllers, like commands and timers, holds the
+ * radio lock exclusively. Data only goes through the connection it is sent
+ * on and holds it shared, so threads can move packets in parallel. Nested
+ * calls from handlers run under the outer lock.
+ */
+static int radio_readers;
+static int radio_writer;
+static __thread unsigned int radio_depth;
+
+/* Its address tells the threads apart */
+static __thread char thread_owner;
+
+static void radio_lock(bool exclusive)
+{
+	if (radio_depth++)
+		return;
+
+	if (exclusive) {
+		while (!__sync_bool_compare_and_swap(&radio_writer, 0, 1))
+			sched_yield();
+
+		while (__sync_fetch_and_add(&radio_readers, 0))
+			sched_yield();
+
+		return;
+	}
+
+	for (;;) {
+		/* Writers go first so that steady traffic can't starve them */
+		while (__sync_fetch_and_add(&radio_writer, 0))
+			sched_yield();
+
+		__sync_fetch_and_add(&radio_readers, 1);
+
+		if (!__sync_fetch_and_add(&radio_writer, 0))
+			return;
+
+		__sync_fetch_and_sub(&radio_readers, 1);
+	}
+}
+
+static void radio_unlock(bool exclusive)
+{
+	if (--radio_depth)
+		return;
+
+	if (exclusive)
+		__sync_lock_release(&radio_writer);
+	else
+		__sync_fetch_and_sub(&radio_readers, 1);
+}
 
 static int get_hook_index(struct btdev *btdev, enum btdev_hook_type type,
 								uint16_t opcode)
@@ -195,24 +296,43 @@ static bool run_hooks(struct btdev *btdev, enum btdev_hook_type type,
 
 static inline int add_btdev(struct btdev *btdev)
 {
-	int i, index = -1;
+	struct btdev **list;
+	int i, len;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_list_len; i++) {
 		if (btdev_list[i] == NULL) {
-			index = i;
-			btdev_list[index] = btdev;
-			break;
+			btdev_list[i] = btdev;
+			return i;
 		}
 	}
 
-	return index;
+	if (btdev_list_len >= MAX_BTDEV_ENTRIES)
+		return -1;
+
+	len = btdev_list_len ? btdev_list_len * 2 : 16;
+	if (len > MAX_BTDEV_ENTRIES)
+		len = MAX_BTDEV_ENTRIES;
+
+	list = realloc(btdev_list, len * sizeof(*list));
+	if (!list)
+		return -1;
+
+	memset(list + btdev_list_len, 0,
+				(len - btdev_list_len) * sizeof(*list));
+
+	btdev_list = list;
+	btdev_list_len = len;
+
+	btdev_list[i] = btdev;
+
+	return i;
 }
 
 static inline int del_btdev(struct btdev *btdev)
 {
 	int i, index = -1;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_list_len; i++) {
 		if (btdev_list[i] == btdev) {
 			index = i;
 			btdev_list[index] = NULL;
@@ -220,6 +340,15 @@ static inline int del_btdev(struct btdev *btdev)
 		}
 	}
 
+	for (i = 0; i < btdev_list_len; i++) {
+		if (btdev_list[i])
+			return index;
+	}
+
+	free(btdev_list);
+	btdev_list = NULL;
+	btdev_list_len = 0;
+
 	return index;
 }
 
@@ -227,7 +356,7 @@ static inline struct btdev *find_btdev_by_bdaddr(const uint8_t *bdaddr)
 {
 	int i;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_list_len; i++) {
 		if (btdev_list[i] && !memcmp(btdev_list[i]->bdaddr, bdaddr, 6))
 			return btdev_list[i];
 	}
@@ -240,7 +369,7 @@ static inline struct btdev *find_btdev_by_bdaddr_type(const uint8_t *bdaddr,
 {
 	int i;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_list_len; i++) {
 		int cmp;
 
 		if (!btdev_list[i])
@@ -258,6 +387,114 @@ static inline struct btdev *find_btdev_by_bdaddr_type(const uint8_t *bdaddr,
 	return NULL;
 }
 
+static bool match_handle(const void *data, const void *match_data)
+{
+	const struct btdev_conn *conn = data;
+
+	return conn->handle == PTR_TO_UINT(match_data);
+}
+
+static struct btdev_conn *find_conn(struct btdev *btdev, uint16_t handle)
+{
+	return queue_find(btdev->conns, match_handle, UINT_TO_PTR(handle));
+}
+
+static struct btdev_conn *find_acl_by_bdaddr(struct btdev *btdev,
+							const uint8_t *bdaddr)
+{
+	const struct queue_entry *entry;
+
+	for (entry = queue_get_entries(btdev->conns); entry;
+							entry = entry->next) {
+		struct btdev_conn *conn = entry->data;
+
+		if (conn->type != CONN_TYPE_ACL)
+			continue;
+
+		if (!memcmp(conn->link->dev->bdaddr, bdaddr, 6))
+			return conn;
+	}
+
+	return NULL;
+}
+
+static uint16_t alloc_handle(struct btdev *btdev, uint16_t base)
+{
+	uint16_t handle;
+
+	for (handle = base; handle <= MAX_HANDLE; handle++) {
+		if (!find_conn(btdev, handle))
+			return handle;
+	}
+
+	return 0x0000;
+}
+
+static struct btdev_conn *conn_new(struct btdev *btdev, struct btdev *remote,
+								uint8_t type)
+{
+	struct btdev_conn *conn, *link;
+	uint16_t base, handle, link_handle;
+
+	if (type == CONN_TYPE_SCO || type == CONN_TYPE_ESCO)
+		base = SCO_HANDLE_BASE;
+	else
+		base = ACL_HANDLE_BASE;
+
+	handle = alloc_handle(btdev, base);
+	link_handle = alloc_handle(remote, base);
+	if (!handle || !link_handle)
+		return NULL;
+
+	conn = new0(struct btdev_conn, 1);
+	conn->handle = handle;
+	conn->type = type;
+	conn->dev = btdev;
+
+	link = new0(struct btdev_conn, 1);
+	link->handle = link_handle;
+	link->type = type;
+	link->dev = remote;
+
+	conn->link = link;
+	link->link = conn;
+
+	queue_push_tail(btdev->conns, conn);
+	queue_push_tail(remote->conns, link);
+
+	return conn;
+}
+
+/* LE links use the separate buffers reported by LE Read Buffer Size */
+static uint16_t *pending_count(struct btdev_conn *conn)
+{
+	if (conn->type == CONN_TYPE_LE)
+		return &conn->dev->le_pending;
+
+	return &conn->dev->acl_pending;
+}
+
+static void conn_flush(struct btdev_conn *conn)
+{
+	/* Pending packets are implicitly released on disconnection */
+	*pending_count(conn) -= queue_length(conn->tx_queue);
+	queue_destroy(conn->tx_queue, free);
+	conn->tx_queue = NULL;
+	conn->credit = 0;
+}
+
+static void conn_free(struct btdev_conn *conn)
+{
+	queue_remove(conn->link->dev->conns, conn->link);
+	queue_remove(conn->dev->conns, conn);
+
+	conn_flush(conn->link);
+	conn_flush(conn);
+
+	free(conn->link);
+	free(conn);
+}
+
 static void hexdump(const unsigned char *buf, uint16_t len)
 {
 	static const char hexdigits[] = "0123456789abcdef";
@@ -297,12 +534,12 @@ static void hexdump(const unsigned char *buf, uint16_t len)
 	}
 }
 
-static void get_bdaddr(uint16_t id, uint8_t index, uint8_t *bdaddr)
+static void get_bdaddr(uint16_t id, uint16_t index, uint8_t *bdaddr)
 {
 	bdaddr[0] = id & 0xff;
 	bdaddr[1] = id >> 8;
-	bdaddr[2] = index;
-	bdaddr[3] = 0x01;
+	bdaddr[2] = index & 0xff;
+	bdaddr[3] = 0x01 + (index >> 8);
 	bdaddr[4] = 0xaa;
 	bdaddr[5] = 0x00;
 }
@@ -636,18 +873,28 @@ struct btdev *btdev_create(enum btdev_type type, uint16_t id)
 
 	btdev->acl_mtu = 192;
 	btdev->acl_max_pkt = 1;
+	btdev->le_max_pkt = 1;
 
 	btdev->country_code = 0x00;
 
+	btdev->owner = &thread_owner;
+
+	radio_lock(true);
+
 	index = add_btdev(btdev);
 	if (index < 0) {
+		radio_unlock(true);
 		bt_crypto_unref(btdev->crypto);
 		free(btdev);
 		return NULL;
 	}
 
+	btdev->conns = queue_new();
+
 	get_bdaddr(id, index, btdev->bdaddr);
 
+	radio_unlock(true);
+
 	return btdev;
 }
 
@@ -656,12 +903,26 @@ void btdev_destroy(struct btdev *btdev)
 	if (!btdev)
 		return;
 
+	radio_lock(true);
+
 	if (btdev->inquiry_id > 0)
 		timeout_remove(btdev->inquiry_id);
 
-	bt_crypto_unref(btdev->crypto);
+	if (btdev->link_id > 0)
+		timeout_remove(btdev->link_id);
+
+	/* Links to controllers that are still around just go away */
+	while (!queue_isempty(btdev->conns))
+		conn_free(queue_peek_head(btdev->conns));
+
+	queue_destroy(btdev->conns, NULL);
+
 	del_btdev(btdev);
 
+	radio_unlock(true);
+
+	bt_crypto_unref(btdev->crypto);
+
 	free(btdev);
 }
 
@@ -713,12 +974,58 @@ void btdev_set_send_handler(struct btdev *btdev, btdev_send_func handler,
 	btdev->send_data = user_data;
 }
 
+void btdev_set_post_handler(struct btdev *btdev, btdev_send_func handler,
+							void *user_data)
+{
+	if (!btdev)
+		return;
+
+	btdev->post_handler = handler;
+	btdev->post_data = user_data;
+}
+
+bool btdev_set_link_model(struct btdev *btdev,
+				const struct btdev_link_model *model)
+{
+	if (!btdev)
+		return false;
+
+	/* Packets queued under the old model would be accounted wrongly */
+	if (btdev->acl_pending || btdev->le_pending)
+		return false;
+
+	if (!model) {
+		btdev->link_model_enabled = false;
+		return true;
+	}
+
+	btdev->link_model = *model;
+	btdev->link_model_enabled = true;
+
+	if (!btdev->link_model.interval)
+		btdev->link_model.interval = DEFAULT_LINK_INTERVAL;
+
+	if (model->acl_max_pkt)
+		btdev->acl_max_pkt = model->acl_max_pkt;
+
+	if (model->le_max_pkt)
+		btdev->le_max_pkt = model->le_max_pkt;
+
+	return true;
+}
+
 static void send_packet(struct btdev *btdev, const struct iovec *iov,
 								int iovlen)
 {
 	if (!btdev->send_handler)
 		return;
 
+	/* Packets caused by other threads are handed over to the owner */
+	if (btdev->post_handler && btdev->owner != &thread_owner) {
+		btdev->post_handler(iov, iovlen, btdev->post_data);
+		return;
+	}
+
 	btdev->send_handler(iov, iovlen, btdev->send_data);
 }
 
@@ -809,7 +1116,7 @@ static void cmd_status(struct btdev *btdev, uint8_t status, uint16_t opcode)
 }
 
 static void le_meta_event(struct btdev *btdev, uint8_t event,
-						void *data, uint8_t len)
+						const void *data, uint8_t len)
 {
 	void *pkt_data;
 
@@ -825,21 +1132,18 @@ static void le_meta_event(struct btdev *btdev, uint8_t event,
 	send_event(btdev, BT_HCI_EVT_LE_META_EVENT, pkt_data, 1 + len);
 }
 
-static void num_completed_packets(struct btdev *btdev)
+static void num_completed_packets(struct btdev *btdev, uint16_t handle)
 {
-	if (btdev->conn) {
-		struct bt_hci_evt_num_completed_packets ncp;
+	struct bt_hci_evt_num_completed_packets ncp;
 
-		ncp.num_handles = 1;
-		ncp.handle = cpu_to_le16(42);
-		ncp.count = cpu_to_le16(1);
+	ncp.num_handles = 1;
+	ncp.handle = cpu_to_le16(handle);
+	ncp.count = cpu_to_le16(1);
 
-		send_event(btdev, BT_HCI_EVT_NUM_COMPLETED_PACKETS,
-							&ncp, sizeof(ncp));
-	}
+	send_event(btdev, BT_HCI_EVT_NUM_COMPLETED_PACKETS, &ncp, sizeof(ncp));
 }
 
-static bool inquiry_callback(void *user_data)
+static bool inquiry_results(void *user_data)
 {
 	struct inquiry_data *data = user_data;
 	struct btdev *btdev = data->btdev;
@@ -848,10 +1152,10 @@ static bool inquiry_callback(void *user_data)
 	int i;
 
 	/*Report devices only once and wait for inquiry timeout*/
-	if (data->iter == MAX_BTDEV_ENTRIES)
+	if (data->iter >= btdev_list_len)
 		return true;
 
-	for (i = data->iter; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = data->iter; i < btdev_list_len; i++) {
 		/*Lets sent 10 inquiry results at once */
 		if (sent + 10 == data->sent_count)
 			break;
@@ -927,6 +1231,17 @@ finish:
 	return false;
 }
 
+static bool inquiry_callback(void *user_data)
+{
+	bool result;
+
+	radio_lock(true);
+	result = inquiry_results(user_data);
+	radio_unlock(true);
+
+	return result;
+}
+
 static void inquiry_destroy(void *user_data)
 {
 	struct inquiry_data *data = user_data;
@@ -935,6 +1250,8 @@ static void inquiry_destroy(void *user_data)
 	if (!btdev)
 		goto finish;
 
+	radio_lock(true);
+
 	btdev->inquiry_id = 0;
 
 	if (btdev->inquiry_timeout_id > 0) {
@@ -942,6 +1259,8 @@ static void inquiry_destroy(void *user_data)
 		btdev->inquiry_timeout_id = 0;
 	}
 
+	radio_unlock(true);
+
 finish:
 	free(data);
 }
@@ -952,6 +1271,8 @@ static bool inquiry_timeout(void *user_data)
 	struct btdev *btdev = data->btdev;
 	struct bt_hci_evt_inquiry_complete ic;
 
+	radio_lock(true);
+
 	timeout_remove(btdev->inquiry_id);
 	btdev->inquiry_timeout_id = 0;
 
@@ -959,6 +1280,8 @@ static bool inquiry_timeout(void *user_data)
 	ic.status = BT_HCI_ERR_SUCCESS;
 	send_event(btdev, BT_HCI_EVT_INQUIRY_COMPLETE, &ic, sizeof(ic));
 
+	radio_unlock(true);
+
 	return false;
 }
 
@@ -1027,23 +1350,28 @@ static void conn_complete(struct btdev *btdev,
 					const uint8_t *bdaddr, uint8_t status)
 {
 	struct bt_hci_evt_conn_complete cc;
+	struct btdev_conn *conn = NULL;
 
 	if (!status) {
 		struct btdev *remote = find_btdev_by_bdaddr(bdaddr);
 
-		btdev->conn = remote;
-		remote->conn = btdev;
+		conn = conn_new(btdev, remote, CONN_TYPE_ACL);
+		if (!conn)
+			status = BT_HCI_ERR_MEM_CAPACITY_EXCEEDED;
+	}
 
+	if (conn) {
 		cc.status = status;
 		memcpy(cc.bdaddr, btdev->bdaddr, 6);
 		cc.encr_mode = 0x00;
 
-		cc.handle = cpu_to_le16(42);
+		cc.handle = cpu_to_le16(conn->link->handle);
 		cc.link_type = 0x01;
 
-		send_event(remote, BT_HCI_EVT_CONN_COMPLETE, &cc, sizeof(cc));
+		send_event(conn->link->dev, BT_HCI_EVT_CONN_COMPLETE,
+							&cc, sizeof(cc));
 
-		cc.handle = cpu_to_le16(42);
+		cc.handle = cpu_to_le16(conn->handle);
 		cc.link_type = 0x01;
 	} else {
 		cc.handle = cpu_to_le16(0x0000);
@@ -1072,18 +1400,26 @@ static void accept_conn_request_complete(struct btdev *btdev,
 		conn_complete(btdev, bdaddr, BT_HCI_ERR_SUCCESS);
 }
 
-static void sync_conn_complete(struct btdev *btdev, uint16_t voice_setting,
-								uint8_t status)
+static void sync_conn_complete(struct btdev *btdev, uint16_t handle,
+					uint16_t voice_setting, uint8_t status)
 {
 	struct bt_hci_evt_sync_conn_complete cc;
+	struct btdev_conn *acl, *conn = NULL;
 
-	if (!btdev->conn)
+	acl = find_conn(btdev, handle);
+	if (!acl)
 		return;
 
+	if (status == BT_HCI_ERR_SUCCESS) {
+		conn = conn_new(btdev, acl->link->dev, CONN_TYPE_ESCO);
+		if (!conn)
+			status = BT_HCI_ERR_MEM_CAPACITY_EXCEEDED;
+	}
+
 	cc.status = status;
-	memcpy(cc.bdaddr, btdev->conn->bdaddr, 6);
+	memcpy(cc.bdaddr, acl->link->dev->bdaddr, 6);
 
-	cc.handle = cpu_to_le16(status == BT_HCI_ERR_SUCCESS ? 257 : 0);
+	cc.handle = cpu_to_le16(conn ? conn->handle : 0);
 	cc.link_type = 0x02;
 	cc.tx_interval = 0x000c;
 	cc.retrans_window = 0x06;
@@ -1094,16 +1430,25 @@ static void sync_conn_complete(struct btdev *btdev, uint16_t voice_setting,
 	send_event(btdev, BT_HCI_EVT_SYNC_CONN_COMPLETE, &cc, sizeof(cc));
 }
 
-static void sco_conn_complete(struct btdev *btdev, uint8_t status)
+static void sco_conn_complete(struct btdev *btdev, uint16_t handle,
+								uint8_t status)
 {
 	struct bt_hci_evt_conn_complete cc;
+	struct btdev_conn *acl, *conn = NULL;
 
-	if (!btdev->conn)
+	acl = find_conn(btdev, handle);
+	if (!acl)
 		return;
 
+	if (status == BT_HCI_ERR_SUCCESS) {
+		conn = conn_new(btdev, acl->link->dev, CONN_TYPE_SCO);
+		if (!conn)
+			status = BT_HCI_ERR_MEM_CAPACITY_EXCEEDED;
+	}
+
 	cc.status = status;
-	memcpy(cc.bdaddr, btdev->conn->bdaddr, 6);
-	cc.handle = cpu_to_le16(status == BT_HCI_ERR_SUCCESS ? 257 : 0);
+	memcpy(cc.bdaddr, acl->link->dev->bdaddr, 6);
+	cc.handle = cpu_to_le16(conn ? conn->handle : 0);
 	cc.link_type = 0x00;
 	cc.encr_mode = 0x00;
 
@@ -1123,13 +1468,18 @@ static void le_conn_complete(struct btdev *btdev,
 
 	if (!status) {
 		struct btdev *remote;
+		struct btdev_conn *conn;
 
 		remote = find_btdev_by_bdaddr_type(lecc->peer_addr,
 							lecc->peer_addr_type);
 
-		btdev->conn = remote;
+		conn = conn_new(btdev, remote, CONN_TYPE_LE);
+		if (!conn) {
+			status = BT_HCI_ERR_MEM_CAPACITY_EXCEEDED;
+			goto done;
+		}
+
 		btdev->le_adv_enable = 0;
-		remote->conn = btdev;
 		remote->le_adv_enable = 0;
 
 		cc->status = status;
@@ -1140,14 +1490,17 @@ static void le_conn_complete(struct btdev *btdev,
 			memcpy(cc->peer_addr, btdev->bdaddr, 6);
 
 		cc->role = 0x01;
-		cc->handle = cpu_to_le16(42);
+		cc->handle = cpu_to_le16(conn->link->handle);
 		cc->interval = lecc->max_interval;
 		cc->latency = lecc->latency;
 		cc->supv_timeout = lecc->supv_timeout;
 
 		send_event(remote, BT_HCI_EVT_LE_META_EVENT, buf, sizeof(buf));
+
+		cc->handle = cpu_to_le16(conn->handle);
 	}
 
+done:
 	cc->status = status;
 	cc->peer_addr_type = lecc->peer_addr_type;
 	memcpy(cc->peer_addr, lecc->peer_addr, 6);
@@ -1226,20 +1579,20 @@ static void conn_request(struct btdev *btdev, const uint8_t *bdaddr)
 static void rej_le_conn_update(struct btdev *btdev, uint16_t handle,
 								uint8_t reason)
 {
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 	struct __packed {
 		uint8_t subevent;
 		struct bt_hci_evt_le_conn_update_complete ev;
 	} ev;
 
-	if (!remote)
+	if (!conn)
 		return;
 
 	ev.subevent = BT_HCI_EVT_LE_CONN_UPDATE_COMPLETE;
-	ev.ev.handle = cpu_to_le16(handle);
+	ev.ev.handle = cpu_to_le16(conn->link->handle);
 	ev.ev.status = cpu_to_le16(reason);
 
-	send_event(remote, BT_HCI_EVT_LE_META_EVENT, &ev, sizeof(ev));
+	send_event(conn->link->dev, BT_HCI_EVT_LE_META_EVENT, &ev, sizeof(ev));
 }
 
 static void le_conn_update(struct btdev *btdev, uint16_t handle,
@@ -1247,7 +1600,7 @@ static void le_conn_update(struct btdev *btdev, uint16_t handle,
 				uint16_t latency, uint16_t supv_timeout,
 				uint16_t min_length, uint16_t max_length)
 {
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 	struct __packed {
 		uint8_t subevent;
 		struct bt_hci_evt_le_conn_update_complete ev;
@@ -1259,15 +1612,18 @@ static void le_conn_update(struct btdev *btdev, uint16_t handle,
 	ev.ev.latency = cpu_to_le16(latency);
 	ev.ev.supv_timeout = cpu_to_le16(supv_timeout);
 
-	if (remote)
+	if (conn)
 		ev.ev.status = BT_HCI_ERR_SUCCESS;
 	else
 		ev.ev.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 
 	send_event(btdev, BT_HCI_EVT_LE_META_EVENT, &ev, sizeof(ev));
 
-	if (remote)
-		send_event(remote, BT_HCI_EVT_LE_META_EVENT, &ev, sizeof(ev));
+	if (conn) {
+		ev.ev.handle = cpu_to_le16(conn->link->handle);
+		send_event(conn->link->dev, BT_HCI_EVT_LE_META_EVENT,
+							&ev, sizeof(ev));
+	}
 }
 
 static void le_conn_param_req(struct btdev *btdev, uint16_t handle,
@@ -1275,32 +1631,60 @@ static void le_conn_param_req(struct btdev *btdev, uint16_t handle,
 				uint16_t latency, uint16_t supv_timeout,
 				uint16_t min_length, uint16_t max_length)
 {
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 	struct __packed {
 		uint8_t subevent;
 		struct bt_hci_evt_le_conn_param_request ev;
 	} ev;
 
-	if (!remote)
+	if (!conn)
 		return;
 
 	ev.subevent = BT_HCI_EVT_LE_CONN_PARAM_REQUEST;
-	ev.ev.handle = cpu_to_le16(handle);
+	ev.ev.handle = cpu_to_le16(conn->link->handle);
 	ev.ev.min_interval = cpu_to_le16(min_interval);
 	ev.ev.max_interval = cpu_to_le16(max_interval);
 	ev.ev.latency = cpu_to_le16(latency);
 	ev.ev.supv_timeout = cpu_to_le16(supv_timeout);
 
-	send_event(remote, BT_HCI_EVT_LE_META_EVENT, &ev, sizeof(ev));
+	send_event(conn->link->dev, BT_HCI_EVT_LE_META_EVENT, &ev, sizeof(ev));
+}
+
+static void conn_disconnect(struct btdev_conn *conn, uint8_t reason)
+{
+	struct bt_hci_evt_disconnect_complete dc;
+	struct btdev *btdev = conn->dev;
+	struct btdev *remote = conn->link->dev;
+
+	dc.status = BT_HCI_ERR_SUCCESS;
+	dc.reason = reason;
+
+	dc.handle = cpu_to_le16(conn->handle);
+	send_event(btdev, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
+
+	dc.handle = cpu_to_le16(conn->link->handle);
+	send_event(remote, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
+
+	conn_free(conn);
+}
+
+static bool match_sync_conn(const void *data, const void *match_data)
+{
+	const struct btdev_conn *conn = data;
+
+	if (conn->type != CONN_TYPE_SCO && conn->type != CONN_TYPE_ESCO)
+		return false;
+
+	return conn->link->dev == match_data;
 }
 
 static void disconnect_complete(struct btdev *btdev, uint16_t handle,
 							uint8_t reason)
 {
 	struct bt_hci_evt_disconnect_complete dc;
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 
-	if (!remote) {
+	if (!conn) {
 		dc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		dc.handle = cpu_to_le16(handle);
 		dc.reason = 0x00;
@@ -1310,31 +1694,31 @@ static void disconnect_complete(struct btdev *btdev, uint16_t handle,
 		return;
 	}
 
-	dc.status = BT_HCI_ERR_SUCCESS;
-	dc.handle = cpu_to_le16(handle);
-	dc.reason = reason;
+	/* Synchronous links cannot outlive the ACL link they belong to */
+	if (conn->type == CONN_TYPE_ACL) {
+		struct btdev_conn *sco;
 
-	btdev->conn = NULL;
-	remote->conn = NULL;
+		while ((sco = queue_find(btdev->conns, match_sync_conn,
+							conn->link->dev)))
+			conn_disconnect(sco, reason);
+	}
 
-	send_event(btdev, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
-	send_event(remote, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
+	conn_disconnect(conn, reason);
 }
 
 static void link_key_req_reply_complete(struct btdev *btdev,
 					const uint8_t *bdaddr,
 					const uint8_t *link_key)
 {
-	struct btdev *remote = btdev->conn;
+	struct btdev *remote;
+	struct btdev_conn *conn;
 	struct bt_hci_evt_auth_complete ev;
 
 	memcpy(btdev->link_key, link_key, 16);
 
-	if (!remote) {
-		remote = find_btdev_by_bdaddr(bdaddr);
-		if (!remote)
-			return;
-	}
+	remote = find_btdev_by_bdaddr(bdaddr);
+	if (!remote)
+		return;
 
 	if (!memcmp(remote->link_key, LINK_KEY_NONE, 16)) {
 		send_event(remote, BT_HCI_EVT_LINK_KEY_REQUEST,
@@ -1342,27 +1726,28 @@ static void link_key_req_reply_complete(struct btdev *btdev,
 		return;
 	}
 
-	ev.handle = cpu_to_le16(42);
-
 	if (!memcmp(btdev->link_key, remote->link_key, 16))
 		ev.status = BT_HCI_ERR_SUCCESS;
 	else
 		ev.status = BT_HCI_ERR_AUTH_FAILURE;
 
+	conn = find_acl_by_bdaddr(btdev, bdaddr);
+
+	ev.handle = cpu_to_le16(conn ? conn->handle : ACL_HANDLE_BASE);
 	send_event(btdev, BT_HCI_EVT_AUTH_COMPLETE, &ev, sizeof(ev));
+
+	ev.handle = cpu_to_le16(conn ? conn->link->handle : ACL_HANDLE_BASE);
 	send_event(remote, BT_HCI_EVT_AUTH_COMPLETE, &ev, sizeof(ev));
 }
 
 static void link_key_req_neg_reply_complete(struct btdev *btdev,
 							const uint8_t *bdaddr)
 {
-	struct btdev *remote = btdev->conn;
+	struct btdev *remote;
 
-	if (!remote) {
-		remote = find_btdev_by_bdaddr(bdaddr);
-		if (!remote)
-			return;
-	}
+	remote = find_btdev_by_bdaddr(bdaddr);
+	if (!remote)
+		return;
 
 	if (use_ssp(btdev, remote)) {
 		struct bt_hci_evt_io_capability_request io_req;
@@ -1379,9 +1764,8 @@ static void link_key_req_neg_reply_complete(struct btdev *btdev,
 	}
 }
 
-static uint8_t get_link_key_type(struct btdev *btdev)
+static uint8_t get_link_key_type(struct btdev *btdev, struct btdev *remote)
 {
-	struct btdev *remote = btdev->conn;
 	uint8_t auth, unauth;
 
 	if (!remote)
@@ -1422,25 +1806,29 @@ static void link_key_notify(struct btdev *btdev, const uint8_t *bdaddr,
 							const uint8_t *key)
 {
 	struct bt_hci_evt_link_key_notify ev;
+	struct btdev_conn *conn;
 
 	memcpy(btdev->link_key, key, 16);
 
+	conn = find_acl_by_bdaddr(btdev, bdaddr);
+
 	memcpy(ev.bdaddr, bdaddr, 6);
 	memcpy(ev.link_key, key, 16);
-	ev.key_type = get_link_key_type(btdev);
+	ev.key_type = get_link_key_type(btdev, conn ? conn->link->dev : NULL);
 
 	send_event(btdev, BT_HCI_EVT_LINK_KEY_NOTIFY, &ev, sizeof(ev));
 }
 
-static void encrypt_change(struct btdev *btdev, uint8_t mode, uint8_t status)
+static void encrypt_change(struct btdev_conn *conn, uint8_t mode,
+								uint8_t status)
 {
 	struct bt_hci_evt_encrypt_change ev;
 
 	ev.status = status;
-	ev.handle = cpu_to_le16(42);
+	ev.handle = cpu_to_le16(conn->handle);
 	ev.encr_mode = mode;
 
-	send_event(btdev, BT_HCI_EVT_ENCRYPT_CHANGE, &ev, sizeof(ev));
+	send_event(conn->dev, BT_HCI_EVT_ENCRYPT_CHANGE, &ev, sizeof(ev));
 }
 
 static void pin_code_req_reply_complete(struct btdev *btdev,
@@ -1448,13 +1836,12 @@ static void pin_code_req_reply_complete(struct btdev *btdev,
 					const uint8_t *pin_code)
 {
 	struct bt_hci_evt_auth_complete ev;
-	struct btdev *remote = btdev->conn;
+	struct btdev *remote;
+	struct btdev_conn *conn;
 
-	if (!remote) {
-		remote = find_btdev_by_bdaddr(bdaddr);
-		if (!remote)
-			return;
-	}
+	remote = find_btdev_by_bdaddr(bdaddr);
+	if (!remote)
+		return;
 
 	memcpy(btdev->pin, pin_code, pin_len);
 	btdev->pin_len = pin_len;
@@ -1477,8 +1864,9 @@ static void pin_code_req_reply_complete(struct btdev *btdev,
 		ev.status = BT_HCI_ERR_AUTH_FAILURE;
 	}
 
-	if (remote->conn) {
-		ev.handle = cpu_to_le16(42);
+	conn = find_acl_by_bdaddr(remote, btdev->bdaddr);
+	if (conn) {
+		ev.handle = cpu_to_le16(conn->handle);
 		send_event(remote, BT_HCI_EVT_AUTH_COMPLETE, &ev, sizeof(ev));
 	} else {
 		conn_complete(remote, btdev->bdaddr, ev.status);
@@ -1492,24 +1880,27 @@ static void pin_code_req_neg_reply_complete(struct btdev *btdev,
 							const uint8_t *bdaddr)
 {
 	struct bt_hci_evt_auth_complete ev;
-	struct btdev *remote = btdev->conn;
+	struct btdev *remote;
+	struct btdev_conn *conn;
 
-	if (!remote) {
-		remote = find_btdev_by_bdaddr(bdaddr);
-		if (!remote)
-			return;
-	}
+	remote = find_btdev_by_bdaddr(bdaddr);
+	if (!remote)
+		return;
+
+	conn = find_acl_by_bdaddr(btdev, bdaddr);
 
 	ev.status = BT_HCI_ERR_PIN_OR_KEY_MISSING;
-	ev.handle = cpu_to_le16(42);
 
-	if (btdev->conn)
+	if (conn) {
+		ev.handle = cpu_to_le16(conn->handle);
 		send_event(btdev, BT_HCI_EVT_AUTH_COMPLETE, &ev, sizeof(ev));
-	else
+	} else {
 		conn_complete(btdev, bdaddr, BT_HCI_ERR_PIN_OR_KEY_MISSING);
+	}
 
-	if (remote->conn) {
-	        if (remote->pin_len)
+	if (conn) {
+		ev.handle = cpu_to_le16(conn->link->handle);
+		if (remote->pin_len)
 			send_event(remote, BT_HCI_EVT_AUTH_COMPLETE, &ev,
 								sizeof(ev));
 	} else {
@@ -1520,9 +1911,9 @@ static void pin_code_req_neg_reply_complete(struct btdev *btdev,
 
 static void auth_request_complete(struct btdev *btdev, uint16_t handle)
 {
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 
-	if (!remote) {
+	if (!conn) {
 		struct bt_hci_evt_auth_complete ev;
 
 		ev.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
@@ -1535,7 +1926,8 @@ static void auth_request_complete(struct btdev *btdev, uint16_t handle)
 
 	btdev->auth_init = true;
 
-	send_event(btdev, BT_HCI_EVT_LINK_KEY_REQUEST, remote->bdaddr, 6);
+	send_event(btdev, BT_HCI_EVT_LINK_KEY_REQUEST,
+						conn->link->dev->bdaddr, 6);
 }
 
 static void name_request_complete(struct btdev *btdev,
@@ -1563,11 +1955,12 @@ static void name_request_complete(struct btdev *btdev,
 static void remote_features_complete(struct btdev *btdev, uint16_t handle)
 {
 	struct bt_hci_evt_remote_features_complete rfc;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 
-	if (btdev->conn) {
+	if (conn) {
 		rfc.status = BT_HCI_ERR_SUCCESS;
 		rfc.handle = cpu_to_le16(handle);
-		memcpy(rfc.features, btdev->conn->features, 8);
+		memcpy(rfc.features, conn->link->dev->features, 8);
 	} else {
 		rfc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		rfc.handle = cpu_to_le16(handle);
@@ -1595,8 +1988,9 @@ static void remote_ext_features_complete(struct btdev *btdev, uint16_t handle,
 								uint8_t page)
 {
 	struct bt_hci_evt_remote_ext_features_complete refc;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 
-	if (btdev->conn && page < 0x02) {
+	if (conn && page < 0x02) {
 		refc.handle = cpu_to_le16(handle);
 		refc.page = page;
 		refc.max_page = 0x01;
@@ -1604,11 +1998,12 @@ static void remote_ext_features_complete(struct btdev *btdev, uint16_t handle,
 		switch (page) {
 		case 0x00:
 			refc.status = BT_HCI_ERR_SUCCESS;
-			memcpy(refc.features, btdev->conn->features, 8);
+			memcpy(refc.features, conn->link->dev->features, 8);
 			break;
 		case 0x01:
 			refc.status = BT_HCI_ERR_SUCCESS;
-			btdev_get_host_features(btdev->conn, refc.features);
+			btdev_get_host_features(conn->link->dev,
+							refc.features);
 			break;
 		default:
 			refc.status = BT_HCI_ERR_INVALID_PARAMETERS;
@@ -1630,13 +2025,16 @@ static void remote_ext_features_complete(struct btdev *btdev, uint16_t handle,
 static void remote_version_complete(struct btdev *btdev, uint16_t handle)
 {
 	struct bt_hci_evt_remote_version_complete rvc;
+	struct btdev_conn *conn = find_conn(btdev, handle);
+
+	if (conn) {
+		struct btdev *remote = conn->link->dev;
 
-	if (btdev->conn) {
 		rvc.status = BT_HCI_ERR_SUCCESS;
 		rvc.handle = cpu_to_le16(handle);
-		rvc.lmp_ver = btdev->conn->version;
-		rvc.manufacturer = cpu_to_le16(btdev->conn->manufacturer);
-		rvc.lmp_subver = cpu_to_le16(btdev->conn->revision);
+		rvc.lmp_ver = remote->version;
+		rvc.manufacturer = cpu_to_le16(remote->manufacturer);
+		rvc.lmp_subver = cpu_to_le16(remote->revision);
 	} else {
 		rvc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		rvc.handle = cpu_to_le16(handle);
@@ -1653,7 +2051,7 @@ static void remote_clock_offset_complete(struct btdev *btdev, uint16_t handle)
 {
 	struct bt_hci_evt_clock_offset_complete coc;
 
-	if (btdev->conn) {
+	if (find_conn(btdev, handle)) {
 		coc.status = BT_HCI_ERR_SUCCESS;
 		coc.handle = cpu_to_le16(handle);
 		coc.clock_offset = 0;
@@ -1673,7 +2071,7 @@ static void read_enc_key_size_complete(struct btdev *btdev, uint16_t handle)
 
 	rsp.handle = cpu_to_le16(handle);
 
-	if (btdev->conn) {
+	if (find_conn(btdev, handle)) {
 		rsp.status = BT_HCI_ERR_SUCCESS;
 		rsp.key_size = 16;
 	} else {
@@ -1690,16 +2088,19 @@ static void io_cap_req_reply_complete(struct btdev *btdev,
 					uint8_t capability, uint8_t oob_data,
 					uint8_t authentication)
 {
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_acl_by_bdaddr(btdev, bdaddr);
+	struct btdev *remote;
 	struct bt_hci_evt_io_capability_response ev;
 	struct bt_hci_rsp_io_capability_request_reply rsp;
 	uint8_t status;
 
-	if (!remote) {
+	if (!conn) {
 		status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		goto done;
 	}
 
+	remote = conn->link->dev;
+
 	status = BT_HCI_ERR_SUCCESS;
 
 	btdev->io_cap = capability;
@@ -1752,12 +2153,15 @@ static void ssp_complete(struct btdev *btdev, const uint8_t *bdaddr,
 {
 	struct bt_hci_evt_simple_pairing_complete iev, aev;
 	struct bt_hci_evt_auth_complete auth;
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_acl_by_bdaddr(btdev, bdaddr);
+	struct btdev *remote;
 	struct btdev *init, *accp;
 
-	if (!remote)
+	if (!conn)
 		return;
 
+	remote = conn->link->dev;
+
 	btdev->ssp_status = status;
 	btdev->ssp_auth_complete = true;
 
@@ -1794,7 +2198,8 @@ static void ssp_complete(struct btdev *btdev, const uint8_t *bdaddr,
 	}
 
 	auth.status = status;
-	auth.handle = cpu_to_le16(42);
+	auth.handle = cpu_to_le16(init == btdev ? conn->handle :
+							conn->link->handle);
 	send_event(init, BT_HCI_EVT_AUTH_COMPLETE, &auth, sizeof(auth));
 }
 
@@ -1833,6 +2238,20 @@ static void le_send_adv_report(struct btdev *btdev, const struct btdev *remote,
 					1 + 10 + meta_event.lar.data_len + 1);
 }
 
+void btdev_send_le_adv_reports(struct btdev *btdev, const void *data,
+								uint8_t len)
+{
+	if (!btdev || !len)
+		return;
+
+	radio_lock(false);
+
+	if (btdev->le_scan_enable)
+		le_meta_event(btdev, BT_HCI_EVT_LE_ADV_REPORT, data, len);
+
+	radio_unlock(false);
+}
+
 static uint8_t get_adv_report_type(uint8_t adv_type)
 {
 	/*
@@ -1852,7 +2271,7 @@ static void le_set_adv_enable_complete(struct btdev *btdev)
 
 	report_type = get_adv_report_type(btdev->le_adv_type);
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_list_len; i++) {
 		if (!btdev_list[i] || btdev_list[i] == btdev)
 			continue;
 
@@ -1877,7 +2296,7 @@ static void le_set_scan_enable_complete(struct btdev *btdev)
 {
 	int i;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_list_len; i++) {
 		uint8_t report_type;
 
 		if (!btdev_list[i] || btdev_list[i] == btdev)
@@ -1902,13 +2321,14 @@ static void le_set_scan_enable_complete(struct btdev *btdev)
 	}
 }
 
-static void le_read_remote_features_complete(struct btdev *btdev)
+static void le_read_remote_features_complete(struct btdev *btdev,
+							uint16_t handle)
 {
 	char buf[1 + sizeof(struct bt_hci_evt_le_remote_features_complete)];
 	struct bt_hci_evt_le_remote_features_complete *ev = (void *) &buf[1];
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 
-	if (!remote) {
+	if (!conn) {
 		cmd_status(btdev, BT_HCI_ERR_UNKNOWN_CONN_ID,
 					BT_HCI_CMD_LE_READ_REMOTE_FEATURES);
 		return;
@@ -1920,20 +2340,20 @@ static void le_read_remote_features_complete(struct btdev *btdev)
 	memset(buf, 0, sizeof(buf));
 	buf[0] = BT_HCI_EVT_LE_REMOTE_FEATURES_COMPLETE;
 	ev->status = BT_HCI_ERR_SUCCESS;
-	ev->handle = cpu_to_le16(42);
-	memcpy(ev->features, remote->le_features, 8);
+	ev->handle = cpu_to_le16(handle);
+	memcpy(ev->features, conn->link->dev->le_features, 8);
 
 	send_event(btdev, BT_HCI_EVT_LE_META_EVENT, buf, sizeof(buf));
 }
 
-static void le_start_encrypt_complete(struct btdev *btdev, uint16_t ediv,
-								uint64_t rand)
+static void le_start_encrypt_complete(struct btdev *btdev, uint16_t handle,
+						uint16_t ediv, uint64_t rand)
 {
 	char buf[1 + sizeof(struct bt_hci_evt_le_long_term_key_request)];
 	struct bt_hci_evt_le_long_term_key_request *ev = (void *) &buf[1];
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 
-	if (!remote) {
+	if (!conn) {
 		cmd_status(btdev, BT_HCI_ERR_UNKNOWN_CONN_ID,
 						BT_HCI_CMD_LE_START_ENCRYPT);
 		return;
@@ -1943,23 +2363,24 @@ static void le_start_encrypt_complete(struct btdev *btdev, uint16_t ediv,
 
 	memset(buf, 0, sizeof(buf));
 	buf[0] = BT_HCI_EVT_LE_LONG_TERM_KEY_REQUEST;
-	ev->handle = cpu_to_le16(42);
+	ev->handle = cpu_to_le16(conn->link->handle);
 	ev->ediv = ediv;
 	ev->rand = rand;
 
-	send_event(remote, BT_HCI_EVT_LE_META_EVENT, buf, sizeof(buf));
+	send_event(conn->link->dev, BT_HCI_EVT_LE_META_EVENT, buf, sizeof(buf));
 }
 
-static void le_encrypt_complete(struct btdev *btdev)
+static void le_encrypt_complete(struct btdev *btdev, uint16_t handle)
 {
 	struct bt_hci_evt_encrypt_change ev;
 	struct bt_hci_rsp_le_ltk_req_reply rp;
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_conn(btdev, handle);
+	struct btdev *remote;
 
 	memset(&rp, 0, sizeof(rp));
-	rp.handle = cpu_to_le16(42);
+	rp.handle = cpu_to_le16(handle);
 
-	if (!remote) {
+	if (!conn) {
 		rp.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		cmd_complete(btdev, BT_HCI_CMD_LE_LTK_REQ_REPLY, &rp,
 							sizeof(rp));
@@ -1969,6 +2390,8 @@ static void le_encrypt_complete(struct btdev *btdev)
 	rp.status = BT_HCI_ERR_SUCCESS;
 	cmd_complete(btdev, BT_HCI_CMD_LE_LTK_REQ_REPLY, &rp, sizeof(rp));
 
+	remote = conn->link->dev;
+
 	memset(&ev, 0, sizeof(ev));
 
 	if (memcmp(btdev->le_ltk, remote->le_ltk, 16)) {
@@ -1979,22 +2402,23 @@ static void le_encrypt_complete(struct btdev *btdev)
 		ev.encr_mode = 0x01;
 	}
 
-	ev.handle = cpu_to_le16(42);
-
+	ev.handle = cpu_to_le16(conn->handle);
 	send_event(btdev, BT_HCI_EVT_ENCRYPT_CHANGE, &ev, sizeof(ev));
+
+	ev.handle = cpu_to_le16(conn->link->handle);
 	send_event(remote, BT_HCI_EVT_ENCRYPT_CHANGE, &ev, sizeof(ev));
 }
 
-static void ltk_neg_reply_complete(struct btdev *btdev)
+static void ltk_neg_reply_complete(struct btdev *btdev, uint16_t handle)
 {
 	struct bt_hci_rsp_le_ltk_req_neg_reply rp;
 	struct bt_hci_evt_encrypt_change ev;
-	struct btdev *remote = btdev->conn;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 
 	memset(&rp, 0, sizeof(rp));
-	rp.handle = cpu_to_le16(42);
+	rp.handle = cpu_to_le16(handle);
 
-	if (!remote) {
+	if (!conn) {
 		rp.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		cmd_complete(btdev, BT_HCI_CMD_LE_LTK_REQ_NEG_REPLY, &rp,
 							sizeof(rp));
@@ -2006,9 +2430,9 @@ static void ltk_neg_reply_complete(struct btdev *btdev)
 
 	memset(&ev, 0, sizeof(ev));
 	ev.status = BT_HCI_ERR_PIN_OR_KEY_MISSING;
-	ev.handle = cpu_to_le16(42);
+	ev.handle = cpu_to_le16(conn->link->handle);
 
-	send_event(remote, BT_HCI_EVT_ENCRYPT_CHANGE, &ev, sizeof(ev));
+	send_event(conn->link->dev, BT_HCI_EVT_ENCRYPT_CHANGE, &ev, sizeof(ev));
 }
 
 static void btdev_reset(struct btdev *btdev)
@@ -2061,6 +2485,9 @@ static void default_cmd(struct btdev *btdev, uint16_t opcode,
 	const struct bt_hci_cmd_le_set_scan_enable *lsse;
 	const struct bt_hci_cmd_le_start_encrypt *lse;
 	const struct bt_hci_cmd_le_ltk_req_reply *llrr;
+	const struct bt_hci_cmd_le_ltk_req_neg_reply *llrnr;
+	const struct bt_hci_cmd_le_read_remote_features *lrrf;
+	const struct bt_hci_cmd_add_sco_conn *ascc;
 	const struct bt_hci_cmd_le_encrypt *lenc_cmd;
 	const struct bt_hci_cmd_le_generate_dhkey *dh;
 	const struct bt_hci_cmd_le_conn_param_req_reply *lcprr_cmd;
@@ -2922,7 +3349,7 @@ static void default_cmd(struct btdev *btdev, uint16_t opcode,
 			goto unsupported;
 		lrbs.status = BT_HCI_ERR_SUCCESS;
 		lrbs.le_mtu = cpu_to_le16(btdev->acl_mtu);
-		lrbs.le_max_pkt = btdev->acl_max_pkt;
+		lrbs.le_max_pkt = btdev->le_max_pkt;
 		cmd_complete(btdev, opcode, &lrbs, sizeof(lrbs));
 		break;
 
@@ -3134,7 +3561,9 @@ static void default_cmd(struct btdev *btdev, uint16_t opcode,
 	case BT_HCI_CMD_LE_READ_REMOTE_FEATURES:
 		if (btdev->type == BTDEV_TYPE_BREDR)
 			goto unsupported;
-		le_read_remote_features_complete(btdev);
+		lrrf = data;
+		le_read_remote_features_complete(btdev,
+						le16_to_cpu(lrrf->handle));
 		break;
 
 	case BT_HCI_CMD_LE_START_ENCRYPT:
@@ -3142,7 +3571,8 @@ static void default_cmd(struct btdev *btdev, uint16_t opcode,
 			goto unsupported;
 		lse = data;
 		memcpy(btdev->le_ltk, lse->ltk, 16);
-		le_start_encrypt_complete(btdev, lse->ediv, lse->rand);
+		le_start_encrypt_complete(btdev, le16_to_cpu(lse->handle),
+							lse->ediv, lse->rand);
 		break;
 
 	case BT_HCI_CMD_LE_LTK_REQ_REPLY:
@@ -3150,13 +3580,14 @@ static void default_cmd(struct btdev *btdev, uint16_t opcode,
 			goto unsupported;
 		llrr = data;
 		memcpy(btdev->le_ltk, llrr->ltk, 16);
-		le_encrypt_complete(btdev);
+		le_encrypt_complete(btdev, le16_to_cpu(llrr->handle));
 		break;
 
 	case BT_HCI_CMD_LE_LTK_REQ_NEG_REPLY:
 		if (btdev->type == BTDEV_TYPE_BREDR)
 			goto unsupported;
-		ltk_neg_reply_complete(btdev);
+		llrnr = data;
+		ltk_neg_reply_complete(btdev, le16_to_cpu(llrnr->handle));
 		break;
 
 	case BT_HCI_CMD_SETUP_SYNC_CONN:
@@ -3165,14 +3596,16 @@ static void default_cmd(struct btdev *btdev, uint16_t opcode,
 		ssc = data;
 		status = BT_HCI_ERR_SUCCESS;
 		cmd_status(btdev, BT_HCI_ERR_SUCCESS, opcode);
-		sync_conn_complete(btdev, ssc->voice_setting,
-							BT_HCI_ERR_SUCCESS);
+		sync_conn_complete(btdev, le16_to_cpu(ssc->handle),
+					ssc->voice_setting, BT_HCI_ERR_SUCCESS);
 		break;
 
 	case BT_HCI_CMD_ADD_SCO_CONN:
 		if (btdev->type == BTDEV_TYPE_LE)
 			goto unsupported;
-		sco_conn_complete(btdev, BT_HCI_ERR_SUCCESS);
+		ascc = data;
+		sco_conn_complete(btdev, le16_to_cpu(ascc->handle),
+							BT_HCI_ERR_SUCCESS);
 		break;
 
 	case BT_HCI_CMD_ENABLE_DUT_MODE:
@@ -3264,6 +3697,7 @@ static void default_cmd_completion(struct btdev *btdev, uint16_t opcode,
 	const struct bt_hci_cmd_le_conn_param_req_reply *lcprr;
 	const struct bt_hci_cmd_le_conn_param_req_neg_reply *lcprnr;
 	const struct bt_hci_cmd_le_set_scan_enable *lsse;
+	struct btdev_conn *conn;
 
 	switch (opcode) {
 	case BT_HCI_CMD_INQUIRY:
@@ -3345,19 +3779,20 @@ static void default_cmd_completion(struct btdev *btdev, uint16_t opcode,
 		if (btdev->type == BTDEV_TYPE_LE)
 			return;
 		sce = data;
-		if (btdev->conn) {
+		conn = find_conn(btdev, le16_to_cpu(sce->handle));
+		if (conn) {
 			uint8_t mode;
 
 			if (!sce->encr_mode)
 				mode = 0x00;
 			else if (btdev->secure_conn_support &&
-					btdev->conn->secure_conn_support)
+				conn->link->dev->secure_conn_support)
 				mode = 0x02;
 			else
 				mode = 0x01;
 
-			encrypt_change(btdev, mode, BT_HCI_ERR_SUCCESS);
-			encrypt_change(btdev->conn, mode, BT_HCI_ERR_SUCCESS);
+			encrypt_change(conn, mode, BT_HCI_ERR_SUCCESS);
+			encrypt_change(conn->link, mode, BT_HCI_ERR_SUCCESS);
 		}
 		break;
 
@@ -3542,10 +3977,11 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 	}
 }
 
-static void send_acl(struct btdev *conn, const void *data, uint16_t len)
+static void send_acl(struct btdev_conn *conn, const void *data, uint16_t len)
 {
 	struct bt_hci_acl_hdr hdr;
 	struct iovec iov[3];
+	uint8_t flags;
 
 	/* Packet type */
 	iov[0].iov_base = (void *) data;
@@ -3555,8 +3991,12 @@ static void send_acl(struct btdev *conn, const void *data, uint16_t len)
 	 * From controller to host this should be converted to ACL_START.
 	 */
 	memcpy(&hdr, data + 1, sizeof(hdr));
-	if (acl_flags(hdr.handle) == ACL_START_NO_FLUSH)
-		hdr.handle = acl_handle_pack(acl_handle(hdr.handle), ACL_START);
+	flags = acl_flags(le16_to_cpu(hdr.handle));
+	if (flags == ACL_START_NO_FLUSH)
+		flags = ACL_START;
+
+	/* The receiving side knows the link by its own handle */
+	hdr.handle = cpu_to_le16(acl_handle_pack(conn->handle, flags));
 
 	iov[1].iov_base = &hdr;
 	iov[1].iov_len = sizeof(hdr);
@@ -3564,7 +4004,188 @@ static void send_acl(struct btdev *conn, const void *data, uint16_t len)
 	iov[2].iov_base = (void *) (data + 1 + sizeof(hdr));
 	iov[2].iov_len = len - 1 - sizeof(hdr);
 
-	send_packet(conn, iov, 3);
+	send_packet(conn->dev, iov, 3);
+}
+
+struct ncp_batch {
+	struct btdev *btdev;
+	uint8_t num_handles;
+	uint8_t data[1 + 63 * 4];
+};
+
+static void ncp_batch_flush(struct ncp_batch *batch)
+{
+	if (!batch->num_handles)
+		return;
+
+	batch->data[0] = batch->num_handles;
+	send_event(batch->btdev, BT_HCI_EVT_NUM_COMPLETED_PACKETS, batch->data,
+						1 + batch->num_handles * 4);
+	batch->num_handles = 0;
+}
+
+static void ncp_batch_add(struct ncp_batch *batch, uint16_t handle,
+							uint16_t count)
+{
+	uint8_t *ptr = batch->data + 1 + batch->num_handles * 4;
+
+	put_le16(handle, ptr);
+	put_le16(count, ptr + 2);
+
+	if (++batch->num_handles == 63)
+		ncp_batch_flush(batch);
+}
+
+static uint16_t link_event(struct btdev *btdev, struct btdev_conn *conn)
+{
+	const struct btdev_link_model *model = &btdev->link_model;
+	uint32_t rate;
+	uint16_t count = 0;
+
+	if (conn->type == CONN_TYPE_LE)
+		rate = model->le_rate;
+	else
+		rate = model->bredr_rate;
+
+	/* Each interval grants the airtime of the PHY in bytes */
+	if (rate)
+		conn->credit += (uint64_t) rate * model->interval / 8000;
+
+	while (!model->event_pkts || count < model->event_pkts) {
+		struct acl_pkt *pkt = queue_peek_head(conn->tx_queue);
+		uint32_t payload;
+
+		if (!pkt)
+			break;
+
+		payload = pkt->len - 1 - sizeof(struct bt_hci_acl_hdr);
+
+		if (rate) {
+			if (conn->credit < payload)
+				break;
+
+			conn->credit -= payload;
+		}
+
+		queue_pop_head(conn->tx_queue);
+		(*pending_count(conn))--;
+		count++;
+
+		send_acl(conn->link, pkt->data, pkt->len);
+		free(pkt);
+
+		if (!model->batch_ncp)
+			num_completed_packets(btdev, conn->handle);
+	}
+
+	/* Idle links do not bank airtime for later */
+	if (queue_isempty(conn->tx_queue))
+		conn->credit = 0;
+
+	return count;
+}
+
+static bool link_callback(void *user_data)
+{
+	struct btdev *btdev = user_data;
+	const struct queue_entry *entry;
+	struct ncp_batch batch;
+	bool pending;
+
+	radio_lock(false);
+
+	batch.btdev = btdev;
+	batch.num_handles = 0;
+
+	for (entry = queue_get_entries(btdev->conns); entry;
+							entry = entry->next) {
+		struct btdev_conn *conn = entry->data;
+		uint16_t count;
+
+		if (queue_isempty(conn->tx_queue))
+			continue;
+
+		count = link_event(btdev, conn);
+
+		if (count && btdev->link_model.batch_ncp)
+			ncp_batch_add(&batch, conn->handle, count);
+	}
+
+	ncp_batch_flush(&batch);
+
+	pending = btdev->acl_pending || btdev->le_pending;
+	if (!pending)
+		btdev->link_id = 0;
+
+	radio_unlock(false);
+
+	return pending;
+}
+
+static void queue_acl(struct btdev_conn *conn, const void *data, uint16_t len)
+{
+	struct btdev *btdev = conn->dev;
+	uint16_t *pending = pending_count(conn);
+	uint16_t max_pkt;
+	struct acl_pkt *pkt;
+
+	if (conn->type == CONN_TYPE_LE)
+		max_pkt = btdev->le_max_pkt;
+	else
+		max_pkt = btdev->acl_max_pkt;
+
+	/* The host sent more than the advertised buffers allow */
+	if (*pending >= max_pkt) {
+		struct bt_hci_evt_data_buffer_overflow dbo;
+
+		/* LE data travels on ACL, there is no LE link type here */
+		dbo.link_type = 0x01;
+		send_event(btdev, BT_HCI_EVT_DATA_BUFFER_OVERFLOW, &dbo,
+								sizeof(dbo));
+		return;
+	}
+
+	if (!conn->tx_queue)
+		conn->tx_queue = queue_new();
+
+	pkt = malloc(sizeof(*pkt) + len);
+	if (!pkt)
+		return;
+
+	pkt->len = len;
+	memcpy(pkt->data, data, len);
+
+	queue_push_tail(conn->tx_queue, pkt);
+	(*pending)++;
+
+	if (!btdev->link_id)
+		btdev->link_id = timeout_add(btdev->link_model.interval,
+						link_callback, btdev, NULL);
+}
+
+static void process_acl(struct btdev *btdev, const void *data, uint16_t len)
+{
+	struct bt_hci_acl_hdr hdr;
+	struct btdev_conn *conn;
+	uint16_t handle;
+
+	if (len < 1 + sizeof(hdr))
+		return;
+
+	memcpy(&hdr, data + 1, sizeof(hdr));
+	handle = acl_handle(le16_to_cpu(hdr.handle));
+
+	conn = find_conn(btdev, handle);
+	if (!conn)
+		return;
+
+	if (btdev->link_model_enabled) {
+		queue_acl(conn, data, len);
+		return;
+	}
+
+	send_acl(conn->link, data, len);
+	num_completed_packets(btdev, handle);
 }
 
 void btdev_receive_h4(struct btdev *btdev, const void *data, uint16_t len)
@@ -3581,12 +4202,14 @@ void btdev_receive_h4(struct btdev *btdev, const void *data, uint16_t len)
 
 	switch (pkt_type) {
 	case BT_H4_CMD_PKT:
+		radio_lock(true);
 		process_cmd(btdev, data + 1, len - 1);
+		radio_unlock(true);
 		break;
 	case BT_H4_ACL_PKT:
-		if (btdev->conn)
-			send_acl(btdev->conn, data, len);
-		num_completed_packets(btdev);
+		radio_lock(false);
+		process_acl(btdev, data, len);
+		radio_unlock(false);
 		break;
 	default:
 		printf("Unsupported packet 0x%2.2x\n", pkt_type);
@@ -74,6 +74,22 @@ enum btdev_hook_type {
 
 struct btdev;
 
+/*
+ * Airtime model for ACL traffic. Packets are held in the controller and
+ * released once per interval, limited by the PHY bitrate and the number
+ * of packets per connection event. A zero rate or packet count means no
+ * limit for that parameter.
+ */
+struct btdev_link_model {
+	uint32_t bredr_rate;		/* BR/EDR bitrate in bit/s */
+	uint32_t le_rate;		/* LE bitrate in bit/s */
+	uint16_t interval;		/* Connection event interval in ms */
+	uint8_t event_pkts;		/* Packets per link and event */
+	uint16_t acl_max_pkt;		/* Controller ACL buffers */
+	uint16_t le_max_pkt;		/* Controller LE buffers */
+	bool batch_ncp;			/* One NOCP event per interval */
+};
+
 struct btdev *btdev_create(enum btdev_type type, uint16_t id);
 void btdev_destroy(struct btdev *btdev);
 
@@ -90,6 +106,19 @@ void btdev_set_command_handler(struct btdev *btdev, btdev_command_func handler,
 void btdev_set_send_handler(struct btdev *btdev, btdev_send_func handler,
 							void *user_data);
 
+/*
+ * Used instead of the send handler for packets that other threads cause,
+ * so that they can be delivered from the thread that created the device.
+ */
+void btdev_set_post_handler(struct btdev *btdev, btdev_send_func handler,
+							void *user_data);
+
+bool btdev_set_link_model(struct btdev *btdev,
+				const struct btdev_link_model *model);
+
+void btdev_send_le_adv_reports(struct btdev *btdev, const void *data,
+								uint8_t len);
+
 void btdev_receive_h4(struct btdev *btdev, const void *data, uint16_t len);
 
 int btdev_add_hook(struct btdev *btdev, enum btdev_hook_type type,
@@ -38,27 +38,42 @@
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
+#include "lib/mgmt.h"
 
 #include "monitor/bt.h"
 #include "emulator/btdev.h"
 #include "emulator/bthost.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/mgmt.h"
 #include "emulator/hciemu.h"
 
+struct hciemu_client {
+	struct bthost *host;
+	struct btdev *dev;
+	guint start_source;
+	guint host_source;
+	guint source;
+};
+
 struct hciemu {
 	int ref_count;
 	enum btdev_type btdev_type;
-	struct bthost *host_stack;
 	struct btdev *master_dev;
-	struct btdev *client_dev;
-	guint host_source;
+	struct queue *clients;
 	guint master_source;
-	guint client_source;
+	uint16_t index;
+	struct index_filter *index_filter;
 	struct queue *post_command_hooks;
 	char bdaddr_str[18];
 };
 
+struct index_filter {
+	struct hciemu *hciemu;
+	hciemu_index_func_t func;
+	void *user_data;
+};
+
 struct hciemu_command_hook {
 	hciemu_command_func_t function;
 	void *user_data;
@@ -200,6 +215,46 @@ static gboolean receive_btdev(GIOChannel *channel, GIOCondition condition,
 	return TRUE;
 }
 
+static gboolean receive_master(GIOChannel *channel, GIOCondition condition,
+							gpointer user_data)
+{
+	struct hciemu *hciemu = user_data;
+	unsigned char buf[4096];
+	ssize_t len;
+	int fd;
+
+	if (condition & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
+		return FALSE;
+
+	fd = g_io_channel_unix_get_fd(channel);
+
+	len = read(fd, buf, sizeof(buf));
+	if (len < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+
+		return FALSE;
+	}
+
+	if (len < 1)
+		return FALSE;
+
+	switch (buf[0]) {
+	case HCI_VENDOR_PKT:
+		/* The vhci driver reports the index of the new controller */
+		if (len >= 4)
+			hciemu->index = get_le16(buf + 2);
+		break;
+	case BT_H4_CMD_PKT:
+	case BT_H4_ACL_PKT:
+	case BT_H4_SCO_PKT:
+		btdev_receive_h4(hciemu->master_dev, buf, len);
+		break;
+	}
+
+	return TRUE;
+}
+
 static guint create_source_btdev(int fd, struct btdev *btdev)
 {
 	GIOChannel *channel;
@@ -225,6 +280,7 @@ static guint create_source_btdev(int fd, struct btdev *btdev)
 static bool create_vhci(struct hciemu *hciemu)
 {
 	struct btdev *btdev;
+	GIOChannel *channel;
 	uint8_t create_req[2];
 	ssize_t written;
 	int fd;
@@ -254,70 +310,162 @@ static bool create_vhci(struct hciemu *hciemu)
 
 	hciemu->master_dev = btdev;
 
-	hciemu->master_source = create_source_btdev(fd, btdev);
+	channel = g_io_channel_unix_new(fd);
+
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+
+	btdev_set_send_handler(btdev, writev_callback, channel);
+
+	hciemu->master_source = g_io_add_watch_full(channel,
+				G_PRIORITY_DEFAULT,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				receive_master, hciemu, NULL);
+
+	g_io_channel_unref(channel);
 
 	return true;
 }
 
-struct bthost *hciemu_client_get_host(struct hciemu *hciemu)
+struct hciemu_client *hciemu_get_client(struct hciemu *hciemu, int num)
 {
+	const struct queue_entry *entry;
+
 	if (!hciemu)
 		return NULL;
 
-	return hciemu->host_stack;
+	for (entry = queue_get_entries(hciemu->clients); entry;
+					entry = entry->next, num--) {
+		if (!num)
+			return entry->data;
+	}
+
+	return NULL;
 }
 
-static bool create_stack(struct hciemu *hciemu)
+struct bthost *hciemu_client_host(struct hciemu_client *client)
 {
-	struct btdev *btdev;
-	struct bthost *bthost;
+	if (!client)
+		return NULL;
+
+	return client->host;
+}
+
+const uint8_t *hciemu_client_bdaddr(struct hciemu_client *client)
+{
+	if (!client)
+		return NULL;
+
+	return btdev_get_bdaddr(client->dev);
+}
+
+struct bthost *hciemu_client_get_host(struct hciemu *hciemu)
+{
+	return hciemu_client_host(hciemu_get_client(hciemu, 0));
+}
+
+static gboolean start_stack(gpointer user_data)
+{
+	struct hciemu_client *client = user_data;
+
+	client->start_source = 0;
+
+	bthost_start(client->host);
+
+	return FALSE;
+}
+
+static void client_destroy(void *data)
+{
+	struct hciemu_client *client = data;
+
+	if (client->start_source)
+		g_source_remove(client->start_source);
+
+	g_source_remove(client->host_source);
+	g_source_remove(client->source);
+
+	bthost_destroy(client->host);
+	btdev_destroy(client->dev);
+
+	free(client);
+}
+
+static struct hciemu_client *create_client(struct hciemu *hciemu)
+{
+	struct hciemu_client *client;
 	int sv[2];
 
-	btdev = btdev_create(hciemu->btdev_type, 0x00);
-	if (!btdev)
-		return false;
+	client = new0(struct hciemu_client, 1);
+	if (!client)
+		return NULL;
 
-	bthost = bthost_create();
-	if (!bthost) {
-		btdev_destroy(btdev);
-		return false;
+	client->dev = btdev_create(hciemu->btdev_type, 0x00);
+	if (!client->dev) {
+		free(client);
+		return NULL;
+	}
+
+	client->host = bthost_create();
+	if (!client->host) {
+		btdev_destroy(client->dev);
+		free(client);
+		return NULL;
 	}
 
-	btdev_set_command_handler(btdev, client_command_callback, hciemu);
+	btdev_set_command_handler(client->dev, client_command_callback,
+								hciemu);
 
 	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
 								0, sv) < 0) {
-		bthost_destroy(bthost);
-		btdev_destroy(btdev);
-		return false;
+		bthost_destroy(client->host);
+		btdev_destroy(client->dev);
+		free(client);
+		return NULL;
 	}
 
-	hciemu->client_dev = btdev;
-	hciemu->host_stack = bthost;
-
-	hciemu->client_source = create_source_btdev(sv[0], btdev);
-	hciemu->host_source = create_source_bthost(sv[1], bthost);
+	client->source = create_source_btdev(sv[0], client->dev);
+	client->host_source = create_source_bthost(sv[1], client->host);
+	client->start_source = g_idle_add(start_stack, client);
 
-	return true;
+	return client;
 }
 
-static gboolean start_stack(gpointer user_data)
+static bool create_stack(struct hciemu *hciemu, uint8_t num)
 {
-	struct hciemu *hciemu = user_data;
+	uint8_t i;
 
-	bthost_start(hciemu->host_stack);
+	for (i = 0; i < num; i++) {
+		struct hciemu_client *client = create_client(hciemu);
 
-	return FALSE;
+		if (!client)
+			return false;
+
+		queue_push_tail(hciemu->clients, client);
+	}
+
+	return true;
 }
 
 struct hciemu *hciemu_new(enum hciemu_type type)
+{
+	return hciemu_new_num(type, 1);
+}
+
+struct hciemu *hciemu_new_num(enum hciemu_type type, uint8_t num)
 {
 	struct hciemu *hciemu;
 
+	if (!num)
+		return NULL;
+
 	hciemu = new0(struct hciemu, 1);
 	if (!hciemu)
 		return NULL;
 
+	hciemu->index = HCIEMU_INDEX_NONE;
+
 	switch (type) {
 	case HCIEMU_TYPE_BREDRLE:
 		hciemu->btdev_type = BTDEV_TYPE_BREDRLE;
@@ -341,13 +489,17 @@ struct hciemu *hciemu_new(enum hciemu_type type)
 		return NULL;
 	}
 
+	hciemu->clients = queue_new();
+
 	if (!create_vhci(hciemu)) {
+		queue_destroy(hciemu->clients, NULL);
 		queue_destroy(hciemu->post_command_hooks, NULL);
 		free(hciemu);
 		return NULL;
 	}
 
-	if (!create_stack(hciemu)) {
+	if (!create_stack(hciemu, num)) {
+		queue_destroy(hciemu->clients, client_destroy);
 		g_source_remove(hciemu->master_source);
 		btdev_destroy(hciemu->master_dev);
 		queue_destroy(hciemu->post_command_hooks, NULL);
@@ -355,8 +507,6 @@ struct hciemu *hciemu_new(enum hciemu_type type)
 		return NULL;
 	}
 
-	g_idle_add(start_stack, hciemu);
-
 	return hciemu_ref(hciemu);
 }
 
@@ -378,19 +528,83 @@ void hciemu_unref(struct hciemu *hciemu)
 	if (__sync_sub_and_fetch(&hciemu->ref_count, 1))
 		return;
 
+	/* The registration may outlive the emulator, it just goes quiet */
+	if (hciemu->index_filter)
+		hciemu->index_filter->hciemu = NULL;
+
 	queue_destroy(hciemu->post_command_hooks, destroy_command_hook);
+	queue_destroy(hciemu->clients, client_destroy);
 
-	g_source_remove(hciemu->host_source);
-	g_source_remove(hciemu->client_source);
 	g_source_remove(hciemu->master_source);
-
-	bthost_destroy(hciemu->host_stack);
-	btdev_destroy(hciemu->client_dev);
 	btdev_destroy(hciemu->master_dev);
 
 	free(hciemu);
 }
 
+static bool has_index(struct hciemu *hciemu, uint16_t index)
+{
+	/* Older kernels do not report the index, so accept any of them */
+	if (hciemu->index == HCIEMU_INDEX_NONE)
+		return true;
+
+	return hciemu->index == index;
+}
+
+static void index_added_filter(uint16_t index, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct index_filter *filter = user_data;
+
+	if (!filter->hciemu || !has_index(filter->hciemu, index))
+		return;
+
+	filter->func(index, length, param, filter->user_data);
+}
+
+static void index_filter_free(void *user_data)
+{
+	struct index_filter *filter = user_data;
+
+	if (filter->hciemu)
+		filter->hciemu->index_filter = NULL;
+
+	free(filter);
+}
+
+/*
+ * Tester workers run several tests at the same time and every test creates
+ * its own controllers, so Index Added events show up for controllers that
+ * belong to other tests as well. Only the ones of this emulator are passed
+ * on to the callback.
+ */
+unsigned int hciemu_register_index_added(struct hciemu *hciemu,
+					struct mgmt *mgmt,
+					hciemu_index_func_t func,
+					void *user_data)
+{
+	struct index_filter *filter;
+	unsigned int id;
+
+	if (!hciemu || !mgmt || !func || hciemu->index_filter)
+		return 0;
+
+	filter = new0(struct index_filter, 1);
+	filter->hciemu = hciemu;
+	filter->func = func;
+	filter->user_data = user_data;
+
+	id = mgmt_register(mgmt, MGMT_EV_INDEX_ADDED, MGMT_INDEX_NONE,
+				index_added_filter, filter, index_filter_free);
+	if (!id) {
+		free(filter);
+		return 0;
+	}
+
+	hciemu->index_filter = filter;
+
+	return id;
+}
+
 const char *hciemu_get_address(struct hciemu *hciemu)
 {
 	const uint8_t *addr;
@@ -422,10 +636,7 @@ const uint8_t *hciemu_get_master_bdaddr(struct hciemu *hciemu)
 
 const uint8_t *hciemu_get_client_bdaddr(struct hciemu *hciemu)
 {
-	if (!hciemu || !hciemu->client_dev)
-		return NULL;
-
-	return btdev_get_bdaddr(hciemu->client_dev);
+	return hciemu_client_bdaddr(hciemu_get_client(hciemu, 0));
 }
 
 uint8_t hciemu_get_master_scan_enable(struct hciemu *hciemu)
@@ -436,6 +647,28 @@ uint8_t hciemu_get_master_scan_enable(struct hciemu *hciemu)
 	return btdev_get_scan_enable(hciemu->master_dev);
 }
 
+bool hciemu_set_link_model(struct hciemu *hciemu,
+				const struct btdev_link_model *model)
+{
+	const struct queue_entry *entry;
+
+	if (!hciemu)
+		return false;
+
+	if (!btdev_set_link_model(hciemu->master_dev, model))
+		return false;
+
+	for (entry = queue_get_entries(hciemu->clients); entry;
+							entry = entry->next) {
+		struct hciemu_client *client = entry->data;
+
+		if (!btdev_set_link_model(client->dev, model))
+			return false;
+	}
+
+	return true;
+}
+
 uint8_t hciemu_get_master_le_scan_enable(struct hciemu *hciemu)
 {
 	if (!hciemu || !hciemu->master_dev)
@@ -24,7 +24,12 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define HCIEMU_INDEX_NONE	0xffff
+
 struct hciemu;
+struct hciemu_client;
+struct btdev_link_model;
+struct mgmt;
 
 enum hciemu_type {
 	HCIEMU_TYPE_BREDRLE,
@@ -41,12 +46,25 @@ enum hciemu_hook_type {
 };
 
 struct hciemu *hciemu_new(enum hciemu_type type);
+struct hciemu *hciemu_new_num(enum hciemu_type type, uint8_t num);
 
 struct hciemu *hciemu_ref(struct hciemu *hciemu);
 void hciemu_unref(struct hciemu *hciemu);
 
+struct hciemu_client *hciemu_get_client(struct hciemu *hciemu, int num);
+struct bthost *hciemu_client_host(struct hciemu_client *client);
+const uint8_t *hciemu_client_bdaddr(struct hciemu_client *client);
+
 struct bthost *hciemu_client_get_host(struct hciemu *hciemu);
 
+typedef void (*hciemu_index_func_t)(uint16_t index, uint16_t length,
+					const void *param, void *user_data);
+
+unsigned int hciemu_register_index_added(struct hciemu *hciemu,
+					struct mgmt *mgmt,
+					hciemu_index_func_t func,
+					void *user_data);
+
 const char *hciemu_get_address(struct hciemu *hciemu);
 uint8_t *hciemu_get_features(struct hciemu *hciemu);
 
@@ -55,6 +73,9 @@ const uint8_t *hciemu_get_client_bdaddr(struct hciemu *hciemu);
 
 uint8_t hciemu_get_master_scan_enable(struct hciemu *hciemu);
 
+bool hciemu_set_link_model(struct hciemu *hciemu,
+				const struct btdev_link_model *model);
+
 uint8_t hciemu_get_master_le_scan_enable(struct hciemu *hciemu);
 
 typedef void (*hciemu_command_func_t)(uint16_t opcode, const void *data,
@@ -29,12 +29,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <getopt.h>
+#include <sys/uio.h>
 
 #include "src/shared/mainloop.h"
 #include "serial.h"
 #include "server.h"
+#include "btdev.h"
+#include "advpop.h"
 #include "vhci.h"
+#include "shard.h"
 #include "amp.h"
 #include "le.h"
 
@@ -48,6 +53,156 @@ static void signal_callback(int signum, void *user_data)
 	}
 }
 
+struct vhci_setup {
+	enum vhci_type type;
+	const struct btdev_link_model *link_model;
+	const struct advpop_config *adv_config;
+	struct advpop_config adv_data;
+};
+
+static bool setup_vhci(const struct vhci_setup *setup)
+{
+	struct vhci *vhci;
+
+	vhci = vhci_open(setup->type);
+	if (!vhci) {
+		fprintf(stderr, "Failed to open Virtual HCI device\n");
+		return false;
+	}
+
+	if (setup->link_model)
+		vhci_set_link_model(vhci, setup->link_model);
+
+	if (setup->adv_config && !vhci_set_advertisers(vhci, setup->adv_config))
+		fprintf(stderr, "Failed to add advertisers\n");
+
+	return true;
+}
+
+static void shard_setup_vhci(void *user_data)
+{
+	struct vhci_setup *setup = user_data;
+
+	setup_vhci(setup);
+	free(setup);
+}
+
+static bool parse_link_model(char *str, struct btdev_link_model *model)
+{
+	char *opt;
+
+	memset(model, 0, sizeof(*model));
+
+	for (opt = strtok(str, ","); opt; opt = strtok(NULL, ",")) {
+		unsigned long val;
+		char *ptr, *end;
+
+		if (!strcmp(opt, "batch")) {
+			model->batch_ncp = true;
+			continue;
+		}
+
+		ptr = strchr(opt, '=');
+		if (!ptr)
+			return false;
+
+		*ptr++ = '\0';
+
+		val = strtoul(ptr, &end, 10);
+		if (!*ptr || *end)
+			return false;
+
+		if (!strcmp(opt, "bredr"))
+			model->bredr_rate = val * 1000;
+		else if (!strcmp(opt, "le"))
+			model->le_rate = val * 1000;
+		else if (!strcmp(opt, "interval") && val <= UINT16_MAX)
+			model->interval = val;
+		else if (!strcmp(opt, "packets") && val <= UINT8_MAX)
+			model->event_pkts = val;
+		else if (!strcmp(opt, "buffers") && val && val <= UINT16_MAX)
+			model->acl_max_pkt = val;
+		else if (!strcmp(opt, "lebuffers") && val && val <= UINT8_MAX)
+			model->le_max_pkt = val;
+		else
+			return false;
+	}
+
+	return true;
+}
+
+static bool parse_advertisers(char *str, struct advpop_config *config)
+{
+	char *opt;
+
+	memset(config, 0, sizeof(*config));
+
+	for (opt = strtok(str, ","); opt; opt = strtok(NULL, ",")) {
+		long val;
+		char *ptr, *end;
+
+		if (!strcmp(opt, "public")) {
+			config->addr_types |= ADVPOP_ADDR_PUBLIC;
+			continue;
+		}
+
+		if (!strcmp(opt, "static")) {
+			config->addr_types |= ADVPOP_ADDR_STATIC;
+			continue;
+		}
+
+		if (!strcmp(opt, "rpa")) {
+			config->addr_types |= ADVPOP_ADDR_RPA;
+			continue;
+		}
+
+		ptr = strchr(opt, '=');
+		if (!ptr)
+			return false;
+
+		*ptr++ = '\0';
+
+		val = strtol(ptr, &end, 10);
+		if (!*ptr || *end)
+			return false;
+
+		if (!strcmp(opt, "count") && val > 0)
+			config->count = val;
+		else if (!strcmp(opt, "min") && val > 0 && val <= UINT16_MAX)
+			config->min_interval = val;
+		else if (!strcmp(opt, "max") && val > 0 && val <= UINT16_MAX)
+			config->max_interval = val;
+		else if (!strcmp(opt, "rssi_min") && val >= -127 && val <= 20)
+			config->rssi_min = val;
+		else if (!strcmp(opt, "rssi_max") && val >= -127 && val <= 20)
+			config->rssi_max = val;
+		else if (!strcmp(opt, "rotate") && val >= 0)
+			config->rpa_timeout = val;
+		else if (!strcmp(opt, "batch") && val > 0 && val <= UINT8_MAX)
+			config->reports_per_event = val;
+		else if (!strcmp(opt, "seed") && val >= 0)
+			config->seed = val;
+		else
+			return false;
+	}
+
+	return config->count > 0;
+}
+
+static bool parse_threads(const char *str, int *count)
+{
+	long val;
+	char *end;
+
+	val = strtol(str, &end, 10);
+	if (!*str || *end || val < 1 || val > UINT8_MAX)
+		return false;
+
+	*count = val;
+
+	return true;
+}
+
 static void usage(void)
 {
 	printf("btvirt - Bluetooth emulator\n"
@@ -60,7 +215,28 @@ static void usage(void)
 		"\t-L                    Create LE only controller\n"
 		"\t-B                    Create BR/EDR only controller\n"
 		"\t-A                    Create AMP controller\n"
+		"\t-M, --model <params>  Link model for local controllers\n"
+		"\t-a, --advertisers <params>\n"
+		"\t                      Virtual advertisers for local controllers\n"
+		"\t-t, --threads <num>   Spread local controllers over threads\n"
 		"\t-h, --help            Show help options\n");
+	printf("link model parameters (comma separated):\n"
+		"\tbredr=<kbit/s>        BR/EDR bitrate\n"
+		"\tle=<kbit/s>           LE bitrate\n"
+		"\tinterval=<ms>         Connection event interval\n"
+		"\tpackets=<num>         Packets per connection event\n"
+		"\tbuffers=<num>         Controller ACL buffers\n"
+		"\tlebuffers=<num>       Controller LE buffers\n"
+		"\tbatch                 Batch completed packets events\n");
+	printf("advertiser parameters (comma separated):\n"
+		"\tcount=<num>           Number of advertisers\n"
+		"\tpublic,static,rpa     Address types to use\n"
+		"\trotate=<s>            RPA rotation period\n"
+		"\tmin=<ms>,max=<ms>     Advertising interval range\n"
+		"\trssi_min=<dBm>        Lowest RSSI\n"
+		"\trssi_max=<dBm>        Highest RSSI\n"
+		"\tbatch=<num>           Reports per event\n"
+		"\tseed=<num>            Random seed\n");
 }
 
 static const struct option main_options[] = {
@@ -70,6 +246,9 @@ static const struct option main_options[] = {
 	{ "le",      no_argument,       NULL, 'L' },
 	{ "bredr",   no_argument,       NULL, 'B' },
 	{ "amp",     no_argument,       NULL, 'A' },
+	{ "model",   required_argument, NULL, 'M' },
+	{ "advertisers", required_argument, NULL, 'a' },
+	{ "threads", required_argument, NULL, 't' },
 	{ "letest",  optional_argument, NULL, 'U' },
 	{ "amptest", optional_argument, NULL, 'T' },
 	{ "version", no_argument,	NULL, 'v' },
@@ -90,6 +269,13 @@ int main(int argc, char *argv[])
 	int amptest_count = 0;
 	int vhci_count = 0;
 	enum vhci_type vhci_type = VHCI_TYPE_BREDRLE;
+	struct btdev_link_model link_model;
+	bool link_model_enabled = false;
+	struct advpop_config adv_config;
+	bool advertisers_enabled = false;
+	struct shard **shards = NULL;
+	int thread_count = 0;
+	int exit_status;
 	sigset_t mask;
 	int i;
 
@@ -98,7 +284,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "Ssl::LBAUTvh",
+		opt = getopt_long(argc, argv, "Ssl::LBAM:a:t:UTvh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -125,6 +311,26 @@ int main(int argc, char *argv[])
 		case 'A':
 			vhci_type = VHCI_TYPE_AMP;
 			break;
+		case 'M':
+			if (!parse_link_model(optarg, &link_model)) {
+				fprintf(stderr, "Invalid link model\n");
+				return EXIT_FAILURE;
+			}
+			link_model_enabled = true;
+			break;
+		case 'a':
+			if (!parse_advertisers(optarg, &adv_config)) {
+				fprintf(stderr, "Invalid advertisers\n");
+				return EXIT_FAILURE;
+			}
+			advertisers_enabled = true;
+			break;
+		case 't':
+			if (!parse_threads(optarg, &thread_count)) {
+				fprintf(stderr, "Invalid number of threads\n");
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'U':
 			if (optarg)
 				letest_count = atoi(optarg);
@@ -182,14 +388,61 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	for (i = 0; i < vhci_count; i++) {
-		struct vhci *vhci;
+	if (thread_count > vhci_count)
+		thread_count = vhci_count;
 
-		vhci = vhci_open(vhci_type);
-		if (!vhci) {
-			fprintf(stderr, "Failed to open Virtual HCI device\n");
+	if (thread_count > 0) {
+		shards = calloc(thread_count, sizeof(*shards));
+		if (!shards)
 			return EXIT_FAILURE;
+
+		for (i = 0; i < thread_count; i++) {
+			shards[i] = shard_new();
+			if (!shards[i]) {
+				fprintf(stderr, "Failed to start thread\n");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	for (i = 0; i < vhci_count; i++) {
+		struct vhci_setup setup, *copy;
+
+		memset(&setup, 0, sizeof(setup));
+		setup.type = vhci_type;
+
+		if (link_model_enabled)
+			setup.link_model = &link_model;
+
+		if (advertisers_enabled) {
+			/* Keep the populations of several controllers apart */
+			setup.adv_data = adv_config;
+			setup.adv_data.seed += i;
+			setup.adv_config = &setup.adv_data;
+		}
+
+		if (!shards) {
+			if (!setup_vhci(&setup))
+				return EXIT_FAILURE;
+			continue;
 		}
+
+		/*
+		 * Links between threads take a hop through the owner's
+		 * queue, so keep neighbouring controllers together and hand
+		 * each thread a range.
+		 */
+		copy = malloc(sizeof(*copy));
+		if (!copy)
+			return EXIT_FAILURE;
+
+		*copy = setup;
+
+		if (copy->adv_config)
+			copy->adv_config = &copy->adv_data;
+
+		shard_post(shards[i * thread_count / vhci_count],
+						shard_setup_vhci, copy);
 	}
 
 	if (serial_enabled) {
@@ -227,5 +480,12 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "Failed to open monitor server\n");
 	}
 
-	return mainloop_run();
+	exit_status = mainloop_run();
+
+	for (i = 0; i < thread_count; i++)
+		shard_free(shards[i]);
+
+	free(shards);
+
+	return exit_status;
 }
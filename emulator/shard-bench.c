@@ -0,0 +1,520 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "lib/bluetooth.h"
+#include "lib/hci.h"
+#include "monitor/bt.h"
+#include "src/shared/util.h"
+#include "src/shared/mainloop.h"
+#include "btdev.h"
+#include "shard.h"
+
+#define ACL_DATA_LEN	27
+#define MAX_IN_FLIGHT	64
+
+struct bench_link {
+	struct bench *bench;
+	struct bench *peer;
+	struct btdev *central;
+	struct btdev *peripheral;
+	uint16_t handle;
+	int in_flight;
+	uint64_t packets;
+};
+
+/*
+ * Every shard drives the centrals of its links, the peripherals either live
+ * on the same shard or on the next one. An eventfd that is never drained
+ * keeps the loop busy sending ACL packets, so the loop overhead is part of
+ * the measurement.
+ */
+struct bench {
+	struct shard *shard;
+	struct bench_link *links;
+	unsigned int num_links;
+	int pump_fd;
+};
+
+static struct bench *benches;
+static int num_benches;
+
+static volatile int running;
+static int ready;
+static int failed;
+
+static int option_controllers = 64;
+static int option_threads;
+static int option_duration = 3;
+
+static void send_cmd(struct btdev *btdev, uint16_t opcode, const void *param,
+								uint8_t len)
+{
+	uint8_t buf[4 + 255];
+
+	buf[0] = BT_H4_CMD_PKT;
+	put_le16(opcode, buf + 1);
+	buf[3] = len;
+	memcpy(buf + 4, param, len);
+
+	btdev_receive_h4(btdev, buf, 4 + len);
+}
+
+static void central_send(const struct iovec *iov, int iovlen, void *user_data)
+{
+	struct bench_link *link = user_data;
+	const struct bt_hci_evt_hdr *hdr;
+	const struct bt_hci_evt_le_conn_complete *evt;
+	const uint8_t *data;
+
+	/* Indicator, header and parameters come in separate vectors */
+	if (iovlen < 3 || *((uint8_t *) iov[0].iov_base) != BT_H4_EVT_PKT)
+		return;
+
+	hdr = iov[1].iov_base;
+	if (hdr->evt != BT_HCI_EVT_LE_META_EVENT)
+		return;
+
+	data = iov[2].iov_base;
+	if (data[0] != BT_HCI_EVT_LE_CONN_COMPLETE)
+		return;
+
+	evt = (const void *) (data + 1);
+	if (!evt->status)
+		link->handle = le16_to_cpu(evt->handle);
+}
+
+static void peripheral_receive(struct bench_link *link, uint8_t type)
+{
+	if (type == BT_H4_ACL_PKT && __sync_fetch_and_add(&running, 0))
+		link->packets++;
+}
+
+static void peripheral_send(const struct iovec *iov, int iovlen,
+							void *user_data)
+{
+	const uint8_t *pkt = iov[0].iov_base;
+
+	peripheral_receive(user_data, pkt[0]);
+}
+
+static void peripheral_deliver(const void *data, size_t len,
+							void *user_data)
+{
+	struct bench_link *link = user_data;
+	const uint8_t *pkt = data;
+
+	if (pkt[0] == BT_H4_ACL_PKT)
+		__sync_fetch_and_sub(&link->in_flight, 1);
+
+	peripheral_receive(link, pkt[0]);
+}
+
+static void peripheral_post(const struct iovec *iov, int iovlen,
+							void *user_data)
+{
+	struct bench_link *link = user_data;
+	const uint8_t *pkt = iov[0].iov_base;
+
+	if (pkt[0] == BT_H4_ACL_PKT)
+		__sync_fetch_and_add(&link->in_flight, 1);
+
+	if (!shard_post_data(link->peer->shard, peripheral_deliver, iov,
+							iovlen, link) &&
+						pkt[0] == BT_H4_ACL_PKT)
+		__sync_fetch_and_sub(&link->in_flight, 1);
+}
+
+static void pump_callback(int fd, uint32_t events, void *user_data)
+{
+	struct bench *bench = user_data;
+	uint8_t buf[5 + ACL_DATA_LEN];
+	unsigned int i, sent = 0;
+
+	memset(buf, 0, sizeof(buf));
+	buf[0] = BT_H4_ACL_PKT;
+	put_le16(ACL_DATA_LEN, buf + 3);
+
+	for (i = 0; i < bench->num_links; i++) {
+		struct bench_link *link = &bench->links[i];
+
+		/* Like a host out of buffers, wait for the other shard */
+		if (__sync_fetch_and_add(&link->in_flight, 0) >= MAX_IN_FLIGHT)
+			continue;
+
+		put_le16(link->handle | 0x2000, buf + 1);
+		btdev_receive_h4(link->central, buf, sizeof(buf));
+		sent++;
+	}
+
+	/* Spinning would only keep the receiving shards from running */
+	if (!sent)
+		sched_yield();
+}
+
+static void setup_done(bool success)
+{
+	if (!success)
+		__sync_fetch_and_add(&failed, 1);
+
+	__sync_fetch_and_add(&ready, 1);
+}
+
+/* Runs a step on every shard and waits for all of them to finish it */
+static bool run_step(shard_func_t func)
+{
+	int i;
+
+	ready = 0;
+
+	for (i = 0; i < num_benches; i++) {
+		if (!shard_post(benches[i].shard, func, &benches[i]))
+			setup_done(false);
+	}
+
+	while (__sync_fetch_and_add(&ready, 0) < num_benches)
+		usleep(1000);
+
+	return __sync_fetch_and_add(&failed, 0) == 0;
+}
+
+static void create_devices(void *user_data)
+{
+	struct bench *bench = user_data;
+	uint8_t enable = 0x01;
+	bool success = true;
+	int i;
+	unsigned int j;
+
+	for (j = 0; j < bench->num_links; j++) {
+		struct bench_link *link = &bench->links[j];
+
+		link->central = btdev_create(BTDEV_TYPE_LE, 0x00);
+		if (!link->central) {
+			success = false;
+			goto done;
+		}
+
+		btdev_set_send_handler(link->central, central_send, link);
+	}
+
+	/* Peripherals are owned by the shard that receives their packets */
+	for (i = 0; i < num_benches; i++) {
+		for (j = 0; j < benches[i].num_links; j++) {
+			struct bench_link *link = &benches[i].links[j];
+
+			if (link->peer != bench)
+				continue;
+
+			link->peripheral = btdev_create(BTDEV_TYPE_LE, 0x01);
+			if (!link->peripheral) {
+				success = false;
+				goto done;
+			}
+
+			btdev_set_send_handler(link->peripheral,
+						peripheral_send, link);
+			btdev_set_post_handler(link->peripheral,
+						peripheral_post, link);
+
+			send_cmd(link->peripheral,
+					BT_HCI_CMD_LE_SET_ADV_ENABLE,
+					&enable, 1);
+		}
+	}
+
+done:
+	setup_done(success);
+}
+
+static void connect_links(void *user_data)
+{
+	struct bench *bench = user_data;
+	struct bt_hci_cmd_le_create_conn cmd;
+	bool success = true;
+	unsigned int i;
+
+	for (i = 0; i < bench->num_links; i++) {
+		struct bench_link *link = &bench->links[i];
+
+		memset(&cmd, 0, sizeof(cmd));
+		memcpy(cmd.peer_addr, btdev_get_bdaddr(link->peripheral), 6);
+		send_cmd(link->central, BT_HCI_CMD_LE_CREATE_CONN, &cmd,
+								sizeof(cmd));
+
+		if (!link->handle) {
+			success = false;
+			goto done;
+		}
+	}
+
+	bench->pump_fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (bench->pump_fd < 0) {
+		success = false;
+		goto done;
+	}
+
+	if (mainloop_add_fd(bench->pump_fd, EPOLLIN, pump_callback,
+							bench, NULL) < 0)
+		success = false;
+
+done:
+	setup_done(success);
+}
+
+static void stop_pump(void *user_data)
+{
+	struct bench *bench = user_data;
+
+	if (bench->pump_fd >= 0) {
+		mainloop_remove_fd(bench->pump_fd);
+		close(bench->pump_fd);
+		bench->pump_fd = -1;
+	}
+
+	setup_done(true);
+}
+
+/* Only needs to run after the packets that were queued before it */
+static void drain_queue(void *user_data)
+{
+	setup_done(true);
+}
+
+static void destroy_centrals(void *user_data)
+{
+	struct bench *bench = user_data;
+	unsigned int i;
+
+	for (i = 0; i < bench->num_links; i++)
+		btdev_destroy(bench->links[i].central);
+
+	setup_done(true);
+}
+
+static void destroy_peripherals(void *user_data)
+{
+	struct bench *bench = user_data;
+	int i;
+	unsigned int j;
+
+	for (i = 0; i < num_benches; i++) {
+		for (j = 0; j < benches[i].num_links; j++) {
+			struct bench_link *link = &benches[i].links[j];
+
+			if (link->peer == bench)
+				btdev_destroy(link->peripheral);
+		}
+	}
+
+	setup_done(true);
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run_bench(int num_threads, bool cross)
+{
+	int num_links = option_controllers / 2;
+	uint64_t packets = 0;
+	double start, elapsed = -1;
+	bool started;
+	unsigned int j;
+	int i;
+
+	benches = calloc(num_threads, sizeof(*benches));
+	if (!benches)
+		return -1;
+
+	num_benches = num_threads;
+	failed = 0;
+
+	for (i = 0; i < num_threads; i++) {
+		struct bench *bench = &benches[i];
+
+		/* Spread the links as evenly as possible over the shards */
+		bench->num_links = num_links * (i + 1) / num_threads -
+						num_links * i / num_threads;
+		bench->links = calloc(bench->num_links, sizeof(*bench->links));
+		bench->pump_fd = -1;
+
+		for (j = 0; j < bench->num_links; j++) {
+			bench->links[j].bench = bench;
+			bench->links[j].peer = cross ?
+					&benches[(i + 1) % num_threads] : bench;
+		}
+
+		bench->shard = shard_new();
+		if (!bench->links || !bench->shard)
+			failed++;
+	}
+
+	started = !failed;
+
+	if (!started || !run_step(create_devices) ||
+						!run_step(connect_links))
+		goto done;
+
+	start = get_time();
+	__sync_lock_test_and_set(&running, 1);
+
+	sleep(option_duration);
+
+	__sync_lock_test_and_set(&running, 0);
+	elapsed = get_time() - start;
+
+done:
+	/* Packets still queued for other shards need their devices */
+	if (started) {
+		run_step(stop_pump);
+		run_step(drain_queue);
+		run_step(destroy_centrals);
+		run_step(destroy_peripherals);
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		/* Joining the thread makes its counters visible */
+		shard_free(benches[i].shard);
+
+		for (j = 0; j < benches[i].num_links; j++)
+			packets += benches[i].links[j].packets;
+
+		free(benches[i].links);
+	}
+
+	free(benches);
+	benches = NULL;
+	num_benches = 0;
+
+	if (elapsed < 0)
+		return -1;
+
+	return packets / elapsed;
+}
+
+static void usage(void)
+{
+	printf("shard-bench - Emulator thread scaling benchmark\n"
+		"Usage:\n");
+	printf("\tshard-bench [options]\n");
+	printf("options:\n"
+		"\t-c, --controllers <num>  Number of controllers (default 64)\n"
+		"\t-t, --threads <num>      Maximum number of threads\n"
+		"\t-d, --duration <sec>     Duration of each run (default 3)\n"
+		"\t-h, --help               Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "controllers", required_argument, NULL, 'c' },
+	{ "threads",     required_argument, NULL, 't' },
+	{ "duration",    required_argument, NULL, 'd' },
+	{ "help",        no_argument,       NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	double base = 0;
+	int i;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "c:t:d:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'c':
+			option_controllers = atoi(optarg);
+			break;
+		case 't':
+			option_threads = atoi(optarg);
+			break;
+		case 'd':
+			option_duration = atoi(optarg);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!option_threads)
+		option_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (option_controllers < 2 || option_threads < 1 ||
+						option_duration < 1) {
+		fprintf(stderr, "Invalid parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	if (option_threads > option_controllers / 2)
+		option_threads = option_controllers / 2;
+
+	printf("%d controllers, %d s per run\n", option_controllers,
+							option_duration);
+	printf("Threads  Local pkt/s   Speedup  Cross pkt/s   Speedup\n");
+
+	for (i = 1; i <= option_threads; i++) {
+		double local = run_bench(i, false);
+		double cross = run_bench(i, true);
+
+		if (local < 0 || cross < 0) {
+			fprintf(stderr, "Failed to setup controllers\n");
+			return EXIT_FAILURE;
+		}
+
+		if (i == 1)
+			base = local;
+
+		printf("%7d  %11.0f  %6.2fx  %11.0f  %6.2fx\n", i, local,
+					base > 0 ? local / base : 0, cross,
+					base > 0 ? cross / base : 0);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,272 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "src/shared/mainloop.h"
+#include "shard.h"
+
+struct shard_task {
+	struct shard_task *next;
+	shard_func_t func;
+	shard_data_func_t data_func;
+	void *user_data;
+	size_t len;
+	uint8_t data[0];
+};
+
+/*
+ * A shard is a thread running its own mainloop. Any number of threads hand
+ * work to it through a lock-free list of tasks and wake it up via an
+ * eventfd, which is only written when the list was empty so that a burst
+ * of packets costs a single wakeup.
+ */
+struct shard {
+	pthread_t thread;
+	int event_fd;
+	struct shard_task *tasks;
+	struct shard_task quit;
+};
+
+static __thread struct shard *current_shard;
+
+static void push_task(struct shard *shard, struct shard_task *task)
+{
+	struct shard_task *head;
+	uint64_t count = 1;
+
+	/* Once pushed the task belongs to the shard, so only look at head */
+	do {
+		head = shard->tasks;
+		task->next = head;
+	} while (!__sync_bool_compare_and_swap(&shard->tasks, head, task));
+
+	/* A non-empty list means the shard has been woken up already */
+	if (head)
+		return;
+
+	/* Only fails when the counter overflows, which still wakes up */
+	if (write(shard->event_fd, &count, sizeof(count)) < 0)
+		return;
+}
+
+static void free_task(struct shard *shard, struct shard_task *task)
+{
+	if (task != &shard->quit)
+		free(task);
+}
+
+static struct shard_task *take_tasks(struct shard *shard)
+{
+	struct shard_task *list, *fifo = NULL;
+
+	list = __sync_lock_test_and_set(&shard->tasks, NULL);
+
+	/* Tasks are pushed at the head, so reverse them into posting order */
+	while (list) {
+		struct shard_task *next = list->next;
+
+		list->next = fifo;
+		fifo = list;
+		list = next;
+	}
+
+	return fifo;
+}
+
+static void event_callback(int fd, uint32_t events, void *user_data)
+{
+	struct shard *shard = user_data;
+	struct shard_task *task;
+	uint64_t count;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		mainloop_quit();
+		return;
+	}
+
+	if (read(fd, &count, sizeof(count)) < 0)
+		return;
+
+	task = take_tasks(shard);
+
+	while (task) {
+		struct shard_task *next = task->next;
+
+		if (task->data_func)
+			task->data_func(task->data, task->len,
+							task->user_data);
+		else
+			task->func(task->user_data);
+
+		free_task(shard, task);
+
+		task = next;
+	}
+}
+
+static void *shard_thread(void *user_data)
+{
+	struct shard *shard = user_data;
+	sigset_t mask;
+
+	/* Signals are left to the main thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	current_shard = shard;
+
+	mainloop_init();
+
+	if (mainloop_add_fd(shard->event_fd, EPOLLIN, event_callback,
+							shard, NULL) < 0)
+		return NULL;
+
+	mainloop_run();
+
+	return NULL;
+}
+
+static void quit_task(void *user_data)
+{
+	mainloop_quit();
+}
+
+struct shard *shard_new(void)
+{
+	struct shard *shard;
+
+	shard = calloc(1, sizeof(*shard));
+	if (!shard)
+		return NULL;
+
+	shard->quit.func = quit_task;
+
+	shard->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (shard->event_fd < 0) {
+		free(shard);
+		return NULL;
+	}
+
+	if (pthread_create(&shard->thread, NULL, shard_thread, shard)) {
+		close(shard->event_fd);
+		free(shard);
+		return NULL;
+	}
+
+	return shard;
+}
+
+void shard_free(struct shard *shard)
+{
+	struct shard_task *task;
+
+	if (!shard)
+		return;
+
+	push_task(shard, &shard->quit);
+	pthread_join(shard->thread, NULL);
+
+	/* Anything posted after the quit request is dropped */
+	task = take_tasks(shard);
+
+	while (task) {
+		struct shard_task *next = task->next;
+
+		free_task(shard, task);
+		task = next;
+	}
+
+	close(shard->event_fd);
+	free(shard);
+}
+
+struct shard *shard_self(void)
+{
+	return current_shard;
+}
+
+bool shard_post(struct shard *shard, shard_func_t func, void *user_data)
+{
+	struct shard_task *task;
+
+	if (!shard || !func)
+		return false;
+
+	task = calloc(1, sizeof(*task));
+	if (!task)
+		return false;
+
+	task->func = func;
+	task->user_data = user_data;
+
+	push_task(shard, task);
+
+	return true;
+}
+
+/* Copies the data, so the caller's buffers can be reused right away */
+bool shard_post_data(struct shard *shard, shard_data_func_t func,
+				const struct iovec *iov, int iovlen,
+				void *user_data)
+{
+	struct shard_task *task;
+	size_t len = 0;
+	int i;
+
+	if (!shard || !func)
+		return false;
+
+	for (i = 0; i < iovlen; i++)
+		len += iov[i].iov_len;
+
+	task = malloc(sizeof(*task) + len);
+	if (!task)
+		return false;
+
+	task->func = NULL;
+	task->data_func = func;
+	task->user_data = user_data;
+	task->len = 0;
+
+	for (i = 0; i < iovlen; i++) {
+		memcpy(task->data + task->len, iov[i].iov_base,
+							iov[i].iov_len);
+		task->len += iov[i].iov_len;
+	}
+
+	push_task(shard, task);
+
+	return true;
+}
@@ -0,0 +1,42 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+typedef void (*shard_func_t)(void *user_data);
+typedef void (*shard_data_func_t)(const void *data, size_t len,
+							void *user_data);
+
+struct shard;
+
+struct shard *shard_new(void);
+void shard_free(struct shard *shard);
+
+struct shard *shard_self(void);
+
+bool shard_post(struct shard *shard, shard_func_t func, void *user_data);
+bool shard_post_data(struct shard *shard, shard_data_func_t func,
+				const struct iovec *iov, int iovlen,
+				void *user_data);
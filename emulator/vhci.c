@@ -40,6 +40,8 @@
 #include "src/shared/mainloop.h"
 #include "monitor/bt.h"
 #include "btdev.h"
+#include "advpop.h"
+#include "shard.h"
 #include "vhci.h"
 
 #define uninitialized_var(x) x = x
@@ -48,12 +50,15 @@ struct vhci {
 	enum vhci_type type;
 	int fd;
 	struct btdev *btdev;
+	struct advpop *advpop;
+	struct shard *shard;
 };
 
 static void vhci_destroy(void *user_data)
 {
 	struct vhci *vhci = user_data;
 
+	advpop_free(vhci->advpop);
 	btdev_destroy(vhci->btdev);
 
 	close(vhci->fd);
@@ -72,6 +77,24 @@ static void vhci_write_callback(const struct iovec *iov, int iovlen,
 		return;
 }
 
+static void vhci_deliver(const void *data, size_t len, void *user_data)
+{
+	struct vhci *vhci = user_data;
+	ssize_t written;
+
+	written = write(vhci->fd, data, len);
+	if (written < 0)
+		return;
+}
+
+static void vhci_post_callback(const struct iovec *iov, int iovlen,
+							void *user_data)
+{
+	struct vhci *vhci = user_data;
+
+	shard_post_data(vhci->shard, vhci_deliver, iov, iovlen, vhci);
+}
+
 static void vhci_read_callback(int fd, uint32_t events, void *user_data)
 {
 	struct vhci *vhci = user_data;
@@ -100,6 +123,7 @@ struct vhci *vhci_open(enum vhci_type type)
 	enum btdev_type uninitialized_var(btdev_type);
 	unsigned char uninitialized_var(ctrl_type);
 	unsigned char setup_cmd[2];
+	/* Controllers can be opened from several threads */
 	static uint8_t id = 0x23;
 
 	switch (type) {
@@ -143,7 +167,8 @@ struct vhci *vhci_open(enum vhci_type type)
 		return NULL;
 	}
 
-	vhci->btdev = btdev_create(btdev_type, id++);
+	vhci->btdev = btdev_create(btdev_type,
+					__sync_fetch_and_add(&id, 1));
 	if (!vhci->btdev) {
 		close(vhci->fd);
 		free(vhci);
@@ -152,6 +177,11 @@ struct vhci *vhci_open(enum vhci_type type)
 
 	btdev_set_send_handler(vhci->btdev, vhci_write_callback, vhci);
 
+	/* Packets from links to other shards are written by this one */
+	vhci->shard = shard_self();
+	if (vhci->shard)
+		btdev_set_post_handler(vhci->btdev, vhci_post_callback, vhci);
+
 	if (mainloop_add_fd(vhci->fd, EPOLLIN, vhci_read_callback,
 						vhci, vhci_destroy) < 0) {
 		btdev_destroy(vhci->btdev);
@@ -163,6 +193,27 @@ struct vhci *vhci_open(enum vhci_type type)
 	return vhci;
 }
 
+bool vhci_set_link_model(struct vhci *vhci,
+				const struct btdev_link_model *model)
+{
+	if (!vhci)
+		return false;
+
+	return btdev_set_link_model(vhci->btdev, model);
+}
+
+bool vhci_set_advertisers(struct vhci *vhci,
+				const struct advpop_config *config)
+{
+	if (!vhci)
+		return false;
+
+	advpop_free(vhci->advpop);
+	vhci->advpop = advpop_new(vhci->btdev, config);
+
+	return vhci->advpop != NULL;
+}
+
 void vhci_close(struct vhci *vhci)
 {
 	if (!vhci)
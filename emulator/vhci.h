@@ -23,6 +23,7 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 
 enum vhci_type {
 	VHCI_TYPE_BREDRLE,
@@ -32,6 +33,13 @@ enum vhci_type {
 };
 
 struct vhci;
+struct btdev_link_model;
+struct advpop_config;
 
 struct vhci *vhci_open(enum vhci_type type);
 void vhci_close(struct vhci *vhci);
+
+bool vhci_set_link_model(struct vhci *vhci,
+				const struct btdev_link_model *model);
+bool vhci_set_advertisers(struct vhci *vhci,
+				const struct advpop_config *config);
@@ -46,6 +46,7 @@ typedef enum {
 typedef gssize (*GObexDataProducer) (void *buf, gsize len, gpointer user_data);
 typedef gboolean (*GObexDataConsumer) (const void *buf, gsize len,
 							gpointer user_data);
+typedef gssize (*GObexFdProducer) (int *fd, gsize len, gpointer user_data);
 
 #define G_OBEX_ERROR g_obex_error_quark()
 GQuark g_obex_error_quark(void);
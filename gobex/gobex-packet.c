@@ -49,7 +49,11 @@ struct _GObexPacket {
 	GSList *headers;
 
 	GObexDataProducer get_body;
+	GObexFdProducer get_body_fd;
 	gpointer get_body_data;
+
+	int body_fd;		/* Body data left in a file descriptor */
+	gsize body_fd_len;
 };
 
 GObexHeader *g_obex_packet_get_header(GObexPacket *pkt, guint8 id)
@@ -116,7 +120,7 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 {
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
-	if (pkt->get_body != NULL)
+	if (pkt->get_body != NULL || pkt->get_body_fd != NULL)
 		return FALSE;
 
 	pkt->get_body = func;
@@ -125,6 +129,38 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 	return TRUE;
 }
 
+/*
+ * The body bytes of packets using a file descriptor producer are not copied
+ * into the encode buffer: only the body header is encoded and the caller
+ * is expected to send g_obex_packet_get_body_fd() bytes from the current
+ * offset of the descriptor right after it. GObex sends them from its own
+ * duplicate of the descriptor, so the producer keeps ownership of the one
+ * it returns and may close it at any time.
+ */
+gboolean g_obex_packet_add_body_fd(GObexPacket *pkt, GObexFdProducer func,
+							gpointer user_data)
+{
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (pkt->get_body != NULL || pkt->get_body_fd != NULL)
+		return FALSE;
+
+	pkt->get_body_fd = func;
+	pkt->get_body_data = user_data;
+
+	return TRUE;
+}
+
+gsize g_obex_packet_get_body_fd(GObexPacket *pkt, int *fd)
+{
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (fd)
+		*fd = pkt->body_fd;
+
+	return pkt->body_fd_len;
+}
+
 gboolean g_obex_packet_add_unicode(GObexPacket *pkt, guint8 id,
 							const char *str)
 {
@@ -241,6 +277,7 @@ GObexPacket *g_obex_packet_new_valist(guint8 opcode, gboolean final,
 	pkt->headers = g_obex_header_create_list(first_hdr_id, args,
 								&pkt->hlen);
 	pkt->data_policy = G_OBEX_DATA_COPY;
+	pkt->body_fd = -1;
 
 	return pkt;
 }
@@ -404,6 +441,36 @@ static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
 	return ret;
 }
 
+static gssize get_body_fd(GObexPacket *pkt, guint8 *buf, gsize len)
+{
+	guint16 u16;
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	pkt->body_fd = -1;
+	pkt->body_fd_len = 0;
+
+	if (len < 3)
+		return -ENOBUFS;
+
+	ret = pkt->get_body_fd(&pkt->body_fd, len - 3, pkt->get_body_data);
+	if (ret < 0)
+		return ret;
+
+	if (ret > 0)
+		buf[0] = G_OBEX_HDR_BODY;
+	else
+		buf[0] = G_OBEX_HDR_BODY_END;
+
+	u16 = g_htons(ret + 3);
+	memcpy(&buf[1], &u16, sizeof(u16));
+
+	pkt->body_fd_len = ret;
+
+	return ret;
+}
+
 gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 {
 	gssize ret;
@@ -442,8 +509,11 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 		count += ret;
 	}
 
-	if (pkt->get_body) {
-		ret = get_body(pkt, buf + count, len - count);
+	if (pkt->get_body || pkt->get_body_fd) {
+		if (pkt->get_body)
+			ret = get_body(pkt, buf + count, len - count);
+		else
+			ret = get_body_fd(pkt, buf + count, len - count);
 		if (ret < 0)
 			return ret;
 		if (ret == 0) {
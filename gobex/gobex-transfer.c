@@ -50,6 +50,7 @@ struct transfer {
 	guint abort_id;
 
 	GObexDataProducer data_producer;
+	GObexFdProducer fd_producer;
 	GObexDataConsumer data_consumer;
 	GObexFunc complete_func;
 
@@ -125,15 +126,13 @@ static void transfer_abort_response(GObex *obex, GError *err, GObexPacket *rsp,
 	g_error_free(err);
 }
 
+static void put_add_body(struct transfer *transfer, GObexPacket *req);
 
-static gssize put_get_data(void *buf, gsize len, gpointer user_data)
+static gssize put_get_result(struct transfer *transfer, gssize ret)
 {
-	struct transfer *transfer = user_data;
 	GObexPacket *req;
 	GError *err = NULL;
-	gssize ret;
 
-	ret = transfer->data_producer(buf, len, transfer->user_data);
 	if (ret == 0 || ret == -EAGAIN)
 		return ret;
 
@@ -145,7 +144,7 @@ static gssize put_get_data(void *buf, gsize len, gpointer user_data)
 		/* Generate next packet */
 		req = g_obex_packet_new(transfer->opcode, FALSE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(req, put_get_data, transfer);
+		put_add_body(transfer, req);
 		transfer->req_id = g_obex_send_req(transfer->obex, req, -1,
 						transfer_response, transfer,
 						&err);
@@ -163,6 +162,34 @@ done:
 	return ret;
 }
 
+static gssize put_get_data(void *buf, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	ret = transfer->data_producer(buf, len, transfer->user_data);
+
+	return put_get_result(transfer, ret);
+}
+
+static gssize put_get_fd(int *fd, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	ret = transfer->fd_producer(fd, len, transfer->user_data);
+
+	return put_get_result(transfer, ret);
+}
+
+static void put_add_body(struct transfer *transfer, GObexPacket *req)
+{
+	if (transfer->fd_producer)
+		g_obex_packet_add_body_fd(req, put_get_fd, transfer);
+	else
+		g_obex_packet_add_body(req, put_get_data, transfer);
+}
+
 static gboolean handle_get_body(struct transfer *transfer, GObexPacket *rsp,
 								GError **err)
 {
@@ -225,7 +252,7 @@ static void transfer_response(GObex *obex, GError *err, GObexPacket *rsp,
 	if (transfer->opcode == G_OBEX_OP_PUT) {
 		req = g_obex_packet_new(transfer->opcode, FALSE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(req, put_get_data, transfer);
+		put_add_body(transfer, req);
 	} else if (!g_obex_srm_active(transfer->obex)) {
 		req = g_obex_packet_new(transfer->opcode, TRUE,
 							G_OBEX_HDR_INVALID);
@@ -266,9 +293,10 @@ static struct transfer *transfer_new(GObex *obex, guint8 opcode,
 	return transfer;
 }
 
-guint g_obex_put_req_pkt(GObex *obex, GObexPacket *req,
-			GObexDataProducer data_func, GObexFunc complete_func,
-			gpointer user_data, GError **err)
+static guint put_req_pkt(GObex *obex, GObexPacket *req,
+			GObexDataProducer data_func, GObexFdProducer fd_func,
+			GObexFunc complete_func, gpointer user_data,
+			GError **err)
 {
 	struct transfer *transfer;
 
@@ -279,8 +307,9 @@ guint g_obex_put_req_pkt(GObex *obex, GObexPacket *req,
 
 	transfer = transfer_new(obex, G_OBEX_OP_PUT, complete_func, user_data);
 	transfer->data_producer = data_func;
+	transfer->fd_producer = fd_func;
 
-	g_obex_packet_add_body(req, put_get_data, transfer);
+	put_add_body(transfer, req);
 
 	transfer->req_id = g_obex_send_req(obex, req, FIRST_PACKET_TIMEOUT,
 					transfer_response, transfer, err);
@@ -294,6 +323,26 @@ guint g_obex_put_req_pkt(GObex *obex, GObexPacket *req,
 	return transfer->id;
 }
 
+guint g_obex_put_req_pkt(GObex *obex, GObexPacket *req,
+			GObexDataProducer data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	return put_req_pkt(obex, req, data_func, NULL, complete_func,
+							user_data, err);
+}
+
+/*
+ * Same as g_obex_put_req_pkt() but the body is sent straight from the file
+ * descriptor returned by fd_func, without copying it through a buffer.
+ */
+guint g_obex_put_req_pkt_fd(GObex *obex, GObexPacket *req,
+			GObexFdProducer fd_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	return put_req_pkt(obex, req, NULL, fd_func, complete_func,
+							user_data, err);
+}
+
 guint g_obex_put_req(GObex *obex, GObexDataProducer data_func,
 			GObexFunc complete_func, gpointer user_data,
 			GError **err, guint8 first_hdr_id, ...)
@@ -499,17 +548,14 @@ guint g_obex_get_req(GObex *obex, GObexDataConsumer data_func,
 	return transfer->id;
 }
 
-static gssize get_get_data(void *buf, gsize len, gpointer user_data)
+static void get_add_body(struct transfer *transfer, GObexPacket *rsp);
+
+static gssize get_get_result(struct transfer *transfer, gssize ret)
 {
-	struct transfer *transfer = user_data;
 	GObexPacket *req, *rsp;
 	GError *err = NULL;
-	gssize ret;
 	guint8 op;
 
-	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
-
-	ret = transfer->data_producer(buf, len, transfer->user_data);
 	if (ret > 0) {
 		if (!g_obex_srm_active(transfer->obex))
 			return ret;
@@ -517,7 +563,7 @@ static gssize get_get_data(void *buf, gsize len, gpointer user_data)
 		/* Generate next response */
 		rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(rsp, get_get_data, transfer);
+		get_add_body(transfer, rsp);
 
 		if (!g_obex_send(transfer->obex, rsp, &err)) {
 			transfer_complete(transfer, err);
@@ -549,6 +595,38 @@ static gssize get_get_data(void *buf, gsize len, gpointer user_data)
 	return ret;
 }
 
+static gssize get_get_data(void *buf, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	ret = transfer->data_producer(buf, len, transfer->user_data);
+
+	return get_get_result(transfer, ret);
+}
+
+static gssize get_get_fd(int *fd, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	ret = transfer->fd_producer(fd, len, transfer->user_data);
+
+	return get_get_result(transfer, ret);
+}
+
+static void get_add_body(struct transfer *transfer, GObexPacket *rsp)
+{
+	if (transfer->fd_producer)
+		g_obex_packet_add_body_fd(rsp, get_get_fd, transfer);
+	else
+		g_obex_packet_add_body(rsp, get_get_data, transfer);
+}
+
 static gboolean transfer_get_req_first(struct transfer *transfer,
 							GObexPacket *rsp)
 {
@@ -556,7 +634,7 @@ static gboolean transfer_get_req_first(struct transfer *transfer,
 
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
 
-	g_obex_packet_add_body(rsp, get_get_data, transfer);
+	get_add_body(transfer, rsp);
 
 	if (!g_obex_send(transfer->obex, rsp, &err)) {
 		transfer_complete(transfer, err);
@@ -576,7 +654,7 @@ static void transfer_get_req(GObex *obex, GObexPacket *req, gpointer user_data)
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
 
 	rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE, G_OBEX_HDR_INVALID);
-	g_obex_packet_add_body(rsp, get_get_data, transfer);
+	get_add_body(transfer, rsp);
 
 	if (!g_obex_send(obex, rsp, &err)) {
 		transfer_complete(transfer, err);
@@ -584,9 +662,10 @@ static void transfer_get_req(GObex *obex, GObexPacket *req, gpointer user_data)
 	}
 }
 
-guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
-			GObexDataProducer data_func, GObexFunc complete_func,
-			gpointer user_data, GError **err)
+static guint get_rsp_pkt(GObex *obex, GObexPacket *rsp,
+			GObexDataProducer data_func, GObexFdProducer fd_func,
+			GObexFunc complete_func, gpointer user_data,
+			GError **err)
 {
 	struct transfer *transfer;
 	guint id;
@@ -595,6 +674,7 @@ guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
 
 	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
 	transfer->data_producer = data_func;
+	transfer->fd_producer = fd_func;
 
 	if (!transfer_get_req_first(transfer, rsp))
 		return 0;
@@ -615,6 +695,26 @@ guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
 	return transfer->id;
 }
 
+guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
+			GObexDataProducer data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	return get_rsp_pkt(obex, rsp, data_func, NULL, complete_func,
+							user_data, err);
+}
+
+/*
+ * Same as g_obex_get_rsp_pkt() but the body is sent straight from the file
+ * descriptor returned by fd_func, without copying it through a buffer.
+ */
+guint g_obex_get_rsp_pkt_fd(GObex *obex, GObexPacket *rsp,
+			GObexFdProducer fd_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	return get_rsp_pkt(obex, rsp, NULL, fd_func, complete_func,
+							user_data, err);
+}
+
 guint g_obex_get_rsp(GObex *obex, GObexDataProducer data_func,
 			GObexFunc complete_func, gpointer user_data,
 			GError **err, guint8 first_hdr_id, ...)
@@ -27,6 +27,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 #include "gobex.h"
 #include "gobex-debug.h"
@@ -78,6 +80,9 @@ struct _GObex {
 	size_t tx_data;
 	size_t tx_sent;
 
+	int tx_body_fd;
+	size_t tx_body_len;
+
 	gboolean suspended;
 	gboolean use_srm;
 
@@ -267,12 +272,132 @@ static gboolean req_timeout(gpointer user_data)
 	return FALSE;
 }
 
+/*
+ * Append the body bytes the packet left in a file descriptor to the
+ * buffered part of it, used where the body can't be written on its own.
+ */
+static gboolean read_body_fd(GObex *obex, GError **err)
+{
+	guint8 *buf = &obex->tx_buf[obex->tx_sent + obex->tx_data];
+	ssize_t ret;
+
+	while (obex->tx_body_len > 0) {
+		ret = read(obex->tx_body_fd, buf, obex->tx_body_len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0) {
+			g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+					"Unable to read body: %s",
+					ret < 0 ? strerror(errno) :
+					"Unexpected end of file");
+			return FALSE;
+		}
+
+		buf += ret;
+		obex->tx_data += ret;
+		obex->tx_body_len -= ret;
+	}
+
+	return TRUE;
+}
+
+static gboolean write_body_fd(GObex *obex, GError **err)
+{
+	int sk = g_io_channel_unix_get_fd(obex->io);
+	ssize_t ret;
+
+	ret = sendfile(sk, obex->tx_body_fd, NULL, obex->tx_body_len);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+
+		/* Descriptor can't be spliced, fallback to copying */
+		if (errno == EINVAL || errno == ENOSYS)
+			return read_body_fd(obex, err);
+
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+					"sendfile: %s", strerror(errno));
+		return FALSE;
+	}
+
+	if (ret == 0) {
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+					"Unexpected end of file");
+		return FALSE;
+	}
+
+	g_obex_debug(G_OBEX_DEBUG_DATA, "< %zd bytes from fd %d", ret,
+							obex->tx_body_fd);
+
+	obex->tx_body_len -= ret;
+
+	return TRUE;
+}
+
+/*
+ * The producer is free to close its descriptor once it has handed it over,
+ * so keep a duplicate of it for as long as the body is being sent.
+ */
+static gboolean tx_body_set(GObex *obex, GObexPacket *pkt)
+{
+	int fd;
+
+	obex->tx_body_len = g_obex_packet_get_body_fd(pkt, &fd);
+	if (obex->tx_body_len == 0)
+		return TRUE;
+
+	obex->tx_body_fd = dup(fd);
+	if (obex->tx_body_fd < 0) {
+		g_obex_debug(G_OBEX_DEBUG_ERROR, "dup: %s", strerror(errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void tx_body_clear(GObex *obex)
+{
+	if (obex->tx_body_fd >= 0) {
+		close(obex->tx_body_fd);
+		obex->tx_body_fd = -1;
+	}
+
+	obex->tx_body_len = 0;
+}
+
+/*
+ * Once the length of a body has been advertised the peer can't be told that
+ * it won't get all of it, so the only way out is dropping the transport.
+ * Reading then fails and the disconnection is reported from there.
+ */
+static void tx_abort(GObex *obex, GError *err)
+{
+	int sk;
+
+	g_obex_debug(G_OBEX_DEBUG_ERROR, "%s", err ? err->message :
+						"Unable to send body");
+
+	tx_body_clear(obex);
+
+	if (obex->io == NULL)
+		return;
+
+	sk = g_io_channel_unix_get_fd(obex->io);
+	if (shutdown(sk, SHUT_RDWR) < 0)
+		g_obex_debug(G_OBEX_DEBUG_ERROR, "shutdown: %s",
+							strerror(errno));
+}
+
 static gboolean write_stream(GObex *obex, GError **err)
 {
 	GIOStatus status;
 	gsize bytes_written;
 	char *buf;
 
+	if (obex->tx_data == 0)
+		return write_body_fd(obex, err);
+
 	buf = (char *) &obex->tx_buf[obex->tx_sent];
 	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
 							&bytes_written, err);
@@ -293,6 +418,10 @@ static gboolean write_packet(GObex *obex, GError **err)
 	gsize bytes_written;
 	char *buf;
 
+	/* Packets have to be written at once so the body can't be spliced */
+	if (obex->tx_body_len > 0 && !read_body_fd(obex, err))
+		return FALSE;
+
 	buf = (char *) &obex->tx_buf[obex->tx_sent];
 	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
 							&bytes_written, err);
@@ -432,6 +561,7 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 							gpointer user_data)
 {
 	GObex *obex = user_data;
+	GError *err = NULL;
 
 	if (cond & G_IO_NVAL)
 		return FALSE;
@@ -439,7 +569,7 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 	if (cond & (G_IO_HUP | G_IO_ERR))
 		goto stop_tx;
 
-	if (obex->tx_data == 0) {
+	if (obex->tx_data == 0 && obex->tx_body_len == 0) {
 		struct pending_pkt *p = g_queue_pop_head(obex->tx_queue);
 		ssize_t len;
 
@@ -470,6 +600,12 @@ encode:
 			goto done;
 		}
 
+		if (!tx_body_set(obex, p->pkt)) {
+			g_queue_push_head(obex->tx_queue, p);
+			tx_abort(obex, NULL);
+			goto stop_tx;
+		}
+
 		if (p->id > 0) {
 			if (obex->pending_req != NULL)
 				pending_pkt_free(obex->pending_req);
@@ -484,7 +620,7 @@ encode:
 			pending_pkt_free(p);
 		}
 
-		obex->tx_data = len;
+		obex->tx_data = len - obex->tx_body_len;
 		obex->tx_sent = 0;
 	}
 
@@ -493,16 +629,27 @@ encode:
 		return FALSE;
 	}
 
-	if (!obex->write(obex, NULL))
+	if (!obex->write(obex, &err)) {
+		/* A body cut short would leave the stream out of sync */
+		if (obex->tx_body_len > 0)
+			tx_abort(obex, err);
+
+		g_clear_error(&err);
 		goto stop_tx;
+	}
+
+	if (obex->tx_body_len == 0)
+		tx_body_clear(obex);
 
 done:
-	if (obex->tx_data > 0 || g_queue_get_length(obex->tx_queue) > 0)
+	if (obex->tx_data > 0 || obex->tx_body_len > 0 ||
+				g_queue_get_length(obex->tx_queue) > 0)
 		return TRUE;
 
 stop_tx:
 	obex->rx_last_op = G_OBEX_OP_NONE;
 	obex->tx_data = 0;
+	tx_body_clear(obex);
 	obex->write_source = 0;
 	return FALSE;
 }
@@ -995,7 +1142,8 @@ void g_obex_resume(GObex *obex)
 		g_obex_srm_resume(obex);
 
 done:
-	if (g_queue_get_length(obex->tx_queue) > 0 || obex->tx_data > 0)
+	if (g_queue_get_length(obex->tx_queue) > 0 || obex->tx_data > 0 ||
+						obex->tx_body_len > 0)
 		enable_tx(obex);
 }
 
@@ -1454,6 +1602,7 @@ GObex *g_obex_new(GIOChannel *io, GObexTransportType transport_type,
 	obex->ref_count = 1;
 	obex->conn_id = CONNID_INVALID;
 	obex->rx_last_op = G_OBEX_OP_NONE;
+	obex->tx_body_fd = -1;
 
 	obex->io_rx_mtu = io_rx_mtu;
 	obex->io_tx_mtu = io_tx_mtu;
@@ -1533,6 +1682,8 @@ void g_obex_unref(GObex *obex)
 	if (obex->write_source > 0)
 		g_source_remove(obex->write_source);
 
+	tx_body_clear(obex);
+
 	g_free(obex->rx_buf);
 	g_free(obex->tx_buf);
 	g_free(obex->srm);
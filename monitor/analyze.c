@@ -27,7 +27,10 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "lib/bluetooth.h"
 
@@ -35,8 +38,82 @@
 #include "src/shared/queue.h"
 #include "src/shared/btsnoop.h"
 #include "monitor/bt.h"
+#include "seek.h"
 #include "analyze.h"
 
+#define FORMAT_TEXT	0
+#define FORMAT_CSV	1
+#define FORMAT_JSON	2
+
+#define HIST_BUCKETS	32
+
+#define CONN_TYPE_ACL	0x00
+#define CONN_TYPE_LE	0x01
+#define CONN_TYPE_SCO	0x02
+
+/* Latencies in microseconds, bucket n holds values below 2^n */
+struct hist {
+	unsigned long count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	unsigned long buckets[HIST_BUCKETS];
+};
+
+struct credits {
+	uint16_t total;
+	unsigned int pending;
+	unsigned int max_pending;
+	bool stalled;
+	struct timeval stall_start;
+	unsigned long num_stalls;
+	uint64_t stall_time;
+};
+
+struct l2cap_chan {
+	uint16_t cid;
+	unsigned long tx_frames;
+	unsigned long rx_frames;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+};
+
+struct hci_conn {
+	uint16_t handle;
+	uint8_t type;
+	uint8_t bdaddr[6];
+	bool setup_seen;
+	bool disconnected;
+	struct timeval time_setup;
+	struct timeval time_disconn;
+	unsigned long tx_num;
+	unsigned long rx_num;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint64_t *tx_sec;
+	uint64_t *rx_sec;
+	unsigned int num_sec;
+	time_t first_sec;
+	struct queue *tx_queue;
+	struct hist tx_latency;
+	bool att_pending[2];
+	struct timeval att_req[2];
+	struct hist att_latency;
+	struct queue *chan_list;
+};
+
+struct cmd_stats {
+	uint16_t opcode;
+	unsigned long count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+struct pending_cmd {
+	uint16_t opcode;
+	struct timeval tv;
+};
+
 struct hci_dev {
 	uint16_t index;
 	uint8_t type;
@@ -52,28 +129,288 @@ struct hci_dev {
 	unsigned long user_log;
 	unsigned long unknown;
 	uint16_t manufacturer;
+	struct credits acl_credits;
+	struct credits le_credits;
+	struct queue *conn_list;
+	struct queue *conn_done;
+	struct queue *cmd_pending;
+	struct queue *cmd_stats;
+	struct hist cmd_latency;
 };
 
 static struct queue *dev_list;
+static struct queue *dev_done;
+static int output_format = FORMAT_TEXT;
 
-static void dev_destroy(void *data)
+bool analyze_set_format(const char *format)
 {
-	struct hci_dev *dev = data;
-	const char *str;
+	if (!strcasecmp(format, "text"))
+		output_format = FORMAT_TEXT;
+	else if (!strcasecmp(format, "csv"))
+		output_format = FORMAT_CSV;
+	else if (!strcasecmp(format, "json"))
+		output_format = FORMAT_JSON;
+	else
+		return false;
+
+	return true;
+}
+
+bool analyze_text_format(void)
+{
+	return output_format == FORMAT_TEXT;
+}
+
+static uint64_t tv_diff(const struct timeval *a, const struct timeval *b)
+{
+	int64_t usec;
+
+	usec = (b->tv_sec - a->tv_sec) * 1000000ll + (b->tv_usec - a->tv_usec);
+
+	return usec < 0 ? 0 : usec;
+}
+
+static void hist_add(struct hist *hist, uint64_t usec)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < HIST_BUCKETS - 1 && usec >= (1ull << bucket))
+		bucket++;
+
+	hist->buckets[bucket]++;
+
+	if (!hist->count || usec < hist->min)
+		hist->min = usec;
+
+	if (usec > hist->max)
+		hist->max = usec;
+
+	hist->sum += usec;
+	hist->count++;
+}
+
+static uint64_t hist_percentile(const struct hist *hist, unsigned int pct)
+{
+	unsigned long target, total = 0;
+	unsigned int i;
+
+	if (!hist->count)
+		return 0;
+
+	target = (hist->count * pct + 99) / 100;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		total += hist->buckets[i];
+		if (total >= target)
+			break;
+	}
+
+	/* Report the bucket limit, clamped to the observed range */
+	if (i >= HIST_BUCKETS - 1 || (1ull << i) > hist->max)
+		return hist->max;
+
+	return 1ull << i;
+}
+
+static void print_hist_text(const char *label, const struct hist *hist,
+							const char *indent)
+{
+	unsigned int i;
+
+	if (!hist->count)
+		return;
+
+	printf("%s%s: %lu samples\n", indent, label, hist->count);
+	printf("%s  min %llu usec, avg %llu usec, max %llu usec\n", indent,
+				(unsigned long long) hist->min,
+				(unsigned long long) (hist->sum / hist->count),
+				(unsigned long long) hist->max);
+	printf("%s  p50 %llu usec, p90 %llu usec, p99 %llu usec\n", indent,
+			(unsigned long long) hist_percentile(hist, 50),
+			(unsigned long long) hist_percentile(hist, 90),
+			(unsigned long long) hist_percentile(hist, 99));
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (!hist->buckets[i])
+			continue;
+
+		printf("%s  < %-10llu usec %lu\n", indent,
+					i < HIST_BUCKETS - 1 ?
+					(unsigned long long) (1ull << i) :
+					(unsigned long long) hist->max + 1,
+					hist->buckets[i]);
+	}
+}
 
-	switch (dev->type) {
+static void print_hist_json(const char *label, const struct hist *hist)
+{
+	unsigned int i;
+	bool first = true;
+
+	printf("\"%s\":{\"count\":%lu,\"min\":%llu,\"avg\":%llu,"
+			"\"max\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,"
+			"\"buckets\":[", label, hist->count,
+			(unsigned long long) hist->min,
+			(unsigned long long) (hist->count ?
+						hist->sum / hist->count : 0),
+			(unsigned long long) hist->max,
+			(unsigned long long) hist_percentile(hist, 50),
+			(unsigned long long) hist_percentile(hist, 90),
+			(unsigned long long) hist_percentile(hist, 99));
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (!hist->buckets[i])
+			continue;
+
+		printf("%s{\"below\":%llu,\"count\":%lu}", first ? "" : ",",
+					(unsigned long long) (1ull << i),
+					hist->buckets[i]);
+		first = false;
+	}
+
+	printf("]}");
+}
+
+static const char *conn_type_str(uint8_t type)
+{
+	switch (type) {
+	case CONN_TYPE_ACL:
+		return "BR/EDR";
+	case CONN_TYPE_LE:
+		return "LE";
+	case CONN_TYPE_SCO:
+		return "SCO";
+	}
+
+	return "unknown";
+}
+
+static const char *dev_type_str(uint8_t type)
+{
+	switch (type) {
 	case 0x00:
-		str = "BR/EDR";
-		break;
+		return "BR/EDR";
 	case 0x01:
-		str = "AMP";
-		break;
-	default:
-		str = "unknown";
-		break;
+		return "AMP";
 	}
 
-	printf("Found %s controller with index %u\n", str, dev->index);
+	return "unknown";
+}
+
+static void chan_print_text(void *data, void *user_data)
+{
+	struct l2cap_chan *chan = data;
+	struct hci_conn *conn = user_data;
+	uint64_t total = conn->tx_bytes + conn->rx_bytes;
+
+	printf("    L2CAP CID 0x%4.4x: %lu/%lu frames, "
+			"%llu/%llu bytes TX/RX (%llu%% of link)\n",
+			chan->cid, chan->tx_frames, chan->rx_frames,
+			(unsigned long long) chan->tx_bytes,
+			(unsigned long long) chan->rx_bytes,
+			(unsigned long long) (total ? (chan->tx_bytes +
+					chan->rx_bytes) * 100 / total : 0));
+}
+
+static uint64_t conn_duration(const struct hci_conn *conn)
+{
+	struct timeval end;
+	unsigned int last;
+
+	if (conn->disconnected)
+		return tv_diff(&conn->time_setup, &conn->time_disconn);
+
+	if (!conn->num_sec)
+		return 0;
+
+	last = conn->num_sec;
+	end.tv_sec = conn->first_sec + last;
+	end.tv_usec = 0;
+
+	return tv_diff(&conn->time_setup, &end);
+}
+
+static void conn_peak(const struct hci_conn *conn, uint64_t *tx_peak,
+							uint64_t *rx_peak)
+{
+	unsigned int i;
+
+	*tx_peak = 0;
+	*rx_peak = 0;
+
+	for (i = 0; i < conn->num_sec; i++) {
+		if (conn->tx_sec[i] > *tx_peak)
+			*tx_peak = conn->tx_sec[i];
+		if (conn->rx_sec[i] > *rx_peak)
+			*rx_peak = conn->rx_sec[i];
+	}
+}
+
+static void conn_print_text(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+	uint64_t duration, tx_peak, rx_peak;
+
+	duration = conn_duration(conn);
+	conn_peak(conn, &tx_peak, &rx_peak);
+
+	printf("  Found %s connection with handle %u\n",
+				conn_type_str(conn->type), conn->handle);
+	if (conn->setup_seen)
+		printf("    BD_ADDR %2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X\n",
+			conn->bdaddr[5], conn->bdaddr[4], conn->bdaddr[3],
+			conn->bdaddr[2], conn->bdaddr[1], conn->bdaddr[0]);
+	printf("    %llu.%06llu seconds%s\n",
+			(unsigned long long) (duration / 1000000),
+			(unsigned long long) (duration % 1000000),
+			conn->disconnected ? "" : " (not disconnected)");
+	printf("    %lu TX packets, %llu bytes\n", conn->tx_num,
+					(unsigned long long) conn->tx_bytes);
+	printf("    %lu RX packets, %llu bytes\n", conn->rx_num,
+					(unsigned long long) conn->rx_bytes);
+
+	if (duration)
+		printf("    Throughput TX %llu bytes/s avg, %llu bytes/s peak\n"
+			"    Throughput RX %llu bytes/s avg, %llu bytes/s peak\n",
+			(unsigned long long) (conn->tx_bytes * 1000000 /
+								duration),
+			(unsigned long long) tx_peak,
+			(unsigned long long) (conn->rx_bytes * 1000000 /
+								duration),
+			(unsigned long long) rx_peak);
+
+	print_hist_text("TX completion latency", &conn->tx_latency, "    ");
+	print_hist_text("ATT response latency", &conn->att_latency, "    ");
+
+	queue_foreach(conn->chan_list, chan_print_text, conn);
+}
+
+static void cmd_stats_print_text(void *data, void *user_data)
+{
+	struct cmd_stats *stats = data;
+
+	printf("    0x%2.2x|0x%4.4x: %lu commands, avg %llu usec, "
+			"max %llu usec\n", stats->opcode >> 10,
+			stats->opcode & 0x3ff, stats->count,
+			(unsigned long long) (stats->sum / stats->count),
+			(unsigned long long) stats->max);
+}
+
+static void credits_print_text(const char *label, const struct credits *cr)
+{
+	if (!cr->total && !cr->max_pending)
+		return;
+
+	printf("  %s buffers: %u, max in flight %u\n", label, cr->total,
+							cr->max_pending);
+	printf("    %lu credit stalls, %llu usec stalled\n", cr->num_stalls,
+					(unsigned long long) cr->stall_time);
+}
+
+static void dev_print_text(struct hci_dev *dev)
+{
+	printf("Found %s controller with index %u\n",
+					dev_type_str(dev->type), dev->index);
 	printf("  BD_ADDR %2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X",
 			dev->bdaddr[5], dev->bdaddr[4], dev->bdaddr[3],
 			dev->bdaddr[2], dev->bdaddr[1], dev->bdaddr[0]);
@@ -90,8 +427,292 @@ static void dev_destroy(void *data)
 	printf("  %lu system notes\n", dev->system_note);
 	printf("  %lu user logs\n", dev->user_log);
 	printf("  %lu unknown opcodes\n", dev->unknown);
+
+	print_hist_text("Command latency", &dev->cmd_latency, "  ");
+	queue_foreach(dev->cmd_stats, cmd_stats_print_text, NULL);
+
+	credits_print_text("ACL", &dev->acl_credits);
+	credits_print_text("LE", &dev->le_credits);
+
+	queue_foreach(dev->conn_done, conn_print_text, NULL);
+	queue_foreach(dev->conn_list, conn_print_text, NULL);
+
 	printf("\n");
+}
+
+struct json_list {
+	bool first;
+};
+
+static void json_sep(struct json_list *list)
+{
+	if (!list->first)
+		printf(",");
 
+	list->first = false;
+}
+
+static void chan_print_json(void *data, void *user_data)
+{
+	struct l2cap_chan *chan = data;
+
+	json_sep(user_data);
+
+	printf("{\"cid\":%u,\"tx_frames\":%lu,\"rx_frames\":%lu,"
+			"\"tx_bytes\":%llu,\"rx_bytes\":%llu}", chan->cid,
+			chan->tx_frames, chan->rx_frames,
+			(unsigned long long) chan->tx_bytes,
+			(unsigned long long) chan->rx_bytes);
+}
+
+static void conn_print_json(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+	struct json_list chans = { .first = true };
+	unsigned int i;
+
+	json_sep(user_data);
+
+	printf("{\"handle\":%u,\"type\":\"%s\",\"bdaddr\":"
+			"\"%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X\","
+			"\"disconnected\":%s,\"duration\":%llu,"
+			"\"tx_packets\":%lu,\"tx_bytes\":%llu,"
+			"\"rx_packets\":%lu,\"rx_bytes\":%llu,",
+			conn->handle, conn_type_str(conn->type),
+			conn->bdaddr[5], conn->bdaddr[4], conn->bdaddr[3],
+			conn->bdaddr[2], conn->bdaddr[1], conn->bdaddr[0],
+			conn->disconnected ? "true" : "false",
+			(unsigned long long) conn_duration(conn),
+			conn->tx_num, (unsigned long long) conn->tx_bytes,
+			conn->rx_num, (unsigned long long) conn->rx_bytes);
+
+	printf("\"throughput\":[");
+	for (i = 0; i < conn->num_sec; i++)
+		printf("%s{\"time\":%llu,\"tx_bytes\":%llu,\"rx_bytes\":%llu}",
+			i ? "," : "",
+			(unsigned long long) (conn->first_sec + i),
+			(unsigned long long) conn->tx_sec[i],
+			(unsigned long long) conn->rx_sec[i]);
+	printf("],");
+
+	print_hist_json("tx_latency", &conn->tx_latency);
+	printf(",");
+	print_hist_json("att_latency", &conn->att_latency);
+
+	printf(",\"channels\":[");
+	queue_foreach(conn->chan_list, chan_print_json, &chans);
+	printf("]}");
+}
+
+static void cmd_stats_print_json(void *data, void *user_data)
+{
+	struct cmd_stats *stats = data;
+
+	json_sep(user_data);
+
+	printf("{\"opcode\":%u,\"count\":%lu,\"avg\":%llu,\"max\":%llu}",
+			stats->opcode, stats->count,
+			(unsigned long long) (stats->sum / stats->count),
+			(unsigned long long) stats->max);
+}
+
+static void credits_print_json(const char *label, const struct credits *cr)
+{
+	printf("\"%s\":{\"buffers\":%u,\"max_pending\":%u,\"stalls\":%lu,"
+			"\"stall_time\":%llu}", label, cr->total,
+			cr->max_pending, cr->num_stalls,
+			(unsigned long long) cr->stall_time);
+}
+
+static void dev_print_json(void *data, void *user_data)
+{
+	struct hci_dev *dev = data;
+	struct json_list list = { .first = true };
+
+	json_sep(user_data);
+
+	printf("{\"index\":%u,\"type\":\"%s\",\"bdaddr\":"
+			"\"%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X\","
+			"\"manufacturer\":%u,\"commands\":%lu,\"events\":%lu,"
+			"\"acl_packets\":%lu,\"sco_packets\":%lu,"
+			"\"vendor_diagnostics\":%lu,\"system_notes\":%lu,"
+			"\"user_logs\":%lu,\"unknown_opcodes\":%lu,",
+			dev->index, dev_type_str(dev->type),
+			dev->bdaddr[5], dev->bdaddr[4], dev->bdaddr[3],
+			dev->bdaddr[2], dev->bdaddr[1], dev->bdaddr[0],
+			dev->manufacturer, dev->num_cmd, dev->num_evt,
+			dev->num_acl, dev->num_sco, dev->vendor_diag,
+			dev->system_note, dev->user_log, dev->unknown);
+
+	print_hist_json("cmd_latency", &dev->cmd_latency);
+
+	printf(",\"opcodes\":[");
+	queue_foreach(dev->cmd_stats, cmd_stats_print_json, &list);
+	printf("],");
+
+	credits_print_json("acl_credits", &dev->acl_credits);
+	printf(",");
+	credits_print_json("le_credits", &dev->le_credits);
+
+	list.first = true;
+	printf(",\"connections\":[");
+	queue_foreach(dev->conn_done, conn_print_json, &list);
+	queue_foreach(dev->conn_list, conn_print_json, &list);
+	printf("]}");
+}
+
+static void conn_print_csv(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+	struct hci_dev *dev = user_data;
+	uint64_t tx_peak, rx_peak;
+
+	conn_peak(conn, &tx_peak, &rx_peak);
+
+	printf("%u,%u,%s,%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X,%llu,"
+			"%lu,%llu,%lu,%llu,%llu,%llu,%lu,%llu,%llu,%lu,%llu,%llu\n",
+			dev->index, conn->handle, conn_type_str(conn->type),
+			conn->bdaddr[5], conn->bdaddr[4], conn->bdaddr[3],
+			conn->bdaddr[2], conn->bdaddr[1], conn->bdaddr[0],
+			(unsigned long long) conn_duration(conn),
+			conn->tx_num, (unsigned long long) conn->tx_bytes,
+			conn->rx_num, (unsigned long long) conn->rx_bytes,
+			(unsigned long long) tx_peak,
+			(unsigned long long) rx_peak,
+			conn->tx_latency.count,
+			(unsigned long long) hist_percentile(&conn->tx_latency,
+									50),
+			(unsigned long long) hist_percentile(&conn->tx_latency,
+									99),
+			conn->att_latency.count,
+			(unsigned long long) hist_percentile(&conn->att_latency,
+									50),
+			(unsigned long long) hist_percentile(&conn->att_latency,
+									99));
+}
+
+static void dev_conn_print_csv(void *data, void *user_data)
+{
+	struct hci_dev *dev = data;
+
+	queue_foreach(dev->conn_done, conn_print_csv, dev);
+	queue_foreach(dev->conn_list, conn_print_csv, dev);
+}
+
+struct csv_conn {
+	struct hci_dev *dev;
+	struct hci_conn *conn;
+};
+
+static void chan_print_csv(void *data, void *user_data)
+{
+	struct l2cap_chan *chan = data;
+	struct csv_conn *csv = user_data;
+
+	printf("%u,%u,%u,%lu,%llu,%lu,%llu\n", csv->dev->index,
+			csv->conn->handle, chan->cid,
+			chan->tx_frames, (unsigned long long) chan->tx_bytes,
+			chan->rx_frames, (unsigned long long) chan->rx_bytes);
+}
+
+static void conn_chan_print_csv(void *data, void *user_data)
+{
+	struct csv_conn csv = { .dev = user_data, .conn = data };
+
+	queue_foreach(csv.conn->chan_list, chan_print_csv, &csv);
+}
+
+static void dev_chan_print_csv(void *data, void *user_data)
+{
+	struct hci_dev *dev = data;
+
+	queue_foreach(dev->conn_done, conn_chan_print_csv, dev);
+	queue_foreach(dev->conn_list, conn_chan_print_csv, dev);
+}
+
+static void conn_time_print_csv(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+	struct hci_dev *dev = user_data;
+	unsigned int i;
+
+	for (i = 0; i < conn->num_sec; i++)
+		printf("%u,%u,%llu,%llu,%llu\n", dev->index, conn->handle,
+				(unsigned long long) (conn->first_sec + i),
+				(unsigned long long) conn->tx_sec[i],
+				(unsigned long long) conn->rx_sec[i]);
+}
+
+static void dev_time_print_csv(void *data, void *user_data)
+{
+	struct hci_dev *dev = data;
+
+	queue_foreach(dev->conn_done, conn_time_print_csv, dev);
+	queue_foreach(dev->conn_list, conn_time_print_csv, dev);
+}
+
+static void dev_cmd_print_csv(void *data, void *user_data)
+{
+	struct hci_dev *dev = data;
+	const struct queue_entry *entry;
+
+	for (entry = queue_get_entries(dev->cmd_stats); entry;
+							entry = entry->next) {
+		struct cmd_stats *stats = entry->data;
+
+		printf("%u,0x%4.4x,%lu,%llu,%llu\n", dev->index,
+			stats->opcode, stats->count,
+			(unsigned long long) (stats->sum / stats->count),
+			(unsigned long long) stats->max);
+	}
+}
+
+static void print_csv(void)
+{
+	printf("index,handle,type,bdaddr,duration,tx_packets,tx_bytes,"
+			"rx_packets,rx_bytes,tx_peak,rx_peak,tx_latency_count,"
+			"tx_latency_p50,tx_latency_p99,att_latency_count,"
+			"att_latency_p50,att_latency_p99\n");
+	queue_foreach(dev_done, dev_conn_print_csv, NULL);
+	queue_foreach(dev_list, dev_conn_print_csv, NULL);
+
+	printf("\nindex,handle,cid,tx_frames,tx_bytes,rx_frames,rx_bytes\n");
+	queue_foreach(dev_done, dev_chan_print_csv, NULL);
+	queue_foreach(dev_list, dev_chan_print_csv, NULL);
+
+	printf("\nindex,handle,time,tx_bytes,rx_bytes\n");
+	queue_foreach(dev_done, dev_time_print_csv, NULL);
+	queue_foreach(dev_list, dev_time_print_csv, NULL);
+
+	printf("\nindex,opcode,count,avg_latency,max_latency\n");
+	queue_foreach(dev_done, dev_cmd_print_csv, NULL);
+	queue_foreach(dev_list, dev_cmd_print_csv, NULL);
+}
+
+static void dev_print(void *data, void *user_data)
+{
+	dev_print_text(data);
+}
+
+static void conn_destroy(void *data)
+{
+	struct hci_conn *conn = data;
+
+	queue_destroy(conn->tx_queue, free);
+	queue_destroy(conn->chan_list, free);
+	free(conn->tx_sec);
+	free(conn->rx_sec);
+	free(conn);
+}
+
+static void dev_destroy(void *data)
+{
+	struct hci_dev *dev = data;
+
+	queue_destroy(dev->conn_list, conn_destroy);
+	queue_destroy(dev->conn_done, conn_destroy);
+	queue_destroy(dev->cmd_pending, free);
+	queue_destroy(dev->cmd_stats, free);
 	free(dev);
 }
 
@@ -103,6 +724,10 @@ static struct hci_dev *dev_alloc(uint16_t index)
 
 	dev->index = index;
 	dev->manufacturer = 0xffff;
+	dev->conn_list = queue_new();
+	dev->conn_done = queue_new();
+	dev->cmd_pending = queue_new();
+	dev->cmd_stats = queue_new();
 
 	return dev;
 }
@@ -131,6 +756,155 @@ static struct hci_dev *dev_lookup(uint16_t index)
 	return dev;
 }
 
+static bool conn_match_handle(const void *a, const void *b)
+{
+	const struct hci_conn *conn = a;
+	uint16_t handle = PTR_TO_UINT(b);
+
+	return conn->handle == handle;
+}
+
+static struct hci_conn *conn_alloc(struct hci_dev *dev, uint16_t handle,
+							uint8_t type)
+{
+	struct hci_conn *conn;
+
+	conn = new0(struct hci_conn, 1);
+
+	conn->handle = handle;
+	conn->type = type;
+	conn->tx_queue = queue_new();
+	conn->chan_list = queue_new();
+
+	queue_push_tail(dev->conn_list, conn);
+
+	return conn;
+}
+
+static struct hci_conn *conn_lookup(struct hci_dev *dev, uint16_t handle,
+							uint8_t type)
+{
+	struct hci_conn *conn;
+
+	conn = queue_find(dev->conn_list, conn_match_handle,
+							UINT_TO_PTR(handle));
+	if (!conn)
+		conn = conn_alloc(dev, handle, type);
+
+	return conn;
+}
+
+static void conn_account(struct hci_conn *conn, struct timeval *tv,
+						bool out, uint16_t size)
+{
+	unsigned int sec;
+
+	if (!conn->num_sec) {
+		conn->first_sec = tv->tv_sec;
+		if (!conn->setup_seen)
+			conn->time_setup = *tv;
+	}
+
+	if (tv->tv_sec < conn->first_sec)
+		sec = 0;
+	else
+		sec = tv->tv_sec - conn->first_sec;
+
+	if (sec >= conn->num_sec) {
+		unsigned int num = sec + 1;
+
+		conn->tx_sec = realloc(conn->tx_sec, num * sizeof(uint64_t));
+		conn->rx_sec = realloc(conn->rx_sec, num * sizeof(uint64_t));
+		if (!conn->tx_sec || !conn->rx_sec) {
+			fprintf(stderr, "Failed to allocate throughput data\n");
+			exit(EXIT_FAILURE);
+		}
+
+		memset(conn->tx_sec + conn->num_sec, 0,
+				(num - conn->num_sec) * sizeof(uint64_t));
+		memset(conn->rx_sec + conn->num_sec, 0,
+				(num - conn->num_sec) * sizeof(uint64_t));
+		conn->num_sec = num;
+	}
+
+	if (out) {
+		conn->tx_num++;
+		conn->tx_bytes += size;
+		conn->tx_sec[sec] += size;
+	} else {
+		conn->rx_num++;
+		conn->rx_bytes += size;
+		conn->rx_sec[sec] += size;
+	}
+}
+
+static struct credits *conn_credits(struct hci_dev *dev,
+						struct hci_conn *conn)
+{
+	/* LE links share the ACL buffers if there are no LE buffers */
+	if (conn->type == CONN_TYPE_LE && dev->le_credits.total)
+		return &dev->le_credits;
+
+	return &dev->acl_credits;
+}
+
+static void credits_consume(struct credits *cr, struct timeval *tv)
+{
+	cr->pending++;
+
+	if (cr->pending > cr->max_pending)
+		cr->max_pending = cr->pending;
+
+	if (cr->total && cr->pending >= cr->total && !cr->stalled) {
+		cr->stalled = true;
+		cr->stall_start = *tv;
+		cr->num_stalls++;
+	}
+}
+
+static void credits_release(struct credits *cr, struct timeval *tv,
+							uint16_t count)
+{
+	cr->pending = count > cr->pending ? 0 : cr->pending - count;
+
+	if (cr->stalled && cr->pending < cr->total) {
+		cr->stalled = false;
+		cr->stall_time += tv_diff(&cr->stall_start, tv);
+	}
+}
+
+static void conn_finish(struct hci_dev *dev, struct timeval *tv,
+						struct hci_conn *conn)
+{
+	/* Packets still queued in the controller are flushed */
+	if (conn->type != CONN_TYPE_SCO)
+		credits_release(conn_credits(dev, conn), tv,
+					queue_length(conn->tx_queue));
+
+	queue_push_tail(dev->conn_done, conn);
+}
+
+static void conn_setup(struct hci_dev *dev, struct timeval *tv,
+				uint16_t handle, uint8_t type,
+				const uint8_t *bdaddr)
+{
+	struct hci_conn *conn;
+
+	/* The disconnect of an earlier user of the handle went missing,
+	 * but its statistics are still reported.
+	 */
+	conn = queue_remove_if(dev->conn_list, conn_match_handle,
+							UINT_TO_PTR(handle));
+	if (conn)
+		conn_finish(dev, tv, conn);
+
+	conn = conn_alloc(dev, handle, type);
+
+	conn->setup_seen = true;
+	conn->time_setup = *tv;
+	memcpy(conn->bdaddr, bdaddr, 6);
+}
+
 static void new_index(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
@@ -140,6 +914,7 @@ static void new_index(struct timeval *tv, uint16_t index,
 	dev = dev_alloc(index);
 
 	dev->type = ni->type;
+	dev->time_added = *tv;
 	memcpy(dev->bdaddr, ni->bdaddr, 6);
 
 	queue_push_tail(dev_list, dev);
@@ -156,15 +931,21 @@ static void del_index(struct timeval *tv, uint16_t index,
 		return;
 	}
 
-	dev_destroy(dev);
+	dev->time_removed = *tv;
+
+	queue_push_tail(dev_done, dev);
 }
 
 static void command_pkt(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_cmd_hdr *hdr = data;
+	struct pending_cmd *cmd;
 	struct hci_dev *dev;
 
+	if (size < sizeof(*hdr))
+		return;
+
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
 
@@ -173,6 +954,59 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_cmd++;
+
+	cmd = new0(struct pending_cmd, 1);
+	cmd->opcode = le16_to_cpu(hdr->opcode);
+	cmd->tv = *tv;
+
+	queue_push_tail(dev->cmd_pending, cmd);
+}
+
+static bool cmd_match_opcode(const void *a, const void *b)
+{
+	const struct pending_cmd *cmd = a;
+
+	return cmd->opcode == PTR_TO_UINT(b);
+}
+
+static bool stats_match_opcode(const void *a, const void *b)
+{
+	const struct cmd_stats *stats = a;
+
+	return stats->opcode == PTR_TO_UINT(b);
+}
+
+static void cmd_done(struct hci_dev *dev, struct timeval *tv, uint16_t opcode)
+{
+	struct pending_cmd *cmd;
+	struct cmd_stats *stats;
+	uint64_t latency;
+
+	if (!opcode)
+		return;
+
+	cmd = queue_remove_if(dev->cmd_pending, cmd_match_opcode,
+							UINT_TO_PTR(opcode));
+	if (!cmd)
+		return;
+
+	latency = tv_diff(&cmd->tv, tv);
+	free(cmd);
+
+	hist_add(&dev->cmd_latency, latency);
+
+	stats = queue_find(dev->cmd_stats, stats_match_opcode,
+							UINT_TO_PTR(opcode));
+	if (!stats) {
+		stats = new0(struct cmd_stats, 1);
+		stats->opcode = opcode;
+		queue_push_tail(dev->cmd_stats, stats);
+	}
+
+	stats->count++;
+	stats->sum += latency;
+	if (latency > stats->max)
+		stats->max = latency;
 }
 
 static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
@@ -180,7 +1014,9 @@ static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
 {
 	const struct bt_hci_rsp_read_bd_addr *rsp = data;
 
-	printf("Read BD Addr event with status 0x%2.2x\n", rsp->status);
+	if (output_format == FORMAT_TEXT)
+		printf("Read BD Addr event with status 0x%2.2x\n",
+								rsp->status);
 
 	if (rsp->status)
 		return;
@@ -188,6 +1024,28 @@ static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
 	memcpy(dev->bdaddr, rsp->bdaddr, 6);
 }
 
+static void rsp_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->acl_credits.total = le16_to_cpu(rsp->acl_max_pkt);
+}
+
+static void rsp_le_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_le_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->le_credits.total = rsp->le_max_pkt;
+}
+
 static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 					const void *data, uint16_t size)
 {
@@ -199,10 +1057,145 @@ static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 
 	opcode = le16_to_cpu(evt->opcode);
 
+	cmd_done(dev, tv, opcode);
+
 	switch (opcode) {
 	case BT_HCI_CMD_READ_BD_ADDR:
 		rsp_read_bd_addr(dev, tv, data, size);
 		break;
+	case BT_HCI_CMD_READ_BUFFER_SIZE:
+		rsp_read_buffer_size(dev, tv, data, size);
+		break;
+	case BT_HCI_CMD_LE_READ_BUFFER_SIZE:
+		rsp_le_read_buffer_size(dev, tv, data, size);
+		break;
+	}
+}
+
+static void evt_cmd_status(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_cmd_status *evt = data;
+
+	if (size < sizeof(*evt))
+		return;
+
+	cmd_done(dev, tv, le16_to_cpu(evt->opcode));
+}
+
+static void evt_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_conn_complete *evt = data;
+	uint8_t type;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	type = evt->link_type == 0x01 ? CONN_TYPE_ACL : CONN_TYPE_SCO;
+
+	conn_setup(dev, tv, le16_to_cpu(evt->handle), type, evt->bdaddr);
+}
+
+static void evt_sync_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_sync_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_setup(dev, tv, le16_to_cpu(evt->handle), CONN_TYPE_SCO,
+								evt->bdaddr);
+}
+
+static void evt_disconnect_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_disconnect_complete *evt = data;
+	struct hci_conn *conn;
+	uint16_t handle;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	handle = le16_to_cpu(evt->handle);
+
+	conn = queue_remove_if(dev->conn_list, conn_match_handle,
+							UINT_TO_PTR(handle));
+	if (!conn)
+		return;
+
+	conn->disconnected = true;
+	conn->time_disconn = *tv;
+
+	conn_finish(dev, tv, conn);
+}
+
+static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const uint8_t *num_handles = data;
+	const uint8_t *ptr = data + 1;
+	uint8_t i;
+
+	if (size < 1 || size < 1 + *num_handles * 4)
+		return;
+
+	for (i = 0; i < *num_handles; i++, ptr += 4) {
+		uint16_t handle = get_le16(ptr) & 0x0fff;
+		uint16_t count = get_le16(ptr + 2);
+		struct hci_conn *conn;
+		uint16_t n;
+
+		conn = queue_find(dev->conn_list, conn_match_handle,
+							UINT_TO_PTR(handle));
+		if (!conn)
+			continue;
+
+		for (n = 0; n < count; n++) {
+			struct timeval *sent;
+
+			sent = queue_pop_head(conn->tx_queue);
+			if (!sent)
+				break;
+
+			hist_add(&conn->tx_latency, tv_diff(sent, tv));
+			free(sent);
+		}
+
+		credits_release(conn_credits(dev, conn), tv, count);
+	}
+}
+
+static void evt_le_meta_event(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const uint8_t *subevent = data;
+	const struct bt_hci_evt_le_conn_complete *cc;
+	const struct bt_hci_evt_le_enhanced_conn_complete *ecc;
+
+	if (size < 1)
+		return;
+
+	data += 1;
+	size -= 1;
+
+	switch (*subevent) {
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+		cc = data;
+		if (size < sizeof(*cc) || cc->status)
+			return;
+		conn_setup(dev, tv, le16_to_cpu(cc->handle), CONN_TYPE_LE,
+								cc->peer_addr);
+		break;
+	case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE:
+		ecc = data;
+		if (size < sizeof(*ecc) || ecc->status)
+			return;
+		conn_setup(dev, tv, le16_to_cpu(ecc->handle), CONN_TYPE_LE,
+							ecc->peer_addr);
+		break;
 	}
 }
 
@@ -212,6 +1205,9 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	const struct bt_hci_evt_hdr *hdr = data;
 	struct hci_dev *dev;
 
+	if (size < sizeof(*hdr))
+		return;
+
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
 
@@ -225,14 +1221,145 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	case BT_HCI_EVT_CMD_COMPLETE:
 		evt_cmd_complete(dev, tv, data, size);
 		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		evt_cmd_status(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_CONN_COMPLETE:
+		evt_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_SYNC_CONN_COMPLETE:
+		evt_sync_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		evt_disconnect_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		evt_num_completed_packets(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		evt_le_meta_event(dev, tv, data, size);
+		break;
 	}
 }
 
-static void acl_pkt(struct timeval *tv, uint16_t index,
+static bool chan_match_cid(const void *a, const void *b)
+{
+	const struct l2cap_chan *chan = a;
+
+	return chan->cid == PTR_TO_UINT(b);
+}
+
+static bool att_is_request(uint8_t opcode)
+{
+	switch (opcode) {
+	case 0x02:	/* Exchange MTU Request */
+	case 0x04:	/* Find Information Request */
+	case 0x06:	/* Find By Type Value Request */
+	case 0x08:	/* Read By Type Request */
+	case 0x0a:	/* Read Request */
+	case 0x0c:	/* Read Blob Request */
+	case 0x0e:	/* Read Multiple Request */
+	case 0x10:	/* Read By Group Type Request */
+	case 0x12:	/* Write Request */
+	case 0x16:	/* Prepare Write Request */
+	case 0x18:	/* Execute Write Request */
+	case 0x1d:	/* Handle Value Indication */
+		return true;
+	}
+
+	return false;
+}
+
+static bool att_is_response(uint8_t opcode)
+{
+	switch (opcode) {
+	case 0x01:	/* Error Response */
+	case 0x03:	/* Exchange MTU Response */
+	case 0x05:	/* Find Information Response */
+	case 0x07:	/* Find By Type Value Response */
+	case 0x09:	/* Read By Type Response */
+	case 0x0b:	/* Read Response */
+	case 0x0d:	/* Read Blob Response */
+	case 0x0f:	/* Read Multiple Response */
+	case 0x11:	/* Read By Group Type Response */
+	case 0x13:	/* Write Response */
+	case 0x17:	/* Prepare Write Response */
+	case 0x19:	/* Execute Write Response */
+	case 0x1e:	/* Handle Value Confirmation */
+		return true;
+	}
+
+	return false;
+}
+
+static void att_pdu(struct hci_conn *conn, struct timeval *tv, bool out,
+					const uint8_t *data, uint16_t size)
+{
+	if (size < 1)
+		return;
+
+	/* Requests and responses are tracked per requesting side, so
+	 * slot 0 holds local requests and slot 1 remote requests.
+	 */
+	if (att_is_request(data[0])) {
+		conn->att_pending[out ? 0 : 1] = true;
+		conn->att_req[out ? 0 : 1] = *tv;
+	} else if (att_is_response(data[0])) {
+		unsigned int slot = out ? 1 : 0;
+
+		if (!conn->att_pending[slot])
+			return;
+
+		conn->att_pending[slot] = false;
+		hist_add(&conn->att_latency,
+				tv_diff(&conn->att_req[slot], tv));
+	}
+}
+
+static void l2cap_frame(struct hci_conn *conn, struct timeval *tv, bool out,
+					const void *data, uint16_t size)
+{
+	const struct bt_l2cap_hdr *hdr = data;
+	struct l2cap_chan *chan;
+	uint16_t cid, len;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	len = le16_to_cpu(hdr->len);
+	cid = le16_to_cpu(hdr->cid);
+
+	chan = queue_find(conn->chan_list, chan_match_cid, UINT_TO_PTR(cid));
+	if (!chan) {
+		chan = new0(struct l2cap_chan, 1);
+		chan->cid = cid;
+		queue_push_tail(conn->chan_list, chan);
+	}
+
+	if (out) {
+		chan->tx_frames++;
+		chan->tx_bytes += len;
+	} else {
+		chan->rx_frames++;
+		chan->rx_bytes += len;
+	}
+
+	if (cid == 0x0004)
+		att_pdu(conn, tv, out, data + sizeof(*hdr),
+						size - sizeof(*hdr));
+}
+
+static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_acl_hdr *hdr = data;
+	struct hci_conn *conn;
 	struct hci_dev *dev;
+	uint16_t handle;
+	uint8_t flags;
+
+	if (size < sizeof(*hdr))
+		return;
 
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
@@ -242,14 +1369,40 @@ static void acl_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_acl++;
+
+	handle = le16_to_cpu(hdr->handle);
+	flags = handle >> 12;
+	handle &= 0x0fff;
+
+	conn = conn_lookup(dev, handle, CONN_TYPE_ACL);
+
+	conn_account(conn, tv, out, size);
+
+	if (out) {
+		struct timeval *sent;
+
+		sent = new0(struct timeval, 1);
+		*sent = *tv;
+		queue_push_tail(conn->tx_queue, sent);
+
+		credits_consume(conn_credits(dev, conn), tv);
+	}
+
+	/* Only start fragments carry the L2CAP header */
+	if ((flags & 0x03) != 0x01)
+		l2cap_frame(conn, tv, out, data, size);
 }
 
-static void sco_pkt(struct timeval *tv, uint16_t index,
+static void sco_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_sco_hdr *hdr = data;
+	struct hci_conn *conn;
 	struct hci_dev *dev;
 
+	if (size < sizeof(*hdr))
+		return;
+
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
 
@@ -258,6 +1411,11 @@ static void sco_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_sco++;
+
+	conn = conn_lookup(dev, le16_to_cpu(hdr->handle) & 0x0fff,
+							CONN_TYPE_SCO);
+
+	conn_account(conn, tv, out, size);
 }
 
 static void info_index(struct timeval *tv, uint16_t index,
@@ -324,11 +1482,66 @@ static void unknown_opcode(struct timeval *tv, uint16_t index,
 	dev->unknown++;
 }
 
+static void analyze_packet(struct timeval *tv, uint16_t index,
+				uint16_t opcode, const void *data,
+				uint16_t size, void *user_data)
+{
+	unsigned long *num_packets = user_data;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+		new_index(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_DEL_INDEX:
+		del_index(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		command_pkt(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		event_pkt(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		acl_pkt(tv, index, opcode == BTSNOOP_OPCODE_ACL_TX_PKT,
+							data, size);
+		break;
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		sco_pkt(tv, index, opcode == BTSNOOP_OPCODE_SCO_TX_PKT,
+							data, size);
+		break;
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+		break;
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		info_index(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_VENDOR_DIAG:
+		vendor_diag(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_SYSTEM_NOTE:
+		system_note(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_USER_LOGGING:
+		user_log(tv, index, data, size);
+		break;
+	default:
+		fprintf(stderr, "Unknown opcode %u\n", opcode);
+		unknown_opcode(tv, index, data, size);
+		break;
+	}
+
+	(*num_packets)++;
+}
+
 void analyze_trace(const char *path)
 {
 	struct btsnoop *btsnoop_file;
 	unsigned long num_packets = 0;
+	struct json_list list = { .first = true };
 	uint32_t format;
+	int err;
 
 	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
 	if (!btsnoop_file)
@@ -347,6 +1560,17 @@ void analyze_trace(const char *path)
 	}
 
 	dev_list = queue_new();
+	dev_done = queue_new();
+
+	if (seek_enabled()) {
+		/* Statistics depend on packet order, so never use workers */
+		err = seek_replay(btsnoop_file, path, analyze_packet,
+								&num_packets);
+		if (err && err != -ENOENT)
+			fprintf(stderr, "Failed to read selected packets\n");
+		if (err != -ENOENT)
+			goto report;
+	}
 
 	while (1) {
 		unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
@@ -357,53 +1581,28 @@ void analyze_trace(const char *path)
 								buf, &pktlen))
 			break;
 
-		switch (opcode) {
-		case BTSNOOP_OPCODE_NEW_INDEX:
-			new_index(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_DEL_INDEX:
-			del_index(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_COMMAND_PKT:
-			command_pkt(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_EVENT_PKT:
-			event_pkt(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_ACL_TX_PKT:
-		case BTSNOOP_OPCODE_ACL_RX_PKT:
-			acl_pkt(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_SCO_TX_PKT:
-		case BTSNOOP_OPCODE_SCO_RX_PKT:
-			sco_pkt(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_OPEN_INDEX:
-		case BTSNOOP_OPCODE_CLOSE_INDEX:
-			break;
-		case BTSNOOP_OPCODE_INDEX_INFO:
-			info_index(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_VENDOR_DIAG:
-			vendor_diag(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_SYSTEM_NOTE:
-			system_note(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_USER_LOGGING:
-			user_log(&tv, index, buf, pktlen);
-			break;
-		default:
-			fprintf(stderr, "Unknown opcode %u\n", opcode);
-			unknown_opcode(&tv, index, buf, pktlen);
-			break;
-		}
-
-		num_packets++;
+		analyze_packet(&tv, index, opcode, buf, pktlen, &num_packets);
 	}
 
-	printf("Trace contains %lu packets\n\n", num_packets);
+report:
+	switch (output_format) {
+	case FORMAT_TEXT:
+		queue_foreach(dev_done, dev_print, NULL);
+		queue_foreach(dev_list, dev_print, NULL);
+		printf("Trace contains %lu packets\n\n", num_packets);
+		break;
+	case FORMAT_CSV:
+		print_csv();
+		break;
+	case FORMAT_JSON:
+		printf("{\"packets\":%lu,\"controllers\":[", num_packets);
+		queue_foreach(dev_done, dev_print_json, &list);
+		queue_foreach(dev_list, dev_print_json, &list);
+		printf("]}\n");
+		break;
+	}
 
+	queue_destroy(dev_done, dev_destroy);
 	queue_destroy(dev_list, dev_destroy);
 
 done:
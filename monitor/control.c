@@ -53,9 +53,11 @@
 #include "hcidump.h"
 #include "ellisys.h"
 #include "tty.h"
+#include "seek.h"
 #include "control.h"
 
 static struct btsnoop *btsnoop_file = NULL;
+static int btsnoop_flush_id = -1;
 static bool hcidump_fallback = false;
 
 struct control_data {
@@ -1360,23 +1362,77 @@ int control_tty(const char *path, unsigned int speed)
 	return 0;
 }
 
-bool control_writer(const char *path)
+bool control_writer(const char *path, size_t max_size,
+						unsigned int max_count)
 {
-	btsnoop_file = btsnoop_create(path, BTSNOOP_FORMAT_MONITOR);
+	btsnoop_file = btsnoop_create(path, max_size, max_count,
+						BTSNOOP_FORMAT_MONITOR);
 
 	return !!btsnoop_file;
 }
 
-void control_reader(const char *path)
+static void flush_callback(int id, void *user_data)
+{
+	btsnoop_flush(btsnoop_file);
+
+	mainloop_modify_timeout(id, PTR_TO_UINT(user_data));
+}
+
+bool control_writer_buffer(size_t size, unsigned int flush_interval)
+{
+	if (!btsnoop_set_buffer(btsnoop_file, size, flush_interval))
+		return false;
+
+	if (btsnoop_flush_id >= 0) {
+		mainloop_remove_timeout(btsnoop_flush_id);
+		btsnoop_flush_id = -1;
+	}
+
+	/* Packet timestamps only drive flushing while traffic flows, so
+	 * make sure an idle trace still reaches the disk.
+	 */
+	if (size && flush_interval)
+		btsnoop_flush_id = mainloop_add_timeout(flush_interval,
+					flush_callback,
+					UINT_TO_PTR(flush_interval), NULL);
+
+	return true;
+}
+
+void control_cleanup(void)
+{
+	if (btsnoop_flush_id >= 0) {
+		mainloop_remove_timeout(btsnoop_flush_id);
+		btsnoop_flush_id = -1;
+	}
+
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+static void seek_callback(struct timeval *tv, uint16_t index,
+				uint16_t opcode, const void *data,
+				uint16_t size, void *user_data)
+{
+	if (opcode == 0xffff)
+		return;
+
+	packet_monitor(tv, NULL, index, opcode, data, size);
+	ellisys_inject_hci(tv, index, opcode, data, size);
+}
+
+bool control_reader(const char *path)
 {
 	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
 	uint16_t pktlen;
 	uint32_t format;
 	struct timeval tv;
+	bool result = true;
+	int err;
 
 	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
 	if (!btsnoop_file)
-		return;
+		return false;
 
 	format = btsnoop_get_format(btsnoop_file);
 
@@ -1398,6 +1454,19 @@ void control_reader(const char *path)
 	case BTSNOOP_FORMAT_HCI:
 	case BTSNOOP_FORMAT_UART:
 	case BTSNOOP_FORMAT_MONITOR:
+		if (seek_enabled()) {
+			err = seek_reader(btsnoop_file, path, seek_callback,
+									NULL);
+			if (!err)
+				break;
+
+			/* Output may already be written, so never redo it */
+			if (err != -ENOENT) {
+				result = false;
+				break;
+			}
+		}
+
 		while (1) {
 			uint16_t index, opcode;
 
@@ -1429,6 +1498,8 @@ void control_reader(const char *path)
 	close_pager();
 
 	btsnoop_unref(btsnoop_file);
+
+	return result;
 }
 
 int control_tracing(void)
@@ -23,9 +23,13 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 
-bool control_writer(const char *path);
-void control_reader(const char *path);
+bool control_writer(const char *path, size_t max_size,
+						unsigned int max_count);
+bool control_writer_buffer(size_t size, unsigned int flush_interval);
+void control_cleanup(void);
+bool control_reader(const char *path);
 void control_server(const char *path);
 int control_tty(const char *path, unsigned int speed);
 int control_tracing(void);
@@ -29,11 +29,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
 
 #include "lib/bluetooth.h"
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
 #include "bt.h"
 #include "packet.h"
 #include "display.h"
@@ -88,11 +90,12 @@
 #define L2CAP_SAR_END		0x02
 #define L2CAP_SAR_CONTINUE	0x03
 
-#define MAX_CHAN 64
+#define HANDLE_HASH_SIZE 64
 
 struct chan_data {
 	uint16_t index;
 	uint16_t handle;
+	uint16_t id;
 	uint8_t ident;
 	uint16_t scid;
 	uint16_t dcid;
@@ -103,122 +106,272 @@ struct chan_data {
 	uint8_t  seq_num;
 };
 
-static struct chan_data chan_list[MAX_CHAN];
+struct frag_data {
+	void *buf;
+	uint16_t pos;
+	uint16_t len;
+	uint16_t cid;
+};
+
+struct handle_data {
+	uint16_t index;
+	uint16_t handle;
+	struct queue *chan_list;
+	struct frag_data frag[2];
+};
+
+static struct queue *handle_hash[HANDLE_HASH_SIZE];
+
+/* Channels moved to an AMP controller receive their frames on another
+ * controller index than the one used for signalling.
+ */
+static struct queue *amp_chan_list;
+
+static uint32_t *chan_ids;
+static unsigned int chan_ids_size;
+
+static uint16_t alloc_chan_id(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < chan_ids_size; i++) {
+		if (chan_ids[i] != 0xffffffff) {
+			uint16_t bit = ffs(~chan_ids[i]) - 1;
+
+			chan_ids[i] |= 1u << bit;
+			return i * 32 + bit;
+		}
+	}
+
+	chan_ids = realloc(chan_ids, (chan_ids_size + 1) * sizeof(uint32_t));
+	if (!chan_ids) {
+		fprintf(stderr, "Failed to allocate channel identifier\n");
+		exit(EXIT_FAILURE);
+	}
+
+	chan_ids[chan_ids_size] = 0x00000001;
+
+	return chan_ids_size++ * 32;
+}
+
+static void free_chan_id(uint16_t id)
+{
+	chan_ids[id / 32] &= ~(1u << (id % 32));
+}
+
+static void chan_free(void *data)
+{
+	struct chan_data *chan = data;
+
+	if (chan->ctrlid)
+		queue_remove(amp_chan_list, chan);
+
+	free_chan_id(chan->id);
+	free(chan);
+}
+
+static struct queue *handle_bucket(uint16_t index, uint16_t handle)
+{
+	unsigned int hash = ((index << 12) ^ handle) % HANDLE_HASH_SIZE;
+
+	if (!handle_hash[hash])
+		handle_hash[hash] = queue_new();
+
+	return handle_hash[hash];
+}
+
+static bool match_handle(const void *a, const void *b)
+{
+	const struct handle_data *data = a;
+	const struct handle_data *match = b;
+
+	return data->index == match->index && data->handle == match->handle;
+}
+
+static struct handle_data *find_handle(uint16_t index, uint16_t handle,
+								bool create)
+{
+	struct handle_data match = { .index = index, .handle = handle };
+	struct queue *bucket = handle_bucket(index, handle);
+	struct handle_data *data;
+
+	data = queue_find(bucket, match_handle, &match);
+	if (data || !create)
+		return data;
+
+	data = new0(struct handle_data, 1);
+	data->index = index;
+	data->handle = handle;
+	data->chan_list = queue_new();
+
+	queue_push_tail(bucket, data);
+
+	return data;
+}
+
+static void clear_fragment_buffer(struct frag_data *frag)
+{
+	free(frag->buf);
+	frag->buf = NULL;
+	frag->pos = 0;
+	frag->len = 0;
+}
+
+void l2cap_release_handle(uint16_t index, uint16_t handle)
+{
+	struct handle_data match = { .index = index, .handle = handle };
+	struct handle_data *data;
+
+	data = queue_remove_if(handle_bucket(index, handle), match_handle,
+								&match);
+	if (!data)
+		return;
+
+	clear_fragment_buffer(&data->frag[0]);
+	clear_fragment_buffer(&data->frag[1]);
+	queue_destroy(data->chan_list, chan_free);
+	free(data);
+}
+
+static struct queue *frame_chan_list(const struct l2cap_frame *frame)
+{
+	struct handle_data *data;
+
+	data = find_handle(frame->index, frame->handle, false);
+	if (!data)
+		return NULL;
+
+	return data->chan_list;
+}
 
 static void assign_scid(const struct l2cap_frame *frame,
 				uint16_t scid, uint16_t psm, uint8_t ctrlid)
 {
-	int i, n = -1;
+	struct handle_data *data;
+	struct chan_data *chan = NULL;
+	const struct queue_entry *entry;
 	uint8_t seq_num = 1;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (n < 0 && chan_list[i].handle == 0x0000) {
-			n = i;
-			continue;
-		}
-
-		if (chan_list[i].index != frame->index)
-			continue;
+	data = find_handle(frame->index, frame->handle, true);
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (entry = queue_get_entries(data->chan_list); entry;
+							entry = entry->next) {
+		struct chan_data *tmp = entry->data;
 
-		if (chan_list[i].psm == psm)
+		if (tmp->psm == psm)
 			seq_num++;
 
 		/* Don't break on match - we still need to go through all
 		 * channels to find proper seq_num.
 		 */
 		if (frame->in) {
-			if (chan_list[i].dcid == scid)
-				n = i;
+			if (tmp->dcid == scid)
+				chan = tmp;
 		} else {
-			if (chan_list[i].scid == scid)
-				n = i;
+			if (tmp->scid == scid)
+				chan = tmp;
 		}
 	}
 
-	if (n < 0)
-		return;
+	if (chan) {
+		if (chan->ctrlid)
+			queue_remove(amp_chan_list, chan);
+	} else {
+		chan = new0(struct chan_data, 1);
+		chan->id = alloc_chan_id();
+		queue_push_tail(data->chan_list, chan);
+	}
 
-	memset(&chan_list[n], 0, sizeof(chan_list[n]));
-	chan_list[n].index = frame->index;
-	chan_list[n].handle = frame->handle;
-	chan_list[n].ident = frame->ident;
+	chan->index = frame->index;
+	chan->handle = frame->handle;
+	chan->ident = frame->ident;
+
+	chan->scid = 0;
+	chan->dcid = 0;
 
 	if (frame->in)
-		chan_list[n].dcid = scid;
+		chan->dcid = scid;
 	else
-		chan_list[n].scid = scid;
+		chan->scid = scid;
+
+	chan->psm = psm;
+	chan->ctrlid = ctrlid;
+	chan->mode = 0;
+	chan->ext_ctrl = 0;
+
+	chan->seq_num = seq_num;
+
+	if (ctrlid) {
+		if (!amp_chan_list)
+			amp_chan_list = queue_new();
+
+		queue_push_tail(amp_chan_list, chan);
+	}
+}
 
-	chan_list[n].psm = psm;
-	chan_list[n].ctrlid = ctrlid;
-	chan_list[n].mode = 0;
+static bool match_release(const void *a, const void *b)
+{
+	const struct chan_data *chan = a;
+	const struct l2cap_frame *frame = b;
+	uint16_t scid = frame->cid;
 
-	chan_list[n].seq_num = seq_num;
+	if (frame->in)
+		return chan->scid == scid;
+
+	return chan->dcid == scid;
 }
 
 static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
 {
-	int i;
+	struct l2cap_frame match = *frame;
+	struct queue *chan_list;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	chan_list = frame_chan_list(frame);
+	if (!chan_list)
+		return;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	match.cid = scid;
 
-		if (frame->in) {
-			if (chan_list[i].scid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
-		}
-	}
+	chan = queue_remove_if(chan_list, match_release, &match);
+	if (chan)
+		chan_free(chan);
 }
 
 static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
 								uint16_t scid)
 {
-	int i;
+	const struct queue_entry *entry;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	entry = queue_get_entries(frame_chan_list(frame));
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (; entry; entry = entry->next) {
+		struct chan_data *chan = entry->data;
 
-		if (frame->ident != 0 && chan_list[i].ident != frame->ident)
+		if (frame->ident != 0 && chan->ident != frame->ident)
 			continue;
 
 		if (frame->in) {
 			if (scid) {
-				if (chan_list[i].scid == scid) {
-					chan_list[i].dcid = dcid;
+				if (chan->scid == scid) {
+					chan->dcid = dcid;
 					break;
 				}
 			} else {
-				if (chan_list[i].scid && !chan_list[i].dcid) {
-					chan_list[i].dcid = dcid;
+				if (chan->scid && !chan->dcid) {
+					chan->dcid = dcid;
 					break;
 				}
 			}
 		} else {
 			if (scid) {
-				if (chan_list[i].dcid == scid) {
-					chan_list[i].scid = dcid;
+				if (chan->dcid == scid) {
+					chan->scid = dcid;
 					break;
 				}
 			} else {
-				if (chan_list[i].dcid && !chan_list[i].scid) {
-					chan_list[i].scid = dcid;
+				if (chan->dcid && !chan->scid) {
+					chan->scid = dcid;
 					break;
 				}
 			}
@@ -226,134 +379,139 @@ static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
 	}
 }
 
-static void assign_mode(const struct l2cap_frame *frame,
-					uint8_t mode, uint16_t dcid)
+static struct chan_data *find_dcid(const struct l2cap_frame *frame,
+								uint16_t dcid)
 {
-	int i;
+	const struct queue_entry *entry;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	entry = queue_get_entries(frame_chan_list(frame));
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (; entry; entry = entry->next) {
+		struct chan_data *chan = entry->data;
 
 		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
+			if (chan->scid == dcid)
+				return chan;
 		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
+			if (chan->dcid == dcid)
+				return chan;
 		}
 	}
+
+	return NULL;
 }
 
-static int get_chan_data_index(const struct l2cap_frame *frame)
+static void assign_mode(const struct l2cap_frame *frame,
+					uint8_t mode, uint16_t dcid)
 {
-	int i;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	chan = find_dcid(frame, dcid);
+	if (chan)
+		chan->mode = mode;
+}
+
+static bool match_frame_cid(const struct chan_data *chan,
+					const struct l2cap_frame *frame)
+{
+	if (chan->handle != frame->handle)
+		return false;
+
+	if (frame->in)
+		return chan->scid == frame->cid;
+
+	return chan->dcid == frame->cid;
+}
+
+static struct chan_data *get_chan_data(const struct l2cap_frame *frame)
+{
+	const struct queue_entry *entry;
 
-		if (chan_list[i].ctrlid != 0 &&
-					chan_list[i].ctrlid != frame->index)
+	entry = queue_get_entries(frame_chan_list(frame));
+
+	for (; entry; entry = entry->next) {
+		struct chan_data *chan = entry->data;
+
+		if (chan->ctrlid != 0)
 			continue;
 
-		if (chan_list[i].handle != frame->handle)
+		if (match_frame_cid(chan, frame))
+			return chan;
+	}
+
+	entry = queue_get_entries(amp_chan_list);
+
+	for (; entry; entry = entry->next) {
+		struct chan_data *chan = entry->data;
+
+		if (chan->ctrlid != frame->index)
 			continue;
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return i;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return i;
-		}
+		if (match_frame_cid(chan, frame))
+			return chan;
 	}
 
-	return -1;
+	return NULL;
 }
 
 static uint16_t get_psm(const struct l2cap_frame *frame)
 {
-	int i = get_chan_data_index(frame);
+	struct chan_data *chan = get_chan_data(frame);
 
-	if (i < 0)
+	if (!chan)
 		return 0;
 
-	return chan_list[i].psm;
+	return chan->psm;
 }
 
 static uint8_t get_mode(const struct l2cap_frame *frame)
 {
-	int i = get_chan_data_index(frame);
+	struct chan_data *chan = get_chan_data(frame);
 
-	if (i < 0)
+	if (!chan)
 		return 0;
 
-	return chan_list[i].mode;
+	return chan->mode;
 }
 
 static uint16_t get_chan(const struct l2cap_frame *frame)
 {
-	int i = get_chan_data_index(frame);
+	struct chan_data *chan = get_chan_data(frame);
 
-	if (i < 0)
+	if (!chan)
 		return 0;
 
-	return i;
+	return chan->id;
 }
 
 static uint8_t get_seq_num(const struct l2cap_frame *frame)
 {
-	int i = get_chan_data_index(frame);
+	struct chan_data *chan = get_chan_data(frame);
 
-	if (i < 0)
+	if (!chan)
 		return 0;
 
-	return chan_list[i].seq_num;
+	return chan->seq_num;
 }
 
 static void assign_ext_ctrl(const struct l2cap_frame *frame,
 					uint8_t ext_ctrl, uint16_t dcid)
 {
-	int i;
-
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
-
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	struct chan_data *chan;
 
-		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		}
-	}
+	chan = find_dcid(frame, dcid);
+	if (chan)
+		chan->ext_ctrl = ext_ctrl;
 }
 
 static uint8_t get_ext_ctrl(const struct l2cap_frame *frame)
 {
-	int i = get_chan_data_index(frame);
+	struct chan_data *chan = get_chan_data(frame);
 
-	if (i < 0)
+	if (!chan)
 		return 0;
 
-	return chan_list[i].ext_ctrl;
+	return chan->ext_ctrl;
 }
 
 static char *sar2str(uint8_t sar)
@@ -459,25 +617,6 @@ static void l2cap_ctrl_parse(struct l2cap_frame *frame, uint32_t ctrl)
 		printf(" F-bit");
 }
 
-#define MAX_INDEX 16
-
-struct index_data {
-	void *frag_buf;
-	uint16_t frag_pos;
-	uint16_t frag_len;
-	uint16_t frag_cid;
-};
-
-static struct index_data index_list[MAX_INDEX][2];
-
-static void clear_fragment_buffer(uint16_t index, bool in)
-{
-	free(index_list[index][in].frag_buf);
-	index_list[index][in].frag_buf = NULL;
-	index_list[index][in].frag_pos = 0;
-	index_list[index][in].frag_len = 0;
-}
-
 static void print_psm(uint16_t psm)
 {
 	print_field("PSM: %d (0x%4.4x)", le16_to_cpu(psm), le16_to_cpu(psm));
@@ -3116,21 +3255,21 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 					const void *data, uint16_t size)
 {
 	const struct bt_l2cap_hdr *hdr = data;
+	struct frag_data *frag;
 	uint16_t len, cid;
 
-	if (index > MAX_INDEX - 1) {
-		print_text(COLOR_ERROR, "controller index too large");
-		packet_hexdump(data, size);
-		return;
-	}
+	/* Fragments are reassembled per connection handle and direction
+	 * since controllers interleave ACL packets of different links.
+	 */
+	frag = &find_handle(index, handle, true)->frag[in];
 
 	switch (flags) {
 	case 0x00:	/* start of a non-automatically-flushable PDU */
 	case 0x02:	/* start of an automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected start frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
@@ -3158,54 +3297,51 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 			return;
 		}
 
-		index_list[index][in].frag_buf = malloc(len);
-		if (!index_list[index][in].frag_buf) {
+		frag->buf = malloc(len);
+		if (!frag->buf) {
 			print_text(COLOR_ERROR, "failed buffer allocation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		memcpy(index_list[index][in].frag_buf, data, size);
-		index_list[index][in].frag_pos = size;
-		index_list[index][in].frag_len = len - size;
-		index_list[index][in].frag_cid = cid;
+		memcpy(frag->buf, data, size);
+		frag->pos = size;
+		frag->len = len - size;
+		frag->cid = cid;
 		break;
 
 	case 0x01:	/* continuing fragment */
-		if (!index_list[index][in].frag_len) {
+		if (!frag->len) {
 			print_text(COLOR_ERROR, "unexpected continuation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		if (size > index_list[index][in].frag_len) {
+		if (size > frag->len) {
 			print_text(COLOR_ERROR, "fragment too long");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
-		memcpy(index_list[index][in].frag_buf +
-				index_list[index][in].frag_pos, data, size);
-		index_list[index][in].frag_pos += size;
-		index_list[index][in].frag_len -= size;
+		memcpy(frag->buf + frag->pos, data, size);
+		frag->pos += size;
+		frag->len -= size;
 
-		if (!index_list[index][in].frag_len) {
+		if (!frag->len) {
 			/* complete frame */
-			l2cap_frame(index, in, handle,
-					index_list[index][in].frag_cid,
-					index_list[index][in].frag_buf,
-					index_list[index][in].frag_pos);
-			clear_fragment_buffer(index, in);
+			l2cap_frame(index, in, handle, frag->cid,
+						frag->buf, frag->pos);
+			clear_fragment_buffer(frag);
 			return;
 		}
 		break;
 
 	case 0x03:	/* complete automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected complete frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
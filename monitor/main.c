@@ -28,6 +28,9 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
@@ -41,6 +44,7 @@
 #include "analyze.h"
 #include "ellisys.h"
 #include "control.h"
+#include "seek.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -60,7 +64,16 @@ static void usage(void)
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t-z, --max-size <size>  Rotate trace file at size (K/M)\n"
+		"\t-c, --max-count <num>  Keep at most num rotated files\n"
+		"\t-b, --buffer <size>    Buffer trace writes up to size\n"
+		"\t-f, --flush <msec>     Flush buffered writes interval\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
+		"\t    --start <sec>      Show traces from time offset\n"
+		"\t    --end <sec>        Show traces up to time offset\n"
+		"\t    --handle <handle>  Show traces for connection handle\n"
+		"\t-j, --jobs <num>       Decode traces with num workers\n"
+		"\t-F, --format <format>  Analyze output (text, csv, json)\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
 		"\t-p, --priority <level> Show only priority or lower\n"
 		"\t-i, --index <num>      Show only specified controller\n"
@@ -73,12 +86,83 @@ static void usage(void)
 		"\t-h, --help             Show help options\n");
 }
 
+static bool parse_uint(const char *str, unsigned long long max,
+						unsigned long long *val,
+						char **endptr)
+{
+	/* strtoull() silently negates a leading minus sign */
+	if (!isdigit(*str))
+		return false;
+
+	errno = 0;
+	*val = strtoull(str, endptr, 10);
+	if (errno || *val > max)
+		return false;
+
+	return true;
+}
+
+static bool parse_count(const char *str, unsigned int *count)
+{
+	unsigned long long val;
+	char *endptr;
+
+	if (!parse_uint(str, UINT_MAX, &val, &endptr) || *endptr != '\0')
+		return false;
+
+	*count = val;
+
+	return true;
+}
+
+static size_t parse_size(const char *str)
+{
+	unsigned long long size, mult;
+	char *endptr;
+
+	if (!parse_uint(str, SIZE_MAX, &size, &endptr))
+		return 0;
+
+	switch (*endptr) {
+	case '\0':
+		return size;
+	case 'k':
+	case 'K':
+		mult = 1024;
+		break;
+	case 'm':
+	case 'M':
+		mult = 1024 * 1024;
+		break;
+	case 'g':
+	case 'G':
+		mult = 1024 * 1024 * 1024;
+		break;
+	default:
+		return 0;
+	}
+
+	if (endptr[1] != '\0' || size > SIZE_MAX / mult)
+		return 0;
+
+	return size * mult;
+}
+
 static const struct option main_options[] = {
 	{ "tty",     required_argument, NULL, 'd' },
 	{ "tty-speed", required_argument, NULL, 'B' },
 	{ "read",    required_argument, NULL, 'r' },
 	{ "write",   required_argument, NULL, 'w' },
+	{ "max-size",  required_argument, NULL, 'z' },
+	{ "max-count", required_argument, NULL, 'c' },
+	{ "buffer",  required_argument, NULL, 'b' },
+	{ "flush",   required_argument, NULL, 'f' },
 	{ "analyze", required_argument, NULL, 'a' },
+	{ "start",   required_argument, NULL, '1' },
+	{ "end",     required_argument, NULL, '2' },
+	{ "handle",  required_argument, NULL, '3' },
+	{ "jobs",    required_argument, NULL, 'j' },
+	{ "format",  required_argument, NULL, 'F' },
 	{ "server",  required_argument, NULL, 's' },
 	{ "priority",required_argument, NULL, 'p' },
 	{ "index",   required_argument, NULL, 'i' },
@@ -97,7 +181,12 @@ int main(int argc, char *argv[])
 	unsigned long filter_mask = 0;
 	const char *reader_path = NULL;
 	const char *writer_path = NULL;
+	size_t writer_max_size = 0;
+	unsigned int writer_max_count = 0;
+	size_t writer_buf_size = 0;
+	unsigned int writer_flush = 1000;
 	const char *analyze_path = NULL;
+	bool decode_jobs = false;
 	const char *ellisys_server = NULL;
 	const char *tty = NULL;
 	unsigned int tty_speed = B115200;
@@ -113,7 +202,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "d:r:w:a:s:p:i:tTSE:vh",
+		opt = getopt_long(argc, argv, "d:r:w:z:c:b:f:a:j:F:s:p:i:tTSE:vh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -135,9 +224,67 @@ int main(int argc, char *argv[])
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'z':
+			writer_max_size = parse_size(optarg);
+			if (!writer_max_size) {
+				fprintf(stderr, "Invalid size: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			if (!parse_count(optarg, &writer_max_count)) {
+				fprintf(stderr, "Invalid count: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b':
+			writer_buf_size = parse_size(optarg);
+			if (!writer_buf_size) {
+				fprintf(stderr, "Invalid size: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'f':
+			if (!parse_count(optarg, &writer_flush)) {
+				fprintf(stderr, "Invalid interval: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
+		case '1':
+			if (!seek_set_start(optarg)) {
+				fprintf(stderr, "Invalid time: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case '2':
+			if (!seek_set_end(optarg)) {
+				fprintf(stderr, "Invalid time: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case '3':
+			if (!seek_set_handle(optarg)) {
+				fprintf(stderr, "Invalid handle: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'j':
+			if (!seek_set_jobs(optarg)) {
+				fprintf(stderr, "Invalid jobs: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			decode_jobs = true;
+			break;
+		case 'F':
+			if (!analyze_set_format(optarg)) {
+				fprintf(stderr, "Invalid format: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 's':
 			control_server(optarg);
 			break;
@@ -196,13 +343,37 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (seek_enabled() && !reader_path && !analyze_path) {
+		fprintf(stderr, "Ranges and decoding jobs require reading "
+							"or analyzing\n");
+		return EXIT_FAILURE;
+	}
+
+	if (decode_jobs && analyze_path) {
+		fprintf(stderr, "Decoding jobs can't be combined with "
+							"analyze\n");
+		return EXIT_FAILURE;
+	}
+
+	if (seek_enabled() && ellisys_server) {
+		fprintf(stderr, "Ranges and decoding jobs can't be combined "
+							"with Ellisys\n");
+		return EXIT_FAILURE;
+	}
+
+	if (writer_max_count && !writer_max_size) {
+		fprintf(stderr, "Rotating files requires a maximum size\n");
+		return EXIT_FAILURE;
+	}
+
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
 
 	mainloop_set_signal(&mask, signal_callback, NULL, NULL);
 
-	printf("Bluetooth monitor ver %s\n", VERSION);
+	if (!analyze_path || analyze_text_format())
+		printf("Bluetooth monitor ver %s\n", VERSION);
 
 	keys_setup();
 
@@ -217,15 +388,24 @@ int main(int argc, char *argv[])
 		if (ellisys_server)
 			ellisys_enable(ellisys_server, ellisys_port);
 
-		control_reader(reader_path);
+		if (!control_reader(reader_path))
+			return EXIT_FAILURE;
+
 		return EXIT_SUCCESS;
 	}
 
-	if (writer_path && !control_writer(writer_path)) {
+	if (writer_path && !control_writer(writer_path, writer_max_size,
+							writer_max_count)) {
 		printf("Failed to open '%s'\n", writer_path);
 		return EXIT_FAILURE;
 	}
 
+	if (writer_path && writer_buf_size &&
+			!control_writer_buffer(writer_buf_size, writer_flush)) {
+		printf("Failed to set up buffer for '%s'\n", writer_path);
+		return EXIT_FAILURE;
+	}
+
 	if (ellisys_server)
 		ellisys_enable(ellisys_server, ellisys_port);
 
@@ -237,6 +417,8 @@ int main(int argc, char *argv[])
 
 	exit_status = mainloop_run();
 
+	control_cleanup();
+
 	keys_cleanup();
 
 	return exit_status;
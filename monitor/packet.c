@@ -43,6 +43,7 @@
 #include "lib/hci_lib.h"
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
 #include "src/shared/btsnoop.h"
 #include "display.h"
 #include "bt.h"
@@ -95,51 +96,78 @@ static uint16_t index_current = 0;
 
 #define UNKNOWN_MANUFACTURER 0xffff
 
-#define MAX_CONN 16
+#define CONN_HASH_SIZE 64
 
 struct conn_data {
+	uint16_t index;
 	uint16_t handle;
 	uint8_t  type;
 };
 
-static struct conn_data conn_list[MAX_CONN];
+static struct queue *conn_hash[CONN_HASH_SIZE];
+
+static struct queue *conn_bucket(uint16_t index, uint16_t handle)
+{
+	unsigned int hash = ((index << 12) ^ handle) % CONN_HASH_SIZE;
+
+	if (!conn_hash[hash])
+		conn_hash[hash] = queue_new();
+
+	return conn_hash[hash];
+}
+
+static bool match_conn(const void *a, const void *b)
+{
+	const struct conn_data *conn = a;
+	const struct conn_data *match = b;
+
+	return conn->index == match->index && conn->handle == match->handle;
+}
+
+static struct conn_data *find_conn(uint16_t handle)
+{
+	struct conn_data match = { .index = index_current, .handle = handle };
+
+	return queue_find(conn_bucket(index_current, handle), match_conn,
+								&match);
+}
 
 static void assign_handle(uint16_t handle, uint8_t type)
 {
-	int i;
+	struct conn_data *conn;
 
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == 0x0000) {
-			conn_list[i].handle = handle;
-			conn_list[i].type = type;
-			break;
-		}
+	conn = find_conn(handle);
+	if (!conn) {
+		conn = new0(struct conn_data, 1);
+		conn->index = index_current;
+		conn->handle = handle;
+		queue_push_tail(conn_bucket(index_current, handle), conn);
 	}
+
+	conn->type = type;
 }
 
 static void release_handle(uint16_t handle)
 {
-	int i;
+	struct conn_data match = { .index = index_current, .handle = handle };
+	struct conn_data *conn;
 
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == handle) {
-			conn_list[i].handle = 0x0000;
-			conn_list[i].type = 0x00;
-			break;
-		}
-	}
+	conn = queue_remove_if(conn_bucket(index_current, handle), match_conn,
+								&match);
+	free(conn);
+
+	l2cap_release_handle(index_current, handle);
 }
 
 static uint8_t get_type(uint16_t handle)
 {
-	int i;
+	struct conn_data *conn;
 
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == handle)
-			return conn_list[i].type;
-	}
+	conn = find_conn(handle);
+	if (!conn)
+		return 0xff;
 
-	return 0xff;
+	return conn->type;
 }
 
 void packet_set_filter(unsigned long filter)
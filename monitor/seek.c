@@ -0,0 +1,1065 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2014  Intel Corporation
+ *  Copyright (C) 2002-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "src/shared/util.h"
+#include "src/shared/btsnoop.h"
+#include "monitor/bt.h"
+#include "display.h"
+#include "seek.h"
+
+/*
+ * The sidecar index is stored next to the trace as <trace>.idx and is
+ * only used when the size and modification time of the trace still
+ * match the values recorded in its header.
+ */
+struct seek_file_hdr {
+	uint8_t  id[8];
+	uint32_t version;
+	uint32_t entry_size;
+	uint64_t trace_size;
+	uint64_t trace_mtime;
+	uint64_t count;
+} __attribute__((packed));
+
+static const uint8_t seek_file_id[] = { 'b', 't', 'm', 'o',
+					'n', 'i', 'd', 'x' };
+
+static const uint32_t seek_file_version = 2;
+
+struct seek_index {
+	struct seek_entry *entries;
+	unsigned long count;
+	unsigned long alloc;
+};
+
+/* Commands for the filtered handle that still wait for their result */
+#define MAX_PENDING_COMMANDS	16
+
+struct seek_command {
+	uint16_t index;
+	uint16_t opcode;
+};
+
+static bool start_filter = false;
+static uint64_t start_offset;
+static bool end_filter = false;
+static uint64_t end_offset;
+static bool handle_filter = false;
+static uint16_t handle_number;
+static unsigned int num_jobs = 1;
+
+static bool parse_time(const char *str, uint64_t *usec)
+{
+	char *endptr;
+	double val;
+
+	val = strtod(str, &endptr);
+	if (endptr == str || *endptr != '\0' || val < 0)
+		return false;
+
+	*usec = val * 1000000.0;
+
+	return true;
+}
+
+bool seek_set_start(const char *str)
+{
+	if (!parse_time(str, &start_offset))
+		return false;
+
+	start_filter = true;
+
+	return true;
+}
+
+bool seek_set_end(const char *str)
+{
+	if (!parse_time(str, &end_offset))
+		return false;
+
+	end_filter = true;
+
+	return true;
+}
+
+bool seek_set_handle(const char *str)
+{
+	unsigned long val;
+	char *endptr;
+
+	val = strtoul(str, &endptr, 0);
+	if (endptr == str || *endptr != '\0' || val > 0x0eff)
+		return false;
+
+	handle_filter = true;
+	handle_number = val;
+
+	return true;
+}
+
+bool seek_set_jobs(const char *str)
+{
+	unsigned long val;
+	char *endptr;
+
+	val = strtoul(str, &endptr, 10);
+	if (endptr == str || *endptr != '\0' || !val || val > 256)
+		return false;
+
+	num_jobs = val;
+
+	return true;
+}
+
+bool seek_enabled(void)
+{
+	return start_filter || end_filter || handle_filter || num_jobs > 1;
+}
+
+static uint16_t cmd_handle(const void *data, uint16_t size)
+{
+	const struct bt_hci_cmd_hdr *hdr = data;
+
+	if (size < sizeof(*hdr) + 2)
+		return SEEK_HANDLE_NONE;
+
+	switch (le16_to_cpu(hdr->opcode)) {
+	case BT_HCI_CMD_DISCONNECT:
+	case BT_HCI_CMD_AUTH_REQUESTED:
+	case BT_HCI_CMD_SET_CONN_ENCRYPT:
+	case BT_HCI_CMD_READ_REMOTE_FEATURES:
+	case BT_HCI_CMD_READ_REMOTE_EXT_FEATURES:
+	case BT_HCI_CMD_READ_REMOTE_VERSION:
+	case BT_HCI_CMD_LE_CONN_UPDATE:
+	case BT_HCI_CMD_LE_READ_REMOTE_FEATURES:
+	case BT_HCI_CMD_LE_START_ENCRYPT:
+	case BT_HCI_CMD_LE_LTK_REQ_REPLY:
+	case BT_HCI_CMD_LE_LTK_REQ_NEG_REPLY:
+	case BT_HCI_CMD_LE_SET_DATA_LENGTH:
+		return get_le16(data + sizeof(*hdr)) & 0x0fff;
+	}
+
+	return SEEK_HANDLE_NONE;
+}
+
+static uint16_t le_meta_handle(const uint8_t *data, uint16_t size)
+{
+	if (size < 3)
+		return SEEK_HANDLE_NONE;
+
+	switch (data[0]) {
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+	case BT_HCI_EVT_LE_CONN_UPDATE_COMPLETE:
+	case BT_HCI_EVT_LE_REMOTE_FEATURES_COMPLETE:
+	case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE:
+		if (size < 4)
+			break;
+		return get_le16(data + 2) & 0x0fff;
+	case BT_HCI_EVT_LE_LONG_TERM_KEY_REQUEST:
+	case BT_HCI_EVT_LE_CONN_PARAM_REQUEST:
+	case BT_HCI_EVT_LE_DATA_LENGTH_CHANGE:
+		return get_le16(data + 1) & 0x0fff;
+	}
+
+	return SEEK_HANDLE_NONE;
+}
+
+static uint16_t evt_handle(const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_hdr *hdr = data;
+	const uint8_t *params = data + sizeof(*hdr);
+
+	if (size < sizeof(*hdr))
+		return SEEK_HANDLE_NONE;
+
+	size -= sizeof(*hdr);
+
+	switch (hdr->evt) {
+	case BT_HCI_EVT_CONN_COMPLETE:
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+	case BT_HCI_EVT_AUTH_COMPLETE:
+	case BT_HCI_EVT_ENCRYPT_CHANGE:
+	case BT_HCI_EVT_REMOTE_FEATURES_COMPLETE:
+	case BT_HCI_EVT_REMOTE_VERSION_COMPLETE:
+	case BT_HCI_EVT_MODE_CHANGE:
+	case BT_HCI_EVT_REMOTE_EXT_FEATURES_COMPLETE:
+	case BT_HCI_EVT_SYNC_CONN_COMPLETE:
+	case BT_HCI_EVT_ENCRYPT_KEY_REFRESH_COMPLETE:
+		if (size < 3)
+			break;
+		return get_le16(params + 1) & 0x0fff;
+	case BT_HCI_EVT_MAX_SLOTS_CHANGE:
+		if (size < 2)
+			break;
+		return get_le16(params) & 0x0fff;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		if (size < 3)
+			break;
+		/* Credits for several handles are returned together */
+		if (params[0] != 1)
+			return SEEK_HANDLE_ANY;
+		return get_le16(params + 1) & 0x0fff;
+	case BT_HCI_EVT_LE_META_EVENT:
+		return le_meta_handle(params, size);
+	}
+
+	return SEEK_HANDLE_NONE;
+}
+
+static void fill_codes(struct seek_entry *entry, const void *data,
+								uint16_t size)
+{
+	const struct bt_hci_evt_hdr *hdr = data;
+	const uint8_t *params = data + sizeof(*hdr);
+
+	entry->command = 0;
+	entry->event = 0;
+	entry->subevent = 0;
+
+	if (entry->opcode == BTSNOOP_OPCODE_COMMAND_PKT) {
+		if (size >= sizeof(struct bt_hci_cmd_hdr))
+			entry->command = get_le16(data);
+		return;
+	}
+
+	if (entry->opcode != BTSNOOP_OPCODE_EVENT_PKT || size < sizeof(*hdr))
+		return;
+
+	entry->event = hdr->evt;
+	size -= sizeof(*hdr);
+
+	switch (hdr->evt) {
+	case BT_HCI_EVT_CMD_COMPLETE:
+		if (size >= 3)
+			entry->command = get_le16(params + 1);
+		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		if (size >= 4)
+			entry->command = get_le16(params + 2);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		if (size >= 1)
+			entry->subevent = params[0];
+		break;
+	}
+}
+
+uint16_t seek_packet_handle(uint16_t opcode, const void *data, uint16_t size)
+{
+	switch (opcode) {
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		return cmd_handle(data, size);
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		return evt_handle(data, size);
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		if (size < 2)
+			break;
+		return get_le16(data) & 0x0fff;
+	}
+
+	return SEEK_HANDLE_NONE;
+}
+
+static bool index_append(struct seek_index *idx, const struct seek_entry *entry)
+{
+	if (idx->count == idx->alloc) {
+		unsigned long alloc = idx->alloc ? idx->alloc * 2 : 4096;
+		struct seek_entry *entries;
+
+		entries = realloc(idx->entries, alloc * sizeof(*entries));
+		if (!entries)
+			return false;
+
+		idx->entries = entries;
+		idx->alloc = alloc;
+	}
+
+	idx->entries[idx->count++] = *entry;
+
+	return true;
+}
+
+static bool index_build(struct seek_index *idx, struct btsnoop *btsnoop)
+{
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	struct seek_entry entry;
+	struct timeval tv;
+	uint16_t index, opcode, pktlen;
+
+	while (1) {
+		entry.offset = btsnoop_get_offset(btsnoop);
+
+		if (!btsnoop_read_hci(btsnoop, &tv, &index, &opcode,
+							buf, &pktlen))
+			break;
+
+		if (opcode == 0xffff)
+			continue;
+
+		entry.ts = tv.tv_sec * 1000000ll + tv.tv_usec;
+		entry.index = index;
+		entry.opcode = opcode;
+		entry.handle = seek_packet_handle(opcode, buf, pktlen);
+		fill_codes(&entry, buf, pktlen);
+		memset(entry.reserved, 0, sizeof(entry.reserved));
+
+		if (!index_append(idx, &entry))
+			return false;
+	}
+
+	return true;
+}
+
+static bool index_read(struct seek_index *idx, const char *path,
+							const struct stat *st)
+{
+	struct seek_file_hdr hdr;
+	struct stat idx_st;
+	uint64_t count;
+	unsigned long i;
+	ssize_t len;
+	size_t size;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &idx_st) < 0 || idx_st.st_size < (off_t) sizeof(hdr))
+		goto failed;
+
+	len = read(fd, &hdr, sizeof(hdr));
+	if (len != sizeof(hdr))
+		goto failed;
+
+	if (memcmp(hdr.id, seek_file_id, sizeof(seek_file_id)) ||
+			le32_to_cpu(hdr.version) != seek_file_version ||
+			le32_to_cpu(hdr.entry_size) !=
+						sizeof(struct seek_entry))
+		goto failed;
+
+	if (le64_to_cpu(hdr.trace_size) != (uint64_t) st->st_size ||
+			le64_to_cpu(hdr.trace_mtime) != (uint64_t) st->st_mtime)
+		goto failed;
+
+	/* A truncated or stale index must not size the allocation */
+	count = le64_to_cpu(hdr.count);
+	size = idx_st.st_size - sizeof(hdr);
+
+	if (size % sizeof(struct seek_entry) ||
+				count != size / sizeof(struct seek_entry))
+		goto failed;
+
+	idx->count = count;
+	idx->alloc = idx->count;
+
+	if (!idx->count)
+		goto done;
+
+	idx->entries = malloc(size);
+	if (!idx->entries)
+		goto failed;
+
+	len = read(fd, idx->entries, size);
+	if (len < 0 || (size_t) len != size) {
+		free(idx->entries);
+		idx->entries = NULL;
+		goto failed;
+	}
+
+	for (i = 0; i < idx->count; i++) {
+		struct seek_entry *entry = &idx->entries[i];
+
+		entry->offset = le64_to_cpu(entry->offset);
+		entry->ts = le64_to_cpu(entry->ts);
+		entry->index = le16_to_cpu(entry->index);
+		entry->opcode = le16_to_cpu(entry->opcode);
+		entry->handle = le16_to_cpu(entry->handle);
+		entry->command = le16_to_cpu(entry->command);
+	}
+
+done:
+	close(fd);
+	return true;
+
+failed:
+	idx->count = 0;
+	idx->alloc = 0;
+	close(fd);
+	return false;
+}
+
+static void index_write(struct seek_index *idx, const char *path,
+							const struct stat *st)
+{
+	struct seek_file_hdr hdr;
+	struct seek_entry entry;
+	unsigned long i;
+	FILE *fp;
+
+	/* The trace may live in a read-only location, so a missing
+	 * sidecar only means the index is rebuilt next time.
+	 */
+	fp = fopen(path, "we");
+	if (!fp)
+		return;
+
+	memcpy(hdr.id, seek_file_id, sizeof(seek_file_id));
+	hdr.version = cpu_to_le32(seek_file_version);
+	hdr.entry_size = cpu_to_le32(sizeof(struct seek_entry));
+	hdr.trace_size = cpu_to_le64(st->st_size);
+	hdr.trace_mtime = cpu_to_le64(st->st_mtime);
+	hdr.count = cpu_to_le64(idx->count);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto failed;
+
+	for (i = 0; i < idx->count; i++) {
+		entry.offset = cpu_to_le64(idx->entries[i].offset);
+		entry.ts = cpu_to_le64(idx->entries[i].ts);
+		entry.index = cpu_to_le16(idx->entries[i].index);
+		entry.opcode = cpu_to_le16(idx->entries[i].opcode);
+		entry.handle = cpu_to_le16(idx->entries[i].handle);
+		entry.command = cpu_to_le16(idx->entries[i].command);
+		entry.event = idx->entries[i].event;
+		entry.subevent = idx->entries[i].subevent;
+		memset(entry.reserved, 0, sizeof(entry.reserved));
+
+		if (fwrite(&entry, sizeof(entry), 1, fp) != 1)
+			goto failed;
+	}
+
+	if (fclose(fp) == 0)
+		return;
+
+	unlink(path);
+	return;
+
+failed:
+	fclose(fp);
+	unlink(path);
+}
+
+struct seek_index *seek_index_load(struct btsnoop *btsnoop, const char *path)
+{
+	struct seek_index *idx;
+	char idx_path[PATH_MAX];
+	uint64_t offset;
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return NULL;
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+
+	snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+
+	if (index_read(idx, idx_path, &st))
+		return idx;
+
+	offset = btsnoop_get_offset(btsnoop);
+
+	if (!index_build(idx, btsnoop)) {
+		seek_index_free(idx);
+		return NULL;
+	}
+
+	btsnoop_set_offset(btsnoop, offset);
+
+	index_write(idx, idx_path, &st);
+
+	return idx;
+}
+
+void seek_index_free(struct seek_index *idx)
+{
+	if (!idx)
+		return;
+
+	free(idx->entries);
+	free(idx);
+}
+
+unsigned long seek_index_count(struct seek_index *idx)
+{
+	if (!idx)
+		return 0;
+
+	return idx->count;
+}
+
+const struct seek_entry *seek_index_get(struct seek_index *idx,
+							unsigned long pos)
+{
+	if (!idx || pos >= idx->count)
+		return NULL;
+
+	return &idx->entries[pos];
+}
+
+unsigned long seek_index_find(struct seek_index *idx, uint64_t ts)
+{
+	unsigned long low = 0, high;
+
+	if (!idx)
+		return 0;
+
+	high = idx->count;
+
+	/* Lower bound search, so traces are assumed to be in time order */
+	while (low < high) {
+		unsigned long mid = low + (high - low) / 2;
+
+		if (idx->entries[mid].ts < ts)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static bool is_index_control(uint16_t opcode)
+{
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+	case BTSNOOP_OPCODE_DEL_INDEX:
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		return true;
+	}
+
+	return false;
+}
+
+static bool entry_match(const struct seek_entry *entry)
+{
+	if (!handle_filter)
+		return true;
+
+	if (is_index_control(entry->opcode))
+		return true;
+
+	return entry->handle == handle_number ||
+					entry->handle == SEEK_HANDLE_ANY;
+}
+
+static bool is_conn_setup(const struct seek_entry *entry)
+{
+	if (entry->opcode != BTSNOOP_OPCODE_EVENT_PKT ||
+					entry->handle >= SEEK_HANDLE_ANY)
+		return false;
+
+	switch (entry->event) {
+	case BT_HCI_EVT_CONN_COMPLETE:
+	case BT_HCI_EVT_SYNC_CONN_COMPLETE:
+		return true;
+	case BT_HCI_EVT_LE_META_EVENT:
+		return entry->subevent == BT_HCI_EVT_LE_CONN_COMPLETE ||
+			entry->subevent == BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE;
+	}
+
+	return false;
+}
+
+static bool is_disconnect(const struct seek_entry *entry)
+{
+	return entry->opcode == BTSNOOP_OPCODE_EVENT_PKT &&
+			entry->event == BT_HCI_EVT_DISCONNECT_COMPLETE;
+}
+
+static bool is_command_result(const struct seek_entry *entry)
+{
+	return entry->opcode == BTSNOOP_OPCODE_EVENT_PKT &&
+			(entry->event == BT_HCI_EVT_CMD_COMPLETE ||
+			entry->event == BT_HCI_EVT_CMD_STATUS);
+}
+
+/*
+ * Mark the connection setup of every connection that is still up when
+ * the selected range starts, so the connection can be decoded.
+ */
+static bool *select_context(struct seek_index *idx, unsigned long pos)
+{
+	unsigned long *live = NULL;
+	unsigned long num_live = 0, i, n;
+	bool *context;
+
+	context = calloc(pos ? pos : 1, sizeof(*context));
+	if (!context)
+		return NULL;
+
+	for (i = 0; i < pos; i++) {
+		const struct seek_entry *entry = &idx->entries[i];
+
+		if (!is_conn_setup(entry) && !is_disconnect(entry))
+			continue;
+
+		for (n = 0; n < num_live; n++) {
+			const struct seek_entry *conn = &idx->entries[live[n]];
+
+			if (conn->index == entry->index &&
+						conn->handle == entry->handle)
+				break;
+		}
+
+		if (n < num_live) {
+			context[live[n]] = false;
+			live[n] = live[--num_live];
+		}
+
+		if (is_disconnect(entry))
+			continue;
+
+		if (!(num_live % 64)) {
+			unsigned long *tmp;
+
+			tmp = realloc(live, (num_live + 64) * sizeof(*live));
+			if (!tmp) {
+				free(live);
+				free(context);
+				return NULL;
+			}
+
+			live = tmp;
+		}
+
+		live[num_live++] = i;
+		context[i] = true;
+	}
+
+	free(live);
+
+	return context;
+}
+
+static void add_command(struct seek_command *pending,
+					unsigned int *num_pending,
+					const struct seek_entry *entry)
+{
+	/* The oldest command most likely never got a result */
+	if (*num_pending == MAX_PENDING_COMMANDS) {
+		(*num_pending)--;
+		memmove(pending, pending + 1, *num_pending * sizeof(*pending));
+	}
+
+	pending[*num_pending].index = entry->index;
+	pending[*num_pending].opcode = entry->command;
+	(*num_pending)++;
+}
+
+/*
+ * Command Status and Command Complete only carry the opcode, so they are
+ * matched to the commands sent for the filtered handle.
+ */
+static bool take_command(struct seek_command *pending,
+					unsigned int *num_pending,
+					const struct seek_entry *entry)
+{
+	unsigned int i;
+
+	if (!is_command_result(entry))
+		return false;
+
+	for (i = 0; i < *num_pending; i++) {
+		if (pending[i].index != entry->index ||
+					pending[i].opcode != entry->command)
+			continue;
+
+		(*num_pending)--;
+		memmove(pending + i, pending + i + 1,
+				(*num_pending - i) * sizeof(*pending));
+		return true;
+	}
+
+	return false;
+}
+
+static void replay_entry(struct btsnoop *btsnoop,
+				const struct seek_entry *entry,
+				seek_func_t func, void *user_data)
+{
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	struct timeval tv;
+	uint16_t index, opcode, pktlen;
+
+	if (!btsnoop_set_offset(btsnoop, entry->offset))
+		return;
+
+	if (!btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &pktlen))
+		return;
+
+	func(&tv, index, opcode, buf, pktlen, user_data);
+}
+
+static unsigned long *select_entries(struct seek_index *idx,
+							unsigned long *count)
+{
+	struct seek_command pending[MAX_PENDING_COMMANDS];
+	unsigned int num_pending = 0;
+	uint64_t base, start, end;
+	unsigned long *sel;
+	unsigned long i, pos;
+	bool *context;
+
+	*count = 0;
+
+	sel = malloc((idx->count ? idx->count : 1) * sizeof(*sel));
+	if (!sel)
+		return NULL;
+
+	if (!idx->count)
+		return sel;
+
+	/* Offsets are relative to the first second of the trace, the same
+	 * base that is used for displaying time offsets.
+	 */
+	base = idx->entries[0].ts - (idx->entries[0].ts % 1000000ll);
+	start = start_filter ? base + start_offset : 0;
+	end = end_filter ? base + end_offset : UINT64_MAX;
+
+	pos = seek_index_find(idx, start);
+
+	context = select_context(idx, pos);
+	if (!context) {
+		free(sel);
+		return NULL;
+	}
+
+	/* Controller information and the setup of connections from before
+	 * the range are still needed to decode the packets within it.
+	 */
+	for (i = 0; i < pos; i++) {
+		const struct seek_entry *entry = &idx->entries[i];
+
+		if (is_index_control(entry->opcode) ||
+					(context[i] && entry_match(entry)))
+			sel[(*count)++] = i;
+	}
+
+	free(context);
+
+	for (i = pos; i < idx->count; i++) {
+		const struct seek_entry *entry = &idx->entries[i];
+
+		if (entry->ts > end)
+			break;
+
+		if (entry_match(entry)) {
+			if (handle_filter &&
+				entry->opcode == BTSNOOP_OPCODE_COMMAND_PKT)
+				add_command(pending, &num_pending, entry);
+		} else if (!take_command(pending, &num_pending, entry))
+			continue;
+
+		sel[(*count)++] = i;
+	}
+
+	return sel;
+}
+
+/*
+ * Packets of one connection are always decoded by the same worker so
+ * that the connection and channel state of the decoders stays intact.
+ * Packets without a connection handle are grouped per controller.
+ */
+static unsigned int entry_worker(const struct seek_entry *entry)
+{
+	uint32_t key;
+
+	if (entry->handle >= SEEK_HANDLE_ANY)
+		key = (entry->index << 16) | SEEK_HANDLE_NONE;
+	else
+		key = (entry->index << 16) | entry->handle;
+
+	key *= 2654435761u;
+
+	return (key >> 8) % num_jobs;
+}
+
+struct seek_worker {
+	pid_t pid;
+	FILE *output;
+	FILE *offsets;
+	uint8_t *map;
+	size_t map_size;
+	uint64_t cur_offset;
+};
+
+static void worker_run(struct seek_worker *worker, unsigned int id,
+				struct btsnoop *btsnoop, struct seek_index *idx,
+				const unsigned long *sel, unsigned long count,
+				seek_func_t func, void *user_data)
+{
+	unsigned long i;
+
+	if (dup2(fileno(worker->output), STDOUT_FILENO) < 0)
+		_exit(EXIT_FAILURE);
+
+	setvbuf(stdout, NULL, _IOFBF, 1024 * 1024);
+
+	for (i = 0; i < count; i++) {
+		const struct seek_entry *entry = &idx->entries[sel[i]];
+		uint64_t offset;
+		off_t pos;
+
+		if (entry_worker(entry) == id) {
+			replay_entry(btsnoop, entry, func, user_data);
+
+			offset = ftello(stdout);
+			fwrite(&offset, sizeof(offset), 1, worker->offsets);
+			continue;
+		}
+
+		/* Controller information and the first packet, which sets
+		 * the time base, are decoded by every worker, but only the
+		 * output of the owning worker is kept.
+		 */
+		if (i > 0 && !is_index_control(entry->opcode))
+			continue;
+
+		pos = ftello(stdout);
+
+		replay_entry(btsnoop, entry, func, user_data);
+		fflush(stdout);
+
+		if (ftruncate(STDOUT_FILENO, pos) < 0 ||
+					fseeko(stdout, pos, SEEK_SET) < 0)
+			_exit(EXIT_FAILURE);
+	}
+
+	if (fflush(stdout) != 0 || fflush(worker->offsets) != 0)
+		_exit(EXIT_FAILURE);
+
+	_exit(EXIT_SUCCESS);
+}
+
+static bool copy_output(struct seek_worker *worker)
+{
+	uint64_t offset;
+
+	if (fread(&offset, sizeof(offset), 1, worker->offsets) != 1)
+		return false;
+
+	if (offset < worker->cur_offset || offset > worker->map_size)
+		return false;
+
+	if (offset > worker->cur_offset &&
+			fwrite(worker->map + worker->cur_offset,
+				offset - worker->cur_offset, 1, stdout) != 1)
+		return false;
+
+	worker->cur_offset = offset;
+
+	return true;
+}
+
+static bool parallel_reader(struct btsnoop *btsnoop, struct seek_index *idx,
+				const unsigned long *sel, unsigned long count,
+				seek_func_t func, void *user_data)
+{
+	struct seek_worker *workers;
+	bool result = false;
+	unsigned int i;
+	unsigned long n;
+
+	workers = calloc(num_jobs, sizeof(*workers));
+	if (!workers)
+		return false;
+
+	/* Make sure the workers inherit the terminal settings of the
+	 * parent and no pending output gets duplicated.
+	 */
+	use_color();
+	num_columns();
+	fflush(stdout);
+
+	for (i = 0; i < num_jobs; i++) {
+		struct seek_worker *worker = &workers[i];
+
+		worker->output = tmpfile();
+		worker->offsets = tmpfile();
+		if (!worker->output || !worker->offsets)
+			goto done;
+
+		worker->pid = fork();
+		if (worker->pid < 0) {
+			perror("Failed to fork decoding worker");
+			goto done;
+		}
+
+		if (worker->pid == 0)
+			worker_run(worker, i, btsnoop, idx, sel, count,
+							func, user_data);
+	}
+
+	result = true;
+
+	for (i = 0; i < num_jobs; i++) {
+		int status;
+
+		if (waitpid(workers[i].pid, &status, 0) < 0 ||
+				!WIFEXITED(status) ||
+				WEXITSTATUS(status) != EXIT_SUCCESS) {
+			fprintf(stderr, "Decoding worker %u failed\n", i);
+			result = false;
+		}
+
+		workers[i].pid = 0;
+		rewind(workers[i].offsets);
+	}
+
+	if (!result)
+		goto done;
+
+	for (i = 0; i < num_jobs; i++) {
+		struct seek_worker *worker = &workers[i];
+		struct stat st;
+		void *map;
+
+		if (fstat(fileno(worker->output), &st) < 0) {
+			result = false;
+			goto done;
+		}
+
+		if (!st.st_size)
+			continue;
+
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+						fileno(worker->output), 0);
+		if (map == MAP_FAILED) {
+			result = false;
+			goto done;
+		}
+
+		worker->map = map;
+		worker->map_size = st.st_size;
+	}
+
+	/* Merge the output of the workers back in trace order */
+	for (n = 0; n < count; n++) {
+		const struct seek_entry *entry = &idx->entries[sel[n]];
+
+		if (!copy_output(&workers[entry_worker(entry)])) {
+			fprintf(stderr, "Failed to merge decoded output\n");
+			result = false;
+			break;
+		}
+	}
+
+	if (fflush(stdout) != 0)
+		result = false;
+
+done:
+	for (i = 0; i < num_jobs; i++) {
+		if (workers[i].pid > 0) {
+			kill(workers[i].pid, SIGTERM);
+			waitpid(workers[i].pid, NULL, 0);
+		}
+
+		if (workers[i].map)
+			munmap(workers[i].map, workers[i].map_size);
+
+		if (workers[i].output)
+			fclose(workers[i].output);
+
+		if (workers[i].offsets)
+			fclose(workers[i].offsets);
+	}
+
+	free(workers);
+
+	return result;
+}
+
+static int read_entries(struct btsnoop *btsnoop, const char *path,
+				unsigned int jobs, seek_func_t func,
+				void *user_data)
+{
+	struct seek_index *idx;
+	unsigned long *sel;
+	unsigned long i, count;
+	int err = 0;
+
+	idx = seek_index_load(btsnoop, path);
+	if (!idx)
+		return -ENOENT;
+
+	sel = select_entries(idx, &count);
+	if (!sel) {
+		seek_index_free(idx);
+		return -ENOMEM;
+	}
+
+	if (jobs > 1 && count > 0) {
+		if (!parallel_reader(btsnoop, idx, sel, count,
+							func, user_data))
+			err = -EIO;
+		goto done;
+	}
+
+	for (i = 0; i < count; i++)
+		replay_entry(btsnoop, &idx->entries[sel[i]], func, user_data);
+
+done:
+	free(sel);
+	seek_index_free(idx);
+
+	return err;
+}
+
+int seek_reader(struct btsnoop *btsnoop, const char *path,
+					seek_func_t func, void *user_data)
+{
+	return read_entries(btsnoop, path, num_jobs, func, user_data);
+}
+
+/* Same selection as seek_reader(), but always handed out in trace order */
+int seek_replay(struct btsnoop *btsnoop, const char *path,
+					seek_func_t func, void *user_data)
+{
+	return read_entries(btsnoop, path, 1, func, user_data);
+}
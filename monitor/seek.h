@@ -0,0 +1,70 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2014  Intel Corporation
+ *  Copyright (C) 2002-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#define SEEK_HANDLE_NONE	0xffff
+#define SEEK_HANDLE_ANY		0xfffe
+
+struct btsnoop;
+
+struct seek_entry {
+	uint64_t offset;
+	uint64_t ts;
+	uint16_t index;
+	uint16_t opcode;
+	uint16_t handle;
+	uint16_t command;	/* HCI opcode of a command or its result */
+	uint8_t  event;		/* HCI event code */
+	uint8_t  subevent;	/* LE meta event code */
+	uint8_t  reserved[4];
+} __attribute__((packed));
+
+struct seek_index;
+
+typedef void (*seek_func_t)(struct timeval *tv, uint16_t index,
+				uint16_t opcode, const void *data,
+				uint16_t size, void *user_data);
+
+bool seek_set_start(const char *str);
+bool seek_set_end(const char *str);
+bool seek_set_handle(const char *str);
+bool seek_set_jobs(const char *str);
+bool seek_enabled(void);
+
+uint16_t seek_packet_handle(uint16_t opcode, const void *data, uint16_t size);
+
+struct seek_index *seek_index_load(struct btsnoop *btsnoop, const char *path);
+void seek_index_free(struct seek_index *idx);
+unsigned long seek_index_count(struct seek_index *idx);
+const struct seek_entry *seek_index_get(struct seek_index *idx,
+							unsigned long pos);
+unsigned long seek_index_find(struct seek_index *idx, uint64_t ts);
+
+int seek_reader(struct btsnoop *btsnoop, const char *path,
+					seek_func_t func, void *user_data);
+int seek_replay(struct btsnoop *btsnoop, const char *path,
+					seek_func_t func, void *user_data);
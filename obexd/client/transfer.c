@@ -762,6 +762,22 @@ static gssize put_xfer_progress(void *buf, gsize len, gpointer user_data)
 	return size;
 }
 
+static gssize put_xfer_fd(int *fd, gsize len, gpointer user_data)
+{
+	struct obc_transfer *transfer = user_data;
+	gssize size;
+
+	if (transfer->transferred >= transfer->size)
+		return 0;
+
+	size = MIN((gint64) len, transfer->size - transfer->transferred);
+
+	*fd = transfer->fd;
+	transfer->transferred += size;
+
+	return size;
+}
+
 gboolean obc_transfer_set_callback(struct obc_transfer *transfer,
 					transfer_callback_t func,
 					void *user_data)
@@ -850,6 +866,7 @@ static gboolean transfer_start_put(struct obc_transfer *transfer, GError **err)
 {
 	GObexPacket *req;
 	GObexHeader *hdr;
+	struct stat st;
 
 	if (transfer->xfer > 0) {
 		g_set_error(err, OBC_TRANSFER_ERROR, -EALREADY,
@@ -875,9 +892,15 @@ static gboolean transfer_start_put(struct obc_transfer *transfer, GError **err)
 		g_obex_packet_add_header(req, hdr);
 	}
 
-	transfer->xfer = g_obex_put_req_pkt(transfer->obex, req,
-					put_xfer_progress, xfer_complete,
-					transfer, err);
+	/* Regular files are sent without copying them through a buffer */
+	if (fstat(transfer->fd, &st) == 0 && S_ISREG(st.st_mode))
+		transfer->xfer = g_obex_put_req_pkt_fd(transfer->obex, req,
+						put_xfer_fd, xfer_complete,
+						transfer, err);
+	else
+		transfer->xfer = g_obex_put_req_pkt(transfer->obex, req,
+						put_xfer_progress,
+						xfer_complete, transfer, err);
 	if (transfer->xfer == 0)
 		return FALSE;
 
@@ -0,0 +1,221 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+
+#include <glib.h>
+
+#include "file-copy.h"
+
+/* Amount copied on each main loop iteration */
+#define COPY_CHUNK_SIZE		(1024 * 1024)
+#define COPY_BUFFER_SIZE	(64 * 1024)
+
+enum copy_method {
+	COPY_RANGE,
+	COPY_SENDFILE,
+	COPY_READ_WRITE,
+};
+
+struct file_copy {
+	int in_fd;
+	int out_fd;
+	uint64_t size;
+	uint64_t copied;
+	enum copy_method method;
+	uint8_t *buf;
+	guint source;
+	file_copy_progress_t progress;
+	file_copy_complete_t complete;
+	void *user_data;
+};
+
+static ssize_t copy_range(struct file_copy *copy)
+{
+#ifdef __NR_copy_file_range
+	return syscall(__NR_copy_file_range, copy->in_fd, NULL, copy->out_fd,
+						NULL, COPY_CHUNK_SIZE, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static ssize_t copy_read_write(struct file_copy *copy)
+{
+	ssize_t len, ret;
+	size_t written = 0;
+
+	if (copy->buf == NULL)
+		copy->buf = g_malloc(COPY_BUFFER_SIZE);
+
+	len = read(copy->in_fd, copy->buf, COPY_BUFFER_SIZE);
+	if (len <= 0)
+		return len;
+
+	while (written < (size_t) len) {
+		ret = write(copy->out_fd, copy->buf + written, len - written);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return ret;
+		}
+
+		written += ret;
+	}
+
+	return len;
+}
+
+/*
+ * Use the cheapest method the kernel supports for the given pair of files:
+ * copy_file_range() may be done by the filesystem itself, sendfile()
+ * still avoids copying data to userspace and plain read/write works for
+ * anything else. All of them advance the file offsets so switching method
+ * in the middle of a copy is fine.
+ */
+static ssize_t copy_chunk(struct file_copy *copy)
+{
+	ssize_t ret;
+
+	switch (copy->method) {
+	case COPY_RANGE:
+		ret = copy_range(copy);
+		if (ret >= 0 || (errno != ENOSYS && errno != EXDEV &&
+				errno != EINVAL && errno != EOPNOTSUPP))
+			return ret;
+
+		copy->method = COPY_SENDFILE;
+		/* fall through */
+	case COPY_SENDFILE:
+		ret = sendfile(copy->out_fd, copy->in_fd, NULL,
+							COPY_CHUNK_SIZE);
+		if (ret >= 0 || (errno != ENOSYS && errno != EINVAL))
+			return ret;
+
+		copy->method = COPY_READ_WRITE;
+		/* fall through */
+	case COPY_READ_WRITE:
+	default:
+		return copy_read_write(copy);
+	}
+}
+
+static void copy_free(struct file_copy *copy)
+{
+	if (copy->source > 0)
+		g_source_remove(copy->source);
+
+	close(copy->in_fd);
+	close(copy->out_fd);
+	g_free(copy->buf);
+	g_free(copy);
+}
+
+static void copy_finish(struct file_copy *copy, int err)
+{
+	copy->source = 0;
+
+	if (copy->complete)
+		copy->complete(err, copy->user_data);
+
+	copy_free(copy);
+}
+
+static gboolean copy_cb(gpointer user_data)
+{
+	struct file_copy *copy = user_data;
+	ssize_t ret;
+
+	ret = copy_chunk(copy);
+	if (ret < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return TRUE;
+
+		copy_finish(copy, -errno);
+		return FALSE;
+	}
+
+	if (ret == 0) {
+		copy_finish(copy, 0);
+		return FALSE;
+	}
+
+	copy->copied += ret;
+
+	if (copy->progress)
+		copy->progress(copy->copied, copy->size, copy->user_data);
+
+	return TRUE;
+}
+
+/*
+ * Copy the content of in_fd to out_fd from their current offsets in chunks
+ * driven by the main loop. Both descriptors are owned by the copy and
+ * closed once it completes or is cancelled.
+ */
+struct file_copy *file_copy_start(int in_fd, int out_fd,
+					file_copy_progress_t progress,
+					file_copy_complete_t complete,
+					void *user_data)
+{
+	struct file_copy *copy;
+	struct stat st;
+
+	if (in_fd < 0 || out_fd < 0)
+		return NULL;
+
+	copy = g_new0(struct file_copy, 1);
+	copy->in_fd = in_fd;
+	copy->out_fd = out_fd;
+	copy->method = COPY_RANGE;
+	copy->progress = progress;
+	copy->complete = complete;
+	copy->user_data = user_data;
+
+	if (fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode))
+		copy->size = st.st_size;
+
+	copy->source = g_idle_add(copy_cb, copy);
+
+	return copy;
+}
+
+/* Stop the copy without calling the complete callback */
+void file_copy_cancel(struct file_copy *copy)
+{
+	if (copy == NULL)
+		return;
+
+	copy_free(copy);
+}
@@ -0,0 +1,35 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+typedef void (*file_copy_progress_t) (uint64_t copied, uint64_t size,
+							void *user_data);
+typedef void (*file_copy_complete_t) (int err, void *user_data);
+
+struct file_copy;
+
+struct file_copy *file_copy_start(int in_fd, int out_fd,
+					file_copy_progress_t progress,
+					file_copy_complete_t complete,
+					void *user_data);
+void file_copy_cancel(struct file_copy *copy);
@@ -35,7 +35,6 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
-#include <sys/sendfile.h>
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <inttypes.h>
@@ -46,6 +45,8 @@
 #include "obexd/src/plugin.h"
 #include "obexd/src/log.h"
 #include "obexd/src/mimetype.h"
+#include "file-copy.h"
+#include "string-read.h"
 #include "filesystem.h"
 
 #define EOL_CHARS "\n"
@@ -242,6 +243,21 @@ static ssize_t filesystem_read(void *object, void *buf, size_t count)
 	return ret;
 }
 
+/* Only regular files can have their content spliced to the transport */
+static int filesystem_get_fd(void *object)
+{
+	int fd = GPOINTER_TO_INT(object);
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+	if (!S_ISREG(st.st_mode))
+		return -EINVAL;
+
+	return fd;
+}
+
 static ssize_t filesystem_write(void *object, const void *buf, size_t count)
 {
 	ssize_t ret;
@@ -267,37 +283,71 @@ static int filesystem_rename(const char *name, const char *destname)
 	return ret;
 }
 
-static int sendfile_async(int out_fd, int in_fd, off_t *offset, size_t count)
+struct copy_request {
+	struct file_copy *copy;
+	char *name;
+	char *destname;
+};
+
+static GSList *copies = NULL;
+
+static void copy_request_free(struct copy_request *req)
 {
-	int pid;
+	copies = g_slist_remove(copies, req);
 
-	/* Run sendfile on child process */
-	pid = fork();
-	switch (pid) {
-		case 0:
-			break;
-		case -1:
-			error("fork() %s (%d)", strerror(errno), errno);
-			return -errno;
-		default:
-			DBG("child %d forked", pid);
-			return pid;
-	}
+	g_free(req->name);
+	g_free(req->destname);
+	g_free(req);
+}
 
-	/* At child */
-	if (sendfile(out_fd, in_fd, offset, count) < 0)
-		error("sendfile(): %s (%d)", strerror(errno), errno);
+static void copy_progress(uint64_t copied, uint64_t size, void *user_data)
+{
+	struct copy_request *req = user_data;
 
-	close(in_fd);
-	close(out_fd);
+	DBG("%s: %" PRIu64 "/%" PRIu64 " bytes", req->destname, copied, size);
+}
+
+static void copy_complete(int err, void *user_data)
+{
+	struct copy_request *req = user_data;
 
-	exit(errno);
+	if (err < 0) {
+		error("copy(%s, %s): %s (%d)", req->name, req->destname,
+							strerror(-err), -err);
+		unlink(req->destname);
+	} else
+		DBG("%s copied to %s", req->name, req->destname);
+
+	copy_request_free(req);
+}
+
+static void copy_cancel(struct copy_request *req)
+{
+	DBG("cancel copy to %s", req->destname);
+
+	file_copy_cancel(req->copy);
+	unlink(req->destname);
+	copy_request_free(req);
+}
+
+static struct copy_request *find_copy(const char *destname)
+{
+	GSList *l;
+
+	for (l = copies; l; l = l->next) {
+		struct copy_request *req = l->data;
+
+		if (g_str_equal(req->destname, destname))
+			return req;
+	}
+
+	return NULL;
 }
 
 static int filesystem_copy(const char *name, const char *destname)
 {
+	struct copy_request *req;
 	void *in, *out;
-	ssize_t ret;
 	size_t size;
 	struct stat st;
 	int in_fd, out_fd, err;
@@ -305,45 +355,42 @@ static int filesystem_copy(const char *name, const char *destname)
 	in = filesystem_open(name, O_RDONLY, 0, NULL, &size, &err);
 	if (in == NULL) {
 		error("open(%s): %s (%d)", name, strerror(-err), -err);
-		return -err;
+		return err;
 	}
 
 	in_fd = GPOINTER_TO_INT(in);
-	ret = fstat(in_fd, &st);
-	if (ret < 0) {
-		error("stat(%s): %s (%d)", name, strerror(errno), errno);
-		return -errno;
+	if (fstat(in_fd, &st) < 0) {
+		err = -errno;
+		error("stat(%s): %s (%d)", name, strerror(-err), -err);
+		filesystem_close(in);
+		return err;
 	}
 
+	/* A new copy to the same destination supersedes the pending one */
+	req = find_copy(destname);
+	if (req)
+		copy_cancel(req);
+
 	out = filesystem_open(destname, O_WRONLY | O_CREAT | O_TRUNC,
 					st.st_mode, NULL, &size, &err);
 	if (out == NULL) {
 		error("open(%s): %s (%d)", destname, strerror(-err), -err);
 		filesystem_close(in);
-		return -errno;
+		return err;
 	}
 
 	out_fd = GPOINTER_TO_INT(out);
 
-	/* Check if sendfile is supported */
-	ret = sendfile(out_fd, in_fd, NULL, 0);
-	if (ret < 0) {
-		ret = -errno;
-		error("sendfile: %s (%zd)", strerror(-ret), -ret);
-		goto done;
-	}
+	req = g_new0(struct copy_request, 1);
+	req->name = g_strdup(name);
+	req->destname = g_strdup(destname);
 
-	ret = sendfile_async(out_fd, in_fd, NULL, st.st_size);
-	if (ret < 0)
-		goto done;
+	/* The copy owns both descriptors from now on */
+	req->copy = file_copy_start(in_fd, out_fd, copy_progress,
+						copy_complete, req);
+	copies = g_slist_append(copies, req);
 
 	return 0;
-
-done:
-	filesystem_close(in);
-	filesystem_close(out);
-
-	return ret;
 }
 
 struct capability_object {
@@ -352,6 +399,12 @@ struct capability_object {
 	int err;
 	gboolean aborted;
 	GString *buffer;
+	size_t offset;
+};
+
+struct folder_object {
+	GString *buffer;
+	size_t offset;
 };
 
 static void script_exited(GPid pid, int status, void *data)
@@ -560,6 +613,19 @@ failed:
 	return NULL;
 }
 
+static struct folder_object *folder_new(GString *buffer)
+{
+	struct folder_object *object;
+
+	if (buffer == NULL)
+		return NULL;
+
+	object = g_new0(struct folder_object, 1);
+	object->buffer = buffer;
+
+	return object;
+}
+
 static void *folder_open(const char *name, int oflag, mode_t mode,
 					void *context, size_t *size, int *err)
 {
@@ -569,7 +635,7 @@ static void *folder_open(const char *name, int oflag, mode_t mode,
 	object = append_folder_preamble(object);
 	object = g_string_append(object, FL_BODY_BEGIN);
 
-	return append_listing(object, name, FALSE, size, err);
+	return folder_new(append_listing(object, name, FALSE, size, err));
 }
 
 static void *pcsuite_open(const char *name, int oflag, mode_t mode,
@@ -581,36 +647,24 @@ static void *pcsuite_open(const char *name, int oflag, mode_t mode,
 	object = append_pcsuite_preamble(object);
 	object = g_string_append(object, FL_BODY_BEGIN);
 
-	return append_listing(object, name, TRUE, size, err);
+	return folder_new(append_listing(object, name, TRUE, size, err));
 }
 
-static int string_free(void *object)
+static int folder_close(void *object)
 {
-	GString *string = object;
+	struct folder_object *obj = object;
 
-	g_string_free(string, TRUE);
+	g_string_free(obj->buffer, TRUE);
+	g_free(obj);
 
 	return 0;
 }
 
-ssize_t string_read(void *object, void *buf, size_t count)
-{
-	GString *string = object;
-	ssize_t len;
-
-	if (string->len == 0)
-		return 0;
-
-	len = MIN(string->len, count);
-	memcpy(buf, string->str, len);
-	g_string_erase(string, 0, len);
-
-	return len;
-}
-
 static ssize_t folder_read(void *object, void *buf, size_t count)
 {
-	return string_read(object, buf, count);
+	struct folder_object *obj = object;
+
+	return string_read(obj->buffer, &obj->offset, buf, count);
 }
 
 static ssize_t capability_read(void *object, void *buf, size_t count)
@@ -618,7 +672,7 @@ static ssize_t capability_read(void *object, void *buf, size_t count)
 	struct capability_object *obj = object;
 
 	if (obj->buffer)
-		return string_read(obj->buffer, buf, count);
+		return string_read(obj->buffer, &obj->offset, buf, count);
 
 	if (obj->pid >= 0)
 		return -EAGAIN;
@@ -659,6 +713,7 @@ static struct obex_mime_type_driver file = {
 	.close = filesystem_close,
 	.read = filesystem_read,
 	.write = filesystem_write,
+	.get_fd = filesystem_get_fd,
 	.remove = remove,
 	.move = filesystem_rename,
 	.copy = filesystem_copy,
@@ -678,7 +733,7 @@ static struct obex_mime_type_driver folder = {
 	.target_size = FTP_TARGET_SIZE,
 	.mimetype = "x-obex/folder-listing",
 	.open = folder_open,
-	.close = string_free,
+	.close = folder_close,
 	.read = folder_read,
 };
 
@@ -689,7 +744,7 @@ static struct obex_mime_type_driver pcsuite = {
 	.who_size = PCSUITE_WHO_SIZE,
 	.mimetype = "x-obex/folder-listing",
 	.open = pcsuite_open,
-	.close = string_free,
+	.close = folder_close,
 	.read = folder_read,
 };
 
@@ -714,6 +769,9 @@ static int filesystem_init(void)
 
 static void filesystem_exit(void)
 {
+	while (copies)
+		copy_cancel(copies->data);
+
 	obex_mime_type_driver_unregister(&folder);
 	obex_mime_type_driver_unregister(&capability);
 	obex_mime_type_driver_unregister(&file);
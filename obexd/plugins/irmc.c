@@ -44,6 +44,7 @@
 #include "obexd/src/manager.h"
 #include "obexd/src/mimetype.h"
 #include "phonebook.h"
+#include "string-read.h"
 #include "filesystem.h"
 
 struct aparam_header {
@@ -59,6 +60,7 @@ struct irmc_session {
 	struct apparam_field *params;
 	uint16_t entries;
 	GString *buffer;
+	size_t offset;
 	char sn[DID_LEN];
 	char did[DID_LEN];
 	char manu[DID_LEN];
@@ -284,6 +286,7 @@ static int irmc_open_info(struct irmc_session *irmc)
 	if (irmc->buffer == NULL)
 		irmc->buffer = g_string_new("");
 
+	irmc->offset = 0;
 	g_string_printf(irmc->buffer, "Total-Records:%d\r\n"
 				"Maximum-Records:%d\r\n"
 				"IEL:2\r\n"
@@ -299,6 +302,7 @@ static int irmc_open_cc(struct irmc_session *irmc)
 	if (irmc->buffer == NULL)
 		irmc->buffer = g_string_new("");
 
+	irmc->offset = 0;
 	g_string_printf(irmc->buffer, "%d\r\n", irmc->params->maxlistcount);
 
 	return 0;
@@ -332,6 +336,7 @@ static int irmc_open_luid(struct irmc_session *irmc)
 		irmc->buffer = g_string_new("");
 
 	DBG("changelog request, force whole book");
+	irmc->offset = 0;
 	g_string_printf(irmc->buffer, "SN:%s\r\n"
 					"DID:%s\r\n"
 					"Total-Records:%d\r\n"
@@ -407,6 +412,7 @@ static int irmc_close(void *object)
 	if (irmc->buffer) {
 		g_string_free(irmc->buffer, TRUE);
 		irmc->buffer = NULL;
+		irmc->offset = 0;
 	}
 
 	if (irmc->request) {
@@ -426,7 +432,7 @@ static ssize_t irmc_read(void *object, void *buf, size_t count)
 	if (!irmc->buffer)
                 return -EAGAIN;
 
-	len = string_read(irmc->buffer, buf, count);
+	len = string_read(irmc->buffer, &irmc->offset, buf, count);
 	DBG("returning %d bytes", len);
 	return len;
 }
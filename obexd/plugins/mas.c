@@ -43,6 +43,7 @@
 #include "obexd/src/mimetype.h"
 #include "obexd/src/manager.h"
 #include "obexd/src/map_ap.h"
+#include "string-read.h"
 #include "filesystem.h"
 #include "messages.h"
 
@@ -68,6 +69,7 @@ struct mas_session {
 	gboolean finished;
 	gboolean nth_call;
 	GString *buffer;
+	size_t offset;
 	GObexApparam *inparams;
 	GObexApparam *outparams;
 	gboolean ap_sent;
@@ -101,6 +103,7 @@ static void reset_request(struct mas_session *mas)
 	if (mas->buffer) {
 		g_string_free(mas->buffer, TRUE);
 		mas->buffer = NULL;
+		mas->offset = 0;
 	}
 
 	if (mas->inparams) {
@@ -744,7 +747,7 @@ static ssize_t any_read(void *obj, void *buf, size_t count)
 
 	DBG("");
 
-	len = string_read(mas->buffer, buf, count);
+	len = string_read(mas->buffer, &mas->offset, buf, count);
 
 	if (len == 0 && !mas->finished)
 		return -EAGAIN;
@@ -0,0 +1,337 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <stdint.h>
+#include <glib.h>
+
+#include "pbap-cache.h"
+
+struct cache_entry {
+	uint32_t handle;
+	unsigned int seq;
+	char *id;
+	char *name;
+	char *name_down;
+	char *sound;
+	char *tel;
+};
+
+typedef gboolean (*cache_entry_find_f) (const struct cache_entry *entry,
+							const char *value);
+
+static void cache_entry_free(void *data)
+{
+	struct cache_entry *entry = data;
+
+	g_free(entry->id);
+	g_free(entry->name);
+	g_free(entry->name_down);
+	g_free(entry->sound);
+	g_free(entry->tel);
+	g_free(entry);
+}
+
+static gboolean entry_name_find(const struct cache_entry *entry,
+							const char *value)
+{
+	if (!entry->name)
+		return FALSE;
+
+	if (strlen(value) == 0)
+		return TRUE;
+
+	return (g_strstr_len(entry->name_down, -1, value) ? TRUE : FALSE);
+}
+
+static gboolean entry_sound_find(const struct cache_entry *entry,
+							const char *value)
+{
+	if (!entry->sound)
+		return FALSE;
+
+	return (g_strstr_len(entry->sound, -1, value) ? TRUE : FALSE);
+}
+
+static gboolean entry_tel_find(const struct cache_entry *entry,
+							const char *value)
+{
+	if (!entry->tel)
+		return FALSE;
+
+	return (g_strstr_len(entry->tel, -1, value) ? TRUE : FALSE);
+}
+
+/*
+ * Entries comparing equal are listed most recently added first, which is
+ * the order the listing had while it was built with insertion sort.
+ */
+static int seq_sort(const struct cache_entry *e1, const struct cache_entry *e2)
+{
+	if (e1->seq == e2->seq)
+		return 0;
+
+	return e1->seq < e2->seq ? 1 : -1;
+}
+
+static int handle_sort(const struct cache_entry *e1,
+						const struct cache_entry *e2)
+{
+	if (e1->handle == e2->handle)
+		return seq_sort(e1, e2);
+
+	return e1->handle < e2->handle ? -1 : 1;
+}
+
+static int indexed_sort(gconstpointer a, gconstpointer b)
+{
+	const struct cache_entry *e1 = *(struct cache_entry * const *) a;
+	const struct cache_entry *e2 = *(struct cache_entry * const *) b;
+
+	return handle_sort(e1, e2);
+}
+
+static int alpha_sort(gconstpointer a, gconstpointer b)
+{
+	const struct cache_entry *e1 = *(struct cache_entry * const *) a;
+	const struct cache_entry *e2 = *(struct cache_entry * const *) b;
+	int ret;
+
+	ret = g_strcmp0(e1->name, e2->name);
+	if (ret)
+		return ret;
+
+	return seq_sort(e1, e2);
+}
+
+static int phonetical_sort(gconstpointer a, gconstpointer b)
+{
+	const struct cache_entry *e1 = *(struct cache_entry * const *) a;
+	const struct cache_entry *e2 = *(struct cache_entry * const *) b;
+	int ret;
+
+	/* SOUND attribute is optional. Use Indexed sort if not present. */
+	if (!e1->sound || !e2->sound)
+		return handle_sort(e1, e2);
+
+	ret = g_strcmp0(e1->sound, e2->sound);
+	if (ret)
+		return ret;
+
+	return seq_sort(e1, e2);
+}
+
+static void free_views(struct pbap_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(cache->views); i++) {
+		if (cache->views[i] == NULL)
+			continue;
+
+		g_ptr_array_free(cache->views[i], TRUE);
+		cache->views[i] = NULL;
+	}
+}
+
+/*
+ * Sorted views only hold references to the entries owned by
+ * cache->entries, they are built once per cache fill and reused by every
+ * listing request until the cache changes.
+ */
+static GPtrArray *get_view(struct pbap_cache *cache, uint8_t order)
+{
+	GCompareFunc sort;
+	GPtrArray *view;
+	unsigned int i;
+
+	/*
+	 * Default sorter is "Indexed". Some backends doesn't inform the index,
+	 * for this case a sequential internal index is assigned.
+	 */
+	switch (order) {
+	case PBAP_CACHE_ORDER_ALPHA:
+		sort = alpha_sort;
+		break;
+	case PBAP_CACHE_ORDER_PHONETIC:
+		sort = phonetical_sort;
+		break;
+	default:
+		order = PBAP_CACHE_ORDER_INDEXED;
+		sort = indexed_sort;
+		break;
+	}
+
+	if (cache->entries == NULL)
+		return NULL;
+
+	if (cache->views[order])
+		return cache->views[order];
+
+	view = g_ptr_array_sized_new(cache->entries->len);
+
+	for (i = 0; i < cache->entries->len; i++)
+		g_ptr_array_add(view, g_ptr_array_index(cache->entries, i));
+
+	g_ptr_array_sort(view, sort);
+
+	cache->views[order] = view;
+
+	return view;
+}
+
+void pbap_cache_add(struct pbap_cache *cache, uint32_t handle, const char *id,
+			const char *name, const char *sound, const char *tel)
+{
+	struct cache_entry *entry;
+
+	if (cache->entries == NULL) {
+		cache->entries = g_ptr_array_new_with_free_func(
+							cache_entry_free);
+		cache->handles = g_hash_table_new(NULL, NULL);
+	}
+
+	free_views(cache);
+
+	entry = g_new0(struct cache_entry, 1);
+	entry->handle = handle;
+	entry->seq = cache->entries->len;
+	entry->id = g_strdup(id);
+	entry->name = g_strdup(name);
+	entry->name_down = name ? g_utf8_strdown(name, -1) : NULL;
+	entry->sound = g_strdup(sound);
+	entry->tel = g_strdup(tel);
+
+	g_ptr_array_add(cache->entries, entry);
+
+	/* Lookups by handle resolve to the first entry using it */
+	if (!g_hash_table_lookup(cache->handles, GUINT_TO_POINTER(handle)))
+		g_hash_table_insert(cache->handles, GUINT_TO_POINTER(handle),
+									entry);
+}
+
+void pbap_cache_clear(struct pbap_cache *cache)
+{
+	free_views(cache);
+
+	if (cache->handles) {
+		g_hash_table_destroy(cache->handles);
+		cache->handles = NULL;
+	}
+
+	if (cache->entries) {
+		g_ptr_array_free(cache->entries, TRUE);
+		cache->entries = NULL;
+	}
+}
+
+unsigned int pbap_cache_size(struct pbap_cache *cache)
+{
+	if (cache->entries == NULL)
+		return 0;
+
+	return cache->entries->len;
+}
+
+const char *pbap_cache_find(struct pbap_cache *cache, uint32_t handle)
+{
+	struct cache_entry *entry;
+
+	if (cache->handles == NULL)
+		return NULL;
+
+	entry = g_hash_table_lookup(cache->handles, GUINT_TO_POINTER(handle));
+	if (entry == NULL)
+		return NULL;
+
+	return entry->id;
+}
+
+unsigned int pbap_cache_list(struct pbap_cache *cache, uint8_t order,
+				uint8_t search_attrib, const char *value,
+				unsigned int offset, unsigned int max,
+				pbap_cache_func_t func, void *user_data)
+{
+	const struct cache_entry *entry;
+	cache_entry_find_f find;
+	GPtrArray *view;
+	char *searchval;
+	unsigned int i, count = 0;
+
+	view = get_view(cache, order);
+	if (view == NULL)
+		return 0;
+
+	/* Without a search value the window is a plain slice of the view */
+	if (value == NULL) {
+		for (i = offset; i < view->len && count < max; i++, count++) {
+			entry = g_ptr_array_index(view, i);
+			func(entry->handle, entry->name, user_data);
+		}
+
+		return count;
+	}
+
+	/*
+	 * This implementation checks if the given field CONTAINS the
+	 * search value(case insensitive). Name is the default field
+	 * when the attribute is not provided.
+	 */
+	switch (search_attrib) {
+	case PBAP_CACHE_SEARCH_NUMBER:
+		find = entry_tel_find;
+		break;
+	case PBAP_CACHE_SEARCH_SOUND:
+		find = entry_sound_find;
+		break;
+	default:
+		find = entry_name_find;
+		break;
+	}
+
+	searchval = g_utf8_strdown(value, -1);
+
+	for (i = 0; i < view->len && count < max; i++) {
+		entry = g_ptr_array_index(view, i);
+
+		if (!find(entry, searchval))
+			continue;
+
+		if (offset > 0) {
+			offset--;
+			continue;
+		}
+
+		func(entry->handle, entry->name, user_data);
+		count++;
+	}
+
+	g_free(searchval);
+
+	return count;
+}
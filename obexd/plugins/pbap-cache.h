@@ -0,0 +1,54 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define PBAP_CACHE_ORDER_INDEXED	0x00
+#define PBAP_CACHE_ORDER_ALPHA		0x01
+#define PBAP_CACHE_ORDER_PHONETIC	0x02
+
+#define PBAP_CACHE_SEARCH_NAME		0x00
+#define PBAP_CACHE_SEARCH_NUMBER	0x01
+#define PBAP_CACHE_SEARCH_SOUND		0x02
+
+/*
+ * A zero initialized struct pbap_cache is a valid empty cache, the sorted
+ * views are built on first use and dropped whenever an entry is added.
+ */
+struct pbap_cache {
+	GPtrArray *entries;
+	GHashTable *handles;
+	GPtrArray *views[3];
+};
+
+typedef void (*pbap_cache_func_t) (uint32_t handle, const char *name,
+							void *user_data);
+
+void pbap_cache_add(struct pbap_cache *cache, uint32_t handle, const char *id,
+			const char *name, const char *sound, const char *tel);
+void pbap_cache_clear(struct pbap_cache *cache);
+unsigned int pbap_cache_size(struct pbap_cache *cache);
+const char *pbap_cache_find(struct pbap_cache *cache, uint32_t handle);
+unsigned int pbap_cache_list(struct pbap_cache *cache, uint8_t order,
+				uint8_t search_attrib, const char *value,
+				unsigned int offset, unsigned int max,
+				pbap_cache_func_t func, void *user_data);
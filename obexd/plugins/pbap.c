@@ -49,6 +49,8 @@
 #include "obexd/src/manager.h"
 #include "obexd/src/mimetype.h"
 #include "phonebook.h"
+#include "pbap-cache.h"
+#include "string-read.h"
 #include "filesystem.h"
 
 #define PHONEBOOK_TYPE		"x-bt/phonebook"
@@ -68,15 +70,7 @@
 struct cache {
 	gboolean valid;
 	uint32_t index;
-	GSList *entries;
-};
-
-struct cache_entry {
-	uint32_t handle;
-	char *id;
-	char *name;
-	char *sound;
-	char *tel;
+	struct pbap_cache contacts;
 };
 
 struct pbap_session {
@@ -89,6 +83,7 @@ struct pbap_session {
 
 struct pbap_object {
 	GString *buffer;
+	size_t offset;
 	GObexApparam *apparam;
 	gboolean firstpacket;
 	gboolean lastpart;
@@ -100,77 +95,6 @@ static const uint8_t PBAP_TARGET[TARGET_SIZE] = {
 			0x79, 0x61, 0x35, 0xF0,  0xF0, 0xC5, 0x11, 0xD8,
 			0x09, 0x66, 0x08, 0x00,  0x20, 0x0C, 0x9A, 0x66  };
 
-typedef int (*cache_entry_find_f) (const struct cache_entry *entry,
-			const char *value);
-
-static void cache_entry_free(void *data)
-{
-	struct cache_entry *entry = data;
-
-	g_free(entry->id);
-	g_free(entry->name);
-	g_free(entry->sound);
-	g_free(entry->tel);
-	g_free(entry);
-}
-
-static gboolean entry_name_find(const struct cache_entry *entry,
-		const char *value)
-{
-	char *name;
-	gboolean ret;
-
-	if (!entry->name)
-		return FALSE;
-
-	if (strlen(value) == 0)
-		return TRUE;
-
-	name = g_utf8_strdown(entry->name, -1);
-	ret = (g_strstr_len(name, -1, value) ? TRUE : FALSE);
-	g_free(name);
-
-	return ret;
-}
-
-static gboolean entry_sound_find(const struct cache_entry *entry,
-		const char *value)
-{
-	if (!entry->sound)
-		return FALSE;
-
-	return (g_strstr_len(entry->sound, -1, value) ? TRUE : FALSE);
-}
-
-static gboolean entry_tel_find(const struct cache_entry *entry,
-		const char *value)
-{
-	if (!entry->tel)
-		return FALSE;
-
-	return (g_strstr_len(entry->tel, -1, value) ? TRUE : FALSE);
-}
-
-static const char *cache_find(struct cache *cache, uint32_t handle)
-{
-	GSList *l;
-
-	for (l = cache->entries; l; l = l->next) {
-		struct cache_entry *entry = l->data;
-
-		if (entry->handle == handle)
-			return entry->id;
-	}
-
-	return NULL;
-}
-
-static void cache_clear(struct cache *cache)
-{
-	g_slist_free_full(cache->entries, cache_entry_free);
-	cache->entries = NULL;
-}
-
 static void phonebook_size_result(const char *buffer, size_t bufsize,
 					int vcards, int missed,
 					gboolean lastpart, void *user_data)
@@ -251,123 +175,36 @@ static void cache_entry_notify(const char *id, uint32_t handle,
 					const char *tel, void *user_data)
 {
 	struct pbap_session *pbap = user_data;
-	struct cache_entry *entry = g_new0(struct cache_entry, 1);
 	struct cache *cache = &pbap->cache;
 
-	if (handle != PHONEBOOK_INVALID_HANDLE)
-		entry->handle = handle;
-	else
-		entry->handle = ++pbap->cache.index;
-
-	entry->id = g_strdup(id);
-	entry->name = g_strdup(name);
-	entry->sound = g_strdup(sound);
-	entry->tel = g_strdup(tel);
-
-	cache->entries = g_slist_append(cache->entries, entry);
-}
-
-static int alpha_sort(gconstpointer a, gconstpointer b)
-{
-	const struct cache_entry *e1 = a;
-	const struct cache_entry *e2 = b;
-
-	return g_strcmp0(e1->name, e2->name);
-}
-
-static int indexed_sort(gconstpointer a, gconstpointer b)
-{
-	const struct cache_entry *e1 = a;
-	const struct cache_entry *e2 = b;
+	if (handle == PHONEBOOK_INVALID_HANDLE)
+		handle = ++cache->index;
 
-	return (e1->handle - e2->handle);
+	pbap_cache_add(&cache->contacts, handle, id, name, sound, tel);
 }
 
-static int phonetical_sort(gconstpointer a, gconstpointer b)
+static void append_listing_element(uint32_t handle, const char *name,
+							void *user_data)
 {
-	const struct cache_entry *e1 = a;
-	const struct cache_entry *e2 = b;
+	GString *buffer = user_data;
+	char *escaped_name = g_markup_escape_text(name, -1);
 
-	/* SOUND attribute is optional. Use Indexed sort if not present. */
-	if (!e1->sound || !e2->sound)
-		return indexed_sort(a, b);
+	g_string_append_printf(buffer, VCARD_LISTING_ELEMENT, handle,
+								escaped_name);
 
-	return g_strcmp0(e1->sound, e2->sound);
-}
-
-static GSList *sort_entries(GSList *l, uint8_t order, uint8_t search_attrib,
-							const char *value)
-{
-	GSList *sorted = NULL;
-	cache_entry_find_f find;
-	GCompareFunc sort;
-	char *searchval;
-
-	/*
-	 * Default sorter is "Indexed". Some backends doesn't inform the index,
-	 * for this case a sequential internal index is assigned.
-	 * 0x00 = indexed
-	 * 0x01 = alphanumeric
-	 * 0x02 = phonetic
-	 */
-	switch (order) {
-	case 0x01:
-		sort = alpha_sort;
-		break;
-	case 0x02:
-		sort = phonetical_sort;
-		break;
-	default:
-		sort = indexed_sort;
-		break;
-	}
-
-	/*
-	 * This implementation checks if the given field CONTAINS the
-	 * search value(case insensitive). Name is the default field
-	 * when the attribute is not provided.
-	 */
-	switch (search_attrib) {
-		/* Number */
-		case 1:
-			find = entry_tel_find;
-			break;
-		/* Sound */
-		case 2:
-			find = entry_sound_find;
-			break;
-		default:
-			find = entry_name_find;
-			break;
-	}
-
-	searchval = value ? g_utf8_strdown(value, -1) : NULL;
-	for (; l; l = l->next) {
-		struct cache_entry *entry = l->data;
-
-		if (searchval && !find(entry, (const char *) searchval))
-			continue;
-
-		sorted = g_slist_insert_sorted(sorted, entry, sort);
-	}
-
-	g_free(searchval);
-
-	return sorted;
+	g_free(escaped_name);
 }
 
 static int generate_response(void *user_data)
 {
 	struct pbap_session *pbap = user_data;
-	GSList *sorted;
-	GSList *l;
 	uint16_t max = pbap->params->maxlistcount;
 
 	DBG("");
 
 	if (max == 0) {
 		/* Ignore all other parameter and return PhoneBookSize */
-		uint16_t size = g_slist_length(pbap->cache.entries);
+		uint16_t size = pbap_cache_size(&pbap->cache.contacts);
 
 		pbap->obj->apparam = g_obex_apparam_set_uint16(
 							pbap->obj->apparam,
@@ -377,31 +214,17 @@ static int generate_response(void *user_data)
 		return 0;
 	}
 
-	/*
-	 * Don't free the sorted list content: this list contains
-	 * only the reference for the "real" cache entry.
-	 */
-	sorted = sort_entries(pbap->cache.entries, pbap->params->order,
-				pbap->params->searchattrib,
-				(const char *) pbap->params->searchval);
-
 	/* Computing offset considering first entry of the phonebook */
-	l = g_slist_nth(sorted, pbap->params->liststartoffset);
-
 	pbap->obj->buffer = g_string_new(VCARD_LISTING_BEGIN);
-	for (; l && max; l = l->next, max--) {
-		const struct cache_entry *entry = l->data;
-		char *escaped_name = g_markup_escape_text(entry->name, -1);
-
-		g_string_append_printf(pbap->obj->buffer,
-			VCARD_LISTING_ELEMENT, entry->handle, escaped_name);
 
-		g_free(escaped_name);
-	}
+	pbap_cache_list(&pbap->cache.contacts, pbap->params->order,
+				pbap->params->searchattrib,
+				(const char *) pbap->params->searchval,
+				pbap->params->liststartoffset, max,
+				append_listing_element, pbap->obj->buffer);
 
 	pbap->obj->buffer = g_string_append(pbap->obj->buffer,
 							VCARD_LISTING_END);
-	g_slist_free(sorted);
 
 	return 0;
 }
@@ -431,7 +254,7 @@ static void cache_entry_done(void *user_data)
 
 	pbap->cache.valid = TRUE;
 
-	id = cache_find(&pbap->cache, pbap->find_handle);
+	id = pbap_cache_find(&pbap->cache.contacts, pbap->find_handle);
 	if (id == NULL) {
 		DBG("Entry %d not found on cache", pbap->find_handle);
 		obex_object_set_io_flags(pbap->obj, G_IO_ERR, -ENOENT);
@@ -596,7 +419,7 @@ static int pbap_setpath(struct obex_session *os, void *user_data)
 	 */
 	pbap->cache.valid = FALSE;
 	pbap->cache.index = 0;
-	cache_clear(&pbap->cache);
+	pbap_cache_clear(&pbap->cache.contacts);
 
 	return 0;
 }
@@ -615,7 +438,7 @@ static void pbap_disconnect(struct obex_session *os, void *user_data)
 		g_free(pbap->params);
 	}
 
-	cache_clear(&pbap->cache);
+	pbap_cache_clear(&pbap->cache.contacts);
 	g_free(pbap->folder);
 	g_free(pbap);
 }
@@ -799,7 +622,7 @@ static void *vobject_vcard_open(const char *name, int oflag, mode_t mode,
 		goto done;
 	}
 
-	id = cache_find(&pbap->cache, handle);
+	id = pbap_cache_find(&pbap->cache.contacts, handle);
 	if (!id) {
 		ret = -ENOENT;
 		goto fail;
@@ -859,7 +682,7 @@ static ssize_t vobject_pull_read(void *object, void *buf, size_t count)
 		return -EAGAIN;
 	}
 
-	len = string_read(obj->buffer, buf, count);
+	len = string_read(obj->buffer, &obj->offset, buf, count);
 	if (len == 0 && !obj->lastpart) {
 		/* in case when buffer is empty and we know that more
 		 * data is still available in backend, requesting new
@@ -904,7 +727,7 @@ static ssize_t vobject_list_read(void *object, void *buf, size_t count)
 	if (pbap->params->maxlistcount == 0)
 		return -ENOSTR;
 
-	return string_read(obj->buffer, buf, count);
+	return string_read(obj->buffer, &obj->offset, buf, count);
 }
 
 static ssize_t vobject_vcard_read(void *object, void *buf, size_t count)
@@ -916,7 +739,7 @@ static ssize_t vobject_vcard_read(void *object, void *buf, size_t count)
 	if (!obj->buffer)
 		return -EAGAIN;
 
-	return string_read(obj->buffer, buf, count);
+	return string_read(obj->buffer, &obj->offset, buf, count);
 }
 
 static struct obex_mime_type_driver mime_pull = {
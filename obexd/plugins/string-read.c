@@ -0,0 +1,65 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <sys/types.h>
+
+#include <glib.h>
+
+#include "string-read.h"
+
+/*
+ * Copy up to count bytes starting at *offset and advance it. The consumed
+ * part is only dropped once the whole buffer has been read or once it
+ * makes up more than half of the string, so data appended by a producer
+ * while the object is being read is moved at most once instead of on
+ * every packet.
+ */
+ssize_t string_read(GString *string, size_t *offset, void *buf, size_t count)
+{
+	size_t len;
+
+	if (*offset >= string->len) {
+		g_string_truncate(string, 0);
+		*offset = 0;
+		return 0;
+	}
+
+	len = MIN(string->len - *offset, count);
+	memcpy(buf, string->str + *offset, len);
+	*offset += len;
+
+	if (*offset == string->len) {
+		g_string_truncate(string, 0);
+		*offset = 0;
+	} else if (*offset > string->len / 2) {
+		g_string_erase(string, 0, *offset);
+		*offset = 0;
+	}
+
+	return len;
+}
@@ -46,6 +46,7 @@
 #include "obexd/src/log.h"
 #include "obexd/src/manager.h"
 #include "obexd/src/obexd.h"
+#include "string-read.h"
 #include "filesystem.h"
 
 #define SYNCML_TARGET_SIZE 11
@@ -96,6 +97,7 @@ struct synce_context {
 	unsigned int reply_watch;
 	unsigned int abort_watch;
 	GString *buffer;
+	size_t offset;
 	int lasterr;
 	char *id;
 };
@@ -133,6 +135,7 @@ static gboolean reply_signal(DBusConnection *conn, DBusMessage *msg,
 	dbus_message_iter_get_fixed_array(&array_iter, &value, &length);
 
 	context->buffer = g_string_new_len(value, length);
+	context->offset = 0;
 	obex_object_set_io_flags(context, G_IO_IN, 0);
 	context->lasterr = 0;
 
@@ -347,7 +350,8 @@ static ssize_t synce_read(void *object, void *buf, size_t count)
 	DBusPendingCall *call;
 
 	if (context->buffer)
-		return string_read(context->buffer, buf, count);
+		return string_read(context->buffer, &context->offset, buf,
+									count);
 
 	conn = manager_dbus_get_connection();
 	if (conn == NULL)
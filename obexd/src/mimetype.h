@@ -37,6 +37,7 @@ struct obex_mime_type_driver {
 								uint8_t *hi);
 	ssize_t (*read) (void *object, void *buf, size_t count);
 	ssize_t (*write) (void *object, const void *buf, size_t count);
+	int (*get_fd) (void *object);
 	int (*flush) (void *object);
 	int (*copy) (const char *name, const char *destname);
 	int (*move) (const char *name, const char *destname);
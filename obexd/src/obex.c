@@ -446,6 +446,50 @@ static gssize send_data(void *buf, gsize size, gpointer user_data)
 	return driver_read(os, buf, size);
 }
 
+static gssize send_fd(int *fd, gsize size, gpointer user_data)
+{
+	struct obex_session *os = user_data;
+	gssize len;
+
+	DBG("name=%s type=%s file=%p size=%zu", os->name, os->type, os->object,
+									size);
+
+	if (os->aborted)
+		return os->err < 0 ? os->err : -EPERM;
+
+	if (os->object == NULL)
+		return -EIO;
+
+	if (os->service->progress != NULL)
+		os->service->progress(os, os->service_data);
+
+	*fd = os->driver->get_fd(os->object);
+	if (*fd < 0)
+		return *fd;
+
+	len = MIN((int64_t) size, os->size - os->offset);
+	os->offset += len;
+
+	DBG("%zd to be sent from fd %d", len, *fd);
+
+	return len;
+}
+
+/*
+ * Objects backed by a regular file of known size are sent directly from
+ * the file instead of being read into the OBEX packets.
+ */
+static gboolean driver_use_fd(struct obex_session *os)
+{
+	if (os->driver->get_fd == NULL)
+		return FALSE;
+
+	if (os->size == OBJECT_SIZE_UNKNOWN || os->size < 0)
+		return FALSE;
+
+	return os->driver->get_fd(os->object) >= 0;
+}
+
 static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
 {
 	struct obex_session *os = user_data;
@@ -521,8 +565,12 @@ done:
 		g_obex_packet_add_header(rsp, hdr);
 	}
 
-	g_obex_get_rsp_pkt(os->obex, rsp, send_data, transfer_complete, os,
-									NULL);
+	if (driver_use_fd(os))
+		g_obex_get_rsp_pkt_fd(os->obex, rsp, send_fd, transfer_complete,
+								os, NULL);
+	else
+		g_obex_get_rsp_pkt(os->obex, rsp, send_data, transfer_complete,
+								os, NULL);
 
 	os->headers_sent = TRUE;
 
@@ -558,6 +606,38 @@ done:
 	return FALSE;
 }
 
+static ssize_t driver_write_direct(struct obex_session *os,
+					const uint8_t *buf, size_t size)
+{
+	size_t len = 0;
+
+	while (len < size) {
+		ssize_t w;
+
+		w = os->driver->write(os->object, buf + len, size - len);
+		if (w == -EINTR)
+			continue;
+
+		if (w == -EAGAIN)
+			break;
+
+		if (w < 0) {
+			error("write(): %s (%zd)", strerror(-w), -w);
+			return w;
+		}
+
+		len += w;
+		os->offset += w;
+	}
+
+	DBG("%zu written", len);
+
+	if (os->service->progress != NULL)
+		os->service->progress(os, os->service_data);
+
+	return len;
+}
+
 static gboolean recv_data(const void *buf, gsize size, gpointer user_data)
 {
 	struct obex_session *os = user_data;
@@ -573,6 +653,27 @@ static gboolean recv_data(const void *buf, gsize size, gpointer user_data)
 	if (os->size == OBJECT_SIZE_DELETE)
 		os->size = OBJECT_SIZE_UNKNOWN;
 
+	/*
+	 * Unless there is data still waiting for the driver write straight
+	 * from the packet and only keep what the driver can't take yet.
+	 */
+	if (os->pending == 0 && os->object != NULL && os->driver != NULL) {
+		ret = driver_write_direct(os, buf, size);
+		if (ret < 0)
+			return FALSE;
+
+		if ((gsize) ret == size)
+			return TRUE;
+
+		os->buf = g_realloc(os->buf, size - ret);
+		memcpy(os->buf, (const uint8_t *) buf + ret, size - ret);
+		os->pending = size - ret;
+
+		g_obex_suspend(os->obex);
+		os->driver->set_io_watch(os->object, handle_async_io, os);
+		return TRUE;
+	}
+
 	os->buf = g_realloc(os->buf, os->pending + size);
 	memcpy(os->buf + os->pending, buf, size);
 	os->pending += size;
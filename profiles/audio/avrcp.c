@@ -223,6 +223,8 @@ struct pending_pdu {
 
 struct pending_list_items {
 	GSList *items;
+	GHashTable *seen;
+	uint64_t count;
 	uint32_t start;
 	uint32_t end;
 	uint64_t total;
@@ -2464,6 +2466,15 @@ static struct media_item *parse_media_folder(struct avrcp *session,
 	return item;
 }
 
+static void set_uid_counter(struct avrcp_player *player, uint16_t counter)
+{
+	player->uid_counter = counter;
+
+	/* Cached listings are only valid as long as the counter is */
+	if (player->user_data)
+		media_player_set_uid_counter(player->user_data, counter);
+}
+
 static void avrcp_list_items(struct avrcp *session, uint32_t start,
 								uint32_t end);
 static gboolean avrcp_list_items_rsp(struct avctp *conn, uint8_t *operands,
@@ -2496,6 +2507,8 @@ static gboolean avrcp_list_items_rsp(struct avctp *conn, uint8_t *operands,
 		goto done;
 	}
 
+	set_uid_counter(player, get_be16(&pdu->params[1]));
+
 	count = get_be16(&operands[6]);
 	if (count == 0)
 		goto done;
@@ -2525,15 +2538,20 @@ static gboolean avrcp_list_items_rsp(struct avctp *conn, uint8_t *operands,
 			item = parse_media_folder(session, &operands[i], len);
 
 		if (item) {
-			if (g_slist_find(p->items, item))
+			if (g_hash_table_lookup(p->seen, item))
 				goto done;
-			p->items = g_slist_append(p->items, item);
+
+			g_hash_table_add(p->seen, item);
+
+			/* Reversed once the listing is complete */
+			p->items = g_slist_prepend(p->items, item);
+			p->count++;
 		}
 
 		i += len;
 	}
 
-	items = g_slist_length(p->items);
+	items = p->count;
 
 	DBG("start %u end %u items %" PRIu64 " total %" PRIu64 "", p->start,
 						p->end, items, p->total);
@@ -2544,8 +2562,11 @@ static gboolean avrcp_list_items_rsp(struct avctp *conn, uint8_t *operands,
 	}
 
 done:
+	p->items = g_slist_reverse(p->items);
+
 	media_player_list_complete(player->user_data, p->items, err);
 
+	g_hash_table_destroy(p->seen);
 	g_slist_free(p->items);
 	g_free(p);
 	player->p = NULL;
@@ -2641,7 +2662,7 @@ static gboolean avrcp_set_browsed_player_rsp(struct avctp *conn,
 							operand_count < 13)
 		return FALSE;
 
-	player->uid_counter = get_be16(&pdu->params[1]);
+	set_uid_counter(player, get_be16(&pdu->params[1]));
 	player->browsed = true;
 
 	items = get_be32(&pdu->params[3]);
@@ -2991,6 +3012,7 @@ static int ct_list_items(struct media_player *mp, const char *name,
 	avrcp_list_items(session, start, end);
 
 	p = g_new0(struct pending_list_items, 1);
+	p->seen = g_hash_table_new(NULL, NULL);
 	p->start = start;
 	p->end = end;
 	p->total = (uint64_t) (p->end - p->start) + 1;
@@ -3054,7 +3076,7 @@ static gboolean avrcp_search_rsp(struct avctp *conn, uint8_t *operands,
 		goto done;
 	}
 
-	player->uid_counter = get_be16(&pdu->params[1]);
+	set_uid_counter(player, get_be16(&pdu->params[1]));
 	ret = get_be32(&pdu->params[3]);
 
 done:
@@ -3213,7 +3235,7 @@ static gboolean avrcp_get_total_numberofitems_rsp(struct avctp *conn,
 	if (pdu->params[0] == AVRCP_STATUS_OUT_OF_BOUNDS)
 		goto done;
 
-	player->uid_counter = get_be16(&pdu->params[1]);
+	set_uid_counter(player, get_be16(&pdu->params[1]));
 	num_of_items = get_be32(&pdu->params[3]);
 
 	if (!num_of_items)
@@ -3605,7 +3627,7 @@ static void avrcp_addressed_player_changed(struct avrcp *session,
 	}
 
 	player->addressed = true;
-	player->uid_counter = get_be16(&pdu->params[3]);
+	set_uid_counter(player, get_be16(&pdu->params[3]));
 	set_ct_player(session, player);
 
 	if (player->features != NULL)
@@ -3618,7 +3640,7 @@ static void avrcp_uids_changed(struct avrcp *session, struct avrcp_header *pdu)
 {
 	struct avrcp_player *player = session->controller->player;
 
-	player->uid_counter = get_be16(&pdu->params[1]);
+	set_uid_counter(player, get_be16(&pdu->params[1]));
 }
 
 static gboolean avrcp_handle_event(struct avctp *conn, uint8_t code,
@@ -77,6 +77,9 @@ struct media_folder {
 	uint32_t		number_of_items;/* Number of items */
 	GSList			*subfolders;
 	GSList			*items;
+	GHashTable		*uids;		/* Items by uid */
+	GPtrArray		*cache;		/* Listed items by position */
+	uint32_t		list_start;	/* Start of pending listing */
 	DBusMessage		*msg;
 };
 
@@ -101,6 +104,7 @@ struct media_player {
 	struct player_callback	*cb;
 	GSList			*pending;
 	GSList			*folders;
+	uint16_t		uid_counter;
 };
 
 static void append_track(void *key, void *value, void *user_data)
@@ -611,22 +615,12 @@ done:
 	folder->msg = NULL;
 }
 
-void media_player_list_complete(struct media_player *mp, GSList *items,
-								int err)
+static DBusMessage *list_items_reply(DBusMessage *msg, GSList *items)
 {
-	struct media_folder *folder = mp->scope;
 	DBusMessage *reply;
 	DBusMessageIter iter, array;
 
-	if (folder == NULL || folder->msg == NULL)
-		return;
-
-	if (err < 0) {
-		reply = btd_error_failed(folder->msg, strerror(-err));
-		goto done;
-	}
-
-	reply = dbus_message_new_method_return(folder->msg);
+	reply = dbus_message_new_method_return(msg);
 
 	dbus_message_iter_init_append(reply, &iter);
 
@@ -644,6 +638,50 @@ void media_player_list_complete(struct media_player *mp, GSList *items,
 	g_slist_foreach(items, parse_folder_list, &array);
 	dbus_message_iter_close_container(&iter, &array);
 
+	return reply;
+}
+
+static void media_folder_clear_cache(struct media_folder *folder)
+{
+	if (folder->cache != NULL)
+		g_ptr_array_set_size(folder->cache, 0);
+}
+
+static void media_folder_cache_items(struct media_folder *folder,
+								GSList *items)
+{
+	uint32_t index = folder->list_start;
+	GSList *l;
+
+	if (folder->cache == NULL)
+		folder->cache = g_ptr_array_new();
+
+	for (l = items; l; l = l->next, index++) {
+		if (index >= folder->cache->len)
+			g_ptr_array_set_size(folder->cache, index + 1);
+
+		g_ptr_array_index(folder->cache, index) = l->data;
+	}
+}
+
+void media_player_list_complete(struct media_player *mp, GSList *items,
+								int err)
+{
+	struct media_folder *folder = mp->scope;
+	DBusMessage *reply;
+
+	if (folder == NULL || folder->msg == NULL)
+		return;
+
+	if (err < 0) {
+		reply = btd_error_failed(folder->msg, strerror(-err));
+		goto done;
+	}
+
+	media_folder_cache_items(folder, items);
+
+	reply = list_items_reply(folder->msg, items);
+
 done:
 	g_dbus_send_message(btd_get_dbus_connection(), reply);
 	dbus_message_unref(folder->msg);
@@ -712,6 +750,7 @@ void media_player_total_items_complete(struct media_player *mp,
 
 	if (folder->number_of_items != num_of_items) {
 		folder->number_of_items = num_of_items;
+		media_folder_clear_cache(folder);
 
 		g_dbus_emit_property_changed(btd_get_dbus_connection(),
 				mp->path, MEDIA_FOLDER_INTERFACE,
@@ -838,6 +877,46 @@ static int parse_filters(struct media_player *player, DBusMessageIter *iter,
 	return 0;
 }
 
+/*
+ * Items listed before are kept by position, so paging back and forth
+ * through a large folder does not go to the remote player every time.
+ * The cache can only be trusted for players that keep their UIDs stable
+ * i.e. that use a non-zero UID counter.
+ */
+static GSList *media_folder_get_cached(struct media_player *mp,
+						struct media_folder *folder,
+						uint32_t start, uint32_t end)
+{
+	GSList *items = NULL;
+	uint32_t i;
+
+	if (mp->uid_counter == 0 || folder->cache == NULL)
+		return NULL;
+
+	if (folder->number_of_items == 0)
+		return NULL;
+
+	if (end >= folder->number_of_items)
+		end = folder->number_of_items - 1;
+
+	if (start > end || end >= folder->cache->len)
+		return NULL;
+
+	for (i = end + 1; i > start; i--) {
+		struct media_item *item;
+
+		item = g_ptr_array_index(folder->cache, i - 1);
+		if (item == NULL) {
+			g_slist_free(items);
+			return NULL;
+		}
+
+		items = g_slist_prepend(items, item);
+	}
+
+	return items;
+}
+
 static DBusMessage *media_folder_list_items(DBusConnection *conn,
 						DBusMessage *msg, void *data)
 {
@@ -845,7 +924,9 @@ static DBusMessage *media_folder_list_items(DBusConnection *conn,
 	struct media_folder *folder = mp->scope;
 	struct player_callback *cb = mp->cb;
 	DBusMessageIter iter;
+	DBusMessage *reply;
 	uint32_t start, end;
+	GSList *items;
 	int err;
 
 	dbus_message_iter_init(msg, &iter);
@@ -859,6 +940,16 @@ static DBusMessage *media_folder_list_items(DBusConnection *conn,
 	if (folder->msg != NULL)
 		return btd_error_failed(msg, strerror(EBUSY));
 
+	items = media_folder_get_cached(mp, folder, start, end);
+	if (items != NULL) {
+		DBG("%u-%u from cache", start, end);
+		reply = list_items_reply(msg, items);
+		g_slist_free(items);
+		return reply;
+	}
+
+	folder->list_start = start;
+
 	err = cb->cbs->list_items(mp, folder->item->name, start, end,
 							cb->user_data);
 	if (err < 0)
@@ -891,12 +982,29 @@ static void media_item_destroy(void *data)
 	media_item_free(item);
 }
 
+static void media_folder_clear_items(struct media_folder *folder)
+{
+	media_folder_clear_cache(folder);
+
+	if (folder->uids != NULL)
+		g_hash_table_remove_all(folder->uids);
+
+	g_slist_free_full(folder->items, media_item_destroy);
+	folder->items = NULL;
+}
+
 static void media_folder_destroy(void *data)
 {
 	struct media_folder *folder = data;
 
 	g_slist_free_full(folder->subfolders, media_folder_destroy);
-	g_slist_free_full(folder->items, media_item_destroy);
+	media_folder_clear_items(folder);
+
+	if (folder->uids != NULL)
+		g_hash_table_destroy(folder->uids);
+
+	if (folder->cache != NULL)
+		g_ptr_array_free(folder->cache, TRUE);
 
 	if (folder->msg != NULL)
 		dbus_message_unref(folder->msg);
@@ -927,8 +1035,7 @@ static void media_player_change_scope(struct media_player *mp,
 		goto done;
 
 cleanup:
-	g_slist_free_full(mp->scope->items, media_item_destroy);
-	mp->scope->items = NULL;
+	media_folder_clear_items(mp->scope);
 
 	/* Destroy search folder if it exists and is not being set as scope */
 	if (mp->search != NULL && folder != mp->search) {
@@ -1462,19 +1569,10 @@ void media_player_set_playlist(struct media_player *mp, const char *name)
 static struct media_item *media_folder_find_item(struct media_folder *folder,
 								uint64_t uid)
 {
-	GSList *l;
-
-	if (uid == 0)
+	if (uid == 0 || folder->uids == NULL)
 		return NULL;
 
-	for (l = folder->items; l; l = l->next) {
-		struct media_item *item = l->data;
-
-		if (item->uid == uid)
-			return item;
-	}
-
-	return NULL;
+	return g_hash_table_lookup(folder->uids, &uid);
 }
 
 static DBusMessage *media_item_play(DBusConnection *conn, DBusMessage *msg,
@@ -1759,6 +1857,14 @@ static struct media_item *media_folder_create_item(struct media_player *mp,
 		folder->items = g_slist_prepend(folder->items, item);
 		item->metadata = g_hash_table_new_full(g_str_hash, g_str_equal,
 							g_free, g_free);
+
+		if (uid > 0) {
+			if (folder->uids == NULL)
+				folder->uids = g_hash_table_new(g_int64_hash,
+								g_int64_equal);
+
+			g_hash_table_insert(folder->uids, &item->uid, item);
+		}
 	}
 
 	DBG("%s", item->path);
@@ -1837,6 +1943,31 @@ done:
 	return item;
 }
 
+static void clear_cache(GSList *folders)
+{
+	GSList *l;
+
+	for (l = folders; l; l = l->next) {
+		struct media_folder *folder = l->data;
+
+		media_folder_clear_cache(folder);
+		clear_cache(folder->subfolders);
+	}
+}
+
+void media_player_set_uid_counter(struct media_player *mp, uint16_t counter)
+{
+	if (mp->uid_counter == counter)
+		return;
+
+	DBG("%u -> %u", mp->uid_counter, counter);
+
+	mp->uid_counter = counter;
+
+	/* Positions and UIDs of listed items are no longer valid */
+	clear_cache(mp->folders);
+}
+
 void media_player_set_callbacks(struct media_player *mp,
 				const struct media_player_callback *cbs,
 				void *user_data)
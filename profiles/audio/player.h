@@ -90,6 +90,7 @@ void media_player_set_searchable(struct media_player *mp, bool enabled);
 void media_player_set_folder(struct media_player *mp, const char *path,
 								uint32_t items);
 void media_player_set_playlist(struct media_player *mp, const char *name);
+void media_player_set_uid_counter(struct media_player *mp, uint16_t counter);
 struct media_item *media_player_set_playlist_item(struct media_player *mp,
 								uint64_t uid);
 
@@ -0,0 +1,366 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "src/log.h"
+#include "src/shared/util.h"
+
+#include "relay.h"
+
+#define RTP_HEADER_SIZE	12
+#define RTP_VERSION	2
+
+struct relay_pump {
+	struct media_relay	*relay;
+	int			src;
+	int			dst;
+	int			pipe[2];	/* Holds one packet at a time */
+	uint16_t		mtu;
+	uint8_t			*buf;		/* Fallback when not splicing */
+	bool			splice;
+	guint			watch;
+	bool			seq_valid;
+	uint16_t		next_seq;
+	bool			transit_valid;
+	uint32_t		last_transit;
+	uint64_t		jitter;		/* Scaled by 16 */
+	struct media_relay_stats stats;
+};
+
+/*
+ * The endpoint gets one end of a socket pair instead of the AVDTP transport
+ * itself, and packets are moved between the two with splice() through a
+ * pipe so the payload never has to be copied into the daemon.
+ */
+struct media_relay {
+	int			fd;		/* Owned by the AVDTP stream */
+	int			sk[2];		/* Relay and endpoint side */
+	uint32_t		clock_rate;
+	struct relay_pump	in;		/* Transport to endpoint */
+	struct relay_pump	out;		/* Endpoint to transport */
+};
+
+static void pump_update_rtp(struct relay_pump *pump, const uint8_t *hdr,
+								ssize_t len)
+{
+	uint32_t clock_rate = pump->relay->clock_rate;
+	uint32_t transit, diff;
+	uint16_t seq, gap;
+
+	if (len < RTP_HEADER_SIZE || (hdr[0] >> 6) != RTP_VERSION)
+		return;
+
+	seq = get_be16(hdr + 2);
+
+	if (pump->seq_valid) {
+		gap = seq - pump->next_seq;
+
+		/* Anything behind the expected number arrived late */
+		if (gap >= 0x8000) {
+			pump->stats.reordered++;
+			return;
+		}
+
+		pump->stats.lost += gap;
+	}
+
+	pump->seq_valid = true;
+	pump->next_seq = seq + 1;
+
+	if (!clock_rate)
+		return;
+
+	/* RFC 3550 interarrival jitter, in timestamp units */
+	transit = g_get_monotonic_time() * clock_rate / 1000000 -
+							get_be32(hdr + 4);
+
+	if (pump->transit_valid) {
+		diff = transit - pump->last_transit;
+		if (diff >= 0x80000000)
+			diff = -diff;
+
+		pump->jitter += diff - ((pump->jitter + 8) >> 4);
+	}
+
+	pump->transit_valid = true;
+	pump->last_transit = transit;
+}
+
+static int pump_send(struct relay_pump *pump, const void *buf, size_t len)
+{
+	if (send(pump->dst, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		if (errno != EAGAIN && errno != ENOBUFS)
+			return -errno;
+
+		/* Late media is useless, drop it instead of queueing */
+		pump->stats.dropped++;
+		return 0;
+	}
+
+	pump->stats.packets++;
+	pump->stats.bytes += len;
+
+	return 0;
+}
+
+static int pump_copy(struct relay_pump *pump)
+{
+	ssize_t len;
+
+	len = recv(pump->src, pump->buf, pump->mtu, MSG_DONTWAIT);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -errno;
+
+	if (len == 0)
+		return -ECONNRESET;
+
+	return pump_send(pump, pump->buf, len);
+}
+
+static int pump_splice(struct relay_pump *pump)
+{
+	ssize_t len, ret;
+	int err;
+
+	len = splice(pump->src, NULL, pump->pipe[1], NULL, pump->mtu,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len < 0) {
+		if (errno == EINVAL) {
+			/* Nothing has been consumed from the source yet */
+			DBG("splice from fd %d not supported", pump->src);
+			pump->splice = false;
+			return pump_copy(pump);
+		}
+
+		return errno == EAGAIN || errno == EINTR ? 0 : -errno;
+	}
+
+	if (len == 0)
+		return -ECONNRESET;
+
+	ret = splice(pump->pipe[0], NULL, pump->dst, NULL, len,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (ret == len) {
+		pump->stats.packets++;
+		pump->stats.bytes += len;
+		return 0;
+	}
+
+	err = ret < 0 ? errno : 0;
+	if (err && err != EINVAL && err != EAGAIN && err != ENOBUFS)
+		return -err;
+
+	/* Always leave the pipe empty so packets are never merged */
+	if (ret > 0)
+		len -= ret;
+
+	len = read(pump->pipe[0], pump->buf, len);
+	if (len < 0)
+		return -errno;
+
+	if (err == EINVAL) {
+		DBG("splice to fd %d not supported", pump->dst);
+		pump->splice = false;
+		return pump_send(pump, pump->buf, len);
+	}
+
+	pump->stats.dropped++;
+
+	return 0;
+}
+
+static void pump_stop(struct relay_pump *pump)
+{
+	if (pump->watch > 0) {
+		g_source_remove(pump->watch);
+		pump->watch = 0;
+	}
+}
+
+static gboolean pump_cb(GIOChannel *io, GIOCondition cond, gpointer data)
+{
+	struct relay_pump *pump = data;
+	struct media_relay *relay = pump->relay;
+	uint8_t hdr[RTP_HEADER_SIZE];
+	ssize_t len;
+	int err;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
+		goto failed;
+
+	len = recv(pump->src, hdr, sizeof(hdr), MSG_PEEK | MSG_DONTWAIT);
+	if (len < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+		goto failed;
+	}
+
+	if (len == 0)
+		goto failed;
+
+	pump_update_rtp(pump, hdr, len);
+
+	err = pump->splice ? pump_splice(pump) : pump_copy(pump);
+	if (err == 0)
+		return TRUE;
+
+	DBG("fd %d: %s (%d)", pump->src, strerror(-err), -err);
+
+failed:
+	pump->watch = 0;
+
+	/* Let the endpoint see the transport going away and vice versa */
+	pump_stop(pump == &relay->in ? &relay->out : &relay->in);
+	shutdown(relay->sk[0], SHUT_RDWR);
+
+	return FALSE;
+}
+
+static bool pump_start(struct media_relay *relay, struct relay_pump *pump,
+					int src, int dst, uint16_t mtu)
+{
+	GIOChannel *io;
+
+	pump->relay = relay;
+	pump->src = src;
+	pump->dst = dst;
+	pump->mtu = mtu;
+	pump->buf = g_malloc(mtu);
+
+	/*
+	 * A packet spliced into the pipe has to stay within a single page,
+	 * otherwise it could be sent out as several packets.
+	 */
+	if (mtu <= sysconf(_SC_PAGESIZE) &&
+				pipe2(pump->pipe, O_NONBLOCK | O_CLOEXEC) == 0)
+		pump->splice = true;
+	else {
+		pump->pipe[0] = -1;
+		pump->pipe[1] = -1;
+	}
+
+	io = g_io_channel_unix_new(src);
+	pump->watch = g_io_add_watch(io, G_IO_IN | G_IO_ERR | G_IO_HUP |
+						G_IO_NVAL, pump_cb, pump);
+	g_io_channel_unref(io);
+
+	return pump->watch > 0;
+}
+
+static void pump_free(struct relay_pump *pump)
+{
+	pump_stop(pump);
+
+	if (pump->pipe[0] >= 0) {
+		close(pump->pipe[0]);
+		close(pump->pipe[1]);
+	}
+
+	g_free(pump->buf);
+}
+
+static void pump_get_stats(struct relay_pump *pump,
+					struct media_relay_stats *stats)
+{
+	uint32_t clock_rate = pump->relay->clock_rate;
+
+	*stats = pump->stats;
+
+	if (clock_rate)
+		stats->jitter = (pump->jitter >> 4) * 1000000 / clock_rate;
+}
+
+struct media_relay *media_relay_new(int fd, uint16_t imtu, uint16_t omtu,
+							uint32_t clock_rate)
+{
+	struct media_relay *relay;
+
+	relay = g_new0(struct media_relay, 1);
+	relay->fd = fd;
+	relay->clock_rate = clock_rate;
+	relay->in.pipe[0] = relay->in.pipe[1] = -1;
+	relay->out.pipe[0] = relay->out.pipe[1] = -1;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+							0, relay->sk) < 0) {
+		error("Unable to create relay socket: %s (%d)",
+						strerror(errno), errno);
+		g_free(relay);
+		return NULL;
+	}
+
+	if (!pump_start(relay, &relay->in, fd, relay->sk[0], imtu) ||
+			!pump_start(relay, &relay->out, relay->sk[0], fd,
+								omtu)) {
+		error("Unable to start media relay");
+		media_relay_free(relay);
+		return NULL;
+	}
+
+	DBG("fd %d relayed through fd %d (%s)", fd, relay->sk[1],
+				relay->in.splice ? "splice" : "copy");
+
+	return relay;
+}
+
+void media_relay_free(struct media_relay *relay)
+{
+	if (!relay)
+		return;
+
+	pump_free(&relay->in);
+	pump_free(&relay->out);
+
+	close(relay->sk[0]);
+	close(relay->sk[1]);
+
+	g_free(relay);
+}
+
+int media_relay_get_fd(struct media_relay *relay)
+{
+	return relay->sk[1];
+}
+
+void media_relay_get_stats(struct media_relay *relay,
+					struct media_relay_stats *in,
+					struct media_relay_stats *out)
+{
+	if (in)
+		pump_get_stats(&relay->in, in);
+
+	if (out)
+		pump_get_stats(&relay->out, out);
+}
@@ -0,0 +1,42 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct media_relay;
+
+/* Counters for media flowing in one direction through the relay */
+struct media_relay_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	uint32_t dropped;	/* Packets the destination could not take */
+	uint32_t lost;		/* Gaps in the RTP sequence numbers */
+	uint32_t reordered;	/* Late or duplicated RTP packets */
+	uint32_t jitter;	/* RTP interarrival jitter in microseconds */
+};
+
+struct media_relay *media_relay_new(int fd, uint16_t imtu, uint16_t omtu,
+							uint32_t clock_rate);
+void media_relay_free(struct media_relay *relay);
+int media_relay_get_fd(struct media_relay *relay);
+void media_relay_get_stats(struct media_relay *relay,
+					struct media_relay_stats *in,
+					struct media_relay_stats *out);
@@ -27,6 +27,7 @@
 #endif
 
 #include <errno.h>
+#include <inttypes.h>
 
 #include <glib.h>
 
@@ -36,6 +37,7 @@
 
 #include "gdbus/gdbus.h"
 
+#include "src/hcid.h"
 #include "src/adapter.h"
 #include "src/device.h"
 #include "src/dbus-common.h"
@@ -51,6 +53,8 @@
 #include "sink.h"
 #include "source.h"
 #include "avrcp.h"
+#include "a2dp-codecs.h"
+#include "relay.h"
 
 #define MEDIA_TRANSPORT_INTERFACE "org.bluez.MediaTransport1"
 
@@ -98,6 +102,7 @@ struct media_transport {
 	int			fd;		/* Transport file descriptor */
 	uint16_t		imtu;		/* Transport input mtu */
 	uint16_t		omtu;		/* Transport output mtu */
+	struct media_relay	*relay;		/* Transport media relay */
 	transport_state_t	state;
 	guint			hs_watch;
 	guint			source_watch;
@@ -145,6 +150,28 @@ static gboolean state_in_use(transport_state_t state)
 	return FALSE;
 }
 
+static void transport_free_relay(struct media_transport *transport)
+{
+	struct media_relay_stats in, out;
+
+	if (!transport->relay)
+		return;
+
+	media_relay_get_stats(transport->relay, &in, &out);
+
+	info("%s: relayed in %" PRIu64 " packets %" PRIu64 " bytes, "
+			"%u dropped %u lost %u reordered, jitter %u us",
+			transport->path, in.packets, in.bytes, in.dropped,
+			in.lost, in.reordered, in.jitter);
+	info("%s: relayed out %" PRIu64 " packets %" PRIu64 " bytes, "
+			"%u dropped %u lost %u reordered, jitter %u us",
+			transport->path, out.packets, out.bytes, out.dropped,
+			out.lost, out.reordered, out.jitter);
+
+	media_relay_free(transport->relay);
+	transport->relay = NULL;
+}
+
 static void transport_set_state(struct media_transport *transport,
 							transport_state_t state)
 {
@@ -156,6 +183,9 @@ static void transport_set_state(struct media_transport *transport,
 
 	transport->state = state;
 
+	if (state == TRANSPORT_STATE_IDLE)
+		transport_free_relay(transport);
+
 	DBG("State changed %s: %s -> %s", transport->path, str_state[old_state],
 							str_state[state]);
 
@@ -274,6 +304,9 @@ static gboolean media_transport_set_fd(struct media_transport *transport,
 	if (transport->fd == fd)
 		return TRUE;
 
+	/* A relay is tied to the transport it was created for */
+	transport_free_relay(transport);
+
 	transport->fd = fd;
 	transport->imtu = imtu;
 	transport->omtu = omtu;
@@ -283,6 +316,46 @@ static gboolean media_transport_set_fd(struct media_transport *transport,
 	return TRUE;
 }
 
+/* RTP clock rate of the configured codec, 0 if unknown */
+static uint32_t transport_get_clock_rate(struct media_transport *transport)
+{
+	a2dp_sbc_t *sbc = (void *) transport->configuration;
+
+	if (media_endpoint_get_codec(transport->endpoint) != A2DP_CODEC_SBC ||
+					transport->size < (int) sizeof(*sbc))
+		return 0;
+
+	switch (sbc->frequency) {
+	case SBC_SAMPLING_FREQ_16000:
+		return 16000;
+	case SBC_SAMPLING_FREQ_32000:
+		return 32000;
+	case SBC_SAMPLING_FREQ_44100:
+		return 44100;
+	case SBC_SAMPLING_FREQ_48000:
+		return 48000;
+	}
+
+	return 0;
+}
+
+static int transport_get_relay_fd(struct media_transport *transport, int fd)
+{
+	if (!main_opts.media_relay)
+		return fd;
+
+	if (!transport->relay)
+		transport->relay = media_relay_new(fd, transport->imtu,
+					transport->omtu,
+					transport_get_clock_rate(transport));
+
+	/* Hand out the transport itself if the relay cannot be set up */
+	if (!transport->relay)
+		return fd;
+
+	return media_relay_get_fd(transport->relay);
+}
+
 static void a2dp_resume_complete(struct avdtp *session, int err,
 							void *user_data)
 {
@@ -310,6 +383,8 @@ static void a2dp_resume_complete(struct avdtp *session, int err,
 
 	media_transport_set_fd(transport, fd, imtu, omtu);
 
+	fd = transport_get_relay_fd(transport, fd);
+
 	ret = g_dbus_send_reply(btd_get_dbus_connection(), req->msg,
 						DBUS_TYPE_UNIX_FD, &fd,
 						DBUS_TYPE_UINT16, &imtu,
@@ -736,6 +811,8 @@ static void media_transport_free(void *data)
 	if (transport->destroy != NULL)
 		transport->destroy(transport->data);
 
+	transport_free_relay(transport);
+
 	g_free(transport->configuration);
 	g_free(transport->path);
 	g_free(transport);
@@ -8276,6 +8276,8 @@ int adapter_init(void)
 	if (getenv("MGMT_DEBUG"))
 		mgmt_set_debug(mgmt_master, mgmt_debug, "mgmt: ", NULL);
 
+	mgmt_set_max_pending(mgmt_master, main_opts.max_pending);
+
 	DBG("sending read version command");
 
 	if (mgmt_send(mgmt_master, MGMT_OP_READ_VERSION,
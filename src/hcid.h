@@ -39,6 +39,8 @@ struct main_opts {
 	gboolean	name_resolv;
 	gboolean	debug_keys;
 	gboolean	fast_conn;
+	uint16_t	max_pending;
+	gboolean	media_relay;
 
 	uint16_t	did_source;
 	uint16_t	did_vendor;
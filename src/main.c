@@ -64,6 +64,7 @@
 
 #define DEFAULT_PAIRABLE_TIMEOUT       0 /* disabled */
 #define DEFAULT_DISCOVERABLE_TIMEOUT 180 /* 3 minutes */
+#define DEFAULT_MAX_PENDING_COMMANDS  16
 
 #define SHUTDOWN_GRACE_SECONDS 10
 
@@ -89,6 +90,8 @@ static const char * const supported_options[] = {
 	"DebugKeys",
 	"ControllerMode",
 	"MultiProfile",
+	"MaxPendingCommands",
+	"MediaRelay",
 };
 
 GKeyFile *btd_get_main_conf(void)
@@ -336,6 +339,25 @@ static void parse_config(GKeyFile *config)
 		g_clear_error(&err);
 	else
 		main_opts.fast_conn = boolean;
+
+	val = g_key_file_get_integer(config, "General",
+						"MaxPendingCommands", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 1 || val > UINT16_MAX) {
+		error("Invalid MaxPendingCommands value %d", val);
+	} else {
+		DBG("max_pending=%d", val);
+		main_opts.max_pending = val;
+	}
+
+	boolean = g_key_file_get_boolean(config, "General",
+						"MediaRelay", &err);
+	if (err)
+		g_clear_error(&err);
+	else
+		main_opts.media_relay = boolean;
 }
 
 static void init_defaults(void)
@@ -348,9 +370,11 @@ static void init_defaults(void)
 	main_opts.class = 0x000000;
 	main_opts.pairto = DEFAULT_PAIRABLE_TIMEOUT;
 	main_opts.discovto = DEFAULT_DISCOVERABLE_TIMEOUT;
+	main_opts.max_pending = DEFAULT_MAX_PENDING_COMMANDS;
 	main_opts.reverse_sdp = TRUE;
 	main_opts.name_resolv = TRUE;
 	main_opts.debug_keys = FALSE;
+	main_opts.media_relay = FALSE;
 
 	if (sscanf(VERSION, "%hhu.%hhu", &major, &minor) != 2)
 		return;
@@ -26,12 +26,17 @@
 #endif
 
 #include <endian.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "src/shared/btsnoop.h"
 
@@ -73,8 +78,58 @@ struct btsnoop {
 	bool aborted;
 	bool pklg_format;
 	bool pklg_v2;
+	const char *path;
+	size_t max_size;
+	size_t cur_size;
+	unsigned int max_count;
+	unsigned int cur_count;
+	uint8_t *buf;
+	size_t buf_size;
+	size_t buf_len;
+	unsigned int flush_interval;
+	uint64_t last_flush;
+	uint8_t *map;
+	size_t map_size;
+	size_t map_offset;
 };
 
+static ssize_t read_data(struct btsnoop *btsnoop, void *data, size_t size)
+{
+	if (!btsnoop->map)
+		return read(btsnoop->fd, data, size);
+
+	if (size > btsnoop->map_size - btsnoop->map_offset)
+		size = btsnoop->map_size - btsnoop->map_offset;
+
+	memcpy(data, btsnoop->map + btsnoop->map_offset, size);
+	btsnoop->map_offset += size;
+
+	return size;
+}
+
+static void map_file(struct btsnoop *btsnoop)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(btsnoop->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	if (st.st_size <= 0 || (uint64_t) st.st_size > SIZE_MAX)
+		return;
+
+	/* Reading falls back to read() if the file can't be mapped */
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, btsnoop->fd, 0);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	btsnoop->map = map;
+	btsnoop->map_size = st.st_size;
+	btsnoop->map_offset = 0;
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
@@ -93,7 +148,9 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 
 	btsnoop->flags = flags;
 
-	len = read(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
+	map_file(btsnoop);
+
+	len = read_data(btsnoop, &hdr, BTSNOOP_HDR_SIZE);
 	if (len < 0 || len != BTSNOOP_HDR_SIZE)
 		goto failed;
 
@@ -119,45 +176,114 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		btsnoop->pklg_v2 = (hdr.id[1] == 0x01);
 
 		/* Apple Packet Logger format has no header */
-		lseek(btsnoop->fd, 0, SEEK_SET);
+		if (btsnoop->map)
+			btsnoop->map_offset = 0;
+		else
+			lseek(btsnoop->fd, 0, SEEK_SET);
 	}
 
 	return btsnoop_ref(btsnoop);
 
 failed:
+	if (btsnoop->map)
+		munmap(btsnoop->map, btsnoop->map_size);
 	close(btsnoop->fd);
 	free(btsnoop);
 
 	return NULL;
 }
 
-struct btsnoop *btsnoop_create(const char *path, uint32_t format)
+static ssize_t write_all(int fd, const void *data, size_t size)
 {
-	struct btsnoop *btsnoop;
+	const uint8_t *ptr = data;
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t written;
+
+		written = write(fd, ptr + done, size - done);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		done += written;
+	}
+
+	return done;
+}
+
+static int create_file(struct btsnoop *btsnoop)
+{
+	const char *real_path;
+	char tmp[PATH_MAX];
 	struct btsnoop_hdr hdr;
 	ssize_t written;
 
+	if (btsnoop->max_count && btsnoop->cur_count >= btsnoop->max_count) {
+		snprintf(tmp, PATH_MAX, "%s.%u", btsnoop->path,
+				btsnoop->cur_count - btsnoop->max_count);
+		unlink(tmp);
+	}
+
+	if (btsnoop->max_size) {
+		snprintf(tmp, PATH_MAX, "%s.%u", btsnoop->path,
+							btsnoop->cur_count);
+		real_path = tmp;
+	} else
+		real_path = btsnoop->path;
+
+	btsnoop->cur_count++;
+
+	btsnoop->fd = open(real_path,
+				O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (btsnoop->fd < 0)
+		return -1;
+
+	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+	hdr.version = htobe32(btsnoop_version);
+	hdr.type = htobe32(btsnoop->format);
+
+	written = write_all(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
+	if (written < 0) {
+		close(btsnoop->fd);
+		btsnoop->fd = -1;
+		return -1;
+	}
+
+	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
+
+	return btsnoop->fd;
+}
+
+struct btsnoop *btsnoop_create(const char *path, size_t max_size,
+				unsigned int max_count, uint32_t format)
+{
+	struct btsnoop *btsnoop;
+
+	/* Rotating over files requires a size limit to rotate at */
+	if (!max_size && max_count)
+		return NULL;
+
 	btsnoop = calloc(1, sizeof(*btsnoop));
 	if (!btsnoop)
 		return NULL;
 
-	btsnoop->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
-					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-	if (btsnoop->fd < 0) {
+	btsnoop->path = strdup(path);
+	if (!btsnoop->path) {
 		free(btsnoop);
 		return NULL;
 	}
 
 	btsnoop->format = format;
 	btsnoop->index = 0xffff;
+	btsnoop->max_size = max_size;
+	btsnoop->max_count = max_count;
 
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(btsnoop->format);
-
-	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (written < 0) {
-		close(btsnoop->fd);
+	if (create_file(btsnoop) < 0) {
+		free((void *) btsnoop->path);
 		free(btsnoop);
 		return NULL;
 	}
@@ -183,9 +309,16 @@ void btsnoop_unref(struct btsnoop *btsnoop)
 	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
 		return;
 
+	btsnoop_flush(btsnoop);
+
+	if (btsnoop->map)
+		munmap(btsnoop->map, btsnoop->map_size);
+
 	if (btsnoop->fd >= 0)
 		close(btsnoop->fd);
 
+	free(btsnoop->buf);
+	free((void *) btsnoop->path);
 	free(btsnoop);
 }
 
@@ -197,17 +330,124 @@ uint32_t btsnoop_get_format(struct btsnoop *btsnoop)
 	return btsnoop->format;
 }
 
+uint64_t btsnoop_get_offset(struct btsnoop *btsnoop)
+{
+	off_t offset;
+
+	if (!btsnoop)
+		return 0;
+
+	if (btsnoop->map)
+		return btsnoop->map_offset;
+
+	offset = lseek(btsnoop->fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return 0;
+
+	return offset;
+}
+
+bool btsnoop_set_offset(struct btsnoop *btsnoop, uint64_t offset)
+{
+	if (!btsnoop || btsnoop->buf)
+		return false;
+
+	if (btsnoop->map) {
+		if (offset > btsnoop->map_size)
+			return false;
+
+		btsnoop->map_offset = offset;
+	} else if (lseek(btsnoop->fd, offset, SEEK_SET) < 0)
+		return false;
+
+	btsnoop->aborted = false;
+
+	return true;
+}
+
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, size_t size,
+						unsigned int flush_interval)
+{
+	uint8_t *buf = NULL;
+
+	if (!btsnoop || btsnoop->fd < 0)
+		return false;
+
+	if (size && size < BTSNOOP_PKT_SIZE + BTSNOOP_MAX_PACKET_SIZE)
+		return false;
+
+	if (!btsnoop_flush(btsnoop))
+		return false;
+
+	if (size) {
+		buf = malloc(size);
+		if (!buf)
+			return false;
+	}
+
+	free(btsnoop->buf);
+
+	btsnoop->buf = buf;
+	btsnoop->buf_size = size;
+	btsnoop->buf_len = 0;
+	btsnoop->flush_interval = flush_interval;
+
+	return true;
+}
+
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	ssize_t written;
+
+	if (!btsnoop || btsnoop->fd < 0)
+		return false;
+
+	if (!btsnoop->buf_len)
+		return true;
+
+	written = write_all(btsnoop->fd, btsnoop->buf, btsnoop->buf_len);
+	btsnoop->buf_len = 0;
+
+	return written >= 0;
+}
+
+static bool rotate_file(struct btsnoop *btsnoop)
+{
+	btsnoop_flush(btsnoop);
+
+	close(btsnoop->fd);
+	btsnoop->fd = -1;
+
+	return create_file(btsnoop) >= 0;
+}
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint32_t flags, uint32_t drops, const void *data,
 			uint16_t size)
 {
 	struct btsnoop_pkt pkt;
+	struct iovec iov[2];
 	uint64_t ts;
+	size_t len;
 	ssize_t written;
 
 	if (!btsnoop || !tv)
 		return false;
 
+	if (btsnoop->fd < 0)
+		return false;
+
+	if (!data)
+		size = 0;
+
+	len = BTSNOOP_PKT_SIZE + size;
+
+	if (btsnoop->max_size && btsnoop->cur_size > BTSNOOP_HDR_SIZE &&
+				btsnoop->cur_size + len > btsnoop->max_size) {
+		if (!rotate_file(btsnoop))
+			return false;
+	}
+
 	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
 
 	pkt.size  = htobe32(size);
@@ -216,13 +456,61 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	pkt.drops = htobe32(drops);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
-	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	btsnoop->cur_size += len;
+
+	if (btsnoop->buf && len > btsnoop->buf_size) {
+		/* Records that can never fit go out directly, in order */
+		if (!btsnoop_flush(btsnoop))
+			return false;
+	} else if (btsnoop->buf) {
+		if (btsnoop->buf_len + len > btsnoop->buf_size) {
+			if (!btsnoop_flush(btsnoop))
+				return false;
+		}
+
+		memcpy(btsnoop->buf + btsnoop->buf_len, &pkt, BTSNOOP_PKT_SIZE);
+		if (size > 0)
+			memcpy(btsnoop->buf + btsnoop->buf_len +
+					BTSNOOP_PKT_SIZE, data, size);
+		btsnoop->buf_len += len;
+
+		if (!btsnoop->last_flush)
+			btsnoop->last_flush = ts;
+
+		/* Flush based on the packet timestamps so that a busy
+		 * trace reaches the disk at least every flush interval.
+		 */
+		if (btsnoop->flush_interval && ts >= btsnoop->last_flush +
+				btsnoop->flush_interval * 1000ll) {
+			btsnoop->last_flush = ts;
+			return btsnoop_flush(btsnoop);
+		}
+
+		return true;
+	}
+
+	iov[0].iov_base = &pkt;
+	iov[0].iov_len = BTSNOOP_PKT_SIZE;
+	iov[1].iov_base = (void *) data;
+	iov[1].iov_len = size;
+
+	written = writev(btsnoop->fd, iov, size > 0 ? 2 : 1);
 	if (written < 0)
 		return false;
 
-	if (data && size > 0) {
-		written = write(btsnoop->fd, data, size);
-		if (written < 0)
+	if ((size_t) written < len) {
+		const uint8_t *ptr = data;
+
+		/* Short write, so complete the remainder by hand */
+		if ((size_t) written < BTSNOOP_PKT_SIZE) {
+			if (write_all(btsnoop->fd, (uint8_t *) &pkt + written,
+					BTSNOOP_PKT_SIZE - written) < 0)
+				return false;
+			written = BTSNOOP_PKT_SIZE;
+		}
+
+		if (write_all(btsnoop->fd, ptr + written - BTSNOOP_PKT_SIZE,
+							len - written) < 0)
 			return false;
 	}
 
@@ -316,7 +604,7 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	uint64_t ts;
 	ssize_t len;
 
-	len = read(btsnoop->fd, &pkt, PKLG_PKT_SIZE);
+	len = read_data(btsnoop, &pkt, PKLG_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -370,7 +658,7 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = read_data(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
@@ -432,7 +720,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	if (btsnoop->pklg_format)
 		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	len = read_data(btsnoop, &pkt, BTSNOOP_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -460,7 +748,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_FORMAT_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
+		len = read_data(btsnoop, &pkt_type, 1);
 		if (len < 0) {
 			btsnoop->aborted = true;
 			return false;
@@ -481,7 +769,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = read_data(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
@@ -26,6 +26,7 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -55,17 +56,22 @@ struct hci_filter {
 	uint16_t opcode;
 };
 
+#define MAX_EVENTS_PER_READ	16
+
 struct bt_hci {
 	int ref_count;
 	struct io *io;
 	bool is_stream;
 	bool writer_active;
+	bool in_notify;
+	bool need_notify_cleanup;
 	uint8_t num_cmds;
 	unsigned int next_cmd_id;
 	unsigned int next_evt_id;
 	struct queue *cmd_queue;
 	struct queue *rsp_queue;
 	struct queue *evt_list;
+	struct queue *evt_buckets[256];
 };
 
 struct cmd {
@@ -84,6 +90,7 @@ struct evt {
 	bt_hci_callback_func_t callback;
 	bt_hci_destroy_func_t destroy;
 	void *user_data;
+	bool removed;
 };
 
 static void cmd_free(void *data)
@@ -107,7 +114,7 @@ static void evt_free(void *data)
 	free(evt);
 }
 
-static void send_command(struct bt_hci *hci, uint16_t opcode,
+static bool send_command(struct bt_hci *hci, uint16_t opcode,
 						void *data, uint8_t size)
 {
 	uint8_t type = BT_H4_CMD_PKT;
@@ -116,7 +123,7 @@ static void send_command(struct bt_hci *hci, uint16_t opcode,
 	int iovcnt;
 
 	if (hci->num_cmds < 1)
-		return;
+		return false;
 
 	hdr.opcode = cpu_to_le16(opcode);
 	hdr.plen = size;
@@ -134,9 +141,11 @@ static void send_command(struct bt_hci *hci, uint16_t opcode,
 		iovcnt = 2;
 
 	if (io_send(hci->io, iov, iovcnt) < 0)
-		return;
+		return false;
 
 	hci->num_cmds--;
+
+	return true;
 }
 
 static bool io_write_callback(struct io *io, void *user_data)
@@ -144,9 +153,20 @@ static bool io_write_callback(struct io *io, void *user_data)
 	struct bt_hci *hci = user_data;
 	struct cmd *cmd;
 
-	cmd = queue_pop_head(hci->cmd_queue);
-	if (cmd) {
-		send_command(hci, cmd->opcode, cmd->data, cmd->size);
+	/*
+	 * Send as many commands as the controller has granted credits for,
+	 * the responses are matched by opcode in the order they arrive.
+	 */
+	while (hci->num_cmds > 0) {
+		cmd = queue_pop_head(hci->cmd_queue);
+		if (!cmd)
+			break;
+
+		if (!send_command(hci, cmd->opcode, cmd->data, cmd->size)) {
+			queue_push_head(hci->cmd_queue, cmd);
+			break;
+		}
+
 		queue_push_tail(hci->rsp_queue, cmd);
 	}
 
@@ -202,14 +222,60 @@ done:
 	wakeup_writer(hci);
 }
 
-static void process_notify(void *data, void *user_data)
+static void remove_evt(struct bt_hci *hci, struct evt *evt)
 {
-	struct bt_hci_evt_hdr *hdr = user_data;
-	struct evt *evt = data;
+	queue_remove(hci->evt_buckets[evt->event], evt);
+	queue_remove(hci->evt_list, evt);
 
-	if (evt->event == hdr->evt)
-		evt->callback(user_data + sizeof(struct bt_hci_evt_hdr),
-						hdr->plen, evt->user_data);
+	evt_free(evt);
+}
+
+static bool match_evt_removed(const void *a, const void *b)
+{
+	const struct evt *evt = a;
+
+	return evt->removed;
+}
+
+static void process_notify(struct bt_hci *hci,
+					const struct bt_hci_evt_hdr *hdr)
+{
+	const struct queue_entry *entry;
+	unsigned int next_id = hci->next_evt_id;
+	struct evt *evt;
+
+	/*
+	 * Only the handlers for this event code are looked at. Removal is
+	 * deferred until all of them have been called, so the entries stay
+	 * valid even when a callback unregisters handlers.
+	 */
+	entry = queue_get_entries(hci->evt_buckets[hdr->evt]);
+	if (!entry)
+		return;
+
+	hci->in_notify = true;
+
+	for (; entry; entry = entry->next) {
+		evt = entry->data;
+
+		/* Skip handlers registered from within a callback */
+		if (evt->removed || evt->id >= next_id)
+			continue;
+
+		evt->callback((const void *) hdr +
+					sizeof(struct bt_hci_evt_hdr),
+					hdr->plen, evt->user_data);
+	}
+
+	hci->in_notify = false;
+
+	if (!hci->need_notify_cleanup)
+		return;
+
+	while ((evt = queue_find(hci->evt_list, match_evt_removed, NULL)))
+		remove_evt(hci, evt);
+
+	hci->need_notify_cleanup = false;
 }
 
 static void process_event(struct bt_hci *hci, const void *data, size_t size)
@@ -247,7 +313,7 @@ static void process_event(struct bt_hci *hci, const void *data, size_t size)
 		break;
 
 	default:
-		queue_foreach(hci->evt_list, process_notify, (void *) hdr);
+		process_notify(hci, hdr);
 		break;
 	}
 }
@@ -256,6 +322,7 @@ static bool io_read_callback(struct io *io, void *user_data)
 {
 	struct bt_hci *hci = user_data;
 	uint8_t buf[512];
+	unsigned int count;
 	ssize_t len;
 	int fd;
 
@@ -266,19 +333,40 @@ static bool io_read_callback(struct io *io, void *user_data)
 	if (hci->is_stream)
 		return false;
 
-	len = read(fd, buf, sizeof(buf));
-	if (len < 0)
-		return false;
+	/* Callbacks are allowed to drop the last reference */
+	bt_hci_ref(hci);
+
+	/*
+	 * Controllers tend to send bursts of events, so handle the ones
+	 * already queued on the socket before going back to the mainloop.
+	 */
+	for (count = 0; count < MAX_EVENTS_PER_READ; count++) {
+		len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len < 0) {
+			if (!count && errno != EAGAIN && errno != EINTR) {
+				bt_hci_unref(hci);
+				return false;
+			}
+
+			break;
+		}
 
-	if (len < 1)
-		return true;
+		if (len < 1)
+			continue;
 
-	switch (buf[0]) {
-	case BT_H4_EVT_PKT:
-		process_event(hci, buf + 1, len - 1);
-		break;
+		switch (buf[0]) {
+		case BT_H4_EVT_PKT:
+			process_event(hci, buf + 1, len - 1);
+			break;
+		}
+
+		/* Nobody is interested in further events anymore */
+		if (__sync_fetch_and_add(&hci->ref_count, 0) < 2)
+			break;
 	}
 
+	bt_hci_unref(hci);
+
 	return true;
 }
 
@@ -419,12 +507,17 @@ struct bt_hci *bt_hci_ref(struct bt_hci *hci)
 
 void bt_hci_unref(struct bt_hci *hci)
 {
+	unsigned int i;
+
 	if (!hci)
 		return;
 
 	if (__sync_sub_and_fetch(&hci->ref_count, 1))
 		return;
 
+	for (i = 0; i < 256; i++)
+		queue_destroy(hci->evt_buckets[i], NULL);
+
 	queue_destroy(hci->evt_list, evt_free);
 	queue_destroy(hci->cmd_queue, cmd_free);
 	queue_destroy(hci->rsp_queue, cmd_free);
@@ -553,11 +646,16 @@ unsigned int bt_hci_register(struct bt_hci *hci, uint8_t event,
 	evt->destroy = destroy;
 	evt->user_data = user_data;
 
+	if (!hci->evt_buckets[event])
+		hci->evt_buckets[event] = queue_new();
+
 	if (!queue_push_tail(hci->evt_list, evt)) {
 		free(evt);
 		return 0;
 	}
 
+	queue_push_tail(hci->evt_buckets[event], evt);
+
 	return evt->id;
 }
 
@@ -576,11 +674,17 @@ bool bt_hci_unregister(struct bt_hci *hci, unsigned int id)
 	if (!hci || !id)
 		return false;
 
-	evt = queue_remove_if(hci->evt_list, match_evt_id, UINT_TO_PTR(id));
-	if (!evt)
+	evt = queue_find(hci->evt_list, match_evt_id, UINT_TO_PTR(id));
+	if (!evt || evt->removed)
 		return false;
 
-	evt_free(evt);
+	if (hci->in_notify) {
+		evt->removed = true;
+		hci->need_notify_cleanup = true;
+		return true;
+	}
+
+	remove_evt(hci, evt);
 
 	return true;
 }
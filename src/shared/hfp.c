@@ -37,6 +37,13 @@
 #include "src/shared/io.h"
 #include "src/shared/hfp.h"
 
+/*
+ * Handlers are spread over buckets by a hash of their prefix, so that a
+ * command or event only has to be compared against the few handlers in
+ * its own bucket.
+ */
+#define HANDLER_BUCKETS 32
+
 struct hfp_gw {
 	int ref_count;
 	int fd;
@@ -44,7 +51,8 @@ struct hfp_gw {
 	struct io *io;
 	struct ringbuf *read_buf;
 	struct ringbuf *write_buf;
-	struct queue *cmd_handlers;
+	size_t read_scanned;
+	struct queue *cmd_handlers[HANDLER_BUCKETS];
 	bool writer_active;
 	bool result_pending;
 	hfp_command_func_t command_callback;
@@ -69,11 +77,12 @@ struct hfp_hf {
 	struct io *io;
 	struct ringbuf *read_buf;
 	struct ringbuf *write_buf;
+	size_t read_scanned;
 
 	bool writer_active;
 	struct queue *cmd_queue;
 
-	struct queue *event_handlers;
+	struct queue *event_handlers[HANDLER_BUCKETS];
 
 	hfp_debug_func_t debug_callback;
 	hfp_destroy_func_t debug_destroy;
@@ -136,6 +145,28 @@ static bool match_handler_prefix(const void *a, const void *b)
 	return true;
 }
 
+static struct queue **handler_bucket(struct queue **buckets,
+							const char *prefix)
+{
+	unsigned int hash = 5381;
+
+	while (*prefix)
+		hash = hash * 33 + (unsigned char) *prefix++;
+
+	return &buckets[hash % HANDLER_BUCKETS];
+}
+
+static void destroy_handler_buckets(struct queue **buckets,
+						queue_destroy_func_t destroy)
+{
+	unsigned int i;
+
+	for (i = 0; i < HANDLER_BUCKETS; i++) {
+		queue_destroy(buckets[i], destroy);
+		buckets[i] = NULL;
+	}
+}
+
 static void write_watch_destroy(void *user_data)
 {
 	struct hfp_gw *hfp = user_data;
@@ -256,8 +287,8 @@ static bool handle_at_command(struct hfp_gw *hfp, const char *data)
 
 done:
 
-	handler = queue_find(hfp->cmd_handlers, match_handler_prefix,
-								lookup_prefix);
+	handler = queue_find(*handler_bucket(hfp->cmd_handlers, lookup_prefix),
+					match_handler_prefix, lookup_prefix);
 	if (!handler) {
 		handle_unknown_at_command(hfp, data);
 		return true;
@@ -484,35 +515,51 @@ static void process_input(struct hfp_gw *hfp)
 		if (!str)
 			return;
 
-		ptr = memchr(str, '\r', len);
+		/*
+		 * Data up to read_scanned has been searched already by an
+		 * earlier call, so only look at what was read since then.
+		 */
+		if (hfp->read_scanned < len)
+			ptr = memchr(str + hfp->read_scanned, '\r',
+						len - hfp->read_scanned);
+		else
+			ptr = NULL;
+
 		if (!ptr) {
 			char *str2;
-			size_t len2;
+			size_t len2, skip;
 
 			/*
 			 * If there is no more data in ringbuffer,
 			 * it's just an incomplete command.
 			 */
-			if (len == ringbuf_len(hfp->read_buf))
+			if (len == ringbuf_len(hfp->read_buf)) {
+				hfp->read_scanned = len;
 				return;
+			}
 
 			str2 = ringbuf_peek(hfp->read_buf, len, &len2);
 			if (!str2)
 				return;
 
-			ptr = memchr(str2, '\r', len2);
-			if (!ptr)
+			skip = hfp->read_scanned > len ?
+						hfp->read_scanned - len : 0;
+
+			ptr = memchr(str2 + skip, '\r', len2 - skip);
+			if (!ptr) {
+				hfp->read_scanned = len + len2;
 				return;
+			}
 
 			*ptr = '\0';
 
-			count = len2 + len;
-			ptr = malloc(count);
+			count = len + (ptr - str2);
+			ptr = malloc(count + 1);
 			if (!ptr)
 				return;
 
 			memcpy(ptr, str, len);
-			memcpy(ptr + len, str2, len2);
+			memcpy(ptr + len, str2, count - len + 1);
 
 			free_ptr = true;
 			str = ptr;
@@ -539,9 +586,12 @@ static void process_input(struct hfp_gw *hfp)
 			read_again = !hfp->result_pending;
 
 		ringbuf_drain(hfp->read_buf, count + 1);
+		hfp->read_scanned = 0;
 
-		if (free_ptr)
+		if (free_ptr) {
 			free(ptr);
+			free_ptr = false;
+		}
 
 	} while (read_again);
 }
@@ -599,11 +649,8 @@ struct hfp_gw *hfp_gw_new(int fd)
 		return NULL;
 	}
 
-	hfp->cmd_handlers = queue_new();
-
 	if (!io_set_read_handler(hfp->io, can_read_data, hfp,
 							read_watch_destroy)) {
-		queue_destroy(hfp->cmd_handlers, destroy_cmd_handler);
 		io_destroy(hfp->io);
 		ringbuf_free(hfp->write_buf);
 		ringbuf_free(hfp->read_buf);
@@ -655,8 +702,7 @@ void hfp_gw_unref(struct hfp_gw *hfp)
 	ringbuf_free(hfp->write_buf);
 	hfp->write_buf = NULL;
 
-	queue_destroy(hfp->cmd_handlers, destroy_cmd_handler);
-	hfp->cmd_handlers = NULL;
+	destroy_handler_buckets(hfp->cmd_handlers, destroy_cmd_handler);
 
 	if (!hfp->in_disconnect) {
 		free(hfp);
@@ -832,6 +878,7 @@ bool hfp_gw_register(struct hfp_gw *hfp, hfp_result_func_t callback,
 						hfp_destroy_func_t destroy)
 {
 	struct cmd_handler *handler;
+	struct queue **bucket;
 
 	handler = new0(struct cmd_handler, 1);
 	handler->callback = callback;
@@ -843,15 +890,19 @@ bool hfp_gw_register(struct hfp_gw *hfp, hfp_result_func_t callback,
 		return false;
 	}
 
-	if (queue_find(hfp->cmd_handlers, match_handler_prefix,
-							handler->prefix)) {
+	bucket = handler_bucket(hfp->cmd_handlers, handler->prefix);
+
+	if (queue_find(*bucket, match_handler_prefix, handler->prefix)) {
 		destroy_cmd_handler(handler);
 		return false;
 	}
 
 	handler->destroy = destroy;
 
-	return queue_push_tail(hfp->cmd_handlers, handler);
+	if (!*bucket)
+		*bucket = queue_new();
+
+	return queue_push_tail(*bucket, handler);
 }
 
 bool hfp_gw_unregister(struct hfp_gw *hfp, const char *prefix)
@@ -863,8 +914,8 @@ bool hfp_gw_unregister(struct hfp_gw *hfp, const char *prefix)
 	if (!lookup_prefix)
 		return false;
 
-	handler = queue_remove_if(hfp->cmd_handlers, match_handler_prefix,
-								lookup_prefix);
+	handler = queue_remove_if(*handler_bucket(hfp->cmd_handlers, prefix),
+					match_handler_prefix, lookup_prefix);
 	free(lookup_prefix);
 
 	if (!handler)
@@ -1115,8 +1166,9 @@ static void hf_call_prefix_handler(struct hfp_hf *hfp, const char *data)
 		return;
 	}
 
-	handler = queue_find(hfp->event_handlers, match_handler_event_prefix,
-								lookup_prefix);
+	handler = queue_find(*handler_bucket(hfp->event_handlers,
+							lookup_prefix),
+				match_handler_event_prefix, lookup_prefix);
 	if (!handler)
 		return;
 
@@ -1155,76 +1207,92 @@ static char *find_cr_lf(char *str, size_t len)
 static void hf_process_input(struct hfp_hf *hfp)
 {
 	char *str, *ptr, *str2, *tmp;
-	size_t len, count, offset, len2;
-	bool free_tmp = false;
+	size_t len, count, offset, len2, head, tail;
 
-	str = ringbuf_peek(hfp->read_buf, 0, &len);
-	if (!str)
-		return;
+	while (1) {
+		str = ringbuf_peek(hfp->read_buf, 0, &len);
+		if (!str)
+			return;
 
-	offset = 0;
+		offset = 0;
 
-	ptr = find_cr_lf(str, len);
-	while (ptr) {
-		count = ptr - (str + offset);
-		if (count == 0) {
-			/* 2 is for <cr><lf> */
-			offset += 2;
-		} else {
-			*ptr = '\0';
-			hf_call_prefix_handler(hfp, str + offset);
-			offset += count + 2;
+		/* Resume the search where the previous read left off */
+		if (hfp->read_scanned < len)
+			ptr = find_cr_lf(str + hfp->read_scanned,
+						len - hfp->read_scanned);
+		else
+			ptr = NULL;
+
+		hfp->read_scanned = 0;
+
+		while (ptr) {
+			count = ptr - (str + offset);
+			if (count == 0) {
+				/* 2 is for <cr><lf> */
+				offset += 2;
+			} else {
+				*ptr = '\0';
+				hf_call_prefix_handler(hfp, str + offset);
+				offset += count + 2;
+			}
+
+			ptr = find_cr_lf(str + offset, len - offset);
 		}
 
-		ptr = find_cr_lf(str + offset, len - offset);
-	}
+		/*
+		 * Just check if there is no wrapped data in ring buffer.
+		 * Should not happen too often
+		 */
+		if (len == ringbuf_len(hfp->read_buf)) {
+			/*
+			 * What is left holds no <cr><lf>, except maybe a <cr>
+			 * at the very end still waiting for its <lf>.
+			 */
+			if (len - offset > 1)
+				hfp->read_scanned = len - offset - 1;
 
-	/*
-	 * Just check if there is no wrapped data in ring buffer.
-	 * Should not happen too often
-	 */
-	if (len == ringbuf_len(hfp->read_buf))
-		goto done;
+			break;
+		}
 
-	str2 = ringbuf_peek(hfp->read_buf, len, &len2);
-	if (!str2)
-		goto done;
+		str2 = ringbuf_peek(hfp->read_buf, len, &len2);
+		if (!str2)
+			break;
 
-	ptr = find_cr_lf(str2, len2);
-	if (!ptr) {
-		/* Might happen that we wrap between \r and \n */
-		ptr = memchr(str2, '\n', len2);
-		if (!ptr)
-			goto done;
-	}
+		if (offset < len && str[len - 1] == '\r' && str2[0] == '\n') {
+			/* Wrapped between <cr> and <lf> */
+			head = len - offset - 1;
+			count = 0;
+			tail = 1;
+		} else {
+			ptr = find_cr_lf(str2, len2);
+			if (!ptr)
+				break;
 
-	count = ptr - str2;
+			head = len - offset;
+			count = ptr - str2;
+			tail = count + 2;
+		}
 
-	if (count) {
-		*ptr = '\0';
+		if (head + count) {
+			tmp = malloc(head + count + 1);
+			if (!tmp)
+				break;
 
-		tmp = malloc(len + count);
-		if (!tmp)
-			goto done;
+			/* "str" here is not a string so we need to use memcpy */
+			memcpy(tmp, str + offset, head);
+			memcpy(tmp + head, str2, count);
+			tmp[head + count] = '\0';
 
-		/* "str" here is not a string so we need to use memcpy */
-		memcpy(tmp, str, len);
-		memcpy(tmp + len, str2, count);
+			hf_call_prefix_handler(hfp, tmp);
 
-		free_tmp = true;
-	} else {
-		str[len-1] = '\0';
-		tmp = str;
-	}
+			free(tmp);
+		}
 
-	hf_call_prefix_handler(hfp, tmp);
-	offset += count;
+		/* More lines may follow the wrapped one, so look again */
+		ringbuf_drain(hfp->read_buf, len + tail);
+	}
 
-done:
 	ringbuf_drain(hfp->read_buf, offset);
-
-	if (free_tmp)
-		free(tmp);
 }
 
 static bool hf_can_read_data(struct io *io, void *user_data)
@@ -1273,14 +1341,12 @@ struct hfp_hf *hfp_hf_new(int fd)
 		return NULL;
 	}
 
-	hfp->event_handlers = queue_new();
 	hfp->cmd_queue = queue_new();
 	hfp->writer_active = false;
 
 	if (!io_set_read_handler(hfp->io, hf_can_read_data, hfp,
 							read_watch_destroy)) {
-		queue_destroy(hfp->event_handlers,
-						destroy_event_handler);
+		queue_destroy(hfp->cmd_queue, free);
 		io_destroy(hfp->io);
 		ringbuf_free(hfp->write_buf);
 		ringbuf_free(hfp->read_buf);
@@ -1327,8 +1393,7 @@ void hfp_hf_unref(struct hfp_hf *hfp)
 	ringbuf_free(hfp->write_buf);
 	hfp->write_buf = NULL;
 
-	queue_destroy(hfp->event_handlers, destroy_event_handler);
-	hfp->event_handlers = NULL;
+	destroy_handler_buckets(hfp->event_handlers, destroy_event_handler);
 
 	queue_destroy(hfp->cmd_queue, free);
 	hfp->cmd_queue = NULL;
@@ -1439,6 +1504,7 @@ bool hfp_hf_register(struct hfp_hf *hfp, hfp_hf_result_func_t callback,
 						hfp_destroy_func_t destroy)
 {
 	struct event_handler *handler;
+	struct queue **bucket;
 
 	if (!callback)
 		return false;
@@ -1453,15 +1519,19 @@ bool hfp_hf_register(struct hfp_hf *hfp, hfp_hf_result_func_t callback,
 		return false;
 	}
 
-	if (queue_find(hfp->event_handlers, match_handler_event_prefix,
-							handler->prefix)) {
+	bucket = handler_bucket(hfp->event_handlers, handler->prefix);
+
+	if (queue_find(*bucket, match_handler_event_prefix, handler->prefix)) {
 		destroy_event_handler(handler);
 		return false;
 	}
 
 	handler->destroy = destroy;
 
-	return queue_push_tail(hfp->event_handlers, handler);
+	if (!*bucket)
+		*bucket = queue_new();
+
+	return queue_push_tail(*bucket, handler);
 }
 
 bool hfp_hf_unregister(struct hfp_hf *hfp, const char *prefix)
@@ -1469,7 +1539,7 @@ bool hfp_hf_unregister(struct hfp_hf *hfp, const char *prefix)
 	struct cmd_handler *handler;
 
 	/* Cast to void as queue_remove needs that */
-	handler = queue_remove_if(hfp->event_handlers,
+	handler = queue_remove_if(*handler_bucket(hfp->event_handlers, prefix),
 						match_handler_event_prefix,
 						(void *) prefix);
 
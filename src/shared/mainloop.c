@@ -40,9 +40,13 @@
 
 #define MAX_EPOLL_EVENTS 10
 
-static int epoll_fd;
-static int epoll_terminate;
-static int exit_status;
+/*
+ * The loop state is per thread, which allows several threads to run their
+ * own independent loop. Single threaded users are not affected by this.
+ */
+static __thread int epoll_fd;
+static __thread int epoll_terminate;
+static __thread int exit_status;
 
 struct mainloop_data {
 	int fd;
@@ -52,9 +56,9 @@ struct mainloop_data {
 	void *user_data;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+#define MAX_MAINLOOP_ENTRIES 1024
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+static __thread struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
 
 struct timeout_data {
 	int fd;
@@ -71,7 +75,7 @@ struct signal_data {
 	void *user_data;
 };
 
-static struct signal_data *signal_data;
+static __thread struct signal_data *signal_data;
 
 void mainloop_init(void)
 {
@@ -311,7 +315,7 @@ static inline int timeout_set(int fd, unsigned int msec)
 	itimer.it_interval.tv_sec = 0;
 	itimer.it_interval.tv_nsec = 0;
 	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000;
+	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000 * 1000;
 
 	return timerfd_settime(fd, 0, &itimer, NULL);
 }
@@ -39,6 +39,8 @@
 #include "src/shared/util.h"
 #include "src/shared/mgmt.h"
 
+#define NOTIFY_BUCKETS	32
+
 struct mgmt {
 	int ref_count;
 	int fd;
@@ -48,7 +50,9 @@ struct mgmt {
 	struct queue *request_queue;
 	struct queue *reply_queue;
 	struct queue *pending_list;
+	unsigned int max_pending;
 	struct queue *notify_list;
+	struct queue *notify_buckets[NOTIFY_BUCKETS];
 	unsigned int next_request_id;
 	unsigned int next_notify_id;
 	bool need_notify_cleanup;
@@ -108,6 +112,26 @@ static bool match_request_index(const void *a, const void *b)
 	return request->index == index;
 }
 
+/*
+ * Notifications are additionally hashed by event and index so that an
+ * incoming event only has to look at the handlers that can match it.
+ */
+static struct queue *notify_bucket(struct mgmt *mgmt, uint16_t event,
+								uint16_t index)
+{
+	return mgmt->notify_buckets[(event + index * 7) % NOTIFY_BUCKETS];
+}
+
+static void destroy_buckets(struct mgmt *mgmt)
+{
+	unsigned int i;
+
+	for (i = 0; i < NOTIFY_BUCKETS; i++) {
+		queue_destroy(mgmt->notify_buckets[i], NULL);
+		mgmt->notify_buckets[i] = NULL;
+	}
+}
+
 static void destroy_notify(void *data)
 {
 	struct mgmt_notify *notify = data;
@@ -141,6 +165,24 @@ static bool match_notify_removed(const void *a, const void *b)
 	return notify->removed;
 }
 
+static void remove_notify(struct mgmt *mgmt, struct mgmt_notify *notify)
+{
+	queue_remove(notify_bucket(mgmt, notify->event, notify->index),
+								notify);
+	queue_remove(mgmt->notify_list, notify);
+
+	destroy_notify(notify);
+}
+
+static void remove_notify_removed(struct mgmt *mgmt)
+{
+	struct mgmt_notify *notify;
+
+	while ((notify = queue_find(mgmt->notify_list, match_notify_removed,
+								NULL)))
+		remove_notify(mgmt, notify);
+}
+
 static void mark_notify_removed(void *data , void *user_data)
 {
 	struct mgmt_notify *notify = data;
@@ -188,6 +230,35 @@ static bool send_request(struct mgmt *mgmt, struct mgmt_request *request)
 	return true;
 }
 
+static bool match_index_idle(const void *a, const void *b)
+{
+	const struct mgmt_request *request = a;
+	const struct mgmt *mgmt = b;
+
+	return !queue_find(mgmt->pending_list, match_request_index,
+						UINT_TO_PTR(request->index));
+}
+
+static struct mgmt_request *next_request(struct mgmt *mgmt)
+{
+	if (mgmt->max_pending < 2) {
+		if (!queue_isempty(mgmt->pending_list))
+			return NULL;
+
+		return queue_pop_head(mgmt->request_queue);
+	}
+
+	if (queue_length(mgmt->pending_list) >= mgmt->max_pending)
+		return NULL;
+
+	/*
+	 * Only one command per index is in flight, so the commands of an
+	 * index are still processed in order and the responses can not be
+	 * mixed up, while other indexes do not have to wait for it.
+	 */
+	return queue_remove_if(mgmt->request_queue, match_index_idle, mgmt);
+}
+
 static bool can_write_data(struct io *io, void *user_data)
 {
 	struct mgmt *mgmt = user_data;
@@ -197,14 +268,11 @@ static bool can_write_data(struct io *io, void *user_data)
 	request = queue_pop_head(mgmt->reply_queue);
 	if (!request) {
 		/* only reply commands can jump the queue */
-		if (!queue_isempty(mgmt->pending_list))
-			return false;
-
-		request = queue_pop_head(mgmt->request_queue);
+		request = next_request(mgmt);
 		if (!request)
 			return false;
 
-		can_write = false;
+		can_write = mgmt->max_pending > 1;
 	} else {
 		/* allow multiple replies to jump the queue */
 		can_write = !queue_isempty(mgmt->reply_queue);
@@ -218,7 +286,11 @@ static bool can_write_data(struct io *io, void *user_data)
 
 static void wakeup_writer(struct mgmt *mgmt)
 {
-	if (!queue_isempty(mgmt->pending_list)) {
+	if (mgmt->max_pending > 1) {
+		if (queue_isempty(mgmt->request_queue) &&
+					queue_isempty(mgmt->reply_queue))
+			return;
+	} else if (!queue_isempty(mgmt->pending_list)) {
 		/* only queued reply commands trigger wakeup */
 		if (queue_isempty(mgmt->reply_queue))
 			return;
@@ -267,47 +339,62 @@ static void request_complete(struct mgmt *mgmt, uint8_t status,
 	wakeup_writer(mgmt);
 }
 
-struct event_index {
-	uint16_t event;
-	uint16_t index;
-	uint16_t length;
-	const void *param;
-};
-
-static void notify_handler(void *data, void *user_data)
-{
-	struct mgmt_notify *notify = data;
-	struct event_index *match = user_data;
-
-	if (notify->removed)
-		return;
-
-	if (notify->event != match->event)
-		return;
-
-	if (notify->index != match->index && notify->index != MGMT_INDEX_NONE)
-		return;
-
-	if (notify->callback)
-		notify->callback(match->index, match->length, match->param,
-							notify->user_data);
-}
-
 static void process_notify(struct mgmt *mgmt, uint16_t event, uint16_t index,
 					uint16_t length, const void *param)
 {
-	struct event_index match = { .event = event, .index = index,
-					.length = length, .param = param };
+	const struct queue_entry *entry, *any = NULL;
+	struct queue *bucket, *any_bucket;
+	unsigned int next_id = mgmt->next_notify_id;
+
+	bucket = notify_bucket(mgmt, event, index);
+	entry = queue_get_entries(bucket);
+
+	/* Handlers for all indexes might live in a different bucket */
+	if (index != MGMT_INDEX_NONE) {
+		any_bucket = notify_bucket(mgmt, event, MGMT_INDEX_NONE);
+		if (any_bucket != bucket)
+			any = queue_get_entries(any_bucket);
+	}
 
 	mgmt->in_notify = true;
 
-	queue_foreach(mgmt->notify_list, notify_handler, &match);
+	/*
+	 * Both buckets are in registration order, merge them to call the
+	 * handlers in the same order as they have been registered. Removal
+	 * is deferred while notifying, so the entries stay valid.
+	 */
+	while (entry || any) {
+		struct mgmt_notify *notify;
+
+		if (!any || (entry && ((struct mgmt_notify *) entry->data)->id <
+				((struct mgmt_notify *) any->data)->id)) {
+			notify = entry->data;
+			entry = entry->next;
+		} else {
+			notify = any->data;
+			any = any->next;
+		}
+
+		/* Skip handlers registered from within a callback */
+		if (notify->id >= next_id)
+			continue;
+
+		if (notify->removed || notify->event != event)
+			continue;
+
+		if (notify->index != index &&
+					notify->index != MGMT_INDEX_NONE)
+			continue;
+
+		if (notify->callback)
+			notify->callback(index, length, param,
+							notify->user_data);
+	}
 
 	mgmt->in_notify = false;
 
 	if (mgmt->need_notify_cleanup) {
-		queue_remove_all(mgmt->notify_list, match_notify_removed,
-							NULL, destroy_notify);
+		remove_notify_removed(mgmt);
 		mgmt->need_notify_cleanup = false;
 	}
 }
@@ -380,6 +467,7 @@ static bool can_read_data(struct io *io, void *user_data)
 struct mgmt *mgmt_new(int fd)
 {
 	struct mgmt *mgmt;
+	unsigned int i;
 
 	if (fd < 0)
 		return NULL;
@@ -387,6 +475,7 @@ struct mgmt *mgmt_new(int fd)
 	mgmt = new0(struct mgmt, 1);
 	mgmt->fd = fd;
 	mgmt->close_on_unref = false;
+	mgmt->max_pending = 1;
 
 	mgmt->len = 512;
 	mgmt->buf = malloc(mgmt->len);
@@ -407,7 +496,11 @@ struct mgmt *mgmt_new(int fd)
 	mgmt->pending_list = queue_new();
 	mgmt->notify_list = queue_new();
 
+	for (i = 0; i < NOTIFY_BUCKETS; i++)
+		mgmt->notify_buckets[i] = queue_new();
+
 	if (!io_set_read_handler(mgmt->io, can_read_data, mgmt, NULL)) {
+		destroy_buckets(mgmt);
 		queue_destroy(mgmt->notify_list, NULL);
 		queue_destroy(mgmt->pending_list, NULL);
 		queue_destroy(mgmt->reply_queue, NULL);
@@ -498,6 +591,7 @@ void mgmt_unref(struct mgmt *mgmt)
 	mgmt->buf = NULL;
 
 	if (!mgmt->in_notify) {
+		destroy_buckets(mgmt);
 		queue_destroy(mgmt->notify_list, NULL);
 		queue_destroy(mgmt->pending_list, NULL);
 		free(mgmt);
@@ -531,6 +625,18 @@ bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close)
 	return true;
 }
 
+bool mgmt_set_max_pending(struct mgmt *mgmt, unsigned int num)
+{
+	if (!mgmt || !num)
+		return false;
+
+	mgmt->max_pending = num;
+
+	wakeup_writer(mgmt);
+
+	return true;
+}
+
 static struct mgmt_request *create_request(uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
@@ -743,6 +849,8 @@ unsigned int mgmt_register(struct mgmt *mgmt, uint16_t event, uint16_t index,
 		return 0;
 	}
 
+	queue_push_tail(notify_bucket(mgmt, event, index), notify);
+
 	return notify->id;
 }
 
@@ -753,13 +861,13 @@ bool mgmt_unregister(struct mgmt *mgmt, unsigned int id)
 	if (!mgmt || !id)
 		return false;
 
-	notify = queue_remove_if(mgmt->notify_list, match_notify_id,
+	notify = queue_find(mgmt->notify_list, match_notify_id,
 							UINT_TO_PTR(id));
-	if (!notify)
+	if (!notify || notify->removed)
 		return false;
 
 	if (!mgmt->in_notify) {
-		destroy_notify(notify);
+		remove_notify(mgmt, notify);
 		return true;
 	}
 
@@ -771,6 +879,8 @@ bool mgmt_unregister(struct mgmt *mgmt, unsigned int id)
 
 bool mgmt_unregister_index(struct mgmt *mgmt, uint16_t index)
 {
+	struct mgmt_notify *notify;
+
 	if (!mgmt)
 		return false;
 
@@ -778,9 +888,12 @@ bool mgmt_unregister_index(struct mgmt *mgmt, uint16_t index)
 		queue_foreach(mgmt->notify_list, mark_notify_removed,
 							UINT_TO_PTR(index));
 		mgmt->need_notify_cleanup = true;
-	} else
-		queue_remove_all(mgmt->notify_list, match_notify_index,
-					UINT_TO_PTR(index), destroy_notify);
+		return true;
+	}
+
+	while ((notify = queue_find(mgmt->notify_list, match_notify_index,
+							UINT_TO_PTR(index))))
+		remove_notify(mgmt, notify);
 
 	return true;
 }
@@ -790,12 +903,13 @@ bool mgmt_unregister_all(struct mgmt *mgmt)
 	if (!mgmt)
 		return false;
 
-	if (mgmt->in_notify) {
-		queue_foreach(mgmt->notify_list, mark_notify_removed,
+	queue_foreach(mgmt->notify_list, mark_notify_removed,
 						UINT_TO_PTR(MGMT_INDEX_NONE));
+
+	if (mgmt->in_notify)
 		mgmt->need_notify_cleanup = true;
-	} else
-		queue_remove_all(mgmt->notify_list, NULL, NULL, destroy_notify);
+	else
+		remove_notify_removed(mgmt);
 
 	return true;
 }
@@ -42,6 +42,7 @@ bool mgmt_set_debug(struct mgmt *mgmt, mgmt_debug_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy);
 
 bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close);
+bool mgmt_set_max_pending(struct mgmt *mgmt, unsigned int num);
 
 typedef void (*mgmt_request_func_t)(uint8_t status, uint16_t length,
 					const void *param, void *user_data);
@@ -28,11 +28,28 @@
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
 
+/*
+ * Number of released entries each queue keeps around for reuse, enough to
+ * cover the usual request/response queues without holding on to memory
+ * after a burst.
+ */
+#define QUEUE_POOL_MAX	32
+
+#ifdef NONATOMIC_REFCOUNT
+#define queue_ref_inc(ref)	(++(ref))
+#define queue_ref_dec(ref)	(--(ref))
+#else
+#define queue_ref_inc(ref)	__sync_add_and_fetch(&(ref), 1)
+#define queue_ref_dec(ref)	__sync_sub_and_fetch(&(ref), 1)
+#endif
+
 struct queue {
 	int ref_count;
 	struct queue_entry *head;
 	struct queue_entry *tail;
 	unsigned int entries;
+	struct queue_entry *pool;
+	unsigned int pool_size;
 };
 
 static struct queue *queue_ref(struct queue *queue)
@@ -40,16 +57,23 @@ static struct queue *queue_ref(struct queue *queue)
 	if (!queue)
 		return NULL;
 
-	__sync_fetch_and_add(&queue->ref_count, 1);
+	queue_ref_inc(queue->ref_count);
 
 	return queue;
 }
 
 static void queue_unref(struct queue *queue)
 {
-	if (__sync_sub_and_fetch(&queue->ref_count, 1))
+	if (queue_ref_dec(queue->ref_count))
 		return;
 
+	while (queue->pool) {
+		struct queue_entry *entry = queue->pool;
+
+		queue->pool = entry->next;
+		free(entry);
+	}
+
 	free(queue);
 }
 
@@ -75,16 +99,36 @@ void queue_destroy(struct queue *queue, queue_destroy_func_t destroy)
 	queue_unref(queue);
 }
 
-static struct queue_entry *queue_entry_new(void *data)
+static struct queue_entry *queue_entry_new(struct queue *queue, void *data)
 {
 	struct queue_entry *entry;
 
-	entry = new0(struct queue_entry, 1);
+	entry = queue->pool;
+	if (entry) {
+		queue->pool = entry->next;
+		queue->pool_size--;
+		entry->next = NULL;
+	} else
+		entry = new0(struct queue_entry, 1);
+
 	entry->data = data;
 
 	return entry;
 }
 
+static void queue_entry_free(struct queue *queue, struct queue_entry *entry)
+{
+	if (queue->pool_size >= QUEUE_POOL_MAX) {
+		free(entry);
+		return;
+	}
+
+	entry->data = NULL;
+	entry->next = queue->pool;
+	queue->pool = entry;
+	queue->pool_size++;
+}
+
 bool queue_push_tail(struct queue *queue, void *data)
 {
 	struct queue_entry *entry;
@@ -92,7 +136,7 @@ bool queue_push_tail(struct queue *queue, void *data)
 	if (!queue)
 		return false;
 
-	entry = queue_entry_new(data);
+	entry = queue_entry_new(queue, data);
 
 	if (queue->tail)
 		queue->tail->next = entry;
@@ -114,7 +158,7 @@ bool queue_push_head(struct queue *queue, void *data)
 	if (!queue)
 		return false;
 
-	entry = queue_entry_new(data);
+	entry = queue_entry_new(queue, data);
 
 	entry->next = queue->head;
 
@@ -147,7 +191,7 @@ bool queue_push_after(struct queue *queue, void *entry, void *data)
 	if (!qentry)
 		return false;
 
-	new_entry = queue_entry_new(data);
+	new_entry = queue_entry_new(queue, data);
 
 	new_entry->next = qentry->next;
 
@@ -178,7 +222,7 @@ void *queue_pop_head(struct queue *queue)
 
 	data = entry->data;
 
-	free(entry);
+	queue_entry_free(queue, entry);
 	queue->entries--;
 
 	return data;
@@ -266,7 +310,7 @@ bool queue_remove(struct queue *queue, void *data)
 		if (!entry->next)
 			queue->tail = prev;
 
-		free(entry);
+		queue_entry_free(queue, entry);
 		queue->entries--;
 
 		return true;
@@ -299,7 +343,7 @@ void *queue_remove_if(struct queue *queue, queue_match_func_t function,
 
 			data = entry->data;
 
-			free(entry);
+			queue_entry_free(queue, entry);
 			queue->entries--;
 
 			return data;
@@ -350,7 +394,7 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 			if (destroy)
 				destroy(tmp->data);
 
-			free(tmp);
+			queue_entry_free(queue, tmp);
 			count++;
 		}
 	}
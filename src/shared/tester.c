@@ -31,6 +31,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 #include <sys/signalfd.h>
 
 #include <glib.h>
@@ -80,8 +82,11 @@ enum test_stage {
 	TEST_STAGE_POST_TEARDOWN,
 };
 
+#define MAX_SLOWEST_TESTS	10
+
 struct test_case {
 	char *name;
+	unsigned int index;
 	enum test_result result;
 	enum test_stage stage;
 	const void *test_data;
@@ -99,17 +104,43 @@ struct test_case {
 	void *user_data;
 };
 
+/* Sent by worker processes when a test case starts and when it is done */
+struct test_report {
+	unsigned int index;
+	enum test_result result;
+	bool done;
+	gdouble start_time;
+	gdouble end_time;
+};
+
+struct worker {
+	pid_t pid;
+	int fd;
+	guint source;
+	struct test_case *current;
+	struct test_report report;
+	size_t offset;
+};
+
 static GMainLoop *main_loop;
 
 static GList *test_list;
 static GList *test_current;
 static GTimer *test_timer;
+static unsigned int test_count;
+
+static struct worker *workers;
+static unsigned int num_workers;
+static unsigned int active_workers;
+static int worker_id = -1;
+static int report_fd = -1;
 
 static gboolean option_version = FALSE;
 static gboolean option_quiet = FALSE;
 static gboolean option_debug = FALSE;
 static gboolean option_list = FALSE;
 static const char *option_prefix = NULL;
+static int option_jobs = 1;
 
 static void test_destroy(gpointer data)
 {
@@ -216,6 +247,7 @@ void tester_add_full(const char *name, const void *test_data,
 
 	test = new0(struct test_case, 1);
 	test->name = strdup(name);
+	test->index = test_count++;
 	test->result = TEST_RESULT_NOT_RUN;
 	test->stage = TEST_STAGE_INVALID;
 
@@ -272,10 +304,62 @@ void *tester_get_data(void)
 	return test->user_data;
 }
 
+static int compare_exec_time(const void *a, const void *b)
+{
+	const struct test_case *test_a = *(struct test_case **) a;
+	const struct test_case *test_b = *(struct test_case **) b;
+	gdouble time_a = test_a->end_time - test_a->start_time;
+	gdouble time_b = test_b->end_time - test_b->start_time;
+
+	if (time_a < time_b)
+		return 1;
+
+	if (time_a > time_b)
+		return -1;
+
+	return 0;
+}
+
+static void summarize_slowest(void)
+{
+	struct test_case **tests;
+	unsigned int count = 0, i;
+	GList *list;
+
+	tests = new0(struct test_case *, test_count);
+
+	for (list = g_list_first(test_list); list; list = g_list_next(list)) {
+		struct test_case *test = list->data;
+
+		if (test->result != TEST_RESULT_NOT_RUN)
+			tests[count++] = test;
+	}
+
+	if (count < 2) {
+		free(tests);
+		return;
+	}
+
+	qsort(tests, count, sizeof(*tests), compare_exec_time);
+
+	printf("\n");
+	print_text(COLOR_HIGHLIGHT, "Slowest Tests");
+	print_text(COLOR_HIGHLIGHT, "-------------");
+
+	for (i = 0; i < count && i < MAX_SLOWEST_TESTS; i++) {
+		struct test_case *test = tests[i];
+
+		print_summary(test->name, COLOR_WHITE, "", "%8.3f seconds",
+					test->end_time - test->start_time);
+	}
+
+	free(tests);
+}
+
 static int tester_summarize(void)
 {
 	unsigned int not_run = 0, passed = 0, failed = 0;
-	gdouble execution_time;
+	gdouble execution_time, test_time = 0;
 	GList *list;
 
 	printf("\n");
@@ -289,6 +373,9 @@ static int tester_summarize(void)
 
 		exec_time = test->end_time - test->start_time;
 
+		if (test->result != TEST_RESULT_NOT_RUN)
+			test_time += exec_time;
+
 		switch (test->result) {
 		case TEST_RESULT_NOT_RUN:
 			print_summary(test->name, COLOR_YELLOW, "Not Run", "");
@@ -321,9 +408,15 @@ static int tester_summarize(void)
 			(float) passed * 100 / (not_run + passed + failed) : 0,
 			failed, not_run);
 
+	summarize_slowest();
+
 	execution_time = g_timer_elapsed(test_timer, NULL);
 	printf("Overall execution time: %.3g seconds\n", execution_time);
 
+	if (num_workers > 1)
+		printf("Combined test time: %.3g seconds in %u workers\n",
+						test_time, num_workers);
+
 	return failed;
 }
 
@@ -361,14 +454,43 @@ static gboolean test_timeout(gpointer user_data)
 	return FALSE;
 }
 
+static void send_report(struct test_case *test, bool done)
+{
+	struct test_report report;
+
+	if (report_fd < 0)
+		return;
+
+	memset(&report, 0, sizeof(report));
+	report.index = test->index;
+	report.result = test->result;
+	report.done = done;
+	report.start_time = test->start_time;
+	report.end_time = test->end_time;
+
+	/* Reports are smaller than PIPE_BUF and thus written atomically */
+	if (write(report_fd, &report, sizeof(report)) < 0)
+		perror("Failed to send test report");
+}
+
+static bool test_assigned(struct test_case *test)
+{
+	if (worker_id < 0)
+		return true;
+
+	return test->index % num_workers == (unsigned int) worker_id;
+}
+
 static void next_test_case(void)
 {
 	struct test_case *test;
 
-	if (test_current)
-		test_current = g_list_next(test_current);
-	else
-		test_current = test_list;
+	do {
+		if (test_current)
+			test_current = g_list_next(test_current);
+		else
+			test_current = test_list;
+	} while (test_current && !test_assigned(test_current->data));
 
 	if (!test_current) {
 		g_timer_stop(test_timer);
@@ -384,6 +506,8 @@ static void next_test_case(void)
 
 	test->start_time = g_timer_elapsed(test_timer, NULL);
 
+	send_report(test, false);
+
 	if (test->timeout > 0)
 		test->timeout_id = g_timeout_add_seconds(test->timeout,
 							test_timeout, test);
@@ -423,6 +547,8 @@ static gboolean done_callback(gpointer user_data)
 
 	test->end_time = g_timer_elapsed(test_timer, NULL);
 
+	send_report(test, true);
+
 	print_progress(test->name, COLOR_BLACK, "done");
 	next_test_case();
 
@@ -767,6 +893,11 @@ bool tester_use_debug(void)
 	return option_debug == TRUE ? true : false;
 }
 
+bool tester_use_parallel(void)
+{
+	return option_jobs > 1;
+}
+
 static GOptionEntry options[] = {
 	{ "version", 'v', 0, G_OPTION_ARG_NONE, &option_version,
 				"Show version information and exit" },
@@ -778,6 +909,8 @@ static GOptionEntry options[] = {
 				"Only list the tests to be run" },
 	{ "prefix", 'p', 0, G_OPTION_ARG_STRING, &option_prefix,
 				"Run tests matching provided prefix" },
+	{ "jobs", 'j', 0, G_OPTION_ARG_INT, &option_jobs,
+				"Run tests in parallel worker processes" },
 	{ NULL },
 };
 
@@ -811,9 +944,224 @@ void tester_init(int *argc, char ***argv)
 	test_current = NULL;
 }
 
-int tester_run(void)
+static void run_tests(void)
+{
+	guint signal;
+
+	signal = setup_signalfd();
+
+	g_idle_add(start_tester, NULL);
+	g_main_loop_run(main_loop);
+
+	g_source_remove(signal);
+}
+
+static void handle_report(struct worker *worker)
+{
+	struct test_report *report = &worker->report;
+	struct test_case *test;
+
+	test = g_list_nth_data(test_list, report->index);
+	if (!test)
+		return;
+
+	test->start_time = report->start_time;
+
+	if (!report->done) {
+		worker->current = test;
+		return;
+	}
+
+	test->result = report->result;
+	test->end_time = report->end_time;
+	worker->current = NULL;
+}
+
+static gboolean worker_callback(GIOChannel *channel, GIOCondition condition,
+							gpointer user_data)
+{
+	struct worker *worker = user_data;
+	void *buf = (void *) &worker->report + worker->offset;
+	ssize_t len;
+
+	if (condition & G_IO_IN) {
+		len = read(worker->fd, buf,
+				sizeof(worker->report) - worker->offset);
+		if (len > 0) {
+			worker->offset += len;
+
+			if (worker->offset == sizeof(worker->report)) {
+				handle_report(worker);
+				worker->offset = 0;
+			}
+
+			return TRUE;
+		}
+	}
+
+	/* The worker is done once it closed its end of the pipe */
+	worker->source = 0;
+
+	if (--active_workers == 0)
+		g_main_loop_quit(main_loop);
+
+	return FALSE;
+}
+
+static void run_worker(unsigned int id, int fd)
+{
+	unsigned int i;
+
+	/* Drop what was inherited from the workers started before */
+	for (i = 0; i < id; i++) {
+		g_source_remove(workers[i].source);
+		close(workers[i].fd);
+	}
+
+	worker_id = id;
+	report_fd = fd;
+
+	/* Keep lines of several workers from being mixed up */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	run_tests();
+
+	close(report_fd);
+
+	g_main_loop_unref(main_loop);
+	g_list_free_full(test_list, test_destroy);
+
+	exit(EXIT_SUCCESS);
+}
+
+static bool start_worker(struct worker *worker, unsigned int id)
+{
+	GIOChannel *channel;
+	int fds[2];
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("Failed to create worker pipe");
+		return false;
+	}
+
+	worker->pid = fork();
+	if (worker->pid < 0) {
+		perror("Failed to start worker");
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	if (worker->pid == 0) {
+		close(fds[0]);
+		run_worker(id, fds[1]);
+	}
+
+	close(fds[1]);
+	worker->fd = fds[0];
+
+	channel = g_io_channel_unix_new(worker->fd);
+
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+
+	worker->source = g_io_add_watch(channel,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				worker_callback, worker);
+
+	g_io_channel_unref(channel);
+
+	return true;
+}
+
+static void stop_worker(struct worker *worker)
+{
+	int status;
+
+	if (worker->source > 0) {
+		g_source_remove(worker->source);
+		kill(worker->pid, SIGTERM);
+	}
+
+	if (waitpid(worker->pid, &status, 0) < 0)
+		status = 0;
+
+	close(worker->fd);
+
+	if (!worker->current)
+		return;
+
+	/* A test that was cut short by a crashing worker counts as failed */
+	if (WIFSIGNALED(status) || (WIFEXITED(status) &&
+					WEXITSTATUS(status) != EXIT_SUCCESS)) {
+		worker->current->result = TEST_RESULT_FAILED;
+		worker->current->end_time = worker->current->start_time;
+		print_progress(worker->current->name, COLOR_RED,
+						"worker terminated");
+	}
+}
+
+/*
+ * Every worker is a forked copy of the tester that runs every n-th test
+ * case with its own emulated controllers. The results are reported back
+ * through a pipe and summarized by the parent.
+ */
+static void run_parallel(void)
 {
 	guint signal;
+	unsigned int i;
+
+	num_workers = MIN((unsigned int) option_jobs, test_count);
+	workers = new0(struct worker, num_workers);
+
+	test_timer = g_timer_new();
+
+	/* Buffered output would otherwise be duplicated into the workers */
+	fflush(stdout);
+
+	for (i = 0; i < num_workers; i++) {
+		if (!start_worker(&workers[i], i))
+			break;
+
+		active_workers++;
+	}
+
+	/*
+	 * The workers that did start already split the tests among all of
+	 * them, so the tests of the missing ones would never run. Stop them
+	 * and run everything here instead.
+	 */
+	if (active_workers < num_workers) {
+		for (i = 0; i < active_workers; i++)
+			stop_worker(&workers[i]);
+
+		free(workers);
+		workers = NULL;
+		num_workers = 0;
+		active_workers = 0;
+
+		g_timer_destroy(test_timer);
+		run_tests();
+		return;
+	}
+
+	signal = setup_signalfd();
+
+	g_main_loop_run(main_loop);
+
+	g_source_remove(signal);
+
+	g_timer_stop(test_timer);
+
+	for (i = 0; i < num_workers && workers[i].pid > 0; i++)
+		stop_worker(&workers[i]);
+
+	free(workers);
+	workers = NULL;
+}
+
+int tester_run(void)
+{
 	int ret;
 
 	if (!main_loop)
@@ -824,12 +1172,10 @@ int tester_run(void)
 		return EXIT_SUCCESS;
 	}
 
-	signal = setup_signalfd();
-
-	g_idle_add(start_tester, NULL);
-	g_main_loop_run(main_loop);
-
-	g_source_remove(signal);
+	if (option_jobs > 1 && test_count > 1)
+		run_parallel();
+	else
+		run_tests();
 
 	g_main_loop_unref(main_loop);
 
@@ -0,0 +1,383 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/uio.h>
+
+#include <dbus/dbus.h>
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/hci.h"
+#include "gdbus/gdbus.h"
+#include "monitor/bt.h"
+#include "emulator/btdev.h"
+#include "emulator/advpop.h"
+
+static GMainLoop *main_loop;
+static GDBusProxy *adapter;
+static struct btdev *btdev;
+static struct advpop *advpop;
+static char adapter_addr[18];
+static int vhci_fd = -1;
+
+static unsigned int elapsed;
+static uint64_t last_reports;
+static unsigned int devices, last_devices;
+static unsigned int updates, last_updates;
+
+static int option_count = 1000;
+static int option_min_interval = 100;
+static int option_max_interval = 1000;
+static int option_duration = 10;
+static int option_batch = 1;
+static gboolean option_rpa = FALSE;
+
+static void vhci_write(const struct iovec *iov, int iovlen, void *user_data)
+{
+	if (writev(vhci_fd, iov, iovlen) < 0)
+		fprintf(stderr, "Failed to write to vhci: %s\n",
+							strerror(errno));
+}
+
+static gboolean vhci_read(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	unsigned char buf[4096];
+	ssize_t len;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
+		return FALSE;
+
+	len = read(vhci_fd, buf, sizeof(buf));
+	if (len < 1)
+		return TRUE;
+
+	switch (buf[0]) {
+	case BT_H4_CMD_PKT:
+	case BT_H4_ACL_PKT:
+		btdev_receive_h4(btdev, buf, len);
+		break;
+	}
+
+	return TRUE;
+}
+
+static bool create_controller(void)
+{
+	uint8_t setup_cmd[] = { HCI_VENDOR_PKT, HCI_PRIMARY };
+	GIOChannel *channel;
+	bdaddr_t bdaddr;
+
+	vhci_fd = open("/dev/vhci", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (vhci_fd < 0) {
+		perror("Failed to open /dev/vhci");
+		return false;
+	}
+
+	if (write(vhci_fd, setup_cmd, sizeof(setup_cmd)) < 0) {
+		perror("Failed to setup vhci");
+		close(vhci_fd);
+		return false;
+	}
+
+	btdev = btdev_create(BTDEV_TYPE_LE, 0x42);
+	if (!btdev) {
+		close(vhci_fd);
+		return false;
+	}
+
+	btdev_set_send_handler(btdev, vhci_write, NULL);
+
+	bacpy(&bdaddr, (const bdaddr_t *) btdev_get_bdaddr(btdev));
+	ba2str(&bdaddr, adapter_addr);
+
+	channel = g_io_channel_unix_new(vhci_fd);
+	g_io_add_watch(channel, G_IO_IN | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+							vhci_read, NULL);
+	g_io_channel_unref(channel);
+
+	return true;
+}
+
+static void print_summary(void)
+{
+	uint64_t reports = advpop_get_reports(advpop);
+
+	if (!elapsed)
+		return;
+
+	printf("\nAdvertisers:       %d\n", option_count);
+	printf("Duration:          %u s\n", elapsed);
+	/* Reports injected by the emulator, bluetoothd may drop some */
+	printf("Emulator reports:  %" PRIu64 " (%" PRIu64 "/s)\n", reports,
+							reports / elapsed);
+	printf("Devices created:   %u (%u/s)\n", devices, devices / elapsed);
+	printf("Device updates:    %u (%u/s)\n", updates, updates / elapsed);
+}
+
+static void stop_discovery_reply(DBusMessage *message, void *user_data)
+{
+	print_summary();
+	g_main_loop_quit(main_loop);
+}
+
+static gboolean report_stats(gpointer user_data)
+{
+	uint64_t reports = advpop_get_reports(advpop);
+
+	elapsed++;
+
+	printf("%3u s: %6" PRIu64 " emulator reports/s  %6u new devices/s  "
+				"%6u updates/s  %6u devices\n", elapsed,
+				reports - last_reports, devices - last_devices,
+				updates - last_updates, devices);
+
+	last_reports = reports;
+	last_devices = devices;
+	last_updates = updates;
+
+	if (elapsed < (unsigned int) option_duration)
+		return TRUE;
+
+	if (!g_dbus_proxy_method_call(adapter, "StopDiscovery", NULL,
+					stop_discovery_reply, NULL, NULL))
+		stop_discovery_reply(NULL, NULL);
+
+	return FALSE;
+}
+
+static void start_discovery_reply(DBusMessage *message, void *user_data)
+{
+	DBusError error;
+
+	dbus_error_init(&error);
+
+	if (dbus_set_error_from_message(&error, message)) {
+		fprintf(stderr, "Failed to start discovery: %s\n",
+								error.name);
+		dbus_error_free(&error);
+		g_main_loop_quit(main_loop);
+		return;
+	}
+
+	printf("Discovery started\n");
+
+	last_reports = advpop_get_reports(advpop);
+	g_timeout_add_seconds(1, report_stats, NULL);
+}
+
+static void powered_reply(const DBusError *error, void *user_data)
+{
+	if (dbus_error_is_set(error)) {
+		fprintf(stderr, "Failed to power on: %s\n", error->name);
+		g_main_loop_quit(main_loop);
+		return;
+	}
+
+	if (!g_dbus_proxy_method_call(adapter, "StartDiscovery", NULL,
+					start_discovery_reply, NULL, NULL)) {
+		fprintf(stderr, "Failed to start discovery\n");
+		g_main_loop_quit(main_loop);
+	}
+}
+
+static bool is_device(GDBusProxy *proxy)
+{
+	const char *path = g_dbus_proxy_get_path(proxy);
+	const char *adapter_path;
+
+	if (!adapter)
+		return false;
+
+	if (strcmp(g_dbus_proxy_get_interface(proxy), "org.bluez.Device1"))
+		return false;
+
+	adapter_path = g_dbus_proxy_get_path(adapter);
+
+	return g_str_has_prefix(path, adapter_path) &&
+				path[strlen(adapter_path)] == '/';
+}
+
+static void proxy_added(GDBusProxy *proxy, void *user_data)
+{
+	dbus_bool_t powered = TRUE;
+	DBusMessageIter iter;
+	const char *address;
+
+	if (is_device(proxy)) {
+		devices++;
+		return;
+	}
+
+	if (adapter || strcmp(g_dbus_proxy_get_interface(proxy),
+						"org.bluez.Adapter1"))
+		return;
+
+	if (!g_dbus_proxy_get_property(proxy, "Address", &iter))
+		return;
+
+	dbus_message_iter_get_basic(&iter, &address);
+	if (strcmp(address, adapter_addr))
+		return;
+
+	printf("Using adapter %s (%s)\n", g_dbus_proxy_get_path(proxy),
+								address);
+
+	adapter = proxy;
+
+	if (!g_dbus_proxy_set_property_basic(adapter, "Powered",
+					DBUS_TYPE_BOOLEAN, &powered,
+					powered_reply, NULL, NULL)) {
+		fprintf(stderr, "Failed to power on\n");
+		g_main_loop_quit(main_loop);
+	}
+}
+
+static void proxy_removed(GDBusProxy *proxy, void *user_data)
+{
+	if (proxy != adapter)
+		return;
+
+	fprintf(stderr, "Adapter removed\n");
+	adapter = NULL;
+	g_main_loop_quit(main_loop);
+}
+
+static void property_changed(GDBusProxy *proxy, const char *name,
+					DBusMessageIter *iter, void *user_data)
+{
+	if (is_device(proxy))
+		updates++;
+}
+
+static void disconnect_handler(DBusConnection *connection, void *user_data)
+{
+	fprintf(stderr, "bluetoothd disconnected\n");
+	g_main_loop_quit(main_loop);
+}
+
+static GOptionEntry options[] = {
+	{ "count", 'n', 0, G_OPTION_ARG_INT, &option_count,
+				"Number of advertisers" },
+	{ "min-interval", 'i', 0, G_OPTION_ARG_INT, &option_min_interval,
+				"Minimum advertising interval in ms" },
+	{ "max-interval", 'I', 0, G_OPTION_ARG_INT, &option_max_interval,
+				"Maximum advertising interval in ms" },
+	{ "duration", 't', 0, G_OPTION_ARG_INT, &option_duration,
+				"Measurement duration in seconds" },
+	{ "batch", 'b', 0, G_OPTION_ARG_INT, &option_batch,
+				"Advertising reports per HCI event" },
+	{ "rpa", 'r', 0, G_OPTION_ARG_NONE, &option_rpa,
+				"Use rotating resolvable private addresses" },
+	{ NULL },
+};
+
+int main(int argc, char *argv[])
+{
+	struct advpop_config config;
+	GOptionContext *context;
+	GError *error = NULL;
+	DBusConnection *dbus_conn;
+	GDBusClient *client;
+
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		if (error) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		} else
+			g_printerr("An unknown error occurred\n");
+		exit(1);
+	}
+
+	g_option_context_free(context);
+
+	if (option_count < 1 || option_duration < 1 || option_batch < 1 ||
+			option_batch > 255 || option_min_interval < 1 ||
+			option_max_interval > UINT16_MAX) {
+		fprintf(stderr, "Invalid parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	main_loop = g_main_loop_new(NULL, FALSE);
+
+	dbus_conn = g_dbus_setup_bus(DBUS_BUS_SYSTEM, NULL, NULL);
+	if (!dbus_conn) {
+		fprintf(stderr, "Failed to connect to the system bus\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!create_controller())
+		return EXIT_FAILURE;
+
+	memset(&config, 0, sizeof(config));
+	config.count = option_count;
+	config.min_interval = option_min_interval;
+	config.max_interval = option_max_interval;
+	config.reports_per_event = option_batch;
+
+	if (option_rpa) {
+		config.addr_types = ADVPOP_ADDR_RPA;
+		config.rpa_timeout = 15;
+	} else
+		config.addr_types = ADVPOP_ADDR_PUBLIC | ADVPOP_ADDR_STATIC;
+
+	advpop = advpop_new(btdev, &config);
+	if (!advpop) {
+		fprintf(stderr, "Failed to create advertisers\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("Waiting for adapter %s\n", adapter_addr);
+
+	client = g_dbus_client_new(dbus_conn, "org.bluez", "/org/bluez");
+	g_dbus_client_set_disconnect_watch(client, disconnect_handler, NULL);
+	g_dbus_client_set_proxy_handlers(client, proxy_added, proxy_removed,
+						property_changed, NULL);
+
+	g_main_loop_run(main_loop);
+
+	g_dbus_client_unref(client);
+	dbus_connection_unref(dbus_conn);
+
+	advpop_free(advpop);
+	btdev_destroy(btdev);
+	close(vhci_fd);
+
+	g_main_loop_unref(main_loop);
+
+	return EXIT_SUCCESS;
+}
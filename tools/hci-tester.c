@@ -27,6 +27,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "monitor/bt.h"
 #include "src/shared/hci.h"
@@ -44,6 +45,9 @@ struct user_data {
 	uint8_t bdaddr_ut[6];
 	uint8_t bdaddr_lt[6];
 	uint16_t handle_ut;
+
+	unsigned int num_pending;
+	uint64_t start_time;
 };
 
 struct le_keys {
@@ -286,6 +290,73 @@ static void test_read_local_version_information(const void *test_data)
 	test_command(BT_HCI_CMD_READ_LOCAL_VERSION);
 }
 
+#define BURST_COMMANDS	1000
+
+static uint64_t burst_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void test_command_burst_complete(const void *data, uint8_t size,
+							void *user_data)
+{
+	struct user_data *user = tester_get_data();
+	uint8_t status = *((uint8_t *) data);
+	uint64_t elapsed;
+
+	if (!user->num_pending)
+		return;
+
+	if (status) {
+		tester_warn("HCI command failed (0x%02x)", status);
+		user->num_pending = 0;
+		tester_test_failed();
+		return;
+	}
+
+	if (--user->num_pending)
+		return;
+
+	elapsed = burst_time() - user->start_time;
+	if (!elapsed)
+		elapsed = 1;
+
+	tester_print("%u commands in %llu us (%.0f commands/s)",
+				BURST_COMMANDS, (unsigned long long) elapsed,
+				BURST_COMMANDS * 1000000.0 / elapsed);
+
+	tester_test_passed();
+}
+
+/*
+ * Queues all commands at once, so the rate shows how well the command
+ * credits granted by the controller are used.
+ */
+static void test_command_burst(const void *test_data)
+{
+	struct user_data *user = tester_get_data();
+	unsigned int i;
+
+	user->start_time = burst_time();
+
+	for (i = 0; i < BURST_COMMANDS; i++) {
+		user->num_pending++;
+
+		if (!bt_hci_send(user->hci_ut, BT_HCI_CMD_READ_LOCAL_VERSION,
+					NULL, 0, test_command_burst_complete,
+					NULL, NULL)) {
+			tester_warn("Failed to queue HCI command");
+			user->num_pending = 0;
+			tester_test_failed();
+			return;
+		}
+	}
+}
+
 static void test_read_local_supported_commands(const void *test_data)
 {
 	test_command(BT_HCI_CMD_READ_LOCAL_COMMANDS);
@@ -938,6 +1009,8 @@ int main(int argc, char *argv[])
 				setup_le_generate_dhkey,
 				test_le_generate_dhkey);
 
+	test_hci_local("Command Burst", NULL, NULL, test_command_burst);
+
 	test_hci_local("Inquiry (LIAC)", NULL, NULL, test_inquiry_liac);
 
 	test_hci("Create Connection", NULL,
@@ -37,6 +37,7 @@
 #include "lib/mgmt.h"
 
 #include "monitor/bt.h"
+#include "emulator/btdev.h"
 #include "emulator/bthost.h"
 #include "emulator/hciemu.h"
 
@@ -55,6 +56,9 @@ struct test_data {
 	uint16_t dcid;
 	int sk;
 	int sk2;
+	uint8_t clients_ready;
+	int *sks;
+	uint8_t num_sks;
 };
 
 struct l2cap_data {
@@ -92,6 +96,9 @@ struct l2cap_data {
 	bool server_not_advertising;
 	bool direct_advertising;
 	bool close_one_socket;
+
+	uint8_t num_clients;
+	const struct btdev_link_model *link_model;
 };
 
 static void mgmt_debug(const char *str, void *user_data)
@@ -178,6 +185,8 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
 	struct test_data *data = tester_get_data();
+	const struct l2cap_data *l2data = data->test_data;
+	uint8_t num_clients = 1;
 
 	tester_print("Read Index List callback");
 	tester_print("  Status: 0x%02x", status);
@@ -187,19 +196,31 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 		return;
 	}
 
-	mgmt_register(data->mgmt, MGMT_EV_INDEX_ADDED, MGMT_INDEX_NONE,
-					index_added_callback, NULL, NULL);
-
 	mgmt_register(data->mgmt, MGMT_EV_INDEX_REMOVED, MGMT_INDEX_NONE,
 					index_removed_callback, NULL, NULL);
 
-	data->hciemu = hciemu_new(data->hciemu_type);
+	if (l2data && l2data->num_clients)
+		num_clients = l2data->num_clients;
+
+	data->hciemu = hciemu_new_num(data->hciemu_type, num_clients);
 	if (!data->hciemu) {
 		tester_warn("Failed to setup HCI emulation");
 		tester_pre_setup_failed();
+		return;
 	}
 
+	hciemu_register_index_added(data->hciemu, data->mgmt,
+					index_added_callback, NULL);
+
 	tester_print("New hciemu instance created");
+
+	if (!l2data || !l2data->link_model)
+		return;
+
+	if (!hciemu_set_link_model(data->hciemu, l2data->link_model)) {
+		tester_warn("Failed to setup link model");
+		tester_pre_setup_failed();
+	}
 }
 
 static void test_pre_setup(const void *test_data)
@@ -229,6 +250,12 @@ static void test_post_teardown(const void *test_data)
 		data->io_id = 0;
 	}
 
+	while (data->num_sks > 0)
+		close(data->sks[--data->num_sks]);
+
+	free(data->sks);
+	data->sks = NULL;
+
 	hciemu_unref(data->hciemu);
 	data->hciemu = NULL;
 }
@@ -248,6 +275,8 @@ static void test_data_free(void *test_data)
 			break; \
 		user->hciemu_type = HCIEMU_TYPE_BREDR; \
 		user->io_id = 0; \
+		user->sks = NULL; \
+		user->num_sks = 0; \
 		user->test_data = data; \
 		tester_add_full(name, data, \
 				test_pre_setup, setup, func, NULL, \
@@ -262,6 +291,8 @@ static void test_data_free(void *test_data)
 			break; \
 		user->hciemu_type = HCIEMU_TYPE_LE; \
 		user->io_id = 0; \
+		user->sks = NULL; \
+		user->num_sks = 0; \
 		user->test_data = data; \
 		tester_add_full(name, data, \
 				test_pre_setup, setup, func, NULL, \
@@ -315,6 +346,32 @@ static const struct l2cap_data client_connect_write_success_test = {
 	.data_len = sizeof(l2_data),
 };
 
+/* Slow links with a 20 ms connection event and a single ACL buffer */
+static const struct btdev_link_model slow_link_model = {
+	.bredr_rate = 64000,
+	.le_rate = 64000,
+	.interval = 20,
+	.event_pkts = 1,
+	.acl_max_pkt = 1,
+	.le_max_pkt = 1,
+};
+
+static const struct l2cap_data client_connect_read_slow_link_test = {
+	.client_psm = 0x1001,
+	.server_psm = 0x1001,
+	.read_data = l2_data,
+	.data_len = sizeof(l2_data),
+	.link_model = &slow_link_model,
+};
+
+static const struct l2cap_data client_connect_write_slow_link_test = {
+	.client_psm = 0x1001,
+	.server_psm = 0x1001,
+	.write_data = l2_data,
+	.data_len = sizeof(l2_data),
+	.link_model = &slow_link_model,
+};
+
 static const struct l2cap_data client_connect_nval_psm_test_1 = {
 	.client_psm = 0x1001,
 	.expect_err = ECONNREFUSED,
@@ -540,6 +597,18 @@ static const struct l2cap_data le_server_nval_scid_test = {
 	.expect_cmd_len = sizeof(nval_le_connect_rsp),
 };
 
+static const struct l2cap_data client_connect_multi_test = {
+	.client_psm = 0x1001,
+	.server_psm = 0x1001,
+	.num_clients = 32,
+};
+
+static const struct l2cap_data le_client_connect_multi_test = {
+	.client_psm = 0x0080,
+	.server_psm = 0x0080,
+	.num_clients = 32,
+};
+
 static const struct l2cap_data le_att_client_connect_success_test_1 = {
 	.cid = 0x0004,
 	.sec_level = BT_SECURITY_LOW,
@@ -576,10 +645,17 @@ static void client_cmd_complete(uint16_t opcode, uint8_t status,
 	}
 
 
-	if (status)
+	if (status) {
 		tester_setup_failed();
-	else
-		tester_setup_complete();
+		return;
+	}
+
+	/* Wait until every client is connectable */
+	if (test && test->num_clients &&
+				++data->clients_ready < test->num_clients)
+		return;
+
+	tester_setup_complete();
 }
 
 static void server_cmd_complete(uint16_t opcode, uint8_t status,
@@ -605,7 +681,8 @@ static void setup_powered_client_callback(uint8_t status, uint16_t length,
 {
 	struct test_data *data = tester_get_data();
 	const struct l2cap_data *l2data = data->test_data;
-	struct bthost *bthost;
+	struct hciemu_client *client;
+	int i;
 
 	if (status != MGMT_STATUS_SUCCESS) {
 		tester_setup_failed();
@@ -614,16 +691,24 @@ static void setup_powered_client_callback(uint8_t status, uint16_t length,
 
 	tester_print("Controller powered on");
 
-	bthost = hciemu_client_get_host(data->hciemu);
-	bthost_set_cmd_complete_cb(bthost, client_cmd_complete, user_data);
+	if (data->hciemu_type == HCIEMU_TYPE_LE &&
+				l2data && l2data->server_not_advertising) {
+		tester_setup_complete();
+		return;
+	}
+
+	data->clients_ready = 0;
+
+	for (i = 0; (client = hciemu_get_client(data->hciemu, i)); i++) {
+		struct bthost *bthost = hciemu_client_host(client);
+
+		bthost_set_cmd_complete_cb(bthost, client_cmd_complete,
+								user_data);
 
-	if (data->hciemu_type == HCIEMU_TYPE_LE) {
-		if (!l2data || !l2data->server_not_advertising)
+		if (data->hciemu_type == HCIEMU_TYPE_LE)
 			bthost_set_adv_enable(bthost, 0x01);
 		else
-			tester_setup_complete();
-	} else {
-		bthost_write_scan_enable(bthost, 0x03);
+			bthost_write_scan_enable(bthost, 0x03);
 	}
 }
 
@@ -1235,6 +1320,106 @@ static void test_connect(const void *test_data)
 	tester_print("Connect in progress");
 }
 
+static void connect_next_client(struct test_data *data);
+
+static gboolean l2cap_connect_multi_cb(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct test_data *data = tester_get_data();
+	const struct l2cap_data *l2data = data->test_data;
+	int sk_err, sk;
+	socklen_t len = sizeof(sk_err);
+
+	data->io_id = 0;
+
+	sk = g_io_channel_unix_get_fd(io);
+
+	if (getsockopt(sk, SOL_SOCKET, SO_ERROR, &sk_err, &len) < 0)
+		sk_err = errno;
+
+	if (sk_err) {
+		tester_warn("Connect %u failed: %s (%d)", data->num_sks,
+						strerror(sk_err), sk_err);
+		tester_test_failed();
+		return FALSE;
+	}
+
+	tester_print("Connected to client %u", data->num_sks);
+
+	/* Earlier sockets stay open so all links are up at the same time */
+	if (data->num_sks == l2data->num_clients)
+		tester_test_passed();
+	else
+		connect_next_client(data);
+
+	return FALSE;
+}
+
+static void connect_next_client(struct test_data *data)
+{
+	const struct l2cap_data *l2data = data->test_data;
+	struct hciemu_client *client;
+	uint8_t bdaddr_type;
+	GIOChannel *io;
+	int sk;
+
+	client = hciemu_get_client(data->hciemu, data->num_sks);
+
+	if (data->hciemu_type == HCIEMU_TYPE_LE)
+		bdaddr_type = BDADDR_LE_PUBLIC;
+	else
+		bdaddr_type = BDADDR_BREDR;
+
+	sk = create_l2cap_sock(data, 0, l2data->cid, l2data->sec_level);
+	if (sk < 0) {
+		tester_test_failed();
+		return;
+	}
+
+	data->sks[data->num_sks++] = sk;
+
+	if (connect_l2cap_impl(sk, hciemu_client_bdaddr(client), bdaddr_type,
+					l2data->client_psm, l2data->cid) < 0) {
+		tester_test_failed();
+		return;
+	}
+
+	io = g_io_channel_unix_new(sk);
+	g_io_channel_set_close_on_unref(io, FALSE);
+
+	data->io_id = g_io_add_watch(io, G_IO_OUT, l2cap_connect_multi_cb,
+									NULL);
+
+	g_io_channel_unref(io);
+}
+
+static void test_connect_multi(const void *test_data)
+{
+	struct test_data *data = tester_get_data();
+	const struct l2cap_data *l2data = data->test_data;
+	struct hciemu_client *client;
+	int i;
+
+	for (i = 0; (client = hciemu_get_client(data->hciemu, i)); i++)
+		bthost_add_l2cap_server(hciemu_client_host(client),
+					l2data->server_psm, NULL, NULL);
+
+	data->sks = calloc(l2data->num_clients, sizeof(int));
+	if (!data->sks) {
+		tester_test_failed();
+		return;
+	}
+
+	data->num_sks = 0;
+
+	/* Links are set up one at a time since the kernel serializes
+	 * LE connection attempts anyway.
+	 */
+	connect_next_client(data);
+
+	tester_print("Connect in progress");
+}
+
 static void test_connect_reject(const void *test_data)
 {
 	struct test_data *data = tester_get_data();
@@ -1834,6 +2019,18 @@ int main(int argc, char *argv[])
 					&client_connect_write_success_test,
 					setup_powered_client, test_connect);
 
+	test_l2cap_bredr("L2CAP BR/EDR Client - Read Slow Link",
+					&client_connect_read_slow_link_test,
+					setup_powered_client, test_connect);
+
+	test_l2cap_bredr("L2CAP BR/EDR Client - Write Slow Link",
+					&client_connect_write_slow_link_test,
+					setup_powered_client, test_connect);
+
+	test_l2cap_bredr("L2CAP BR/EDR Client - 32 Peripherals",
+					&client_connect_multi_test,
+					setup_powered_client, test_connect_multi);
+
 	test_l2cap_bredr("L2CAP BR/EDR Client - Invalid PSM 1",
 					&client_connect_nval_psm_test_1,
 					setup_powered_client, test_connect);
@@ -1891,6 +2088,10 @@ int main(int argc, char *argv[])
 				&le_client_connect_reject_test_2,
 				setup_powered_client, test_connect_reject);
 
+	test_l2cap_le("L2CAP LE Client - 32 Peripherals",
+				&le_client_connect_multi_test,
+				setup_powered_client, test_connect_multi);
+
 	test_l2cap_le("L2CAP LE Client - Close socket 1",
 				&le_client_close_socket_test_1,
 				setup_powered_client,
@@ -35,12 +35,14 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <syslog.h>
 #include <signal.h>
 #include <sys/time.h>
 #include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -48,6 +50,7 @@
 #include "lib/l2cap.h"
 
 #include "src/shared/util.h"
+#include "tools/latency.h"
 
 #define NIBBLE_TO_ASCII(c)  ((c) < 0x0a ? (c) + 0x30 : (c) + 0x57)
 
@@ -70,6 +73,9 @@ enum {
 	CSENDRECV,
 	INFOREQ,
 	PAIRING,
+	ECHO,
+	ROUNDTRIP,
+	STREAMS,
 };
 
 static unsigned char *buf;
@@ -125,12 +131,24 @@ static int socktype = SOCK_SEQPACKET;
 static int linger = 0;
 static int reliable = 0;
 static int timestamp = 0;
+static int latency = 0;
 static int defer_setup = 0;
 static int priority = -1;
 static int rcvbuf = 0;
 static int chan_policy = -1;
 static int bdaddr_type = 0;
 
+/* Rate and SDU size of the channels in streams mode, used round robin */
+#define MAX_STREAM_SPECS	16
+
+struct stream_spec {
+	unsigned int rate;	/* SDUs per second, 0 = as fast as possible */
+	long size;		/* SDU size, -1 = data size or omtu */
+};
+
+static struct stream_spec stream_specs[MAX_STREAM_SPECS] = { { 0, -1 } };
+static int num_stream_specs = 1;
+
 struct lookup_table {
 	const char *name;
 	int flag;
@@ -301,6 +319,31 @@ static int setopts(int sk, struct l2cap_options *opts)
 							sizeof(opts->imtu));
 }
 
+static const char *chan_mode_str(int sk)
+{
+	struct l2cap_options opts;
+	struct sockaddr_l2 addr;
+	socklen_t optlen;
+	const char *str;
+
+	if (bdaddr_type != BDADDR_BREDR) {
+		/* Fixed channels are bound by CID only and carry no PSM */
+		memset(&addr, 0, sizeof(addr));
+		optlen = sizeof(addr);
+		if (getsockname(sk, (struct sockaddr *) &addr, &optlen) < 0)
+			return "unknown";
+
+		return addr.l2_psm ? "le_flowctl" : "le_fixed";
+	}
+
+	if (getopts(sk, &opts, true) < 0)
+		return "unknown";
+
+	str = get_lookup_str(l2cap_modes, opts.mode);
+
+	return str ? str : "unknown";
+}
+
 static int do_connect(char *svr)
 {
 	struct sockaddr_l2 addr;
@@ -838,12 +881,15 @@ static void dump_mode(int sk)
 static void recv_mode(int sk)
 {
 	struct timeval tv_beg, tv_end, tv_diff;
+	struct latency_hist hist;
+	struct latency_jitter jitter;
+	const char *mode_str = NULL;
 	struct pollfd p;
 	char ts[30];
 	long total;
 	uint32_t seq;
 	socklen_t optlen;
-	int opt, len;
+	int opt, len, data_start = 6;
 
 	if (data_size < 0)
 		data_size = imtu;
@@ -864,6 +910,13 @@ static void recv_mode(int sk)
 
 	memset(ts, 0, sizeof(ts));
 
+	if (latency) {
+		latency_hist_init(&hist);
+		latency_jitter_init(&jitter);
+		mode_str = chan_mode_str(sk);
+		data_start = LATENCY_HDR_SIZE;
+	}
+
 	p.fd = sk;
 	p.events = POLLIN | POLLERR | POLLHUP;
 
@@ -930,8 +983,22 @@ static void recv_mode(int sk)
 				continue;
 			}
 
+			/*
+			 * One-way latency is only meaningful when both ends
+			 * share the monotonic clock, e.g. two local controllers
+			 */
+			if (latency && len >= LATENCY_HDR_SIZE) {
+				uint64_t sent, now = latency_now();
+
+				sent = get_le64(buf + LATENCY_STAMP_OFFSET);
+				if (now >= sent)
+					latency_hist_add(&hist, now - sent);
+
+				latency_jitter_update(&jitter, sent, now);
+			}
+
 			/* Verify data */
-			for (i = 6; i < len; i++) {
+			for (i = data_start; i < len; i++) {
 				if (buf[i] != 0x7f)
 					syslog(LOG_INFO, "data missmatch: byte %d 0x%2.2x", i, buf[i]);
 			}
@@ -944,6 +1011,12 @@ static void recv_mode(int sk)
 
 		syslog(LOG_INFO,"%s%ld bytes in %.2f sec, %.2f kB/s", ts, total,
 			tv2fl(tv_diff), (float)(total / tv2fl(tv_diff) ) / 1024.0);
+
+		if (latency) {
+			latency_hist_report(&hist, mode_str);
+			syslog(LOG_INFO, "%s jitter: %.1f us", mode_str,
+					latency_jitter_get(&jitter) / 1000.0);
+		}
 	}
 }
 
@@ -983,6 +1056,12 @@ static void do_send(int sk)
 			buf[i] = 0x7f;
 	}
 
+	if (latency && data_size < LATENCY_HDR_SIZE) {
+		syslog(LOG_ERR, "Frames of %ld bytes can't hold timestamps",
+								data_size);
+		exit(1);
+	}
+
 	if (!count && send_delay)
 		usleep(send_delay);
 
@@ -991,6 +1070,9 @@ static void do_send(int sk)
 		put_le32(seq, buf);
 		put_le16(data_size, buf + 4);
 
+		if (latency)
+			put_le64(latency_now(), buf + LATENCY_STAMP_OFFSET);
+
 		seq++;
 
 		sent = 0;
@@ -1052,6 +1134,440 @@ static void send_and_recv_mode(int sk)
 	return;
 }
 
+static void echo_mode(int sk)
+{
+	if (data_size < 0)
+		data_size = imtu;
+
+	latency_echo(sk, buf, data_size);
+}
+
+static void roundtrip_mode(int sk)
+{
+	struct latency_roundtrip rt;
+
+	if (data_size < 0)
+		data_size = omtu;
+
+	memset(&rt, 0, sizeof(rt));
+	rt.mode = chan_mode_str(sk);
+	rt.data_size = data_size;
+	rt.num_frames = num_frames;
+	rt.seq = seq_start;
+	rt.recv_flags = socktype == SOCK_STREAM ? MSG_WAITALL : 0;
+	rt.count = count;
+	rt.delay = send_delay;
+
+	latency_roundtrip(sk, buf, &rt);
+}
+
+#define STREAM_BURST		16
+#define STREAM_MAX_EVENTS	32
+
+struct stream {
+	int sk;
+	unsigned int id;
+	const char *peer;
+	unsigned int rate;
+	long size;
+	long frames;
+	uint32_t seq;
+	uint64_t next_send;
+	bool blocked;
+	uint64_t blocked_since;
+
+	/* Totals and values at the previous report */
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	unsigned int stalls;
+	uint64_t stall_time;
+	uint64_t last_tx_bytes;
+	unsigned int last_stalls;
+};
+
+static volatile sig_atomic_t streams_terminated;
+
+static void streams_sig_term(int sig)
+{
+	streams_terminated = 1;
+}
+
+static bool parse_stream_specs(char *str)
+{
+	char *spec, *end;
+
+	num_stream_specs = 0;
+
+	for (spec = strtok(str, ","); spec; spec = strtok(NULL, ",")) {
+		struct stream_spec *s;
+
+		if (num_stream_specs == MAX_STREAM_SPECS)
+			return false;
+
+		s = &stream_specs[num_stream_specs++];
+
+		s->rate = strtoul(spec, &end, 10);
+		s->size = -1;
+
+		if (*end == ':')
+			s->size = strtol(end + 1, &end, 10);
+
+		if (*end != '\0' || !s->size)
+			return false;
+	}
+
+	return num_stream_specs > 0;
+}
+
+static void stream_close(int efd, struct stream *stream)
+{
+	syslog(LOG_INFO, "Channel %u to %s closed", stream->id, stream->peer);
+
+	epoll_ctl(efd, EPOLL_CTL_DEL, stream->sk, NULL);
+	close(stream->sk);
+	stream->sk = -1;
+}
+
+static void stream_set_blocked(int efd, struct stream *stream, bool blocked,
+								uint64_t now)
+{
+	struct epoll_event ev;
+
+	if (stream->blocked == blocked)
+		return;
+
+	stream->blocked = blocked;
+
+	if (blocked) {
+		stream->stalls++;
+		stream->blocked_since = now;
+	} else
+		stream->stall_time += now - stream->blocked_since;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (blocked ? EPOLLOUT : 0);
+	ev.data.ptr = stream;
+
+	epoll_ctl(efd, EPOLL_CTL_MOD, stream->sk, &ev);
+}
+
+/*
+ * Send what is due on a channel, at most STREAM_BURST SDUs at a time so
+ * that unlimited channels can not starve the others. Running out of
+ * credits or socket buffer shows up as EAGAIN and is accounted as a
+ * stall until the socket becomes writable again.
+ */
+static void stream_send(int efd, struct stream *stream, uint64_t now)
+{
+	int i, len;
+
+	for (i = 0; i < STREAM_BURST && stream->frames; i++) {
+		if (stream->rate && stream->next_send > now)
+			return;
+
+		put_le32(stream->seq, buf);
+		put_le16(stream->size, buf + 4);
+
+		if (latency)
+			put_le64(now, buf + LATENCY_STAMP_OFFSET);
+
+		len = send(stream->sk, buf, stream->size, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				stream_set_blocked(efd, stream, true, now);
+				return;
+			}
+
+			syslog(LOG_ERR, "Send on channel %u failed: %s (%d)",
+					stream->id, strerror(errno), errno);
+			stream_close(efd, stream);
+			return;
+		}
+
+		stream->seq++;
+		stream->tx_bytes += len;
+
+		if (stream->frames > 0)
+			stream->frames--;
+
+		if (!stream->rate)
+			continue;
+
+		stream->next_send += 1000000000ULL / stream->rate;
+
+		/* Do not try to catch up after falling far behind */
+		if (stream->next_send + 1000000000ULL < now)
+			stream->next_send = now;
+	}
+}
+
+static void stream_recv(int efd, struct stream *stream, void *rx_buf)
+{
+	int len;
+
+	while (1) {
+		len = recv(stream->sk, rx_buf, buffer_size, MSG_DONTWAIT);
+		if (len > 0) {
+			stream->rx_bytes += len;
+			continue;
+		}
+
+		if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		stream_close(efd, stream);
+		return;
+	}
+}
+
+static void streams_report(struct stream *streams, unsigned int num,
+						uint64_t elapsed, bool total)
+{
+	double secs = elapsed / 1000000000.0;
+	double sum = 0, sum_sq = 0, kbps, aggregate = 0;
+	bool normalize = true;
+	unsigned int i, stalls;
+	uint64_t bytes;
+
+	if (!num || !elapsed)
+		return;
+
+	for (i = 0; i < num; i++) {
+		if (!streams[i].rate)
+			normalize = false;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct stream *stream = &streams[i];
+		double share;
+
+		if (total) {
+			bytes = stream->tx_bytes;
+			stalls = stream->stalls;
+		} else {
+			bytes = stream->tx_bytes - stream->last_tx_bytes;
+			stalls = stream->stalls - stream->last_stalls;
+		}
+
+		kbps = bytes / secs / 1024.0;
+		aggregate += kbps;
+
+		/* Rate limited channels are compared to what they asked for */
+		share = kbps;
+		if (normalize)
+			share /= stream->rate * stream->size / 1024.0;
+
+		sum += share;
+		sum_sq += share * share;
+
+		syslog(LOG_INFO, "Channel %u (%s)%s: %.2f kB/s sent, "
+				"%" PRIu64 " bytes received, %u stalls%s",
+				stream->id,
+				stream->sk < 0 ? "closed" : stream->peer,
+				total ? " total" : "", kbps, stream->rx_bytes,
+				stalls, stream->blocked ? ", blocked" : "");
+
+		if (total && stream->stalls)
+			syslog(LOG_INFO, "Channel %u stalled for %.1f ms",
+					stream->id, stream->stall_time / 1e6);
+
+		stream->last_tx_bytes = stream->tx_bytes;
+		stream->last_stalls = stream->stalls;
+	}
+
+	/* Jain's index: 1 when all channels get the same share */
+	syslog(LOG_INFO, "%u channels%s: %.2f kB/s, fairness %.3f", num,
+			total ? " total" : "", aggregate,
+			sum_sq > 0 ? sum * sum / (num * sum_sq) : 1.0);
+}
+
+static void streams_mode(int argc, char *argv[])
+{
+	struct epoll_event events[STREAM_MAX_EVENTS];
+	struct stream *streams;
+	struct sigaction sa;
+	void *rx_buf;
+	uint64_t start, now, last_report;
+	unsigned int num = 0, active = 0, i;
+	int n, efd;
+
+	if (count < 1) {
+		syslog(LOG_ERR, "Invalid number of channels per peer");
+		exit(1);
+	}
+
+	streams = calloc(argc * count, sizeof(*streams));
+	rx_buf = malloc(buffer_size);
+	if (!streams || !rx_buf) {
+		syslog(LOG_ERR, "Can't allocate channels");
+		exit(1);
+	}
+
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	if (efd < 0) {
+		syslog(LOG_ERR, "Can't create epoll: %s (%d)",
+							strerror(errno), errno);
+		exit(1);
+	}
+
+	for (n = 0; n < argc; n++) {
+		for (i = 0; i < (unsigned int) count; i++) {
+			struct stream_spec *spec;
+			struct stream *stream = &streams[num];
+			struct epoll_event ev;
+
+			spec = &stream_specs[num % num_stream_specs];
+
+			stream->sk = do_connect(argv[n]);
+			if (stream->sk < 0)
+				continue;
+
+			stream->id = num++;
+			stream->peer = argv[n];
+			stream->rate = spec->rate;
+			stream->frames = num_frames;
+			stream->seq = seq_start;
+
+			stream->size = spec->size > 0 ? spec->size : data_size;
+			if (stream->size < 0 || stream->size > omtu)
+				stream->size = omtu;
+
+			if (stream->size < (latency ? LATENCY_HDR_SIZE : 6)) {
+				syslog(LOG_ERR, "SDU size %ld too small",
+								stream->size);
+				exit(1);
+			}
+
+			syslog(LOG_INFO, "Channel %u: %s mode, %u SDUs/s, "
+					"%ld bytes", stream->id,
+					chan_mode_str(stream->sk),
+					stream->rate, stream->size);
+
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = stream;
+
+			if (epoll_ctl(efd, EPOLL_CTL_ADD, stream->sk,
+								&ev) < 0) {
+				syslog(LOG_ERR, "Can't watch channel: %s (%d)",
+							strerror(errno), errno);
+				exit(1);
+			}
+
+			active++;
+		}
+	}
+
+	if (!active) {
+		syslog(LOG_ERR, "No channel connected");
+		exit(1);
+	}
+
+	memset(buf, 0x7f, buffer_size);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = streams_sig_term;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	syslog(LOG_INFO, "Streaming on %u channels ...", active);
+
+	start = latency_now();
+	last_report = start;
+
+	for (i = 0; i < num; i++)
+		streams[i].next_send = start;
+
+	while (!streams_terminated && active) {
+		uint64_t next = last_report + 1000000000ULL;
+		int timeout;
+
+		now = latency_now();
+		active = 0;
+
+		/* Sleep until the next SDU is due or the next report */
+		for (i = 0; i < num; i++) {
+			struct stream *stream = &streams[i];
+
+			if (stream->sk < 0 || !stream->frames)
+				continue;
+
+			active++;
+
+			if (stream->blocked)
+				continue;
+
+			if (!stream->rate || stream->next_send < next)
+				next = stream->rate ? stream->next_send : now;
+		}
+
+		if (!active)
+			break;
+
+		timeout = next > now ? (next - now + 999999) / 1000000 : 0;
+
+		n = epoll_wait(efd, events, STREAM_MAX_EVENTS, timeout);
+		if (n < 0 && errno != EINTR) {
+			syslog(LOG_ERR, "Polling failed: %s (%d)",
+							strerror(errno), errno);
+			break;
+		}
+
+		now = latency_now();
+
+		for (i = 0; n > 0 && i < (unsigned int) n; i++) {
+			struct stream *stream = events[i].data.ptr;
+
+			if (stream->sk < 0)
+				continue;
+
+			if (events[i].events & EPOLLIN)
+				stream_recv(efd, stream, rx_buf);
+
+			if (stream->sk < 0)
+				continue;
+
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				stream_close(efd, stream);
+				continue;
+			}
+
+			if (events[i].events & EPOLLOUT)
+				stream_set_blocked(efd, stream, false, now);
+		}
+
+		for (i = 0; i < num; i++) {
+			struct stream *stream = &streams[i];
+
+			if (stream->sk >= 0 && !stream->blocked)
+				stream_send(efd, stream, now);
+		}
+
+		if (now - last_report >= 1000000000ULL) {
+			streams_report(streams, num, now - last_report, false);
+			last_report = now;
+		}
+	}
+
+	now = latency_now();
+
+	for (i = 0; i < num; i++) {
+		if (streams[i].blocked)
+			stream_set_blocked(efd, &streams[i], false, now);
+	}
+
+	streams_report(streams, num, now - start, true);
+
+	for (i = 0; i < num; i++) {
+		if (streams[i].sk >= 0)
+			close(streams[i].sk);
+	}
+
+	close(efd);
+	free(rx_buf);
+	free(streams);
+}
+
 static void reconnect_mode(char *svr)
 {
 	while (1) {
@@ -1314,7 +1830,10 @@ static void usage(void)
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
 		"\t-p trigger dedicated bonding\n"
-		"\t-z information request\n");
+		"\t-z information request\n"
+		"\t-j listen and echo incoming data\n"
+		"\t-k connect, then send and time the echoes\n"
+		"\t-o connect -C channels to each peer and stream on all\n");
 
 	printf("Options:\n"
 		"\t[-b bytes] [-i device] [-P psm] [-J cid]\n"
@@ -1323,7 +1842,8 @@ static void usage(void)
 		"\t[-W seconds] enable deferred setup\n"
 		"\t[-B filename] use data packets from file\n"
 		"\t[-N num] send num frames (default = infinite)\n"
-		"\t[-C num] send num frames before delay (default = 1)\n"
+		"\t[-C num] send num frames before delay (default = 1),\n"
+		"\t\tor open num channels to each peer in streams mode\n"
 		"\t[-D milliseconds] delay after sending num frames (default = 0)\n"
 		"\t[-K milliseconds] delay before receiving (default = 0)\n"
 		"\t[-g milliseconds] delay before disconnecting (default = 0)\n"
@@ -1342,6 +1862,9 @@ static void usage(void)
 		"\t[-S] secure connection\n"
 		"\t[-M] become master\n"
 		"\t[-T] enable timestamps\n"
+		"\t[-l] embed send time and report latency and jitter\n"
+		"\t[-f rate[:size],...] SDUs per second and SDU size of\n"
+		"\t\tthe channels in streams mode (default = 0, unlimited)\n"
 		"\t[-V type] address type (help for list, default = bredr)\n"
 		"\t[-e seq] initial sequence value (default = 0)\n");
 }
@@ -1353,7 +1876,7 @@ int main(int argc, char *argv[])
 
 	bacpy(&bdaddr, BDADDR_ANY);
 
-	while ((opt = getopt(argc, argv, "a:b:cde:g:i:mnpqrstuwxyz"
+	while ((opt = getopt(argc, argv, "a:b:cde:f:g:i:jklmnopqrstuwxyz"
 		"AB:C:D:EF:GH:I:J:K:L:MN:O:P:Q:RSTUV:W:X:Y:Z:")) != EOF) {
 		switch (opt) {
 		case 'r':
@@ -1420,6 +1943,20 @@ int main(int argc, char *argv[])
 			need_addr = 1;
 			break;
 
+		case 'j':
+			mode = ECHO;
+			break;
+
+		case 'k':
+			mode = ROUNDTRIP;
+			need_addr = 1;
+			break;
+
+		case 'o':
+			mode = STREAMS;
+			need_addr = 1;
+			break;
+
 		case 'b':
 			data_size = atoi(optarg);
 			break;
@@ -1533,6 +2070,17 @@ int main(int argc, char *argv[])
 			timestamp = 1;
 			break;
 
+		case 'l':
+			latency = 1;
+			break;
+
+		case 'f':
+			if (!parse_stream_specs(optarg)) {
+				fprintf(stderr, "Invalid stream rates\n");
+				exit(1);
+			}
+			break;
+
 		case 'Q':
 			max_transmit = atoi(optarg);
 			break;
@@ -1591,6 +2139,11 @@ int main(int argc, char *argv[])
 	else
 		buffer_size = data_size;
 
+	for (opt = 0; opt < num_stream_specs; opt++) {
+		if (stream_specs[opt].size > buffer_size)
+			buffer_size = stream_specs[opt].size;
+	}
+
 	if (!(buf = malloc(buffer_size))) {
 		perror("Can't allocate data buffer");
 		exit(1);
@@ -1672,6 +2225,21 @@ int main(int argc, char *argv[])
 		case PAIRING:
 			do_pairing(argv[optind]);
 			exit(0);
+
+		case ECHO:
+			do_listen(echo_mode);
+			break;
+
+		case ROUNDTRIP:
+			sk = do_connect(argv[optind]);
+			if (sk < 0)
+				exit(1);
+			roundtrip_mode(sk);
+			break;
+
+		case STREAMS:
+			streams_mode(argc - optind, argv + optind);
+			break;
 	}
 
 	syslog(LOG_INFO, "Exit");
@@ -0,0 +1,290 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "src/shared/util.h"
+#include "latency.h"
+
+#define HALF_BUCKETS	(LATENCY_SUB_BUCKETS / 2)
+
+uint64_t latency_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned int bucket_index(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < LATENCY_SUB_BUCKETS)
+		return value;
+
+	/* Keep the top LATENCY_SUB_BITS bits of the value */
+	shift = 63 - __builtin_clzll(value) - (LATENCY_SUB_BITS - 1);
+
+	return LATENCY_SUB_BUCKETS + (shift - 1) * HALF_BUCKETS +
+					(value >> shift) - HALF_BUCKETS;
+}
+
+/* Middle of the range of values counted by a bucket */
+static uint64_t bucket_value(unsigned int index)
+{
+	unsigned int shift;
+	uint64_t low;
+
+	if (index < LATENCY_SUB_BUCKETS)
+		return index;
+
+	index -= LATENCY_SUB_BUCKETS;
+	shift = index / HALF_BUCKETS + 1;
+	low = (uint64_t) (HALF_BUCKETS + index % HALF_BUCKETS) << shift;
+
+	return low + (((uint64_t) 1 << shift) >> 1);
+}
+
+void latency_hist_init(struct latency_hist *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+
+	hist->min = UINT64_MAX;
+}
+
+void latency_hist_add(struct latency_hist *hist, uint64_t value)
+{
+	hist->counts[bucket_index(value)]++;
+	hist->total++;
+	hist->sum += value;
+
+	if (value < hist->min)
+		hist->min = value;
+
+	if (value > hist->max)
+		hist->max = value;
+}
+
+uint64_t latency_hist_percentile(const struct latency_hist *hist,
+							double percentile)
+{
+	uint64_t target, seen = 0;
+	unsigned int i;
+
+	if (!hist->total)
+		return 0;
+
+	target = hist->total * percentile / 100.0 + 0.5;
+	if (target < 1)
+		target = 1;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen < target)
+			continue;
+
+		/* The exact extremes are known, never report beyond them */
+		if (bucket_value(i) < hist->min)
+			return hist->min;
+
+		if (bucket_value(i) > hist->max || seen == hist->total)
+			return hist->max;
+
+		return bucket_value(i);
+	}
+
+	return hist->max;
+}
+
+void latency_hist_report(const struct latency_hist *hist, const char *label)
+{
+	if (!hist->total)
+		return;
+
+	syslog(LOG_INFO, "%s latency: min %.1f avg %.1f p50 %.1f p99 %.1f "
+			"p99.9 %.1f max %.1f us (%llu samples)", label,
+			hist->min / 1000.0,
+			(double) hist->sum / hist->total / 1000.0,
+			latency_hist_percentile(hist, 50.0) / 1000.0,
+			latency_hist_percentile(hist, 99.0) / 1000.0,
+			latency_hist_percentile(hist, 99.9) / 1000.0,
+			hist->max / 1000.0, (unsigned long long) hist->total);
+}
+
+void latency_jitter_init(struct latency_jitter *jitter)
+{
+	memset(jitter, 0, sizeof(*jitter));
+}
+
+void latency_jitter_update(struct latency_jitter *jitter, uint64_t sent,
+							uint64_t received)
+{
+	int64_t transit = received - sent;
+	uint64_t diff;
+
+	if (!jitter->valid) {
+		jitter->valid = true;
+		jitter->last_transit = transit;
+		return;
+	}
+
+	if (transit > jitter->last_transit)
+		diff = transit - jitter->last_transit;
+	else
+		diff = jitter->last_transit - transit;
+
+	jitter->last_transit = transit;
+
+	/*
+	 * Kept scaled by 16 so the 1/16 gain can be applied with integer
+	 * arithmetic, like the reference implementation does.
+	 */
+	jitter->jitter += diff - ((jitter->jitter + 8) >> 4);
+}
+
+uint64_t latency_jitter_get(const struct latency_jitter *jitter)
+{
+	return jitter->jitter >> 4;
+}
+
+void latency_echo(int sk, uint8_t *buf, long size)
+{
+	ssize_t len;
+
+	syslog(LOG_INFO, "Echoing ...");
+
+	while ((len = recv(sk, buf, size, 0)) > 0) {
+		if (send(sk, buf, len, 0) != len) {
+			syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+			return;
+		}
+	}
+
+	if (len < 0)
+		syslog(LOG_ERR, "Read failed: %s (%d)", strerror(errno), errno);
+}
+
+void latency_roundtrip(int sk, uint8_t *buf,
+				const struct latency_roundtrip *rt)
+{
+	struct latency_hist hist;
+	struct pollfd p;
+	uint64_t now, last_report;
+	unsigned int lost = 0;
+	long frames = rt->num_frames;
+	unsigned long sent = 0;
+	uint32_t seq = rt->seq;
+	char label[32];
+	ssize_t len;
+	int ret;
+
+	if (rt->data_size < LATENCY_HDR_SIZE) {
+		syslog(LOG_ERR, "Frames of %ld bytes can't hold timestamps",
+								rt->data_size);
+		return;
+	}
+
+	snprintf(label, sizeof(label), "%s round trip", rt->mode);
+
+	latency_hist_init(&hist);
+
+	p.fd = sk;
+	p.events = POLLIN | POLLERR | POLLHUP;
+
+	syslog(LOG_INFO, "Measuring round trip ...");
+
+	last_report = latency_now();
+
+	while ((frames == -1) || (frames-- > 0)) {
+		memset(buf + LATENCY_HDR_SIZE, 0x7f,
+					rt->data_size - LATENCY_HDR_SIZE);
+
+		put_le32(seq, buf);
+		put_le16(rt->data_size, buf + 4);
+		put_le64(latency_now(), buf + LATENCY_STAMP_OFFSET);
+
+		if (send(sk, buf, rt->data_size, 0) != rt->data_size) {
+			syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+			break;
+		}
+
+		/* Wait for the echo of this frame, skipping late ones */
+		while (1) {
+			p.revents = 0;
+			ret = poll(&p, 1, 1000);
+			if (ret < 0 || (p.revents & (POLLERR | POLLHUP)))
+				goto done;
+
+			if (!ret) {
+				lost++;
+				break;
+			}
+
+			len = recv(sk, buf, rt->data_size, rt->recv_flags);
+			if (len <= 0)
+				goto done;
+
+			if (len < LATENCY_HDR_SIZE || get_le32(buf) != seq)
+				continue;
+
+			now = latency_now();
+			latency_hist_add(&hist, now -
+				get_le64(buf + LATENCY_STAMP_OFFSET));
+			break;
+		}
+
+		seq++;
+		sent++;
+
+		now = latency_now();
+		if (now - last_report >= 1000000000) {
+			latency_hist_report(&hist, label);
+			last_report = now;
+		}
+
+		if (frames && rt->delay && rt->count > 0 &&
+						!(sent % rt->count))
+			usleep(rt->delay);
+	}
+
+done:
+	latency_hist_report(&hist, label);
+
+	if (lost)
+		syslog(LOG_INFO, "%s: %u frames without echo", rt->mode, lost);
+}
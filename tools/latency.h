@@ -0,0 +1,83 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Log-linear histogram: values below LATENCY_SUB_BUCKETS are counted
+ * exactly, larger ones in LATENCY_SUB_BUCKETS / 2 steps per power of two,
+ * which keeps the error of any reported value below 2%.
+ */
+#define LATENCY_SUB_BITS	6
+#define LATENCY_SUB_BUCKETS	(1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS		(LATENCY_SUB_BUCKETS + \
+			(64 - LATENCY_SUB_BITS) * (LATENCY_SUB_BUCKETS / 2))
+
+/* Monotonic send time embedded in test frames after sequence and length */
+#define LATENCY_STAMP_OFFSET	6
+#define LATENCY_STAMP_SIZE	8
+#define LATENCY_HDR_SIZE	(LATENCY_STAMP_OFFSET + LATENCY_STAMP_SIZE)
+
+struct latency_hist {
+	uint64_t counts[LATENCY_BUCKETS];
+	uint64_t total;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+/* Interarrival jitter as defined by RFC 3550, section 6.4.1 */
+struct latency_jitter {
+	bool valid;
+	int64_t last_transit;
+	uint64_t jitter;
+};
+
+/* Frame exchange driven by latency_roundtrip() */
+struct latency_roundtrip {
+	const char *mode;		/* Channel mode prefixing the reports */
+	long data_size;
+	long num_frames;		/* -1 for no limit */
+	uint32_t seq;			/* Sequence number of the first frame */
+	int recv_flags;
+	int count;			/* Pause after every count frames */
+	unsigned long delay;		/* Pause length in microseconds */
+};
+
+uint64_t latency_now(void);
+
+void latency_echo(int sk, uint8_t *buf, long size);
+void latency_roundtrip(int sk, uint8_t *buf,
+				const struct latency_roundtrip *rt);
+
+void latency_hist_init(struct latency_hist *hist);
+void latency_hist_add(struct latency_hist *hist, uint64_t value);
+uint64_t latency_hist_percentile(const struct latency_hist *hist,
+							double percentile);
+void latency_hist_report(const struct latency_hist *hist, const char *label);
+
+void latency_jitter_init(struct latency_jitter *jitter);
+void latency_jitter_update(struct latency_jitter *jitter, uint64_t sent,
+							uint64_t received);
+uint64_t latency_jitter_get(const struct latency_jitter *jitter);
@@ -62,9 +62,68 @@ struct test_data {
 	uint16_t mgmt_index;
 	struct hciemu *hciemu;
 	enum hciemu_type hciemu_type;
+	uint8_t num_clients;
+	uint8_t clients_ready;
+	uint8_t num_connected;
+	uint8_t num_disconnected;
 	int unmet_conditions;
 };
 
+struct generic_data {
+	const uint16_t *setup_settings;
+	bool setup_nobredr;
+	bool setup_limited_discov;
+	uint16_t setup_expect_hci_command;
+	const void *setup_expect_hci_param;
+	uint8_t setup_expect_hci_len;
+	uint16_t setup_send_opcode;
+	const void *setup_send_param;
+	uint16_t setup_send_len;
+	bool send_index_none;
+	uint16_t send_opcode;
+	const void *send_param;
+	uint16_t send_len;
+	const void * (*send_func)(uint16_t *len);
+	uint8_t expect_status;
+	bool expect_ignore_param;
+	const void *expect_param;
+	uint16_t expect_len;
+	const void * (*expect_func)(uint16_t *len);
+	uint32_t expect_settings_set;
+	uint32_t expect_settings_unset;
+	uint16_t expect_alt_ev;
+	const void *expect_alt_ev_param;
+	bool (*verify_alt_ev_func)(const void *param, uint16_t length);
+	uint16_t expect_alt_ev_len;
+	uint16_t expect_hci_command;
+	const void *expect_hci_param;
+	uint8_t expect_hci_len;
+	const void * (*expect_hci_func)(uint8_t *len);
+	bool expect_pin;
+	uint8_t pin_len;
+	const void *pin;
+	uint8_t client_pin_len;
+	const void *client_pin;
+	bool client_enable_ssp;
+	uint8_t io_cap;
+	uint8_t client_io_cap;
+	uint8_t client_auth_req;
+	bool reject_confirm;
+	bool client_reject_confirm;
+	bool just_works;
+	bool client_enable_le;
+	bool client_enable_sc;
+	bool client_enable_adv;
+	bool expect_sc_key;
+	bool force_power_off;
+	bool addr_type_avail;
+	uint8_t addr_type;
+	bool set_adv;
+	const uint8_t *adv_data;
+	uint8_t adv_data_len;
+	uint8_t num_clients;
+};
+
 static void mgmt_debug(const char *str, void *user_data)
 {
 	const char *prefix = user_data;
@@ -105,6 +164,16 @@ static void read_commands_callback(uint8_t status, uint16_t length,
 	}
 }
 
+static void client_ready(void)
+{
+	struct test_data *data = tester_get_data();
+
+	if (++data->clients_ready < data->num_clients)
+		return;
+
+	tester_pre_setup_complete();
+}
+
 static void read_info_callback(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -113,7 +182,8 @@ static void read_info_callback(uint8_t status, uint16_t length,
 	char addr[18];
 	uint16_t manufacturer;
 	uint32_t supported_settings, current_settings;
-	struct bthost *bthost;
+	struct hciemu_client *client;
+	int i;
 
 	tester_print("Read Info callback");
 	tester_print("  Status: %s (0x%02x)", mgmt_errstr(status), status);
@@ -169,8 +239,10 @@ static void read_info_callback(uint8_t status, uint16_t length,
 		return;
 	}
 
-	bthost = hciemu_client_get_host(data->hciemu);
-	bthost_notify_ready(bthost, tester_pre_setup_complete);
+	data->clients_ready = 0;
+
+	for (i = 0; (client = hciemu_get_client(data->hciemu, i)); i++)
+		bthost_notify_ready(hciemu_client_host(client), client_ready);
 }
 
 static void index_added_callback(uint16_t index, uint16_t length,
@@ -214,6 +286,7 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
 	struct test_data *data = tester_get_data();
+	const struct generic_data *test = data->test_data;
 
 	tester_print("Read Index List callback");
 	tester_print("  Status: %s (0x%02x)", mgmt_errstr(status), status);
@@ -223,17 +296,22 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 		return;
 	}
 
-	mgmt_register(data->mgmt, MGMT_EV_INDEX_ADDED, MGMT_INDEX_NONE,
-					index_added_callback, NULL, NULL);
-
 	mgmt_register(data->mgmt, MGMT_EV_INDEX_REMOVED, MGMT_INDEX_NONE,
 					index_removed_callback, NULL, NULL);
 
-	data->hciemu = hciemu_new(data->hciemu_type);
+	data->num_clients = 1;
+	if (test && test->num_clients)
+		data->num_clients = test->num_clients;
+
+	data->hciemu = hciemu_new_num(data->hciemu_type, data->num_clients);
 	if (!data->hciemu) {
 		tester_warn("Failed to setup HCI emulation");
 		tester_pre_setup_failed();
+		return;
 	}
+
+	hciemu_register_index_added(data->hciemu, data->mgmt,
+					index_added_callback, NULL);
 }
 
 static void test_pre_setup(const void *test_data)
@@ -384,60 +462,6 @@ static void controller_setup(const void *test_data)
 	tester_test_passed();
 }
 
-struct generic_data {
-	const uint16_t *setup_settings;
-	bool setup_nobredr;
-	bool setup_limited_discov;
-	uint16_t setup_expect_hci_command;
-	const void *setup_expect_hci_param;
-	uint8_t setup_expect_hci_len;
-	uint16_t setup_send_opcode;
-	const void *setup_send_param;
-	uint16_t setup_send_len;
-	bool send_index_none;
-	uint16_t send_opcode;
-	const void *send_param;
-	uint16_t send_len;
-	const void * (*send_func)(uint16_t *len);
-	uint8_t expect_status;
-	bool expect_ignore_param;
-	const void *expect_param;
-	uint16_t expect_len;
-	const void * (*expect_func)(uint16_t *len);
-	uint32_t expect_settings_set;
-	uint32_t expect_settings_unset;
-	uint16_t expect_alt_ev;
-	const void *expect_alt_ev_param;
-	bool (*verify_alt_ev_func)(const void *param, uint16_t length);
-	uint16_t expect_alt_ev_len;
-	uint16_t expect_hci_command;
-	const void *expect_hci_param;
-	uint8_t expect_hci_len;
-	const void * (*expect_hci_func)(uint8_t *len);
-	bool expect_pin;
-	uint8_t pin_len;
-	const void *pin;
-	uint8_t client_pin_len;
-	const void *client_pin;
-	bool client_enable_ssp;
-	uint8_t io_cap;
-	uint8_t client_io_cap;
-	uint8_t client_auth_req;
-	bool reject_confirm;
-	bool client_reject_confirm;
-	bool just_works;
-	bool client_enable_le;
-	bool client_enable_sc;
-	bool client_enable_adv;
-	bool expect_sc_key;
-	bool force_power_off;
-	bool addr_type_avail;
-	uint8_t addr_type;
-	bool set_adv;
-	const uint8_t *adv_data;
-	uint8_t adv_data_len;
-};
-
 static const char dummy_data[] = { 0x00 };
 
 static const struct generic_data invalid_command_test = {
@@ -3683,6 +3707,11 @@ static const struct generic_data get_conn_info_succes1_test = {
 	.expect_func = get_conn_info_expect_param_func,
 };
 
+static const struct generic_data connect_multi_test = {
+	.setup_settings = settings_powered_connectable_bondable,
+	.num_clients = 16,
+};
+
 static const struct generic_data get_conn_info_ncon_test = {
 	.setup_settings = settings_powered_connectable_bondable_ssp,
 	.send_opcode = MGMT_OP_GET_CONN_INFO,
@@ -6120,6 +6149,126 @@ static void test_command_generic_connect(const void *test_data)
 	bthost_hci_connect(bthost, master_bdaddr, addr_type);
 }
 
+static bool is_client_addr(struct test_data *data, const bdaddr_t *bdaddr)
+{
+	struct hciemu_client *client;
+	int i;
+
+	for (i = 0; (client = hciemu_get_client(data->hciemu, i)); i++) {
+		if (!memcmp(hciemu_client_bdaddr(client), bdaddr, 6))
+			return true;
+	}
+
+	return false;
+}
+
+static void multi_disconnected_event(uint16_t index, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct test_data *data = tester_get_data();
+	const struct mgmt_ev_device_disconnected *ev = param;
+	char addr[18];
+
+	if (length != sizeof(*ev)) {
+		tester_warn("Invalid disconnected event length");
+		tester_test_failed();
+		return;
+	}
+
+	ba2str(&ev->addr.bdaddr, addr);
+	tester_print("Device %s disconnected, reason %u", addr, ev->reason);
+
+	if (!is_client_addr(data, &ev->addr.bdaddr) ||
+				ev->reason != MGMT_DEV_DISCONN_LOCAL_HOST) {
+		tester_test_failed();
+		return;
+	}
+
+	if (++data->num_disconnected < data->num_clients)
+		return;
+
+	tester_test_passed();
+}
+
+static void disconnect_multi_callback(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	if (status != MGMT_STATUS_SUCCESS) {
+		tester_warn("Disconnect failed: %s", mgmt_errstr(status));
+		tester_test_failed();
+	}
+}
+
+static void multi_connected_event(uint16_t index, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct test_data *data = tester_get_data();
+	const struct mgmt_ev_device_connected *ev = param;
+	struct hciemu_client *client;
+	char addr[18];
+	int i;
+
+	if (length < sizeof(*ev)) {
+		tester_warn("Invalid connected event length");
+		tester_test_failed();
+		return;
+	}
+
+	ba2str(&ev->addr.bdaddr, addr);
+	tester_print("Device %s connected", addr);
+
+	if (!is_client_addr(data, &ev->addr.bdaddr)) {
+		tester_test_failed();
+		return;
+	}
+
+	if (++data->num_connected < data->num_clients)
+		return;
+
+	/* Only take the links down once all of them are up */
+	for (i = 0; (client = hciemu_get_client(data->hciemu, i)); i++) {
+		struct mgmt_cp_disconnect cp;
+
+		memset(&cp, 0, sizeof(cp));
+		memcpy(&cp.addr.bdaddr, hciemu_client_bdaddr(client), 6);
+		cp.addr.type = BDADDR_BREDR;
+
+		mgmt_send(data->mgmt, MGMT_OP_DISCONNECT, data->mgmt_index,
+						sizeof(cp), &cp,
+						disconnect_multi_callback,
+						NULL, NULL);
+	}
+}
+
+static void test_connect_multi(const void *test_data)
+{
+	struct test_data *data = tester_get_data();
+	struct hciemu_client *client;
+	const uint8_t *master_bdaddr;
+	int i;
+
+	data->num_connected = 0;
+	data->num_disconnected = 0;
+
+	mgmt_register(data->mgmt_alt, MGMT_EV_DEVICE_CONNECTED,
+				data->mgmt_index, multi_connected_event,
+				NULL, NULL);
+	mgmt_register(data->mgmt_alt, MGMT_EV_DEVICE_DISCONNECTED,
+				data->mgmt_index, multi_disconnected_event,
+				NULL, NULL);
+
+	master_bdaddr = hciemu_get_master_bdaddr(data->hciemu);
+	if (!master_bdaddr) {
+		tester_warn("No master bdaddr");
+		tester_test_failed();
+		return;
+	}
+
+	for (i = 0; (client = hciemu_get_client(data->hciemu, i)); i++)
+		bthost_hci_connect(hciemu_client_host(client), master_bdaddr,
+								BDADDR_BREDR);
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -6876,6 +7025,10 @@ int main(int argc, char *argv[])
 				&get_conn_info_power_off_test, NULL,
 				test_command_generic_connect);
 
+	test_bredrle_full("Device Connected/Disconnected - 16 Clients",
+				&connect_multi_test, NULL,
+				test_connect_multi, 10);
+
 	test_bredrle("Load Connection Parameters - Invalid Params 1",
 				&load_conn_params_fail_1,
 				NULL, test_command_generic);
@@ -35,6 +35,7 @@
 #include <getopt.h>
 #include <syslog.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -48,6 +49,7 @@
 #include "lib/sdp_lib.h"
 
 #include "src/shared/util.h"
+#include "tools/latency.h"
 
 /* Test modes */
 enum {
@@ -60,6 +62,8 @@ enum {
 	CRECV,
 	LSEND,
 	AUTO,
+	ECHO,
+	ROUNDTRIP,
 };
 
 static unsigned char *buf;
@@ -91,6 +95,7 @@ static int secure = 0;
 static int socktype = SOCK_STREAM;
 static int linger = 0;
 static int timestamp = 0;
+static int latency = 0;
 static int defer_setup = 0;
 static int priority = -1;
 
@@ -479,13 +484,24 @@ done:
 static void recv_mode(int sk)
 {
 	struct timeval tv_beg, tv_end, tv_diff;
+	struct latency_hist hist;
+	struct latency_jitter jitter;
 	char ts[30];
 	long total;
+	int flags = 0;
 
 	syslog(LOG_INFO, "Receiving ...");
 
 	memset(ts, 0, sizeof(ts));
 
+	if (latency) {
+		latency_hist_init(&hist);
+		latency_jitter_init(&jitter);
+
+		/* RFCOMM is a stream, so reassemble whole frames */
+		flags = MSG_WAITALL;
+	}
+
 	while (1) {
 		gettimeofday(&tv_beg,NULL);
 		total = 0;
@@ -494,7 +510,7 @@ static void recv_mode(int sk)
 			//uint16_t l;
 			int r;
 
-			if ((r = recv(sk, buf, data_size, 0)) < 0) {
+			if ((r = recv(sk, buf, data_size, flags)) < 0) {
 				if (r < 0)
 					syslog(LOG_ERR, "Read failed: %s (%d)",
 							strerror(errno), errno);
@@ -535,6 +551,16 @@ static void recv_mode(int sk)
 					syslog(LOG_INFO, "data missmatch: byte %d 0x%2.2x", i, buf[i]);
 			}
 #endif
+			if (latency && r >= LATENCY_HDR_SIZE) {
+				uint64_t sent, now = latency_now();
+
+				sent = get_le64(buf + LATENCY_STAMP_OFFSET);
+				if (now >= sent)
+					latency_hist_add(&hist, now - sent);
+
+				latency_jitter_update(&jitter, sent, now);
+			}
+
 			total += r;
 		}
 		gettimeofday(&tv_end,NULL);
@@ -543,6 +569,12 @@ static void recv_mode(int sk)
 
 		syslog(LOG_INFO,"%s%ld bytes in %.2f sec, %.2f kB/s", ts, total,
 			tv2fl(tv_diff), (float)(total / tv2fl(tv_diff) ) / 1024.0);
+
+		if (latency) {
+			latency_hist_report(&hist, "rfcomm");
+			syslog(LOG_INFO, "rfcomm jitter: %.1f us",
+					latency_jitter_get(&jitter) / 1000.0);
+		}
 	}
 }
 
@@ -569,11 +601,20 @@ static void do_send(int sk)
 			buf[i] = 0x7f;
 	}
 
+	if (latency && data_size < LATENCY_HDR_SIZE) {
+		syslog(LOG_ERR, "Frames of %ld bytes can't hold timestamps",
+								data_size);
+		exit(1);
+	}
+
 	seq = 0;
 	while ((num_frames == -1) || (num_frames-- > 0)) {
 		put_le32(seq, buf);
 		put_le16(data_size, buf + 4);
 
+		if (latency)
+			put_le64(latency_now(), buf + LATENCY_STAMP_OFFSET);
+
 		seq++;
 
 		if (send(sk, buf, data_size, 0) <= 0) {
@@ -599,6 +640,26 @@ static void send_mode(int sk)
 	close(sk);
 }
 
+static void echo_mode(int sk)
+{
+	latency_echo(sk, buf, data_size);
+}
+
+static void roundtrip_mode(int sk)
+{
+	struct latency_roundtrip rt;
+
+	memset(&rt, 0, sizeof(rt));
+	rt.mode = "rfcomm";
+	rt.data_size = data_size;
+	rt.num_frames = num_frames;
+	rt.recv_flags = MSG_WAITALL;
+	rt.count = count;
+	rt.delay = delay;
+
+	latency_roundtrip(sk, buf, &rt);
+}
+
 static void reconnect_mode(char *svr)
 {
 	while(1) {
@@ -679,7 +740,9 @@ static void usage(void)
 		"\t-n connect and be silent\n"
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
-		"\t-a automated test (receive hcix as parameter)\n");
+		"\t-a automated test (receive hcix as parameter)\n"
+		"\t-j listen and echo incoming data\n"
+		"\t-k connect, then send and time the echoes\n");
 
 	printf("Options:\n"
 		"\t[-b bytes] [-i device] [-P channel] [-U uuid]\n"
@@ -695,7 +758,8 @@ static void usage(void)
 		"\t[-E] request encryption\n"
 		"\t[-S] secure connection\n"
 		"\t[-M] become master\n"
-		"\t[-T] enable timestamps\n");
+		"\t[-T] enable timestamps\n"
+		"\t[-l] embed send time and report latency and jitter\n");
 }
 
 int main(int argc, char *argv[])
@@ -706,7 +770,8 @@ int main(int argc, char *argv[])
 	bacpy(&bdaddr, BDADDR_ANY);
 	bacpy(&auto_bdaddr, BDADDR_ANY);
 
-	while ((opt=getopt(argc,argv,"rdscuwmna:b:i:P:U:B:O:N:MAESL:W:C:D:Y:T")) != EOF) {
+	while ((opt = getopt(argc, argv, "rdscuwmnjkla:b:i:P:U:B:O:N:"
+					"MAESL:W:C:D:Y:T")) != EOF) {
 		switch (opt) {
 		case 'r':
 			mode = RECV;
@@ -745,6 +810,19 @@ int main(int argc, char *argv[])
 			need_addr = 1;
 			break;
 
+		case 'j':
+			mode = ECHO;
+			break;
+
+		case 'k':
+			mode = ROUNDTRIP;
+			need_addr = 1;
+			break;
+
+		case 'l':
+			latency = 1;
+			break;
+
 		case 'a':
 			mode = AUTO;
 
@@ -901,6 +979,17 @@ int main(int argc, char *argv[])
 		case AUTO:
 			automated_send_recv();
 			break;
+
+		case ECHO:
+			do_listen(echo_mode);
+			break;
+
+		case ROUNDTRIP:
+			sk = do_connect(argv[optind]);
+			if (sk < 0)
+				exit(1);
+			roundtrip_mode(sk);
+			break;
 	}
 
 	syslog(LOG_INFO, "Exit");
@@ -150,9 +150,6 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 		return;
 	}
 
-	mgmt_register(data->mgmt, MGMT_EV_INDEX_ADDED, MGMT_INDEX_NONE,
-					index_added_callback, NULL, NULL);
-
 	mgmt_register(data->mgmt, MGMT_EV_INDEX_REMOVED, MGMT_INDEX_NONE,
 					index_removed_callback, NULL, NULL);
 
@@ -163,6 +160,9 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 		return;
 	}
 
+	hciemu_register_index_added(data->hciemu, data->mgmt,
+					index_added_callback, NULL);
+
 	tester_print("New hciemu instance created");
 
 	if (data->disable_esco) {
@@ -0,0 +1,242 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "src/shared/tester.h"
+#include "obexd/plugins/file-copy.h"
+
+#define FILE_SIZE	(5 * 1024 * 1024 + 123)
+#define PIPE_SIZE	(48 * 1024)
+
+struct test_data {
+	size_t size;
+	bool use_pipe;
+	bool cancel;
+};
+
+struct copy_data {
+	const struct test_data *test;
+	struct file_copy *copy;
+	char src[32];
+	char dst[32];
+	uint8_t *buf;
+	uint64_t copied;
+	unsigned int progress;
+	int complete;
+	guint timeout;
+};
+
+static void fill_buffer(uint8_t *buf, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = (i * 31 + i / 4096) & 0xff;
+}
+
+static int create_source(struct copy_data *data)
+{
+	int fd;
+
+	fd = mkstemp(data->src);
+	g_assert(fd >= 0);
+
+	if (data->test->size > 0)
+		g_assert(write(fd, data->buf, data->test->size) ==
+						(ssize_t) data->test->size);
+
+	g_assert(lseek(fd, 0, SEEK_SET) == 0);
+
+	return fd;
+}
+
+static int create_pipe(struct copy_data *data)
+{
+	int fds[2];
+
+	g_assert(pipe(fds) == 0);
+
+	/* The data fits in the pipe buffer so it can be written upfront */
+	g_assert(write(fds[1], data->buf, data->test->size) ==
+						(ssize_t) data->test->size);
+	close(fds[1]);
+
+	return fds[0];
+}
+
+static void verify_destination(struct copy_data *data)
+{
+	struct stat st;
+	uint8_t *buf;
+	int fd;
+
+	fd = open(data->dst, O_RDONLY);
+	g_assert(fd >= 0);
+
+	g_assert(fstat(fd, &st) == 0);
+	g_assert_cmpuint(st.st_size, ==, data->test->size);
+
+	buf = g_malloc(data->test->size + 1);
+	g_assert(read(fd, buf, data->test->size) ==
+						(ssize_t) data->test->size);
+	g_assert(memcmp(buf, data->buf, data->test->size) == 0);
+	g_free(buf);
+
+	close(fd);
+}
+
+static void copy_data_free(struct copy_data *data)
+{
+	if (data->timeout > 0)
+		g_source_remove(data->timeout);
+
+	unlink(data->src);
+	unlink(data->dst);
+	g_free(data->buf);
+	g_free(data);
+}
+
+static gboolean cancel_done(gpointer user_data)
+{
+	struct copy_data *data = user_data;
+
+	data->timeout = 0;
+
+	/* The complete callback must not run after a cancel */
+	g_assert_cmpint(data->complete, ==, 0);
+
+	copy_data_free(data);
+	tester_test_passed();
+
+	return FALSE;
+}
+
+static void copy_progress(uint64_t copied, uint64_t size, void *user_data)
+{
+	struct copy_data *data = user_data;
+
+	g_assert(copied > data->copied);
+	g_assert(copied <= data->test->size);
+
+	if (!data->test->use_pipe)
+		g_assert_cmpuint(size, ==, data->test->size);
+
+	data->copied = copied;
+	data->progress++;
+
+	if (data->test->cancel) {
+		file_copy_cancel(data->copy);
+		data->copy = NULL;
+		data->timeout = g_timeout_add(100, cancel_done, data);
+	}
+}
+
+static void copy_complete(int err, void *user_data)
+{
+	struct copy_data *data = user_data;
+
+	data->complete++;
+
+	g_assert_cmpint(err, ==, 0);
+	g_assert_cmpuint(data->copied, ==, data->test->size);
+
+	if (data->test->size > 0)
+		g_assert(data->progress > 0);
+	else
+		g_assert_cmpuint(data->progress, ==, 0);
+
+	verify_destination(data);
+
+	copy_data_free(data);
+	tester_test_passed();
+}
+
+static void test_copy(const void *test_data)
+{
+	const struct test_data *test = test_data;
+	struct copy_data *data;
+	int in_fd, out_fd;
+
+	data = g_new0(struct copy_data, 1);
+	data->test = test;
+	strcpy(data->src, "/tmp/copy-src-XXXXXX");
+	strcpy(data->dst, "/tmp/copy-dst-XXXXXX");
+	data->buf = g_malloc(test->size + 1);
+	fill_buffer(data->buf, test->size);
+
+	if (test->use_pipe)
+		in_fd = create_pipe(data);
+	else
+		in_fd = create_source(data);
+
+	out_fd = mkstemp(data->dst);
+	g_assert(out_fd >= 0);
+
+	data->copy = file_copy_start(in_fd, out_fd, copy_progress,
+						copy_complete, data);
+	g_assert(data->copy != NULL);
+}
+
+static const struct test_data copy_file = {
+	.size = FILE_SIZE,
+};
+
+static const struct test_data copy_empty = {
+	.size = 0,
+};
+
+static const struct test_data copy_pipe = {
+	.size = PIPE_SIZE,
+	.use_pipe = true,
+};
+
+static const struct test_data copy_cancel = {
+	.size = FILE_SIZE,
+	.cancel = true,
+};
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/file-copy/file", &copy_file, NULL, test_copy, NULL);
+	tester_add("/file-copy/empty", &copy_empty, NULL, test_copy, NULL);
+	tester_add("/file-copy/pipe", &copy_pipe, NULL, test_copy, NULL);
+	tester_add("/file-copy/cancel", &copy_cancel, NULL, test_copy, NULL);
+
+	return tester_run();
+}
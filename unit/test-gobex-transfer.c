@@ -35,6 +35,7 @@
 #include <fcntl.h>
 
 #include "gobex/gobex.h"
+#include "obexd/plugins/string-read.h"
 
 #include "util.h"
 
@@ -2334,6 +2335,352 @@ static void test_conn_put_req_seq_srm(void)
 	g_assert_no_error(d.err);
 }
 
+#define PHONEBOOK_CONTACTS 20000
+
+struct phonebook_pull {
+	struct test_data d;
+	gboolean cursor;
+	GString *buffer;
+	size_t offset;
+	GString *expected;
+	GString *received;
+};
+
+static void append_contact(GString *buffer, unsigned int id)
+{
+	g_string_append_printf(buffer, "BEGIN:VCARD\r\n"
+					"VERSION:3.0\r\n"
+					"N:Contact%u;Test;;;\r\n"
+					"FN:Test Contact%u\r\n"
+					"TEL;TYPE=CELL:+1555%07u\r\n"
+					"EMAIL:contact%u@example.com\r\n"
+					"END:VCARD\r\n",
+					id, id, id, id);
+}
+
+static gssize provide_phonebook(void *buf, gsize len, gpointer user_data)
+{
+	struct phonebook_pull *pb = user_data;
+	GString *buffer = pb->buffer;
+
+	if (pb->cursor)
+		return string_read(buffer, &pb->offset, buf, len);
+
+	/* Drop the consumed data on every packet, as obexd used to do */
+	len = MIN(buffer->len, len);
+	memcpy(buf, buffer->str, len);
+	g_string_erase(buffer, 0, len);
+
+	return len;
+}
+
+static gboolean rcv_phonebook(const void *buf, gsize len, gpointer user_data)
+{
+	struct phonebook_pull *pb = user_data;
+
+	g_string_append_len(pb->received, buf, len);
+
+	return TRUE;
+}
+
+static void phonebook_sent(GObex *obex, GError *err, gpointer user_data)
+{
+	struct phonebook_pull *pb = user_data;
+
+	if (err != NULL && pb->d.err == NULL)
+		pb->d.err = g_error_copy(err);
+}
+
+static void handle_get_phonebook(GObex *obex, GObexPacket *req,
+							gpointer user_data)
+{
+	struct phonebook_pull *pb = user_data;
+	guint id;
+
+	id = g_obex_get_rsp(obex, provide_phonebook, phonebook_sent, pb,
+					&pb->d.err, G_OBEX_HDR_INVALID);
+	if (id == 0)
+		g_main_loop_quit(pb->d.mainloop);
+}
+
+typedef void (*transfer_start_func) (GObex *client, gpointer user_data);
+
+/*
+ * Run a transfer between two GObex instances over a local stream socket
+ * and return how long it took, for the cases reporting a throughput.
+ */
+static double run_stream_transfer(struct test_data *d,
+					GObexRequestFunc handle_get,
+					transfer_start_func start,
+					gpointer user_data)
+{
+	GObex *server, *client;
+	guint timer_id;
+	double elapsed;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) < 0) {
+		g_printerr("socketpair: %s", strerror(errno));
+		abort();
+	}
+
+	server = create_gobex(sv[0], G_OBEX_TRANSPORT_STREAM, TRUE);
+	client = create_gobex(sv[1], G_OBEX_TRANSPORT_STREAM, TRUE);
+	g_assert(server != NULL && client != NULL);
+
+	d->mainloop = g_main_loop_new(NULL, FALSE);
+
+	timer_id = g_timeout_add_seconds(30, test_timeout, d);
+
+	g_obex_add_request_function(server, G_OBEX_OP_CONNECT,
+							handle_conn_rsp, d);
+	g_obex_add_request_function(server, G_OBEX_OP_GET, handle_get,
+								user_data);
+
+	g_test_timer_start();
+
+	start(client, user_data);
+	if (d->err == NULL)
+		g_main_loop_run(d->mainloop);
+
+	elapsed = g_test_timer_elapsed();
+
+	g_main_loop_unref(d->mainloop);
+
+	g_source_remove(timer_id);
+	g_obex_unref(client);
+	g_obex_unref(server);
+
+	return elapsed;
+}
+
+static void start_get_phonebook(GObex *client, gpointer user_data)
+{
+	struct phonebook_pull *pb = user_data;
+
+	g_obex_get_req(client, rcv_phonebook, transfer_complete, pb,
+				&pb->d.err, G_OBEX_HDR_TYPE, "x-bt/phonebook",
+				sizeof("x-bt/phonebook"), G_OBEX_HDR_INVALID);
+}
+
+static void test_stream_get_phonebook(gconstpointer data)
+{
+	struct phonebook_pull pb;
+	unsigned int i;
+	double elapsed;
+
+	memset(&pb, 0, sizeof(pb));
+	pb.cursor = GPOINTER_TO_INT(data);
+	pb.expected = g_string_new(NULL);
+	pb.received = g_string_new(NULL);
+
+	for (i = 0; i < PHONEBOOK_CONTACTS; i++)
+		append_contact(pb.expected, i);
+
+	pb.buffer = g_string_new_len(pb.expected->str, pb.expected->len);
+
+	elapsed = run_stream_transfer(&pb.d, handle_get_phonebook,
+						start_get_phonebook, &pb);
+
+	g_assert_no_error(pb.d.err);
+
+	assert_memequal(pb.expected->str, pb.expected->len,
+				pb.received->str, pb.received->len);
+
+	g_test_minimized_result(elapsed, "%s: %zu bytes in %.3f s",
+					pb.cursor ? "cursor" : "erase",
+					pb.expected->len, elapsed);
+
+	g_string_free(pb.buffer, TRUE);
+	g_string_free(pb.expected, TRUE);
+	g_string_free(pb.received, TRUE);
+}
+
+#define FILE_SIZE (16 * 1024 * 1024)
+
+struct file_pull {
+	struct test_data d;
+	int fd;
+	gsize sent;
+	gsize received;
+};
+
+static gssize provide_file_data(void *buf, gsize len, gpointer user_data)
+{
+	struct file_pull *pull = user_data;
+	gssize ret;
+
+	ret = read(pull->fd, buf, len);
+	if (ret < 0)
+		return -errno;
+
+	pull->sent += ret;
+
+	return ret;
+}
+
+static gssize provide_file_fd(int *fd, gsize len, gpointer user_data)
+{
+	struct file_pull *pull = user_data;
+
+	len = MIN(len, FILE_SIZE - pull->sent);
+
+	*fd = pull->fd;
+	pull->sent += len;
+
+	return len;
+}
+
+static gboolean rcv_file(const void *buf, gsize len, gpointer user_data)
+{
+	struct file_pull *pull = user_data;
+	const guint8 *data = buf;
+	gsize i;
+
+	/* The file holds the low byte of each offset */
+	for (i = 0; i < len; i++) {
+		if (data[i] != (guint8) (pull->received + i)) {
+			pull->d.err = g_error_new(TEST_ERROR,
+						TEST_ERROR_UNEXPECTED,
+						"Corrupted data at %zu",
+						pull->received + i);
+			g_main_loop_quit(pull->d.mainloop);
+			return FALSE;
+		}
+	}
+
+	pull->received += len;
+
+	return TRUE;
+}
+
+static void file_sent(GObex *obex, GError *err, gpointer user_data)
+{
+	struct file_pull *pull = user_data;
+
+	if (err != NULL && pull->d.err == NULL)
+		pull->d.err = g_error_copy(err);
+}
+
+static void handle_get_file_data(GObex *obex, GObexPacket *req,
+							gpointer user_data)
+{
+	struct file_pull *pull = user_data;
+	GObexPacket *rsp;
+
+	rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE, G_OBEX_HDR_INVALID);
+
+	if (g_obex_get_rsp_pkt(obex, rsp, provide_file_data, file_sent, pull,
+							&pull->d.err) == 0)
+		g_main_loop_quit(pull->d.mainloop);
+}
+
+static void handle_get_file_fd(GObex *obex, GObexPacket *req,
+							gpointer user_data)
+{
+	struct file_pull *pull = user_data;
+	GObexPacket *rsp;
+
+	rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE, G_OBEX_HDR_INVALID);
+
+	if (g_obex_get_rsp_pkt_fd(obex, rsp, provide_file_fd, file_sent,
+						pull, &pull->d.err) == 0)
+		g_main_loop_quit(pull->d.mainloop);
+}
+
+static void file_connected(GObex *obex, GError *err, GObexPacket *rsp,
+							gpointer user_data)
+{
+	struct file_pull *pull = user_data;
+
+	/* Connecting negotiates a larger MTU than the 255 bytes default */
+	if (err != NULL) {
+		pull->d.err = g_error_copy(err);
+		g_main_loop_quit(pull->d.mainloop);
+		return;
+	}
+
+	if (g_obex_get_req(obex, rcv_file, transfer_complete, pull,
+				&pull->d.err, G_OBEX_HDR_NAME, "file.bin",
+				G_OBEX_HDR_INVALID) == 0)
+		g_main_loop_quit(pull->d.mainloop);
+}
+
+static int create_test_file(void)
+{
+	char path[] = "/tmp/gobex-transfer-XXXXXX";
+	guint8 buf[4096];
+	gsize i, written;
+	int fd;
+
+	fd = mkstemp(path);
+	g_assert(fd >= 0);
+	unlink(path);
+
+	for (written = 0; written < FILE_SIZE; written += sizeof(buf)) {
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = (guint8) (written + i);
+
+		g_assert(write(fd, buf, sizeof(buf)) == sizeof(buf));
+	}
+
+	g_assert(lseek(fd, 0, SEEK_SET) == 0);
+
+	return fd;
+}
+
+static void start_get_file(GObex *client, gpointer user_data)
+{
+	struct file_pull *pull = user_data;
+
+	g_obex_connect(client, file_connected, pull, &pull->d.err,
+							G_OBEX_HDR_INVALID);
+}
+
+static void test_stream_get_file(gconstpointer data)
+{
+	gboolean use_fd = GPOINTER_TO_INT(data);
+	struct file_pull pull;
+	double elapsed;
+
+	memset(&pull, 0, sizeof(pull));
+	pull.fd = create_test_file();
+
+	elapsed = run_stream_transfer(&pull.d, use_fd ? handle_get_file_fd :
+						handle_get_file_data,
+						start_get_file, &pull);
+
+	close(pull.fd);
+
+	g_assert_no_error(pull.d.err);
+	g_assert_cmpuint(pull.received, ==, FILE_SIZE);
+
+	g_test_minimized_result(elapsed, "%s: %.1f MB/s",
+					use_fd ? "sendfile" : "copy",
+					FILE_SIZE / elapsed / (1024 * 1024));
+}
+
+static void test_stream_get_file_short(void)
+{
+	struct file_pull pull;
+
+	memset(&pull, 0, sizeof(pull));
+	pull.fd = create_test_file();
+
+	/* The producer keeps advertising bytes the file no longer has */
+	g_assert(ftruncate(pull.fd, FILE_SIZE / 2) == 0);
+
+	run_stream_transfer(&pull.d, handle_get_file_fd, start_get_file,
+									&pull);
+
+	close(pull.fd);
+
+	g_assert(pull.d.err != NULL);
+	g_assert_cmpuint(pull.received, <, FILE_SIZE);
+
+	g_error_free(pull.d.err);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -2407,5 +2754,19 @@ int main(int argc, char *argv[])
 	g_test_add_func("/gobex/test_conn_put_req_seq_srm",
 						test_conn_put_req_seq_srm);
 
+	g_test_add_data_func("/gobex/test_stream_get_phonebook_erase",
+				GINT_TO_POINTER(FALSE),
+				test_stream_get_phonebook);
+	g_test_add_data_func("/gobex/test_stream_get_phonebook_cursor",
+				GINT_TO_POINTER(TRUE),
+				test_stream_get_phonebook);
+
+	g_test_add_data_func("/gobex/test_stream_get_file_copy",
+				GINT_TO_POINTER(FALSE), test_stream_get_file);
+	g_test_add_data_func("/gobex/test_stream_get_file_fd",
+				GINT_TO_POINTER(TRUE), test_stream_get_file);
+	g_test_add_func("/gobex/test_stream_get_file_short",
+						test_stream_get_file_short);
+
 	return g_test_run();
 }
@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include <glib.h>
 #include "src/shared/hfp.h"
@@ -88,6 +89,28 @@ struct test_data {
 		.fragmented = true,				\
 	}
 
+/*
+ * The payloads are compound literals that only live as long as the block
+ * defining the test, so keep copies of them for when the test runs.
+ */
+static struct test_pdu *copy_pdus(const struct test_pdu *pdus)
+{
+	struct test_pdu *copy;
+	unsigned int i, count = 0;
+
+	while (pdus[count].valid)
+		count++;
+
+	copy = g_new0(struct test_pdu, count + 1);
+
+	for (i = 0; i < count; i++) {
+		copy[i] = pdus[i];
+		copy[i].data = g_memdup(pdus[i].data, pdus[i].size);
+	}
+
+	return copy;
+}
+
 #define define_test(name, function, result_function, args...)		\
 	do {								\
 		const struct test_pdu pdus[] = {			\
@@ -95,7 +118,7 @@ struct test_data {
 		};							\
 		static struct test_data data;				\
 		data.test_name = g_strdup(name);			\
-		data.pdu_list = g_memdup(pdus, sizeof(pdus));		\
+		data.pdu_list = copy_pdus(pdus);			\
 		data.result_func = result_function;			\
 		tester_add(name, &data, NULL, function, NULL);		\
 		data.test_handler = test_handler;			\
@@ -109,7 +132,7 @@ struct test_data {
 		};							\
 		static struct test_data data;				\
 		data.test_name = g_strdup(name);			\
-		data.pdu_list = g_memdup(pdus, sizeof(pdus));		\
+		data.pdu_list = copy_pdus(pdus);			\
 		data.hf_result_func = result_func;			\
 		data.response_func = response_function;			\
 		tester_add(name, &data, NULL, function, NULL);		\
@@ -119,6 +142,10 @@ struct test_data {
 static void test_free(gconstpointer user_data)
 {
 	const struct test_data *data = user_data;
+	unsigned int i;
+
+	for (i = 0; data->pdu_list[i].valid; i++)
+		g_free((void *) data->pdu_list[i].data);
 
 	g_free(data->test_name);
 	g_free(data->pdu_list);
@@ -482,6 +509,152 @@ static void check_string_3(struct hfp_context *result,
 	hfp_gw_send_result(context->hfp, HFP_RESULT_ERROR);
 }
 
+static void check_set_number(struct hfp_context *result,
+				enum hfp_gw_cmd_type type, void *user_data)
+{
+	struct context *context = user_data;
+	unsigned int val;
+
+	g_assert(type == HFP_GW_CMD_TYPE_SET);
+	g_assert(hfp_context_get_number(result, &val));
+	g_assert_cmpint(val, ==, 1234);
+
+	g_idle_add(context_quit, context);
+}
+
+static gboolean send_result_ok(gpointer user_data)
+{
+	struct context *context = user_data;
+
+	hfp_gw_send_result(context->hfp, HFP_RESULT_OK);
+
+	return FALSE;
+}
+
+static void check_wrap(struct hfp_context *result,
+				enum hfp_gw_cmd_type type, void *user_data)
+{
+	struct context *context = user_data;
+	unsigned int val;
+
+	g_assert(type == HFP_GW_CMD_TYPE_SET);
+	g_assert(hfp_context_get_number(result, &val));
+	g_assert_cmpint(val, ==, 1234);
+
+	/* The command following in the buffer is only read after this */
+	g_idle_add(send_result_ok, context);
+}
+
+static void check_type(struct hfp_context *result,
+				enum hfp_gw_cmd_type type, void *user_data)
+{
+	struct context *context = user_data;
+	const struct test_pdu *pdu;
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	g_assert(type == pdu->type);
+}
+
+static void check_not_called(struct hfp_context *result,
+				enum hfp_gw_cmd_type type, void *user_data)
+{
+	g_assert_not_reached();
+}
+
+static void test_register_fragmented(gconstpointer data)
+{
+	struct context *context = create_context(data);
+	const struct test_pdu *pdu;
+	bool ret;
+
+	context->hfp = hfp_gw_new(context->fd_client);
+	g_assert(context->hfp);
+
+	ret = hfp_gw_set_close_on_unref(context->hfp, true);
+	g_assert(ret);
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_gw_register(context->hfp, context->data->result_func,
+					(char *)pdu->data, context, NULL);
+	g_assert(ret);
+
+	g_idle_add(send_pdu, context);
+}
+
+static void test_register_wrap(gconstpointer data)
+{
+	struct context *context = create_context(data);
+	const struct test_pdu *pdu;
+	char buf[4095];
+	ssize_t len;
+	bool ret;
+
+	context->hfp = hfp_gw_new(context->fd_client);
+	g_assert(context->hfp);
+
+	ret = hfp_gw_set_close_on_unref(context->hfp, true);
+	g_assert(ret);
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_gw_register(context->hfp, check_wrap, (char *)pdu->data,
+							context, NULL);
+	g_assert(ret);
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_gw_register(context->hfp, context->data->result_func,
+					(char *)pdu->data, context, NULL);
+	g_assert(ret);
+
+	/*
+	 * Empty lines are skipped, but they move the start of the command
+	 * close to the end of the 4096 byte ring buffer. The buffer is never
+	 * empty in between, so the rest of the command wraps around.
+	 */
+	memset(buf, '\r', sizeof(buf));
+	memcpy(buf + sizeof(buf) - 5, "AT+BR", 5);
+
+	len = write(context->fd_server, buf, sizeof(buf));
+	g_assert_cmpint(len, ==, sizeof(buf));
+
+	send_pdu(context);
+}
+
+static void test_register_collision(gconstpointer data)
+{
+	struct context *context = create_context(data);
+	const struct test_pdu *pdu;
+	bool ret;
+
+	context->hfp = hfp_gw_new(context->fd_client);
+	g_assert(context->hfp);
+
+	ret = hfp_gw_set_close_on_unref(context->hfp, true);
+	g_assert(ret);
+
+	/* Both prefixes end up in the same handler bucket */
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_gw_register(context->hfp, check_not_called,
+					(char *)pdu->data, context, NULL);
+	g_assert(ret);
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_gw_register(context->hfp, context->data->result_func,
+					(char *)pdu->data, context, NULL);
+	g_assert(ret);
+
+	ret = hfp_gw_register(context->hfp, check_not_called,
+					(char *)pdu->data, context, NULL);
+	g_assert(!ret);
+
+	send_pdu(context);
+}
+
 static void test_hf_init(gconstpointer data)
 {
 	struct context *context = create_context(data);
@@ -668,6 +841,211 @@ static void test_hf_unsolicited(gconstpointer data)
 	send_pdu(context);
 }
 
+static void hf_not_called(struct hfp_context *result, void *user_data)
+{
+	g_assert_not_reached();
+}
+
+static void test_hf_collision(gconstpointer data)
+{
+	struct context *context = create_context(data);
+	const struct test_pdu *pdu;
+	bool ret;
+
+	context->hfp_hf = hfp_hf_new(context->fd_client);
+	g_assert(context->hfp_hf);
+
+	ret = hfp_hf_set_close_on_unref(context->hfp_hf, true);
+	g_assert(ret);
+
+	/* Both prefixes end up in the same handler bucket */
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_hf_register(context->hfp_hf, hf_not_called,
+					(char *)pdu->data, context, NULL);
+	g_assert(ret);
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_hf_register(context->hfp_hf, context->data->hf_result_func,
+					(char *)pdu->data, context, NULL);
+	g_assert(ret);
+
+	send_pdu(context);
+}
+
+static void check_hf_wrap(struct hfp_context *result, void *user_data)
+{
+	struct context *context = user_data;
+	const struct test_pdu *pdu;
+	unsigned int ind, val;
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+	g_assert(pdu->valid);
+
+	g_assert(hfp_context_get_number(result, &ind));
+	g_assert(hfp_context_get_number(result, &val));
+	g_assert_cmpint(ind, ==, pdu->data[0]);
+	g_assert_cmpint(val, ==, pdu->data[1]);
+}
+
+static void hf_wrap_done(struct hfp_context *result, void *user_data)
+{
+	struct context *context = user_data;
+
+	/* Every line before this one has been seen exactly once */
+	g_assert(!context->data->pdu_list[context->pdu_offset].valid);
+
+	hfp_hf_disconnect(context->hfp_hf);
+}
+
+static void test_hf_wrap(gconstpointer data)
+{
+	struct context *context = create_context(data);
+	const struct test_pdu *pdu;
+	char buf[4090];
+	ssize_t len;
+	bool ret;
+
+	context->hfp_hf = hfp_hf_new(context->fd_client);
+	g_assert(context->hfp_hf);
+
+	ret = hfp_hf_set_close_on_unref(context->hfp_hf, true);
+	g_assert(ret);
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_hf_register(context->hfp_hf, check_hf_wrap,
+					(char *)pdu->data, context, NULL);
+	g_assert(ret);
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_hf_register(context->hfp_hf, context->data->hf_result_func,
+					(char *)pdu->data, context, NULL);
+	g_assert(ret);
+
+	/*
+	 * Empty lines are skipped, but the unfinished line keeps the 4096
+	 * byte ring buffer from being reset. The next read completes that
+	 * line and wraps around in the middle of the one after it.
+	 */
+	for (len = 0; len < (ssize_t) sizeof(buf); len += 2)
+		memcpy(buf + len, "\r\n", 2);
+
+	memcpy(buf + sizeof(buf) - 8, "+CIEV: 1", 8);
+
+	len = write(context->fd_server, buf, sizeof(buf));
+	g_assert_cmpint(len, ==, sizeof(buf));
+
+	send_pdu(context);
+}
+
+#define BENCH_LINES	100000
+
+static const char *bench_prefixes[] = {
+	"+BRSF", "+CIND", "+CIEV", "+CLCC", "+CHLD", "+CLIP", "+CCWA",
+	"+COPS", "+CNUM", "+BSIR", "+BVRA", "+VGS", "+VGM", "+BINP",
+	"+BTRH", "+BCS", "+BIND", NULL
+};
+
+static const char *bench_lines[] = {
+	"\r\n+CLCC: 1,0,0,0,0,\"1234567\",129\r\n",
+	"\r\n+CLCC: 2,0,5,0,0,\"7654321\",129\r\n",
+	"\r\n+CIEV: 2,1\r\n",
+	"\r\n+CIEV: 3,0\r\n",
+	"\r\n+CIND: 1,1,0,0,5,0,5\r\n",
+	NULL
+};
+
+static char bench_buf[4000];
+static size_t bench_buf_len;
+static unsigned int bench_buf_lines;
+static unsigned int bench_count;
+static uint64_t bench_start;
+
+static uint64_t bench_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_send(struct context *context)
+{
+	ssize_t len;
+
+	len = write(context->fd_server, bench_buf, bench_buf_len);
+	g_assert_cmpint(len, ==, bench_buf_len);
+}
+
+static void bench_handler(struct hfp_context *result, void *user_data)
+{
+	struct context *context = user_data;
+	uint64_t elapsed;
+
+	/* The next chunk is only sent once the previous one is used up */
+	if (++bench_count % bench_buf_lines)
+		return;
+
+	if (bench_count < BENCH_LINES) {
+		bench_send(context);
+		return;
+	}
+
+	elapsed = bench_time() - bench_start;
+	if (!elapsed)
+		elapsed = 1;
+
+	tester_debug("%u lines %8.2f ns/line %8.2f Mlines/s", bench_count,
+					(double) elapsed / bench_count,
+					bench_count * 1000.0 / elapsed);
+
+	hfp_hf_disconnect(context->hfp_hf);
+}
+
+/* Call state traffic as seen by the hands-free side during a call */
+static void test_hf_benchmark(gconstpointer data)
+{
+	struct context *context = create_context(data);
+	unsigned int i;
+	bool ret;
+
+	context->hfp_hf = hfp_hf_new(context->fd_client);
+	g_assert(context->hfp_hf);
+
+	ret = hfp_hf_set_close_on_unref(context->hfp_hf, true);
+	g_assert(ret);
+
+	for (i = 0; bench_prefixes[i]; i++) {
+		ret = hfp_hf_register(context->hfp_hf, bench_handler,
+					bench_prefixes[i], context, NULL);
+		g_assert(ret);
+	}
+
+	bench_buf_len = 0;
+	bench_buf_lines = 0;
+
+	for (i = 0; ; i++) {
+		const char *line = bench_lines[i % 5];
+		size_t len = strlen(line);
+
+		if (bench_buf_len + len > sizeof(bench_buf))
+			break;
+
+		memcpy(bench_buf + bench_buf_len, line, len);
+		bench_buf_len += len;
+		bench_buf_lines++;
+	}
+
+	bench_count = 0;
+	bench_start = bench_time();
+
+	bench_send(context);
+}
+
 static void test_hf_robustness(gconstpointer data)
 {
 	struct context *context = create_context(data);
@@ -730,6 +1108,28 @@ int main(int argc, char *argv[])
 			frg_pdu('A'), frg_pdu('T'), frg_pdu('+'), frg_pdu('B'),
 			frg_pdu('R'), frg_pdu('S'), frg_pdu('F'), frg_pdu('\r'),
 			data_end());
+	define_test("/hfp/test_fragmented_2", test_register_fragmented,
+			check_set_number,
+			raw_pdu('+', 'B', 'R', 'S', 'F', '\0'),
+			frg_pdu('A'), frg_pdu('T'), frg_pdu('+'), frg_pdu('B'),
+			frg_pdu('R'), frg_pdu('S'), frg_pdu('F'), frg_pdu('='),
+			frg_pdu('1'), frg_pdu('2'), frg_pdu('3'), frg_pdu('4'),
+			frg_pdu('\r'),
+			data_end());
+	define_test("/hfp/test_wrap", test_register_wrap, check_type,
+			raw_pdu('+', 'B', 'R', 'S', 'F', '\0'),
+			raw_pdu('+', 'C', 'L', 'C', 'C', '\0'),
+			raw_pdu('S', 'F', '=', '1', '2', '3', '4', '\r',
+				'A', 'T', '+', 'C', 'L', 'C', 'C', '?', '\r'),
+			type_pdu(HFP_GW_CMD_TYPE_READ, 0),
+			data_end());
+	define_test("/hfp/test_collision", test_register_collision,
+			check_set_number,
+			raw_pdu('+', 'C', 'L', 'C', 'C', '\0'),
+			raw_pdu('+', 'C', 'O', 'P', 'S', '\0'),
+			raw_pdu('A', 'T', '+', 'C', 'O', 'P', 'S', '=', '1',
+							'2', '3', '4', '\r'),
+			data_end());
 	define_test("/hfp/test_ustring_1", test_register, check_ustring_1,
 			raw_pdu('D', '\0'),
 			raw_pdu('A', 'T', 'D', '0', '1', '2', '3', '\r'),
@@ -857,5 +1257,26 @@ int main(int argc, char *argv[])
 			frg_pdu('1', ',', '2', 'x', '\r', '\n'),
 			data_end());
 
+	define_hf_test("/hfp_hf/test_collision", test_hf_collision,
+			hf_result_handler, NULL,
+			raw_pdu('+', 'C', 'L', 'C', 'C', '\0'),
+			raw_pdu('+', 'C', 'O', 'P', 'S', '\0'),
+			raw_pdu('\r', '\n', '+', 'C', 'O', 'P', 'S', ':', '0',
+								'\r', '\n'),
+			data_end());
+
+	define_hf_test("/hfp_hf/test_wrap", test_hf_wrap, hf_wrap_done, NULL,
+			raw_pdu('+', 'C', 'I', 'E', 'V', '\0'),
+			raw_pdu('+', 'C', 'L', 'C', 'C', '\0'),
+			raw_pdu(',', '0', '\r', '\n', '+', 'C', 'I', 'E', 'V',
+				':', ' ', '2', ',', '1', '\r', '\n', '\r', '\n',
+				'+', 'C', 'L', 'C', 'C', '\r', '\n'),
+			raw_pdu(1, 0),
+			raw_pdu(2, 1),
+			data_end());
+
+	define_hf_test("/hfp_hf/benchmark", test_hf_benchmark, NULL, NULL,
+			data_end());
+
 	return tester_run();
 }
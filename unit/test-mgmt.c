@@ -34,6 +34,7 @@
 #include "lib/bluetooth.h"
 #include "lib/mgmt.h"
 
+#include "src/shared/util.h"
 #include "src/shared/mgmt.h"
 
 struct context {
@@ -132,7 +133,8 @@ static gboolean server_handler(GIOChannel *channel, GIOCondition cond,
 	return TRUE;
 }
 
-static struct context *create_context(void)
+static struct context *create_server_context(GIOFunc server,
+							void *server_data)
 {
 	struct context *context = g_new0(struct context, 1);
 	GIOChannel *channel;
@@ -153,7 +155,7 @@ static struct context *create_context(void)
 
 	context->server_source = g_io_add_watch(channel,
 				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				server_handler, context);
+				server, server_data ? server_data : context);
 	g_assert(context->server_source > 0);
 
 	g_io_channel_unref(channel);
@@ -170,6 +172,11 @@ static struct context *create_context(void)
 	return context;
 }
 
+static struct context *create_context(void)
+{
+	return create_server_context(server_handler, NULL);
+}
+
 static void execute_context(struct context *context)
 {
 	g_main_loop_run(context->main_loop);
@@ -350,6 +357,67 @@ static void test_event2(gconstpointer data)
 	execute_context(context);
 }
 
+struct dispatch_data {
+	struct context *context;
+	unsigned int count;
+};
+
+static void dispatch_cb(uint16_t index, uint16_t length, const void *param,
+							void *user_data)
+{
+	struct dispatch_data *data = user_data;
+
+	g_assert_cmpint(index, ==, 0x0001);
+	g_assert_cmpint(data->count, ==, 0);
+
+	data->count++;
+}
+
+static void dispatch_last_cb(uint16_t index, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct dispatch_data *data = user_data;
+
+	g_assert_cmpint(index, ==, 0x0001);
+	g_assert_cmpint(data->count, ==, 1);
+
+	context_quit(data->context);
+}
+
+static void dispatch_fail_cb(uint16_t index, uint16_t length,
+					const void *param, void *user_data)
+{
+	g_assert_not_reached();
+}
+
+static void test_event3(gconstpointer data)
+{
+	const struct command_test_data *test = data;
+	struct dispatch_data dispatch;
+	uint16_t i;
+
+	dispatch.context = create_context();
+	dispatch.count = 0;
+
+	/* Handlers for other events and indexes must not be called */
+	for (i = 0; i < 64; i++) {
+		mgmt_register(dispatch.context->mgmt_client, i + 0x0005,
+					0x0001, dispatch_fail_cb, NULL, NULL);
+		mgmt_register(dispatch.context->mgmt_client, test->opcode,
+				i + 0x0002, dispatch_fail_cb, NULL, NULL);
+	}
+
+	mgmt_register(dispatch.context->mgmt_client, test->opcode,
+				MGMT_INDEX_NONE, dispatch_cb, &dispatch, NULL);
+	mgmt_register(dispatch.context->mgmt_client, test->opcode, 0x0001,
+					dispatch_last_cb, &dispatch, NULL);
+
+	g_assert_cmpint(write(dispatch.context->fd, test->cmd_data,
+					test->cmd_size), ==, test->cmd_size);
+
+	execute_context(dispatch.context);
+}
+
 static void unregister_all_cb(uint16_t index, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -429,6 +497,151 @@ static void test_destroy(gconstpointer data)
 	execute_context(context);
 }
 
+struct pipeline_data {
+	struct context *context;
+	uint16_t received[3];
+	unsigned int num_received;
+	uint16_t completed[3];
+	unsigned int num_completed;
+};
+
+
+static void send_read_info_complete(int fd, uint16_t index)
+{
+	unsigned char rsp[] = { 0x01, 0x00, index & 0xff, index >> 8,
+				0x03, 0x00, 0x04, 0x00, 0x00 };
+
+	g_assert_cmpint(write(fd, rsp, sizeof(rsp)), ==, sizeof(rsp));
+}
+
+static gboolean pipeline_server(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct pipeline_data *data = user_data;
+	unsigned char buf[512];
+	ssize_t result;
+	int fd;
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
+		return FALSE;
+
+	fd = g_io_channel_unix_get_fd(channel);
+
+	result = read(fd, buf, sizeof(buf));
+	g_assert_cmpint(result, ==, MGMT_HDR_SIZE);
+	g_assert_cmpint(data->num_received, <, 3);
+
+	data->received[data->num_received++] = get_le16(buf + 2);
+
+	switch (data->num_received) {
+	case 2:
+		/* Both indexes are in flight, complete them out of order */
+		g_assert_cmpint(data->received[0], ==, 0);
+		g_assert_cmpint(data->received[1], ==, 1);
+		g_assert_cmpint(data->num_completed, ==, 0);
+
+		send_read_info_complete(fd, 1);
+		send_read_info_complete(fd, 0);
+		break;
+	case 3:
+		/* The second command for index 0 waited for the first one */
+		g_assert_cmpint(data->received[2], ==, 0);
+		g_assert_cmpint(data->num_completed, ==, 2);
+
+		send_read_info_complete(fd, 0);
+		break;
+	}
+
+	return TRUE;
+}
+
+static gboolean serial_server(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct pipeline_data *data = user_data;
+	unsigned char buf[512];
+	ssize_t result;
+	int fd;
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
+		return FALSE;
+
+	fd = g_io_channel_unix_get_fd(channel);
+
+	result = read(fd, buf, sizeof(buf));
+	g_assert_cmpint(result, ==, MGMT_HDR_SIZE);
+
+	/* Every command waits for the previous one to complete */
+	g_assert_cmpint(data->num_completed, ==, data->num_received);
+
+	data->received[data->num_received++] = get_le16(buf + 2);
+
+	send_read_info_complete(fd, data->received[data->num_received - 1]);
+
+	return TRUE;
+}
+
+static void complete_request(struct pipeline_data *data, uint8_t status,
+							uint16_t index)
+{
+	g_assert_cmpint(status, ==, MGMT_STATUS_SUCCESS);
+	g_assert_cmpint(data->num_completed, <, 3);
+
+	data->completed[data->num_completed++] = index;
+
+	if (data->num_completed == 3)
+		context_quit(data->context);
+}
+
+static void index_0_cb(uint8_t status, uint16_t length, const void *param,
+							void *user_data)
+{
+	complete_request(user_data, status, 0);
+}
+
+static void index_1_cb(uint8_t status, uint16_t length, const void *param,
+							void *user_data)
+{
+	complete_request(user_data, status, 1);
+}
+
+static void test_pipeline(gconstpointer data)
+{
+	unsigned int max_pending = GPOINTER_TO_UINT(data);
+	struct pipeline_data pipeline;
+	struct context *context;
+
+	memset(&pipeline, 0, sizeof(pipeline));
+
+	context = create_server_context(max_pending > 1 ? pipeline_server :
+							serial_server,
+							&pipeline);
+	pipeline.context = context;
+
+	g_assert(mgmt_set_max_pending(context->mgmt_client, max_pending));
+
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 0, 0, NULL,
+					index_0_cb, &pipeline, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 1, 0, NULL,
+					index_1_cb, &pipeline, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 0, 0, NULL,
+					index_0_cb, &pipeline, NULL);
+
+	execute_context(context);
+
+	g_assert_cmpint(pipeline.num_received, ==, 3);
+
+	if (max_pending > 1) {
+		g_assert_cmpint(pipeline.completed[0], ==, 1);
+		g_assert_cmpint(pipeline.completed[1], ==, 0);
+		g_assert_cmpint(pipeline.completed[2], ==, 0);
+	} else {
+		g_assert_cmpint(pipeline.completed[0], ==, 0);
+		g_assert_cmpint(pipeline.completed[1], ==, 1);
+		g_assert_cmpint(pipeline.completed[2], ==, 0);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -443,6 +656,7 @@ int main(int argc, char *argv[])
 
 	g_test_add_data_func("/mgmt/event/1", &event_test_1, test_event);
 	g_test_add_data_func("/mgmt/event/2", &event_test_1, test_event2);
+	g_test_add_data_func("/mgmt/event/3", &event_test_1, test_event3);
 
 	g_test_add_data_func("/mgmt/unregister/1", &event_test_1,
 							test_unregister_all);
@@ -451,5 +665,10 @@ int main(int argc, char *argv[])
 
 	g_test_add_data_func("/mgmt/destroy/1", &event_test_1, test_destroy);
 
+	g_test_add_data_func("/mgmt/pipeline/1", GUINT_TO_POINTER(1),
+							test_pipeline);
+	g_test_add_data_func("/mgmt/pipeline/2", GUINT_TO_POINTER(4),
+							test_pipeline);
+
 	return g_test_run();
 }
@@ -0,0 +1,203 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2016  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "src/shared/tester.h"
+#include "obexd/plugins/pbap-cache.h"
+
+#define CONTACTS	10000
+#define PAGE_SIZE	50
+
+struct page_data {
+	uint32_t expected;
+	int step;
+	unsigned int count;
+};
+
+static uint32_t contact_handle(unsigned int i)
+{
+	/* 7919 is prime so this visits every handle once in shuffled order */
+	return (i * 7919) % CONTACTS;
+}
+
+static void fill_cache(struct pbap_cache *cache)
+{
+	char name[32], sound[32], tel[32], id[32];
+	unsigned int i;
+
+	for (i = 0; i < CONTACTS; i++) {
+		uint32_t handle = contact_handle(i);
+
+		/* Names and sounds sort in reverse handle order */
+		snprintf(id, sizeof(id), "id-%u", handle);
+		snprintf(name, sizeof(name), "Contact %05u",
+							CONTACTS - 1 - handle);
+		snprintf(sound, sizeof(sound), "s%05u", CONTACTS - 1 - handle);
+		snprintf(tel, sizeof(tel), "+1555%07u", handle);
+
+		pbap_cache_add(cache, handle, id, name, sound, tel);
+	}
+}
+
+static void check_page(uint32_t handle, const char *name, void *user_data)
+{
+	struct page_data *data = user_data;
+	char expected[32];
+
+	g_assert_cmpuint(handle, ==, data->expected);
+
+	snprintf(expected, sizeof(expected), "Contact %05u",
+							CONTACTS - 1 - handle);
+	g_assert_cmpstr(name, ==, expected);
+
+	data->expected += data->step;
+	data->count++;
+}
+
+static void page_through(struct pbap_cache *cache, uint8_t order,
+					uint32_t first, int step)
+{
+	struct page_data data;
+	unsigned int offset, count;
+
+	data.expected = first;
+	data.step = step;
+	data.count = 0;
+
+	for (offset = 0; offset < CONTACTS; offset += PAGE_SIZE) {
+		count = pbap_cache_list(cache, order, 0, NULL, offset,
+					PAGE_SIZE, check_page, &data);
+		g_assert_cmpuint(count, ==, PAGE_SIZE);
+	}
+
+	g_assert_cmpuint(data.count, ==, CONTACTS);
+
+	/* Windows past the end of the phonebook are empty */
+	count = pbap_cache_list(cache, order, 0, NULL, CONTACTS, PAGE_SIZE,
+							check_page, &data);
+	g_assert_cmpuint(count, ==, 0);
+}
+
+static void test_find(const void *test_data)
+{
+	struct pbap_cache cache;
+	char id[32];
+	unsigned int i;
+
+	memset(&cache, 0, sizeof(cache));
+
+	g_assert(pbap_cache_find(&cache, 0) == NULL);
+
+	fill_cache(&cache);
+
+	g_assert_cmpuint(pbap_cache_size(&cache), ==, CONTACTS);
+
+	for (i = 0; i < CONTACTS; i++) {
+		snprintf(id, sizeof(id), "id-%u", i);
+		g_assert_cmpstr(pbap_cache_find(&cache, i), ==, id);
+	}
+
+	g_assert(pbap_cache_find(&cache, CONTACTS) == NULL);
+
+	pbap_cache_clear(&cache);
+
+	g_assert_cmpuint(pbap_cache_size(&cache), ==, 0);
+	g_assert(pbap_cache_find(&cache, 0) == NULL);
+
+	tester_test_passed();
+}
+
+static void test_paging(const void *test_data)
+{
+	struct pbap_cache cache;
+
+	memset(&cache, 0, sizeof(cache));
+
+	fill_cache(&cache);
+
+	page_through(&cache, PBAP_CACHE_ORDER_INDEXED, 0, 1);
+	page_through(&cache, PBAP_CACHE_ORDER_ALPHA, CONTACTS - 1, -1);
+	page_through(&cache, PBAP_CACHE_ORDER_PHONETIC, CONTACTS - 1, -1);
+
+	/* Views are reused until the cache changes */
+	page_through(&cache, PBAP_CACHE_ORDER_INDEXED, 0, 1);
+
+	pbap_cache_clear(&cache);
+
+	tester_test_passed();
+}
+
+static void test_search(const void *test_data)
+{
+	struct pbap_cache cache;
+	struct page_data data;
+	unsigned int count;
+
+	memset(&cache, 0, sizeof(cache));
+
+	fill_cache(&cache);
+
+	/* "contact 0012x" matches handles 9879 down to 9870 */
+	data.expected = 9877;
+	data.step = -1;
+	data.count = 0;
+
+	count = pbap_cache_list(&cache, PBAP_CACHE_ORDER_ALPHA,
+					PBAP_CACHE_SEARCH_NAME, "CONTACT 0012",
+					2, PAGE_SIZE, check_page, &data);
+	g_assert_cmpuint(count, ==, 8);
+
+	data.expected = 1234;
+	data.step = 1;
+	data.count = 0;
+
+	count = pbap_cache_list(&cache, PBAP_CACHE_ORDER_INDEXED,
+					PBAP_CACHE_SEARCH_NUMBER, "+15550001234",
+					0, PAGE_SIZE, check_page, &data);
+	g_assert_cmpuint(count, ==, 1);
+
+	pbap_cache_clear(&cache);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/pbap-cache/find", NULL, NULL, test_find, NULL);
+	tester_add("/pbap-cache/paging", NULL, NULL, test_paging, NULL);
+	tester_add("/pbap-cache/search", NULL, NULL, test_search, NULL);
+
+	return tester_run();
+}
@@ -25,6 +25,9 @@
 #include <config.h>
 #endif
 
+#include <stdint.h>
+#include <time.h>
+
 #include <glib.h>
 
 #include "src/shared/util.h"
@@ -259,6 +262,129 @@ static void test_remove_all(const void *data)
 	tester_test_passed();
 }
 
+static void test_pool(const void *data)
+{
+	struct queue *queue;
+	unsigned int n, i;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	/* Mix reused and newly allocated entries in the same queue */
+	for (n = 0; n < 128; n++) {
+		for (i = 0; i < n; i++)
+			g_assert(queue_push_head(queue, UINT_TO_PTR(n - i)));
+
+		g_assert(queue_push_after(queue, UINT_TO_PTR(n), NULL) ==
+								(n > 0));
+		g_assert(queue_push_tail(queue, UINT_TO_PTR(n + 1)));
+
+		g_assert(queue_length(queue) == n + 1 + (n > 0));
+		g_assert(queue_peek_tail(queue) == UINT_TO_PTR(n + 1));
+
+		if (n > 0) {
+			g_assert(queue_remove(queue, NULL));
+			g_assert(queue_peek_head(queue) == UINT_TO_PTR(1));
+		}
+
+		for (i = 1; i < n + 2; i++)
+			g_assert(queue_pop_head(queue) == UINT_TO_PTR(i));
+
+		g_assert(queue_isempty(queue));
+		g_assert(queue_peek_head(queue) == NULL);
+		g_assert(queue_peek_tail(queue) == NULL);
+	}
+
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
+#define BENCH_ENTRIES	64
+#define BENCH_ROUNDS	20000
+
+static uint64_t bench_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_report(const char *name, unsigned int ops, uint64_t start)
+{
+	uint64_t elapsed = bench_time() - start;
+
+	if (!elapsed)
+		elapsed = 1;
+
+	tester_debug("%-8s %10u ops %8.2f ns/op %8.2f Mops/s", name, ops,
+					(double) elapsed / ops,
+					ops * 1000.0 / elapsed);
+}
+
+static void bench_count(void *data, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	*count += PTR_TO_UINT(data);
+}
+
+static bool bench_match(const void *data, const void *match_data)
+{
+	return data == match_data;
+}
+
+static void test_benchmark(const void *data)
+{
+	struct queue *queue;
+	unsigned int i, n, count = 0;
+	uint64_t start;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	/* Short-lived entries as in request and notification queues */
+	start = bench_time();
+	for (n = 0; n < BENCH_ROUNDS; n++) {
+		for (i = 1; i <= BENCH_ENTRIES; i++)
+			queue_push_tail(queue, UINT_TO_PTR(i));
+
+		for (i = 1; i <= BENCH_ENTRIES; i++)
+			count += PTR_TO_UINT(queue_pop_head(queue));
+	}
+	bench_report("push/pop", BENCH_ROUNDS * BENCH_ENTRIES * 2, start);
+
+	for (i = 1; i <= BENCH_ENTRIES; i++)
+		queue_push_tail(queue, UINT_TO_PTR(i));
+
+	start = bench_time();
+	for (n = 0; n < BENCH_ROUNDS; n++)
+		g_assert(queue_find(queue, bench_match,
+					UINT_TO_PTR(n % BENCH_ENTRIES + 1)));
+	bench_report("find", BENCH_ROUNDS, start);
+
+	start = bench_time();
+	for (n = 0; n < BENCH_ROUNDS; n++)
+		queue_foreach(queue, bench_count, &count);
+	bench_report("foreach", BENCH_ROUNDS * BENCH_ENTRIES, start);
+
+	start = bench_time();
+	for (n = 0; n < BENCH_ROUNDS; n++) {
+		void *ptr = UINT_TO_PTR(n % BENCH_ENTRIES + 1);
+
+		g_assert(queue_remove(queue, ptr));
+		g_assert(queue_push_tail(queue, ptr));
+	}
+	bench_report("remove", BENCH_ROUNDS * 2, start);
+
+	g_assert(count > 0);
+	g_assert(queue_length(queue) == BENCH_ENTRIES);
+
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -276,6 +402,8 @@ int main(int argc, char *argv[])
 						test_destroy_remove, NULL);
 	tester_add("/queue/push_after",  NULL, NULL, test_push_after, NULL);
 	tester_add("/queue/remove_all",  NULL, NULL, test_remove_all, NULL);
+	tester_add("/queue/pool", NULL, NULL, test_pool, NULL);
+	tester_add("/queue/benchmark", NULL, NULL, test_benchmark, NULL);
 
 	return tester_run();
 }